@@ -32,6 +32,8 @@ static int grover_flag = 1; // 0 = random, 1 = 11..1
 static int shor_N = 0;
 static int shor_a = 0;
 
+static int xeb_samples = 0;
+
 static char* csv_outputfile = NULL;
 
 enum algorithms {
@@ -52,6 +54,7 @@ static struct argp_option options[] =
     {"grover-flag", 20, "<random|ones>", 0, "Grover flag (default=11..1)", 0},
     {"shor-N", 30, "<N>", 0, "N to factor with Shor's algorithm", 0},
     {"shor-a", 31, "<a>", 0, "value 'a' to use in Shor's algorithm (chosen random if not set)", 0},
+    {"xeb-samples", 32, "<k>", 0, "Estimate linear XEB fidelity of supremacy circuit from k samples (default=0)", 0},
     {"csv-output", 40, "<filename>", 0, "Write stats to given filename (or append if exists)", 0},
     {0, 0, 0, 0, 0, 0}
 };
@@ -95,6 +98,9 @@ parse_opt(int key, char *arg, struct argp_state *state)
     case 31:
         shor_a = atoi(arg);
         break;
+    case 32:
+        xeb_samples = atoi(arg);
+        break;
     case 40:
         csv_outputfile = arg;
         break;
@@ -238,6 +244,33 @@ run_supremacy()
     stats.success = -1;
 
     INFO("Supremacy-%d Time: %f\n", qubits, stats.runtime);
+
+    if (xeb_samples > 0) {
+        // Linear XEB: F = 2^n * mean(p(x_i)) - 1, with x_i sampled from the 
+        // final state (F ~ 1 for ideal samples of a random circuit)
+        bool **samples = malloc(sizeof(bool*) * xeb_samples);
+        complex_t *amps = malloc(sizeof(complex_t) * xeb_samples);
+        bool *ms = malloc(sizeof(bool) * qubits);
+        double p;
+        for (int i = 0; i < xeb_samples; i++) {
+            qmdd_measure_all(stats.final_qmdd, qubits, ms, &p);
+            samples[i] = malloc(sizeof(bool) * qubits);
+            for (int k = 0; k < qubits; k++) samples[i][qubits-1-k] = ms[k];
+        }
+        t1 = wctime();
+        qmdd_get_amplitudes(stats.final_qmdd, samples, xeb_samples, qubits, amps);
+        t2 = wctime();
+        double sum_p = 0;
+        for (int i = 0; i < xeb_samples; i++) {
+            sum_p += amps[i].r*amps[i].r + amps[i].i*amps[i].i;
+            free(samples[i]);
+        }
+        double xeb = ((double)(1ULL << qubits)) * (sum_p / xeb_samples) - 1.0;
+        INFO("Linear XEB (%d samples): %lf (amplitudes in %f s)\n", xeb_samples, xeb, t2-t1);
+        free(samples);
+        free(amps);
+        free(ms);
+    }
 }
 
 void
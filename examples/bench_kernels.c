@@ -0,0 +1,367 @@
+/**
+ * Microbenchmarks for the primitives that dominate QMDD simulation profiles:
+ * the edge weight table (cmap_find_or_put), the unique node table
+ * (llmsset_lookup), the operation cache (cache_get3/cache_put3), cached edge
+ * weight arithmetic (wgt_mul) and node creation (evbdd_makenode) under every
+ * normalization strategy.
+ *
+ * Every kernel performs a fixed number of operations, split over the Lace
+ * workers as a task tree, and is repeated for 1, 2, 4, .., N workers. The
+ * operation keys only depend on the operation index, so every run does the
+ * same work regardless of the number of workers.
+ *
+ * The edge layout (weight index / node index bits of an EVBDD edge) is 
+ * reported as well, to compare builds with and without QSYLVAN_EDGE_WGT_BITS.
+ */
+#include <argp.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <qsylvan.h>
+#include <sylvan_int.h>
+#include <sylvan_edge_weights_complex.h>
+
+
+
+/**********************<Arguments (configured via argp)>***********************/
+
+static int max_workers = 1;
+static uint64_t n_ops  = 1LL<<20;
+static uint64_t n_keys = 1LL<<16;
+static int rseed = 0;
+static double tolerance = 1e-14;
+static size_t node_tablesize = 1LL<<22;
+static size_t cachesize      = 1LL<<20;
+static size_t wgt_tablesize  = 1LL<<20;
+static char* csv_outputfile = NULL;
+
+static struct argp_option options[] =
+{
+    {"workers", 'w', "<workers>", 0, "Maximum number of workers/threads, runs with 1, 2, 4, .., <workers> (default=1)", 0},
+    {"ops", 'n', "<ops>", 0, "Number of operations per kernel (default=2^20)", 0},
+    {"keys", 'k', "<keys>", 0, "Number of distinct keys per kernel (default=2^16)", 0},
+    {"rseed", 'r', "<random-seed>", 0, "Set random seed", 0},
+    {"tol", 1, "<tolerance>", 0, "Tolerance for deciding edge weights equal (default=1e-14)", 0},
+    {"csv-output", 40, "<filename>", 0, "Write results to given filename (or append if exists)", 0},
+    {0, 0, 0, 0, 0, 0}
+};
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+    switch (key) {
+    case 'w':
+        max_workers = atoi(arg);
+        if (max_workers < 1) argp_usage(state);
+        break;
+    case 'n':
+        n_ops = strtoull(arg, NULL, 10);
+        break;
+    case 'k':
+        n_keys = strtoull(arg, NULL, 10);
+        if (n_keys < 2) argp_usage(state);
+        break;
+    case 'r':
+        rseed = atoi(arg);
+        break;
+    case 1:
+        tolerance = atof(arg);
+        break;
+    case 40:
+        csv_outputfile = arg;
+        break;
+    case ARGP_KEY_ARG:
+        argp_usage(state);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+static struct argp argp = { options, parse_opt, 0, 0, 0, 0, 0 };
+
+/*********************</Arguments (configured via argp)>***********************/
+
+
+
+
+
+/*****************************<Keys and timing>********************************/
+
+/**
+ * Obtain current wallclock time
+ */
+static double
+wctime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec + 1E-6 * tv.tv_usec);
+}
+
+/**
+ * Stateless pseudo-random mixer (splitmix64 finalizer), so the key of every
+ * operation is a function of its index only.
+ */
+static inline uint64_t
+mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL + (uint64_t)rseed;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Distinct key k in [0, n_keys) as it appears in a circuit simulation:
+ * a phase e^{i pi j / 8} (T-gate multiples) times a magnitude 1/sqrt(2)^m
+ * (H-gate multiples), with a random phase for a quarter of the keys (rotation
+ * gates).
+ */
+static complex_t
+pool_key(uint64_t k)
+{
+    uint64_t h = mix64(k);
+    fl_t mag = pow(1.0/sqrt(2.0), (double)(h % 24));
+    fl_t theta;
+    if ((h >> 8) % 4 == 0) theta = 2.0 * M_PI * ((h >> 16) & 0xffffffff) / 4294967296.0;
+    else theta = M_PI * ((h >> 16) % 16) / 8.0;
+    return cmake_angle(theta, mag);
+}
+
+/**
+ * Key for operation i: a pool key plus noise well below the tolerance, such
+ * that (most) queries only hit after the table rounds them.
+ */
+static complex_t
+query_key(uint64_t i)
+{
+    uint64_t h = mix64(i ^ 0x5555555555555555ULL);
+    complex_t c = pool_key(h % n_keys);
+    fl_t eps = tolerance / 8.0;
+    c.r += eps * (((int64_t)((h >> 32) & 0xff)) - 128) / 128.0;
+    c.i += eps * (((int64_t)((h >> 40) & 0xff)) - 128) / 128.0;
+    return c;
+}
+
+/****************************</Keys and timing>********************************/
+
+
+
+
+
+/********************************<Kernels>*************************************/
+
+typedef enum kernel {
+    k_cmap_find_or_put,
+    k_llmsset_lookup,
+    k_cache_get_put3,
+    k_wgt_mul,
+    k_evbdd_makenode,
+    n_kernels
+} kernel_t;
+
+static const char *kernel_names[] = {
+    "cmap_find_or_put",
+    "llmsset_lookup",
+    "cache_get3/put3",
+    "wgt_mul",
+    "evbdd_makenode",
+};
+
+// wgt_mul and evbdd_makenode do not expose whether they hit the cache / table
+static const bool kernel_reports_hits[] = { true, true, true, false, false };
+
+static const char *norm_names[] = { "low", "max", "min", "l2" };
+
+static void *bench_cmap = NULL;
+static AMP *amp_pool = NULL;
+static uint64_t bench_opid = 0;
+static int edge_wgt_bits = 0, edge_ptr_bits = 0;
+
+#define BENCH_CHUNK 256
+
+/**
+ * Runs operation i of the given kernel. Returns 1 if the operation was a hit
+ * (key already present / cached), 0 otherwise (or if the kernel can't tell).
+ */
+static inline int
+bench_op(kernel_t kernel, uint64_t i)
+{
+    uint64_t h = mix64(i);
+    uint64_t k = h % n_keys;
+    switch (kernel) {
+    case k_cmap_find_or_put: {
+        complex_t c = query_key(i);
+        uint64_t ref;
+        int found = cmap_find_or_put(bench_cmap, &c, &ref);
+        if (found == -1) {
+            fprintf(stderr, "Benchmark weight table full\n");
+            exit(1);
+        }
+        return found;
+    }
+    case k_llmsset_lookup: {
+        int created;
+        uint64_t a = mix64(k) & 0x0000ffffffffffffULL;
+        uint64_t b = mix64(k + n_keys) & 0x0000ffffffffffffULL;
+        if (llmsset_lookup(nodes, a, b, &created) == 0) {
+            fprintf(stderr, "Benchmark node table full\n");
+            exit(1);
+        }
+        return !created;
+    }
+    case k_cache_get_put3: {
+        uint64_t res;
+        uint64_t a = mix64(k) & 0x000000ffffffffffULL;
+        if (cache_get3(bench_opid, a, k, 0, &res)) return 1;
+        cache_put3(bench_opid, a, k, 0, a ^ k);
+        return 0;
+    }
+    case k_wgt_mul: {
+        AMP a = amp_pool[k];
+        AMP b = amp_pool[mix64(k) % n_keys];
+        wgt_mul(a, b);
+        return 0;
+    }
+    case k_evbdd_makenode: {
+        BDDVAR var = (BDDVAR)(k % 16);
+        EVBDD low  = evbdd_bundle(EVBDD_TERMINAL, amp_pool[k]);
+        EVBDD high = evbdd_bundle(EVBDD_TERMINAL, amp_pool[mix64(k) % n_keys]);
+        evbdd_makenode(var, low, high);
+        return 0;
+    }
+    default:
+        return 0;
+    }
+}
+
+TASK_3(uint64_t, bench_range, int, kernel, uint64_t, from, uint64_t, to)
+{
+    if (to - from > BENCH_CHUNK) {
+        uint64_t mid = from + (to - from) / 2;
+        SPAWN(bench_range, kernel, mid, to);
+        uint64_t hits = CALL(bench_range, kernel, from, mid);
+        return hits + SYNC(bench_range);
+    }
+    uint64_t hits = 0;
+    for (uint64_t i = from; i < to; i++) {
+        hits += bench_op((kernel_t)kernel, i);
+    }
+    return hits;
+}
+
+/*******************************</Kernels>*************************************/
+
+
+
+
+
+/*******************************<Run benchmark>********************************/
+
+static double base_ops_per_sec[n_kernels][n_norm_strategies];
+
+static void
+report(kernel_t kernel, int norm, int workers, double time, uint64_t hits)
+{
+    double ops_per_sec = (time > 0) ? n_ops / time : 0;
+    if (workers == 1) base_ops_per_sec[kernel][norm] = ops_per_sec;
+    double speedup = (base_ops_per_sec[kernel][norm] > 0) ?
+                     ops_per_sec / base_ops_per_sec[kernel][norm] : 0;
+    double hit_rate = kernel_reports_hits[kernel] ? (double)hits / n_ops : NAN;
+    const char *norm_name = (kernel == k_evbdd_makenode) ? norm_names[norm] : "-";
+
+    printf("%-18s norm=%-4s workers=%-3d %10.3lf Mops/s  speedup %5.2lfx  hit rate %.3lf  edge %d/%d\n",
+           kernel_names[kernel], norm_name, workers, ops_per_sec / 1e6, speedup,
+           hit_rate, edge_wgt_bits, edge_ptr_bits);
+
+    if (csv_outputfile != NULL) {
+        FILE *fp = fopen(csv_outputfile, "a");
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0)
+            fprintf(fp, "%s\n", "kernel, norm-strat, workers, ops, keys, tolerance, time, mops_per_sec, speedup, hit_rate, edge_wgt_bits");
+        fprintf(fp, "%s, %s, %d, %" PRIu64 ", %" PRIu64 ", %.3e, %lf, %lf, %lf, %lf, %d\n",
+                kernel_names[kernel], norm_name, workers, n_ops, n_keys, tolerance,
+                time, ops_per_sec / 1e6, speedup, hit_rate, edge_wgt_bits);
+        fclose(fp);
+    }
+}
+
+static void
+run_kernel(kernel_t kernel, int norm, int workers)
+{
+    // Start every kernel from an empty node table and operation cache
+    sylvan_gc();
+    double t_start = wctime();
+    uint64_t hits = RUN(bench_range, kernel, 0, n_ops);
+    double time = wctime() - t_start;
+    report(kernel, norm, workers, time, hits);
+}
+
+static void
+run_with(int workers)
+{
+    for (int norm = 0; norm < n_norm_strategies; norm++) {
+        lace_start(workers, 0);
+        sylvan_set_sizes(node_tablesize, node_tablesize, cachesize, cachesize);
+        sylvan_init_package();
+        qsylvan_init_simulator(wgt_tablesize, wgt_tablesize, tolerance, COMP_HASHMAP, norm);
+        evbdd_get_edge_layout(&edge_wgt_bits, &edge_ptr_bits);
+
+        // Populate the edge weight table with the key pool (not timed)
+        amp_pool = (AMP*)malloc(sizeof(AMP) * n_keys);
+        for (uint64_t k = 0; k < n_keys; k++) {
+            complex_t c = pool_key(k);
+            amp_pool[k] = weight_lookup(&c);
+        }
+
+        if (norm == 0) {
+            // Kernels which do not depend on the normalization strategy
+            bench_cmap = cmap_create(wgt_tablesize, tolerance);
+            run_kernel(k_cmap_find_or_put, norm, workers);
+            cmap_free(bench_cmap);
+            bench_cmap = NULL;
+
+            run_kernel(k_llmsset_lookup, norm, workers);
+
+            bench_opid = cache_next_opid();
+            run_kernel(k_cache_get_put3, norm, workers);
+
+            run_kernel(k_wgt_mul, norm, workers);
+        }
+        run_kernel(k_evbdd_makenode, norm, workers);
+
+        free(amp_pool);
+        amp_pool = NULL;
+        sylvan_quit();
+        lace_stop();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    argp_parse(&argp, argc, argv, 0, 0, 0);
+
+    if (n_keys > n_ops) n_keys = n_ops;
+    if (n_keys < 2) n_keys = 2;
+    // The weight table must hold the key pool plus the products / normalized
+    // weights created by wgt_mul and evbdd_makenode
+    while (wgt_tablesize < 4 * n_keys) wgt_tablesize <<= 1;
+    while (node_tablesize < 4 * n_keys) node_tablesize <<= 1;
+
+    printf("ops per kernel = %" PRIu64 ", distinct keys = %" PRIu64 ", tolerance = %.3e\n",
+           n_ops, n_keys, tolerance);
+
+    for (int workers = 1; workers <= max_workers; workers *= 2) {
+        run_with(workers);
+        if (workers < max_workers && workers * 2 > max_workers) {
+            run_with(max_workers);
+        }
+    }
+
+    return 0;
+}
+
+/******************************</Run benchmark>********************************/
@@ -26,6 +26,10 @@ static double threshold = 1e-6;
 static int wgt_table_type = COMP_HASHMAP;
 static int wgt_norm_strat = NORM_MAX;
 static bool count_nodes = false;
+static bool lookahead = false;
+static int sim_checks = 0;
+static int rseed = 0;
+static bool sim_baseline = false;
 static quantum_circuit_t* circuit_U;
 static quantum_circuit_t* circuit_V;
 
@@ -39,6 +43,10 @@ static struct argp_option options[] =
     {"node-tab-size", 1002, "<size>", 0, "log2 of max node table size (max 40)", 0},
     {"wgt-tab-size", 1003, "<size>", 0, "log2 of max edge weigth table size (max 30 (23 if node table >2^30))", 0},
     {"count-nodes", 'c', 0, 0, "Track maximum number of nodes", 0},
+    {"scheduler", 1004, "<proportional|lookahead>", 0, "How the alternating algorithm interleaves gates of U and V^dagger (default=proportional)", 0},
+    {"sim-checks", 1005, "<n>", 0, "First simulate both circuits on n random basis states to find non-equivalence early (default=0)", 0},
+    {"rseed", 'r', "<random-seed>", 0, "Set random seed for --sim-checks", 0},
+    {"sim-baseline", 1006, 0, 0, "Also run the full check after a --sim-checks counterexample, to report the time saved", 0},
     {0, 0, 0, 0, 0, 0}
 };
 static error_t
@@ -61,6 +69,20 @@ parse_opt(int key, char *arg, struct argp_state *state)
     case 'c':
         count_nodes = true;
         break;
+    case 'r':
+        rseed = atoi(arg);
+        break;
+    case 1004:
+        if (strcmp(arg, "lookahead") == 0) lookahead = true;
+        else if (strcmp(arg, "proportional") == 0) lookahead = false;
+        else argp_usage(state);
+        break;
+    case 1005:
+        sim_checks = atoi(arg);
+        break;
+    case 1006:
+        sim_baseline = true;
+        break;
     case 1000:
         if (strcmp(arg, "pauli") != 0 && strcmp(arg, "alternating") != 0)
             argp_usage(state);
@@ -107,9 +129,38 @@ typedef struct stats_s {
     size_t max_nodes_total;
     size_t max_nodes_U;
     size_t max_nodes_V;
+    int sim_checks_done;
+    double sim_time;
+    double full_check_time;
+    bool sim_passed;
 } stats_t;
 stats_t stats = {0};
 
+// per (qubit, Pauli) stats of the Pauli algorithm
+typedef struct pauli_check_s {
+    BDDVAR qubit;
+    char pauli;
+    bool done;       // false if skipped because of an earlier counterexample
+    bool equivalent;
+    double fidelity;
+    size_t nodes_U;
+    size_t nodes_V;
+    double wall_time;
+} pauli_check_t;
+static pauli_check_t *pauli_checks = NULL;
+static uint32_t n_pauli_checks = 0;
+static volatile bool pauli_cex_found = false;
+
+typedef struct sim_check_s {
+    bool *x;
+    bool done;
+    bool equivalent;
+    double fidelity;
+    double wall_time;
+} sim_check_t;
+sim_check_t *sim_stimuli = NULL;
+volatile bool sim_cex_found = false;
+
 
 void print_stats() {
     // print stats in JSON format
@@ -119,7 +170,20 @@ void print_stats() {
     printf("    \"circuit_U\": \"%s\",\n", circuit_U->name);
     printf("    \"circuit_V\": \"%s\",\n", circuit_V->name);
     printf("    \"equivalent\" : %d,\n", (int)stats.equivalent);
+    if (stats.counterexample[0] != '\0')
+        printf("    \"counterexample\" : \"%s\",\n", stats.counterexample);
     printf("    \"eq_threshold\" : %.5e,\n", threshold); 
+    if (strcmp(eqcheck_alg, "alternating") == 0)
+        printf("    \"scheduler\": \"%s\",\n", lookahead ? "lookahead" : "proportional");
+    if (sim_checks > 0) {
+        printf("    \"sim_checks\": %d,\n", stats.sim_checks_done);
+        printf("    \"sim_time\": %lf,\n", stats.sim_time);
+        if (stats.full_check_time > 0) {
+            printf("    \"full_check_time\": %lf,\n", stats.full_check_time);
+            if (!stats.sim_passed)
+                printf("    \"time_saved\": %lf,\n", stats.full_check_time - stats.sim_time);
+        }
+    }
     printf("    \"min_fidelity\" : %.5e,\n", stats.fidelity);
     printf("    \"max_nodes_total\": %" PRIu64 ",\n", stats.max_nodes_total);
     printf("    \"max_nodes_U\": %" PRIu64 ",\n", stats.max_nodes_U);
@@ -130,7 +194,21 @@ void print_stats() {
     printf("    \"tolerance\": %.5e,\n", tolerance);
     printf("    \"wgt_norm_strat\": %d,\n", wgt_norm_strat);
     printf("    \"workers\": %d\n", workers);
-    printf("  }\n");
+    if (n_pauli_checks > 0) {
+        printf("  },\n");
+        printf("  \"pauli_checks\": [\n");
+        for (uint32_t i = 0; i < n_pauli_checks; i++) {
+            pauli_check_t *c = &pauli_checks[i];
+            printf("    {\"qubit\": %d, \"pauli\": \"%c\", \"done\": %d, ", c->qubit, c->pauli, (int)c->done);
+            printf("\"equivalent\": %d, \"fidelity\": %.5e, ", (int)c->equivalent, c->fidelity);
+            printf("\"nodes_U\": %" PRIu64 ", \"nodes_V\": %" PRIu64 ", ", c->nodes_U, c->nodes_V);
+            printf("\"wall_time\": %lf}%s\n", c->wall_time, (i+1 < n_pauli_checks) ? "," : "");
+        }
+        printf("  ]\n");
+    }
+    else {
+        printf("  }\n");
+    }
     printf("}\n");
 }
 
@@ -146,65 +224,54 @@ wctime()
 }
 
 
-QMDD get_gate_matrix(quantum_op_t* gate, BDDVAR nqubits, bool dag) {
+/**
+ * Returns the gate id of the (dagger of the) single qubit gate which is 
+ * applied to the target of the given gate (cx and cz are controlled x and z).
+ */
+gate_id_t get_gate_id(quantum_op_t* gate, bool dag) {
     // TODO: move this relation between parsed quantum_op and internal gate
     // somewhere else?
     if (strcmp(gate->name, "id") == 0) {
-        return qmdd_create_all_identity_matrix(nqubits);
+        return GATEID_I;
     }
-    else if (strcmp(gate->name, "x") == 0) {
-        return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_X);
+    else if (strcmp(gate->name, "x") == 0 || strcmp(gate->name, "cx") == 0) {
+        return GATEID_X;
     }
     else if (strcmp(gate->name, "y") == 0) {
-        return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Y);
+        return GATEID_Y;
     }
-    else if (strcmp(gate->name, "z") == 0) {
-        return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Z);
+    else if (strcmp(gate->name, "z") == 0 || strcmp(gate->name, "cz") == 0) {
+        return GATEID_Z;
     }
     else if (strcmp(gate->name, "h") == 0) {
-        return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_H);
+        return GATEID_H;
     }
     else if (strcmp(gate->name, "s") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Sdag);
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_S);
+        return dag ? GATEID_Sdag : GATEID_S;
     }
     else if (strcmp(gate->name, "sdg") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_S);
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Sdag);
+        return dag ? GATEID_S : GATEID_Sdag;
     }
     else if (strcmp(gate->name, "t") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Tdag);
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_T);
+        return dag ? GATEID_Tdag : GATEID_T;
     }
     else if (strcmp(gate->name, "tdg") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_T);
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Tdag);
+        return dag ? GATEID_T : GATEID_Tdag;
     }
     else if (strcmp(gate->name, "sx") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_sqrtXdag);
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_sqrtX);
+        return dag ? GATEID_sqrtXdag : GATEID_sqrtX;
     }
     else if (strcmp(gate->name, "sxdg") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_sqrtX);
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_sqrtXdag);
+        return dag ? GATEID_sqrtX : GATEID_sqrtXdag;
     }
     else if (strcmp(gate->name, "rx") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Rx(-gate->angle[0]));
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Rx(gate->angle[0]));
+        return GATEID_Rx(dag ? -gate->angle[0] : gate->angle[0]);
     }
     else if (strcmp(gate->name, "ry") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Ry(-gate->angle[0]));
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Ry(gate->angle[0]));
+        return GATEID_Ry(dag ? -gate->angle[0] : gate->angle[0]);
     }
     else if (strcmp(gate->name, "rz") == 0) {
-        if (dag) return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Rz(-gate->angle[0]));
-        else     return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], GATEID_Rz(gate->angle[0]));
-    }
-    else if (strcmp(gate->name, "cx") == 0) {
-        return qmdd_create_cgate(nqubits, gate->ctrls[0], gate->targets[0], GATEID_X);
-    }
-    else if (strcmp(gate->name, "cz") == 0) {
-        return qmdd_create_cgate(nqubits, gate->ctrls[0], gate->targets[0], GATEID_Z);
+        return GATEID_Rz(dag ? -gate->angle[0] : gate->angle[0]);
     }
     else {
         fprintf(stderr, "Gate '%s' currently unsupported\n", gate->name);
@@ -213,6 +280,20 @@ QMDD get_gate_matrix(quantum_op_t* gate, BDDVAR nqubits, bool dag) {
 }
 
 
+QMDD get_gate_matrix(quantum_op_t* gate, BDDVAR nqubits, bool dag) {
+    gate_id_t gate_id = get_gate_id(gate, dag);
+    if (strcmp(gate->name, "id") == 0) {
+        return qmdd_create_all_identity_matrix(nqubits);
+    }
+    else if (gate->ctrls[0] != -1) {
+        return qmdd_create_cgate(nqubits, gate->ctrls[0], gate->targets[0], gate_id);
+    }
+    else {
+        return qmdd_create_single_qubit_gate(nqubits, gate->targets[0], gate_id);
+    }
+}
+
+
 QMDD compute_UPUdag(quantum_circuit_t *circuit, gate_id_t P, BDDVAR k) {
     BDDVAR nqubits = circuit->qreg_size;
     QMDD circ_matrix = qmdd_create_single_qubit_gate(nqubits, k, P);
@@ -222,6 +303,8 @@ QMDD compute_UPUdag(quantum_circuit_t *circuit, gate_id_t P, BDDVAR k) {
 
     quantum_op_t *op = circuit->operations;
     while (op != NULL) {
+        // another check already found a counterexample
+        if (pauli_cex_found) break;
         switch (op->type) {
             case op_gate:
                 tmp = get_gate_matrix(op, nqubits, false);
@@ -246,34 +329,119 @@ QMDD compute_UPUdag(quantum_circuit_t *circuit, gate_id_t P, BDDVAR k) {
 }
 
 
-void pauli_check(quantum_circuit_t *U, quantum_circuit_t *V, gate_id_t P, BDDVAR k)
+/**
+ * Checks U P_k U^dagger == V P_k V^dagger for check i, i.e. P = X (i even) or
+ * P = Z (i odd) on qubit k = i/2.
+ */
+bool pauli_check(quantum_circuit_t *U, quantum_circuit_t *V, uint32_t i)
 {
+    pauli_check_t *c = &pauli_checks[i];
+    if (pauli_cex_found) return true; // skip, not a counterexample itself
+
+    double t1 = wctime();
     BDDVAR nqubits = U->qreg_size;
-    QMDD qmdd_U = compute_UPUdag(U, P, k);
+    gate_id_t P = (c->pauli == 'X') ? GATEID_X : GATEID_Z;
+    QMDD qmdd_U = compute_UPUdag(U, P, c->qubit);
     evbdd_protect(&qmdd_U);
-    QMDD qmdd_V = compute_UPUdag(V, P, k);
-    evbdd_unprotect(&qmdd_U);
+    QMDD qmdd_V = compute_UPUdag(V, P, c->qubit);
+    evbdd_protect(&qmdd_V);
+    if (pauli_cex_found) {
+        // partial results of an aborted check are meaningless
+        evbdd_unprotect(&qmdd_U);
+        evbdd_unprotect(&qmdd_V);
+        return true;
+    }
 
     if (count_nodes) {
-        size_t nodes_U = evbdd_countnodes(qmdd_U);
-        size_t nodes_V = evbdd_countnodes(qmdd_V);
-        stats.max_nodes_total = max(stats.max_nodes_total,nodes_U+nodes_V);
-        stats.max_nodes_U = max(stats.max_nodes_U, nodes_U);
-        stats.max_nodes_V = max(stats.max_nodes_V, nodes_V);
+        c->nodes_U = evbdd_countnodes(qmdd_U);
+        c->nodes_V = evbdd_countnodes(qmdd_V);
     }
 
+    c->fidelity = 1.0;
+    c->equivalent = true;
     if (qmdd_U != qmdd_V) {
         // if not exactly equal, compute overlap
         double norm = pow(2.0, nqubits*2);
-        double fid = qmdd_fidelity(qmdd_U, qmdd_V, nqubits*2) / norm;
-        stats.fidelity = min(stats.fidelity, fid);
+        c->fidelity = qmdd_fidelity(qmdd_U, qmdd_V, nqubits*2) / norm;
+        if (fabs(c->fidelity - 1.0) > threshold) {
+            c->equivalent = false;
+            pauli_cex_found = true; // terminate the other checks
+        }
+    }
+    evbdd_unprotect(&qmdd_U);
+    evbdd_unprotect(&qmdd_V);
 
-        if (fabs(fid - 1.0) > threshold) {
-            stats.equivalent = false;
-            //lace_stop(); // terminate all workers
-            return;
+    c->wall_time = wctime() - t1;
+    c->done = true;
+    return c->equivalent;
+}
+
+
+/**
+ * Returns true if the circuit contains rotation gates. Their gate ids all
+ * share the single dynamic gate slot, so they cannot be built concurrently.
+ */
+bool has_dynamic_gates(quantum_circuit_t *circuit)
+{
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type != op_gate) continue;
+        if (strcmp(op->name, "rx") == 0 || strcmp(op->name, "ry") == 0 ||
+            strcmp(op->name, "rz") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * A single check i of a batch of independent checks of U and V, which
+ * returns false on a counterexample.
+ */
+typedef bool (*check_fn_t)(quantum_circuit_t*, quantum_circuit_t*, uint32_t);
+
+
+/**
+ * Task tree over the checks [from, to).
+ */
+TASK_5(bool, check_range, check_fn_t, check, quantum_circuit_t*, U, quantum_circuit_t*, V, uint32_t, from, uint32_t, to)
+{
+    if (to - from == 1) return check(U, V, from);
+    uint32_t mid = from + (to - from) / 2;
+    SPAWN(check_range, check, U, V, mid, to);
+    bool low  = CALL(check_range, check, U, V, from, mid);
+    bool high = SYNC(check_range);
+    return low && high;
+}
+
+
+/**
+ * Runs the checks [0, n) as parallel tasks, until one of them sets 
+ * <cex_found>.
+ * 
+ * Garbage collecting the edge weight table renumbers the weights, which is 
+ * only safe while no other checks are running. With multiple workers the 
+ * checks therefore run in batches, with gc in between. Circuits with rotation
+ * gates are checked one at a time (see has_dynamic_gates).
+ */
+void run_checks(quantum_circuit_t *U, quantum_circuit_t *V, check_fn_t check, uint32_t n, volatile bool *cex_found)
+{
+    uint32_t batch = n;
+    if (has_dynamic_gates(U) || has_dynamic_gates(V)) {
+        batch = 1;
+    }
+    else if (lace_workers() > 1) {
+        evbdd_set_auto_gc_wgt_table(false);
+        batch = lace_workers();
+    }
+    for (uint32_t from = 0; from < n && !*cex_found; from += batch) {
+        uint32_t to = min(from + batch, n);
+        RUN(check_range, check, U, V, from, to);
+        if (lace_workers() > 1 && evbdd_test_gc_wgt_table()) {
+            evbdd_gc_wgt_table();
         }
     }
+    evbdd_set_auto_gc_wgt_table(true);
 }
 
 
@@ -281,6 +449,9 @@ void pauli_check(quantum_circuit_t *U, quantum_circuit_t *V, gate_id_t P, BDDVAR
  * Equivalence checking based on Theorem 1 of
  * "Fast equivalence checking of quantum circuits of Clifford gates", 
  * D. Thanos et al., ATVA (2023)
+ * 
+ * The 2n checks U P U^dagger == V P V^dagger (for P = X_k, Z_k) are 
+ * independent and run as parallel tasks, stopping at the first counterexample.
  */
  void pauli_echeck(quantum_circuit_t *U, quantum_circuit_t *V) {
     if (U->qreg_size != V->qreg_size) {
@@ -294,14 +465,152 @@ void pauli_check(quantum_circuit_t *U, quantum_circuit_t *V, gate_id_t P, BDDVAR
     stats.equivalent = true;
     stats.fidelity = 1.0;
 
-    uint64_t m = 0;
-    uint32_t XZ[2] = {GATEID_X, GATEID_Z};
-    char XZ_str[2] = {'X', 'Z'};
-    for (BDDVAR k = 0; k < nqubits; k++) {
-        for (int i = 0; i < 2; i++) {
-            pauli_check(U, V, XZ[i], k);
+    n_pauli_checks = 2 * nqubits;
+    pauli_checks = calloc(n_pauli_checks, sizeof(pauli_check_t));
+    for (uint32_t i = 0; i < n_pauli_checks; i++) {
+        pauli_checks[i].qubit = i / 2;
+        pauli_checks[i].pauli = (i % 2 == 0) ? 'X' : 'Z';
+    }
+    pauli_cex_found = false;
+
+    run_checks(U, V, pauli_check, n_pauli_checks, &pauli_cex_found);
+
+    for (uint32_t i = 0; i < n_pauli_checks; i++) {
+        pauli_check_t *c = &pauli_checks[i];
+        if (!c->done) continue;
+        stats.fidelity = min(stats.fidelity, c->fidelity);
+        stats.max_nodes_total = max(stats.max_nodes_total, c->nodes_U + c->nodes_V);
+        stats.max_nodes_U = max(stats.max_nodes_U, c->nodes_U);
+        stats.max_nodes_V = max(stats.max_nodes_V, c->nodes_V);
+        if (!c->equivalent && stats.equivalent) {
+            stats.equivalent = false;
+            snprintf(stats.counterexample, sizeof(stats.counterexample),
+                     "U %c_%d U^dagger != V %c_%d V^dagger", c->pauli, c->qubit, c->pauli, c->qubit);
+        }
+    }
+}
+
+
+/**
+ * Simulates the circuit on basis state |x>.
+ */
+QMDD simulate_basis_state(quantum_circuit_t *circuit, bool *x)
+{
+    BDDVAR nqubits = circuit->qreg_size;
+    QMDD state = qmdd_create_basis_state(nqubits, x);
+    evbdd_protect(&state);
+
+    quantum_op_t *op = circuit->operations;
+    while (op != NULL && !sim_cex_found) {
+        if (op->type == op_gate) {
+            gate_id_t gate_id = get_gate_id(op, false);
+            if (op->ctrls[0] != -1)
+                state = qmdd_cgate(state, gate_id, op->ctrls[0], op->targets[0], nqubits);
+            else if (gate_id != GATEID_I)
+                state = qmdd_gate(state, gate_id, op->targets[0]);
+        }
+        op = op->next;
+    }
+
+    evbdd_unprotect(&state);
+    return state;
+}
+
+
+/**
+ * Compares U|x> and V|x> for stimulus i.
+ */
+bool sim_check(quantum_circuit_t *U, quantum_circuit_t *V, uint32_t i)
+{
+    sim_check_t *c = &sim_stimuli[i];
+    if (sim_cex_found) return true; // skip, not a counterexample itself
+
+    double t1 = wctime();
+    BDDVAR nqubits = U->qreg_size;
+    QMDD state_U = simulate_basis_state(U, c->x);
+    evbdd_protect(&state_U);
+    QMDD state_V = simulate_basis_state(V, c->x);
+    evbdd_protect(&state_V);
+    if (sim_cex_found) {
+        // partial results of an aborted simulation are meaningless
+        evbdd_unprotect(&state_U);
+        evbdd_unprotect(&state_V);
+        return true;
+    }
+
+    c->fidelity = 1.0;
+    c->equivalent = true;
+    if (state_U != state_V) {
+        c->fidelity = qmdd_fidelity(state_U, state_V, nqubits);
+        if (fabs(c->fidelity - 1.0) > threshold) {
+            c->equivalent = false;
+            sim_cex_found = true; // terminate the other simulations
         }
     }
+    evbdd_unprotect(&state_U);
+    evbdd_unprotect(&state_V);
+
+    c->wall_time = wctime() - t1;
+    c->done = true;
+    return c->equivalent;
+}
+
+
+/**
+ * Compares U|x> and V|x> for <sim_checks> random basis states |x>, as 
+ * parallel tasks (see run_checks). Returns false (and sets the stats) if a 
+ * counterexample is found.
+ */
+bool simulation_precheck(quantum_circuit_t *U, quantum_circuit_t *V)
+{
+    if (U->qreg_size != V->qreg_size) return true; // reported by the checks
+    BDDVAR nqubits = U->qreg_size;
+    double t1 = wctime();
+
+    // draw all stimuli up front, rand() is not thread-safe
+    sim_stimuli = calloc(sim_checks, sizeof(sim_check_t));
+    for (int i = 0; i < sim_checks; i++) {
+        sim_stimuli[i].x = malloc(sizeof(bool) * nqubits);
+        for (BDDVAR k = 0; k < nqubits; k++) sim_stimuli[i].x[k] = rand() & 1;
+    }
+    sim_cex_found = false;
+
+    uint32_t n = (uint32_t) sim_checks;
+    run_checks(U, V, sim_check, n, &sim_cex_found);
+
+    bool res = true;
+    for (uint32_t i = 0; i < n; i++) {
+        sim_check_t *c = &sim_stimuli[i];
+        if (!c->done) continue;
+        stats.sim_checks_done++;
+        if (!c->equivalent && res) {
+            stats.equivalent = false;
+            stats.fidelity = c->fidelity;
+            int len = snprintf(stats.counterexample, sizeof(stats.counterexample), "U|x> != V|x> for x = ");
+            for (BDDVAR k = 0; k < nqubits && len + 1 < (int)sizeof(stats.counterexample); k++) {
+                stats.counterexample[len++] = c->x[k] ? '1' : '0';
+            }
+            stats.counterexample[len] = '\0';
+            res = false;
+        }
+    }
+
+    for (int i = 0; i < sim_checks; i++) free(sim_stimuli[i].x);
+    free(sim_stimuli);
+    stats.sim_time = wctime() - t1;
+    return res;
+}
+
+
+/**
+ * Returns V[i]^dagger * prod (if v is set, for op = V[i]) or prod * U[j] (for
+ * op = U[j]).
+ */
+QMDD lookahead_mult(QMDD prod, quantum_op_t *op, bool v, BDDVAR nqubits)
+{
+    QMDD gate = get_gate_matrix(op, nqubits, v);
+    if (v) return evbdd_matmat_mult(gate, prod, nqubits);
+    else   return evbdd_matmat_mult(prod, gate, nqubits);
 }
 
 
@@ -330,24 +639,63 @@ void alternating_eqcheck(quantum_circuit_t *U, quantum_circuit_t *V)
         int tmp2 = ngates_v; ngates_v = ngates_u; ngates_u = tmp2;
     }
     
-    // compute V^dagger * U from the inside out, 
-    // in steps of 1 for V, and steps of |U|/|V| for U
-    double step_u = (double)ngates_u / (double)ngates_v;
     int i = 0, j = 0;
-    double _j = step_u;
     QMDD prod, vi_dag, uj;
     prod = qmdd_create_all_identity_matrix(nqubits);
-    while (i < ngates_v) {
-        // compute V[i]^dagger * prod * U[j-step_u] * ... * U[j]
-        vi_dag = get_gate_matrix(ops_v[i], nqubits, true);
-        prod = evbdd_matmat_mult(vi_dag, prod, nqubits);
-        while ((j < _j) && (j < ngates_u)) {
-            uj = get_gate_matrix(ops_u[j], nqubits, false);
-            prod = evbdd_matmat_mult(prod, uj, nqubits);
-            j += 1;
+    if (lookahead) {
+        // apply either V[i]^dagger or U[j], whichever gives the smallest 
+        // product, until both circuits are used up. The circuit which is 
+        // furthest behind is tried first, and taken without computing the 
+        // other product if it does not grow the product.
+        QMDD next = EVBDD_ZERO, other = EVBDD_ZERO;
+        evbdd_protect(&prod);
+        evbdd_protect(&next);
+        evbdd_protect(&other);
+        size_t nodes = evbdd_countnodes(prod);
+        while (i < ngates_v || j < ngates_u) {
+            bool take_v = (j == ngates_u) || (i < ngates_v &&
+                          (double)i / ngates_v <= (double)j / ngates_u);
+            next = lookahead_mult(prod, take_v ? ops_v[i] : ops_u[j], take_v, nqubits);
+            size_t nodes_next = evbdd_countnodes(next);
+            if (nodes_next > nodes && (take_v ? j < ngates_u : i < ngates_v)) {
+                other = lookahead_mult(prod, take_v ? ops_u[j] : ops_v[i], !take_v, nqubits);
+                size_t nodes_other = evbdd_countnodes(other);
+                if (nodes_other < nodes_next) {
+                    next = other;
+                    nodes_next = nodes_other;
+                    take_v = !take_v;
+                }
+            }
+            prod = next;
+            nodes = nodes_next;
+            if (take_v) i += 1;
+            else j += 1;
+            stats.max_nodes_total = max(stats.max_nodes_total, nodes);
+        }
+        evbdd_unprotect(&prod);
+        evbdd_unprotect(&next);
+        evbdd_unprotect(&other);
+    }
+    else {
+        // compute V^dagger * U from the inside out, 
+        // in steps of 1 for V, and steps of |U|/|V| for U
+        double step_u = (double)ngates_u / (double)ngates_v;
+        double _j = step_u;
+        while (i < ngates_v) {
+            // compute V[i]^dagger * prod * U[j-step_u] * ... * U[j]
+            vi_dag = get_gate_matrix(ops_v[i], nqubits, true);
+            prod = evbdd_matmat_mult(vi_dag, prod, nqubits);
+            while ((j < _j) && (j < ngates_u)) {
+                uj = get_gate_matrix(ops_u[j], nqubits, false);
+                prod = evbdd_matmat_mult(prod, uj, nqubits);
+                j += 1;
+            }
+            if (count_nodes) {
+                stats.max_nodes_total = max(stats.max_nodes_total, evbdd_countnodes(prod));
+            }
+            i += 1;
+            _j += step_u;
         }
-        i += 1;
-        _j += step_u;
     }
     assert (i == ngates_v);
     assert (j == ngates_u);
@@ -386,12 +734,31 @@ int main(int argc, char *argv[])
     clock_t cpu_t1 = clock();
     double wall_t1 = wctime();
 
-    if (strcmp(eqcheck_alg, "pauli") == 0)
-        pauli_echeck(circuit_U, circuit_V);
-    else if (strcmp(eqcheck_alg, "alternating") == 0)
-        alternating_eqcheck(circuit_U, circuit_V);
-    else
-        fprintf(stderr, "Invalid arg for algorithm (should be caught by argp)\n");
+    if (rseed == 0) rseed = time(NULL);
+    srand(rseed);
+
+    stats.sim_passed = true;
+    if (sim_checks > 0)
+        stats.sim_passed = simulation_precheck(circuit_U, circuit_V);
+
+    // only needed if all stimuli agree (or to measure the time saved)
+    if (stats.sim_passed || sim_baseline) {
+        stats_t sim_stats = stats;
+        double t1 = wctime();
+        if (strcmp(eqcheck_alg, "pauli") == 0)
+            pauli_echeck(circuit_U, circuit_V);
+        else if (strcmp(eqcheck_alg, "alternating") == 0)
+            alternating_eqcheck(circuit_U, circuit_V);
+        else
+            fprintf(stderr, "Invalid arg for algorithm (should be caught by argp)\n");
+        stats.full_check_time = wctime() - t1;
+        if (!stats.sim_passed) {
+            // report the counterexample found by simulation
+            stats.equivalent = sim_stats.equivalent;
+            stats.fidelity = sim_stats.fidelity;
+            memcpy(stats.counterexample, sim_stats.counterexample, sizeof(stats.counterexample));
+        }
+    }
         
     clock_t cpu_t2 = clock();
     double wall_t2 = wctime();
@@ -405,6 +772,7 @@ int main(int argc, char *argv[])
     if (stats.equivalent) lace_stop();
     free_quantum_circuit(circuit_U);
     free_quantum_circuit(circuit_V);
+    free(pauli_checks);
 
     return 0;
 }
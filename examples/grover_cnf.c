@@ -98,3 +98,70 @@ qmdd_grover_cnf(BDDVAR n, int* oracle, BDDVAR k, BDDVAR clauses, BDDVAR n_answer
 
     return qmdd;
 }
+
+/**
+ * BDD of the CNF formula, where literal l refers to qubit abs(l)-1.
+ */
+static BDD
+cnf_to_bdd(int* oracle, BDDVAR k, BDDVAR clauses)
+{
+    // f, the current clause c and literal x are all referenced while the 
+    // next sylvan_or / sylvan_and can trigger garbage collection
+    BDD f = sylvan_true, c = sylvan_false, x = sylvan_false;
+    bdd_refs_pushptr(&f);
+    bdd_refs_pushptr(&c);
+    bdd_refs_pushptr(&x);
+    for (BDDVAR clause = 0; clause < clauses; clause++) {
+        c = sylvan_false;
+        for (BDDVAR l = 0; l < k; l++) {
+            int lit = oracle[clause*k+l];
+            x = (lit < 0) ? sylvan_nithvar(abs(lit)-1) : sylvan_ithvar(lit-1);
+            c = sylvan_or(c, x);
+        }
+        f = sylvan_and(f, c);
+    }
+    bdd_refs_popptr(3);
+    return f;
+}
+
+QMDD
+qmdd_grover_cnf_diagonal(BDDVAR n, int* oracle, BDDVAR k, BDDVAR clauses, BDDVAR n_answers)
+{
+    uint32_t R = floor( 3.14159265359/4.0 * sqrt( pow(2,n) / n_answers ) );
+
+    // oracle: phase -1 on the satisfying assignments
+    BDD f_oracle = cnf_to_bdd(oracle, k, clauses);
+    sylvan_protect(&f_oracle);
+
+    // diffusion (up to global phase): phase -1 on everything but |00...0>
+    BDD f_diff = sylvan_true;
+    sylvan_protect(&f_diff);
+    for (BDDVAR qubit = 0; qubit < n; qubit++) {
+        BDD x = bdd_refs_push(sylvan_nithvar(qubit));
+        f_diff = sylvan_and(f_diff, x);
+        bdd_refs_pop(1);
+    }
+    f_diff = sylvan_not(f_diff);
+
+    QMDD qmdd = qmdd_create_all_zero_state(n);
+    evbdd_protect(&qmdd);
+    for (BDDVAR qubit = 0; qubit < n; qubit++) {
+        qmdd = qmdd_gate(qmdd, GATEID_H, qubit);
+    }
+
+    for (uint32_t i = 1; i <= R; i++) {
+        qmdd = qmdd_apply_diagonal(qmdd, f_oracle, EVBDD_MIN_ONE);
+        for (BDDVAR qubit = 0; qubit < n; qubit++) {
+            qmdd = qmdd_gate(qmdd, GATEID_H, qubit);
+        }
+        qmdd = qmdd_apply_diagonal(qmdd, f_diff, EVBDD_MIN_ONE);
+        for (BDDVAR qubit = 0; qubit < n; qubit++) {
+            qmdd = qmdd_gate(qmdd, GATEID_H, qubit);
+        }
+    }
+
+    evbdd_unprotect(&qmdd);
+    sylvan_unprotect(&f_diff);
+    sylvan_unprotect(&f_oracle);
+    return qmdd;
+}
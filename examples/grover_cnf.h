@@ -11,6 +11,14 @@ QMDD qmdd_grover_cnf(BDDVAR n, int* oracle, BDDVAR k, BDDVAR clauses, BDDVAR n_a
 #define qmdd_grover_cnf_iteration(qmdd,n,k,clauses,oracle) (RUN(qmdd_grover_cnf_iteration,qmdd,n,k,clauses,oracle));
 TASK_DECL_5(QMDD, qmdd_grover_cnf_iteration, QMDD, BDDVAR, BDDVAR,BDDVAR, int*);
 
+/**
+ * Same as qmdd_grover_cnf, but with both the oracle and the diffusion applied
+ * as diagonal operators (qmdd_apply_diagonal) given by a BDD over the n
+ * qubits. This does not need the clause and phase-kickback ancillas, so the
+ * state has only n qubits.
+ */
+QMDD qmdd_grover_cnf_diagonal(BDDVAR n, int* oracle, BDDVAR k, BDDVAR clauses, BDDVAR n_answers);
+
 /**
  * Implementation of Grover where both the state vector and the gates are
  * represented as QMDDs, and matrix-vector / matrix-matrix multiplication is
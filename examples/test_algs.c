@@ -233,6 +233,19 @@ int test_grover_cnf()
 
     if(VERBOSE) printf("qmdd %2d-qubit 3-SAT Grover:  ok (Pr(flag) = %lf)\n", nqubits, prob);
 
+
+    // 3-SAT, 4 qubit test with diagonal oracle (no ancillas)
+    // (the only satisfying assignment of cnf4 is x1 = x2 = x3 = x4 = 0)
+    bool sat4[] = {0,0,0,0};
+    grov = qmdd_grover_cnf_diagonal(nqubits, cnf4, k, clauses, answers);
+    // test probabilities
+    a = evbdd_getvalue(grov, sat4);
+    prob = qmdd_amp_to_prob(a);
+    test_assert(qmdd_is_unitvector(grov, nqubits));
+    test_assert(prob > 0.9);
+
+    if(VERBOSE) printf("qmdd %2d-qubit 3-SAT Grover (diag): ok (Pr(flag) = %lf)\n", nqubits, prob);
+
     return 0;
 }
 
@@ -394,6 +407,7 @@ int main()
     // Simple Sylvan initialization
     sylvan_set_sizes(1LL<<25, 1LL<<25, 1LL<<16, 1LL<<16);
     sylvan_init_package();
+    sylvan_init_mtbdd();
     qsylvan_init_simulator(1LL<<16, 1LL<<16, TOLERANCE, COMP_HASHMAP, NORM_MAX);
     qmdd_set_testing_mode(true); // turn on internal sanity tests
 
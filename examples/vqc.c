@@ -1,25 +1,69 @@
 #include <qsylvan.h>
-#include <stdlib.h> 
+#include <stdlib.h>
+#include <string.h>
 
-void ry_cz_ansatz(int nqubits, int depth)
+void ry_cz_ansatz(int nqubits, int depth, int steps, double lr)
 {
-    QMDD state = qmdd_create_all_zero_state(nqubits);
-    evbdd_protect(&state);
-
+    // parameterized circuit with depth layers of Ry rotations and CZ gates
+    uint32_t nparams = nqubits * depth;
+    uint32_t ngates = depth * (2*nqubits - 1);
+    qmdd_pgate_t *gates = malloc(sizeof(qmdd_pgate_t) * ngates);
+    uint32_t g = 0;
     for (int d = 0; d < depth; d++) {
         // Ry rotations
         for (int n = 0; n < nqubits; n++) {
-            fl_t theta = (fl_t)rand() / (fl_t)RAND_MAX;
-            state = qmdd_gate(state, GATEID_Ry(theta), n);
+            qmdd_pgate_t ry = {QMDD_PGATE_RY, 0, d*nqubits + n, EVBDD_INVALID_VAR,
+                               EVBDD_INVALID_VAR, EVBDD_INVALID_VAR, n};
+            gates[g++] = ry;
         }
 
         // entangling gates
         for (int n = 0; n < nqubits - 1; n++) {
-            state = qmdd_cgate(state, GATEID_Z, n, n+1);
+            qmdd_pgate_t cz = {QMDD_PGATE_FIXED, GATEID_Z, 0, n, EVBDD_INVALID_VAR,
+                               EVBDD_INVALID_VAR, n+1};
+            gates[g++] = cz;
         }
     }
+    qmdd_pcircuit_t pc = {nqubits, nparams, ngates, gates};
+
+    // random initial angles
+    double *theta = malloc(sizeof(double) * nparams);
+    double *grad = malloc(sizeof(double) * nparams);
+    for (uint32_t p = 0; p < nparams; p++) {
+        theta[p] = (double)rand() / (double)RAND_MAX;
+    }
+
+    // energy of transverse field Ising Hamiltonian H = -sum Z_n Z_{n+1} - sum X_n
+    uint32_t nterms = 2*nqubits - 1;
+    char **paulis = malloc(sizeof(char*) * nterms);
+    double *coeffs = malloc(sizeof(double) * nterms);
+    for (uint32_t t = 0; t < nterms; t++) {
+        paulis[t] = malloc(nqubits + 1);
+        memset(paulis[t], 'I', nqubits);
+        paulis[t][nqubits] = '\0';
+        coeffs[t] = -1.0;
+        if (t < (uint32_t)nqubits - 1) {
+            paulis[t][t] = 'Z'; paulis[t][t+1] = 'Z';
+        } else {
+            paulis[t][t - (nqubits - 1)] = 'X';
+        }
+    }
+
+    // gradient descent, with the gradients from the parameter-shift rule
+    for (int s = 0; s <= steps; s++) {
+        double energy = qmdd_param_shift_gradient(&pc, theta, paulis, coeffs, nterms, grad);
+        printf("step %2d: <psi|H|psi> = %lf\n", s, energy);
+        for (uint32_t p = 0; p < nparams; p++) {
+            theta[p] -= lr * grad[p];
+        }
+    }
+    for (uint32_t t = 0; t < nterms; t++) free(paulis[t]);
+    free(paulis);
+    free(coeffs);
 
     // measure
+    QMDD state = qmdd_pcircuit_run(&pc, theta);
+    evbdd_protect(&state);
     bool *outcome = malloc(sizeof(bool) * nqubits);
     double prob;
     qmdd_measure_all(state, nqubits, outcome, &prob);
@@ -30,6 +74,9 @@ void ry_cz_ansatz(int nqubits, int depth)
     printf("> (with prob %lf)\n", prob);
 
     free(outcome);
+    free(theta);
+    free(grad);
+    free(gates);
     evbdd_unprotect(&state);
 }
 
@@ -45,7 +92,7 @@ int main()
     qsylvan_init_defaults(1LL<<20);
 
     srand(time(NULL));
-    ry_cz_ansatz(10, 5);
+    ry_cz_ansatz(6, 3, 20, 0.1);
 
     sylvan_quit();
     return 0;
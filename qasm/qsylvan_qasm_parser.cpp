@@ -20,6 +20,7 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
 #include <stdio.h>
 #include <string.h>
 
@@ -733,6 +734,163 @@ void optimize_qubit_order(quantum_circuit_t *circuit, bool allow_swaps)
     }
 }
 
+// Qubits the gate acts on (targets and controls), returns the number of qubits
+static int
+gate_qubits(quantum_op_t *op, int *qubits)
+{
+    int n = 0;
+    for (int j = 0; j < 2; j++) if (op->targets[j] != -1) qubits[n++] = op->targets[j];
+    for (int j = 0; j < 3; j++) if (op->ctrls[j] != -1) qubits[n++] = op->ctrls[j];
+    return n;
+}
+
+
+static std::vector<std::vector<double>> interaction_graph(quantum_circuit_t *circuit)
+{
+    int n = circuit->qreg_size;
+    std::vector<std::vector<double>> w(n, std::vector<double>(n, 0.0));
+    int qubits[5];
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type != op_gate) continue;
+        int k = gate_qubits(op, qubits);
+        for (int a = 0; a < k; a++) {
+            for (int b = a+1; b < k; b++) {
+                if (qubits[a] == qubits[b]) continue;
+                w[qubits[a]][qubits[b]] += 1.0;
+                w[qubits[b]][qubits[a]] += 1.0;
+            }
+        }
+    }
+    return w;
+}
+
+
+static double arrangement_cost(const std::vector<std::vector<double>> &w, const std::vector<int> &pos)
+{
+    double cost = 0;
+    int n = pos.size();
+    for (int i = 0; i < n; i++) {
+        for (int j = i+1; j < n; j++) {
+            cost += w[i][j] * std::abs(pos[i] - pos[j]);
+        }
+    }
+    return cost;
+}
+
+
+static std::vector<int> reverse_cuthill_mckee(const std::vector<std::vector<double>> &w)
+{
+    int n = w.size();
+    std::vector<int> degree(n, 0);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) if (w[i][j] > 0) degree[i]++;
+    }
+
+    // BFS from an unvisited vertex of minimal degree (for every component),
+    // visiting neighbors in order of increasing degree
+    std::vector<int> order;
+    std::vector<bool> visited(n, false);
+    while ((int)order.size() < n) {
+        int start = -1;
+        for (int i = 0; i < n; i++) {
+            if (!visited[i] && (start == -1 || degree[i] < degree[start])) start = i;
+        }
+        visited[start] = true;
+        size_t head = order.size();
+        order.push_back(start);
+        while (head < order.size()) {
+            int v = order[head++];
+            std::vector<int> nbs;
+            for (int u = 0; u < n; u++) {
+                if (w[v][u] > 0 && !visited[u]) {
+                    visited[u] = true;
+                    nbs.push_back(u);
+                }
+            }
+            std::stable_sort(nbs.begin(), nbs.end(), [&](int a, int b) { return degree[a] < degree[b]; });
+            order.insert(order.end(), nbs.begin(), nbs.end());
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<int> pos(n);
+    for (int k = 0; k < n; k++) pos[order[k]] = k;
+    return pos;
+}
+
+
+static void exchange_local_search(const std::vector<std::vector<double>> &w, std::vector<int> &pos)
+{
+    // Exchange the positions of two qubits while that lowers the cost
+    int n = pos.size();
+    const int max_passes = 50;
+    for (int pass = 0; pass < max_passes; pass++) {
+        bool improved = false;
+        for (int a = 0; a < n; a++) {
+            for (int b = a+1; b < n; b++) {
+                double delta = 0;
+                for (int k = 0; k < n; k++) {
+                    if (k == a || k == b) continue;
+                    int da = std::abs(pos[a] - pos[k]), db = std::abs(pos[b] - pos[k]);
+                    delta += w[a][k] * (db - da) + w[b][k] * (da - db);
+                }
+                if (delta < -1e-9) {
+                    std::swap(pos[a], pos[b]);
+                    improved = true;
+                }
+            }
+        }
+        if (!improved) break;
+    }
+}
+
+
+void interaction_qubit_order(quantum_circuit_t *circuit, int *qubit_pos)
+{
+    int n = circuit->qreg_size;
+    std::vector<std::vector<double>> w = interaction_graph(circuit);
+
+    // Local search from both the circuit order and the RCM order
+    std::vector<int> identity(n);
+    for (int i = 0; i < n; i++) identity[i] = i;
+    std::vector<int> rcm = reverse_cuthill_mckee(w);
+    exchange_local_search(w, identity);
+    exchange_local_search(w, rcm);
+
+    const std::vector<int> &best = (arrangement_cost(w, rcm) < arrangement_cost(w, identity)) ? rcm : identity;
+    for (int i = 0; i < n; i++) qubit_pos[i] = best[i];
+}
+
+
+double predict_peak_nodes(quantum_circuit_t *circuit, const int *qubit_pos)
+{
+    // g[k] = number of multi-qubit gates crossing the cut between k-1 and k
+    int n = circuit->qreg_size;
+    std::vector<int> g(n+1, 0);
+    int qubits[5];
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type != op_gate) continue;
+        int k = gate_qubits(op, qubits);
+        if (k < 2) continue;
+        int lo = n, hi = -1;
+        for (int j = 0; j < k; j++) {
+            int p = (qubit_pos == NULL) ? qubits[j] : qubit_pos[qubits[j]];
+            lo = std::min(lo, p);
+            hi = std::max(hi, p);
+        }
+        for (int c = lo+1; c <= hi; c++) g[c]++;
+    }
+
+    // level k has at most 2^k nodes, and every gate crossing the cut above
+    // it can at most double the number of different sub-vectors
+    double nodes = 1; // terminal
+    for (int k = 0; k < n; k++) {
+        nodes += std::ldexp(1.0, std::min(k, g[k]));
+    }
+    return nodes;
+}
+
+
 quantum_op_t** circuit_as_array(quantum_circuit_t *circuit, bool return_non_empty, int *length)
 {
     // loop over circuit to get lenght
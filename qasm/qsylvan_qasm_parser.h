@@ -72,6 +72,25 @@ quantum_circuit_t* parse_qasm_file(char *filepath);
  */
 void optimize_qubit_order(quantum_circuit_t *circuit, bool allow_swaps);
 
+/**
+ * Computes a qubit order which keeps interacting qubits close together, from
+ * the weighted interaction graph of the circuit (w_ij = number of multi-qubit
+ * gates acting on both q_i and q_j). The order is obtained with reverse 
+ * Cuthill-McKee, followed by a local search (pairwise exchanges) which 
+ * minimizes sum_ij w_ij |pos(i) - pos(j)|. The circuit itself is not changed.
+ * 
+ * @param qubit_pos Array of length qreg_size, qubit_pos[i] is set to the new
+ * position of qubit i.
+ */
+void interaction_qubit_order(quantum_circuit_t *circuit, int *qubit_pos);
+
+/**
+ * Predicts the peak number of QMDD nodes for the given qubit order (NULL for
+ * the circuit order), as sum_k 2^min(k, g_k), where g_k is the number of
+ * multi-qubit gates which cross the cut above position k.
+ */
+double predict_peak_nodes(quantum_circuit_t *circuit, const int *qubit_pos);
+
 /**
  * Free all quantum elements found in quantum_op_s including 'first'.
  */
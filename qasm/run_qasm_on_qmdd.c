@@ -24,10 +24,22 @@
 
 /**********************<Arguments (configured via argp)>***********************/
 
+// largest --wgt-tab-size (the edge layout fixed at configure time, if set)
+#ifdef QSYLVAN_EDGE_WGT_BITS
+#define MAX_WGT_TAB_BITS QSYLVAN_EDGE_WGT_BITS
+#else
+#define MAX_WGT_TAB_BITS 30
+#endif
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+
 static int workers = 1;
 static int rseed = 0;
 static bool count_nodes = false;
 static bool output_vector = false;
+static char* vector_outputfile = NULL;
+static double amp_threshold = 0.0;
+static bool vector_ordered = false;
 static size_t min_tablesize = 1LL<<25;
 static size_t max_tablesize = 1LL<<25;
 static size_t min_cachesize = 1LL<<16;
@@ -39,6 +51,31 @@ static int wgt_table_type = COMP_HASHMAP;
 static int wgt_norm_strat = NORM_MAX;
 static bool wgt_inv_caching = true;
 static int reorder_qubits = 0;
+static double dynamic_reorder = 0;
+static bool interaction_order = false;
+static uint64_t approx_max_nodes = 0;
+static double approx_wgt_fill = 0;
+static double approx_round_fidelity = 0.99;
+static double fidelity_floor = 0.0;
+static bool clifford_prefix = false;
+static uint64_t trajectories = 0;
+static double noise_depolarizing = 0.0;
+static double noise_damping = 0.0;
+static double noise_readout = 0.0;
+static size_t memory_cap = 0;
+static sylvan_pages_t table_pages = SYLVAN_PAGES_DEFAULT;
+static sylvan_numa_t table_numa = SYLVAN_NUMA_FIRST_TOUCH;
+static bool pin_workers = false;
+static bool placement_report = false;
+static char* out_of_core_dir = NULL;
+static BDDVAR dense_block_levels = 0;
+static double dense_block_density = 0.9;
+static int hsf_cut = 0;
+static char **amp_queries = NULL;
+static int n_amp_queries = 0;
+static BDDVAR partition_qubits = 0;
+static qmdd_partition_t *partition = NULL;
+static bool density_matrix = false;
 static char* qasm_inputfile = NULL;
 static char* json_outputfile = NULL;
 
@@ -53,10 +90,35 @@ static struct argp_option options[] =
     {"count-nodes", 'c', 0, 0, "Track maximum number of nodes", 0},
     {"state-vector", 'v', 0, 0, "Also output the complete state vector", 0},
     {"node-tab-size", 1000, "<size>", 0, "log2 of max node table size (max 40)", 0},
-    {"wgt-tab-size", 1001, "<size>", 0, "log2 of max edge weigth table size (max 30 (23 if node table >2^30))", 0},
+    {"wgt-tab-size", 1001, "<size>", 0, "log2 of max edge weigth table size (max " TOSTRING(MAX_WGT_TAB_BITS) ", 23 if node table >2^30 without a configured edge layout)", 0},
     {"reorder", 1002, 0, 0, "Reorders the qubits once such that (most) controls occur before targets in the variable order.", 0},
     {"reorder-swaps", 1003, 0, 0, "Reorders the qubits such that all controls occur before targets (requires inserting SWAP gates).", 0},
     {"disable-inv-caching", 1004, 0, 0, "Disable storing inverse of MUL and DIV in cache.", 0},
+    {"state-vector-file", 1005, "<filename>", 0, "Stream the non-zero amplitudes of the final state to given file as binary (index, re, im) records", 0},
+    {"amp-threshold", 1006, "<threshold>", 0, "Only output amplitudes with |amp|^2 above threshold to the state vector file (default=0)", 0},
+    {"state-vector-ordered", 1007, 0, 0, "Write the state vector file sorted by index (single threaded)", 0},
+    {"reorder-interaction", 1009, 0, 0, "Order the qubits such that interacting qubits are close together (implies --count-nodes)", 0},
+    {"dynamic-reorder", 1008, "<growth>", 0, "Sift the qubit order during simulation whenever the number of nodes has grown by the given factor since the last sifting", 0},
+    {"approx-max-nodes", 1010, "<nodes>", 0, "Approximate the state whenever it has more than the given number of nodes", 0},
+    {"approx-wgt-fill", 1011, "<fraction>", 0, "Approximate the state whenever the edge weight table is filled more than the given fraction", 0},
+    {"approx-round-fidelity", 1012, "<fidelity>", 0, "Minimum fidelity of a single approximation round (default=0.99)", 0},
+    {"fidelity-floor", 1013, "<fidelity>", 0, "Stop approximating once the accumulated fidelity would drop below this (default=0)", 0},
+    {"clifford-prefix", 1014, 0, 0, "Simulate the Clifford gates at the start of the circuit with a stabilizer tableau, and only then switch to QMDDs", 0},
+    {"trajectories", 1015, "<n>", 0, "Sample <n> (noisy) trajectories of the circuit in parallel and output a histogram of the measurement results (default=1000 if a noise option is given)", 0},
+    {"depolarizing", 1016, "<p>", 0, "Depolarizing error probability on every qubit of every gate (trajectory or density matrix mode)", 0},
+    {"amplitude-damping", 1017, "<gamma>", 0, "Amplitude damping with rate gamma on every qubit of every gate (trajectory or density matrix mode)", 0},
+    {"readout-error", 1018, "<p>", 0, "Probability of flipping every measurement result (trajectory or density matrix mode)", 0},
+    {"memory-cap", 1019, "<MB>", 0, "Divide (and rebalance) the given amount of memory over the node table, cache and edge weight table, instead of using fixed table sizes. When the tables are full, the simulation tries to recover and otherwise stops with exit code 2", 0},
+    {"pages", 1020, "<default|small|thp|hugetlb>", 0, "Page size of the node table, cache and edge weight table (hugetlb falls back to thp if not enough huge pages are reserved)", 0},
+    {"numa", 1021, "<local|interleave>", 0, "Place the table pages on the node of the first worker touching them (default), or interleave them over all NUMA nodes", 0},
+    {"pin-workers", 1022, 0, 0, "Pin every worker to its own CPU", 0},
+    {"out-of-core", 1023, "<dir>", 0, "Back the node data and edge weight table by (deleted) files in the given directory, e.g. on a local SSD, so states larger than the memory can be simulated (slowly)", 0},
+    {"dense-blocks", 1024, "<k>", 0, "Apply gates on the bottom (at most <k>, max 16) levels of the state as dense arrays, wherever these levels are (nearly) complete binary trees", 0},
+    {"dense-density", 1025, "<fraction>", 0, "Minimum fraction of a complete binary tree for a level to be included in the dense blocks (default=0.9)", 0},
+    {"hsf-cut", 1026, "<c>", 0, "Hybrid Schrödinger-Feynman simulation: simulate qubits 0..c-1 and c..n-1 as separate QMDDs, and sum over all paths through the (controlled) gates across the cut", 0},
+    {"amplitude", 1027, "<bitstring>", 0, "Output the amplitude of the given basis state (q_{n-1}..q_0, can be given multiple times)", 0},
+    {"partition-qubits", 1028, "<k>", 0, "Split the state on the top k qubits (max 10) over 2^k local processes, which exchange parts of their states over Unix-domain sockets when a gate changes one of these qubits", 0},
+    {"density-matrix", 1029, 0, 0, "Simulate the density matrix of the (mixed) state, with the noise options applied as exact channels instead of sampled trajectories (a density matrix can have up to the square of the nodes of the state vector, so this is much slower)", 0},
     {0, 0, 0, 0, 0, 0}
 };
 
@@ -94,7 +156,7 @@ parse_opt(int key, char *arg, struct argp_state *state)
         max_tablesize = 1LL<<(atoi(arg));
         break;
     case 1001:
-        if (atoi(arg) > 30) argp_usage(state);
+        if (atoi(arg) > MAX_WGT_TAB_BITS) argp_usage(state);
         max_wgt_tab_size = 1LL<<(atoi(arg));
         break;
     case 1002:
@@ -106,12 +168,142 @@ parse_opt(int key, char *arg, struct argp_state *state)
     case 1004:
         wgt_inv_caching = false;
         break;
+    case 1005:
+        vector_outputfile = arg;
+        break;
+    case 1006:
+        amp_threshold = atof(arg);
+        break;
+    case 1007:
+        vector_ordered = true;
+        break;
+    case 1009:
+        interaction_order = true;
+        count_nodes = true;
+        break;
+    case 1008:
+        dynamic_reorder = atof(arg);
+        if (dynamic_reorder <= 1.0) argp_usage(state);
+        break;
+    case 1010:
+        approx_max_nodes = atoll(arg);
+        break;
+    case 1011:
+        approx_wgt_fill = atof(arg);
+        if (approx_wgt_fill <= 0 || approx_wgt_fill > 1) argp_usage(state);
+        break;
+    case 1012:
+        approx_round_fidelity = atof(arg);
+        if (approx_round_fidelity <= 0 || approx_round_fidelity > 1) argp_usage(state);
+        break;
+    case 1013:
+        fidelity_floor = atof(arg);
+        if (fidelity_floor < 0 || fidelity_floor > 1) argp_usage(state);
+        break;
+    case 1014:
+        clifford_prefix = true;
+        break;
+    case 1015:
+        trajectories = atoll(arg);
+        if (trajectories == 0) argp_usage(state);
+        break;
+    case 1016:
+        noise_depolarizing = atof(arg);
+        if (noise_depolarizing < 0 || noise_depolarizing > 1) argp_usage(state);
+        break;
+    case 1017:
+        noise_damping = atof(arg);
+        if (noise_damping < 0 || noise_damping > 1) argp_usage(state);
+        break;
+    case 1018:
+        noise_readout = atof(arg);
+        if (noise_readout < 0 || noise_readout > 1) argp_usage(state);
+        break;
+    case 1019:
+        memory_cap = (size_t)atoll(arg) << 20;
+        if (memory_cap == 0) argp_usage(state);
+        break;
+    case 1020:
+        if (strcmp(arg, "default")==0) table_pages = SYLVAN_PAGES_DEFAULT;
+        else if (strcmp(arg, "small")==0) table_pages = SYLVAN_PAGES_SMALL;
+        else if (strcmp(arg, "thp")==0) table_pages = SYLVAN_PAGES_THP;
+        else if (strcmp(arg, "hugetlb")==0) table_pages = SYLVAN_PAGES_HUGETLB;
+        else argp_usage(state);
+        placement_report = true;
+        break;
+    case 1021:
+        if (strcmp(arg, "local")==0) table_numa = SYLVAN_NUMA_FIRST_TOUCH;
+        else if (strcmp(arg, "interleave")==0) table_numa = SYLVAN_NUMA_INTERLEAVE;
+        else argp_usage(state);
+        placement_report = true;
+        break;
+    case 1022:
+        pin_workers = true;
+        placement_report = true;
+        break;
+    case 1023:
+        out_of_core_dir = arg;
+        placement_report = true;
+        break;
+    case 1024:
+        dense_block_levels = atoi(arg);
+        if (dense_block_levels < 2 || dense_block_levels > QMDD_DENSE_MAX_LEVELS) argp_usage(state);
+        break;
+    case 1025:
+        dense_block_density = atof(arg);
+        if (dense_block_density <= 0 || dense_block_density > 1) argp_usage(state);
+        break;
+    case 1026:
+        hsf_cut = atoi(arg);
+        if (hsf_cut < 1) argp_usage(state);
+        break;
+    case 1027:
+        amp_queries = realloc(amp_queries, sizeof(char*) * (n_amp_queries + 1));
+        amp_queries[n_amp_queries++] = arg;
+        break;
+    case 1028:
+        partition_qubits = atoi(arg);
+        if (partition_qubits < 1 || partition_qubits > 10) argp_usage(state);
+        break;
+    case 1029:
+        density_matrix = true;
+        break;
     case ARGP_KEY_ARG:
         if (state->arg_num >= 1) argp_usage(state);
         qasm_inputfile = arg;
         break;
     case ARGP_KEY_END:
         if (state->arg_num < 1) argp_usage(state);
+        if (density_matrix && (trajectories > 0 || hsf_cut > 0 || partition_qubits > 0 ||
+                               dynamic_reorder > 0 || interaction_order || approx_max_nodes > 0 ||
+                               approx_wgt_fill > 0 || clifford_prefix || memory_cap > 0 ||
+                               dense_block_levels > 0 || output_vector || vector_outputfile != NULL ||
+                               n_amp_queries > 0)) {
+            argp_error(state, "--density-matrix does not support trajectories, --hsf-cut, --partition-qubits, dynamic/interaction reordering, approximation, --clifford-prefix, --memory-cap, --dense-blocks, state vector output or --amplitude");
+        }
+        if (!density_matrix && trajectories == 0 && (noise_depolarizing > 0 || noise_damping > 0 || noise_readout > 0)) {
+            trajectories = 1000;
+        }
+        if (trajectories > 0 && (dynamic_reorder > 0 || interaction_order || approx_max_nodes > 0 ||
+                                 approx_wgt_fill > 0 || clifford_prefix || output_vector ||
+                                 vector_outputfile != NULL || dense_block_levels > 0)) {
+            argp_error(state, "trajectory mode does not support dynamic/interaction reordering, approximation, --clifford-prefix, --dense-blocks or state vector output");
+        }
+        if (trajectories > 0 && n_amp_queries > 0) {
+            argp_error(state, "trajectory mode does not support --amplitude");
+        }
+        if (hsf_cut > 0 && (trajectories > 0 || dynamic_reorder > 0 || interaction_order ||
+                            approx_max_nodes > 0 || approx_wgt_fill > 0 || clifford_prefix ||
+                            memory_cap > 0 || dense_block_levels > 0 || output_vector ||
+                            vector_outputfile != NULL)) {
+            argp_error(state, "--hsf-cut does not support trajectories, dynamic/interaction reordering, approximation, --clifford-prefix, --memory-cap, --dense-blocks or state vector output");
+        }
+        if (partition_qubits > 0 && (trajectories > 0 || hsf_cut > 0 || dynamic_reorder > 0 ||
+                                     interaction_order || approx_max_nodes > 0 || approx_wgt_fill > 0 ||
+                                     clifford_prefix || memory_cap > 0 || output_vector ||
+                                     vector_outputfile != NULL)) {
+            argp_error(state, "--partition-qubits does not support trajectories, --hsf-cut, dynamic/interaction reordering, approximation, --clifford-prefix, --memory-cap or state vector output");
+        }
         break;
     default:
         return ARGP_ERR_UNKNOWN;
@@ -127,29 +319,129 @@ static struct argp argp = { options, parse_opt, "<qasm_file>", 0, 0, 0, 0 };
 // and 'norm' will contain the node count and the norm of the state QMDD before
 // the measurements.
 typedef struct stats_s {
-    uint64_t applied_gates;
+    _Atomic uint64_t applied_gates; // (trajectories and HSF paths run in parallel)
     uint64_t final_nodes;
     uint64_t max_nodes;
     uint64_t shots;
     double simulation_time;
     double norm;
+    double purity;
+    uint64_t vector_entries;
+    double vector_time;
+    uint64_t sifts;
+    uint64_t level_swaps;
+    double reorder_time;
+    double predicted_peak_nodes;
+    double predicted_peak_nodes_circuit;
+    double fidelity_bound;
+    uint64_t approx_rounds;
+    uint64_t clifford_prefix_gates;
+    uint64_t dense_blocks;
+    uint64_t hsf_cross_gates;
+    uint64_t hsf_paths;
+    uint64_t hsf_rank;
+    uint64_t partition_exchanges;
+    uint64_t partition_bytes;
+    complex_t *amplitudes; // of the --amplitude queries, if computed beforehand
+    BDDVAR dense_level;
+    double clifford_prefix_time;
+    uint64_t noise_events;
+    size_t budget_nodes;
+    size_t budget_cache;
+    size_t budget_wgts;
+    uint64_t budget_rebalances;
+    uint64_t oom_recoveries;
+    int pinned_workers;
+    uint64_t major_faults;
+    uint64_t minor_faults;
+    double oom_fidelity;
+    bool out_of_memory;
+    BDDVAR *qubit_levels;
     QMDD final_state;
 } stats_t;
 stats_t stats;
 
 
+static complex_t query_amplitude(quantum_circuit_t *circuit, const char *bits);
+
+
+typedef struct dense_vector_s {
+    complex_t *amps;
+    BDDVAR nqubits;
+    bool reversed;
+} dense_vector_t;
+
+static void
+dense_vector_cb(uint64_t index, complex_t amp, void *context)
+{
+    // index has q_0 as LSB, the output vector is indexed as the original
+    // circuit qubits, which are in reversed order if the circuit was reordered
+    dense_vector_t *vec = (dense_vector_t *) context;
+    uint64_t k = index;
+    if (vec->reversed) {
+        k = 0;
+        for (BDDVAR q = 0; q < vec->nqubits; q++) k = (k << 1) | ((index >> q) & 1);
+    }
+    vec->amps[k] = amp;
+}
+
+/**
+ * Result of a single (noisy) trajectory in trajectory mode.
+ */
+typedef struct trajectory_s {
+    char *outcome;          // classical register as big-endian bit string
+    QMDD final_state;       // (only kept until the end of the batch)
+    uint64_t max_nodes;
+    uint64_t final_nodes;
+    uint64_t noise_events;
+    double norm;
+} trajectory_t;
+static trajectory_t *traj = NULL;
+
+static int
+cmp_outcome(const void *a, const void *b)
+{
+    return strcmp(((const trajectory_t*)a)->outcome, ((const trajectory_t*)b)->outcome);
+}
+
+/**
+ * Prints the number of occurrences of every outcome over all trajectories.
+ */
+static void
+fprint_histogram(FILE *stream)
+{
+    qsort(traj, trajectories, sizeof(trajectory_t), cmp_outcome);
+    for (uint64_t i = 0; i < trajectories; ) {
+        uint64_t j = i;
+        while (j < trajectories && strcmp(traj[i].outcome, traj[j].outcome) == 0) j++;
+        fprintf(stream, "    \"%s\": %" PRIu64 "%s\n", traj[i].outcome, j - i,
+                (j < trajectories) ? "," : "");
+        i = j;
+    }
+}
+
 void fprint_stats(FILE *stream, quantum_circuit_t* circuit)
 {
     fprintf(stream, "{\n");
     fprintf(stream, "  \"measurement_results\": {\n");
-    fprintf(stream, "    \""); fprint_creg(stream, circuit); fprintf(stream, "\": 1\n");
+    if (trajectories > 0) {
+        fprint_histogram(stream);
+    }
+    else {
+        fprintf(stream, "    \""); fprint_creg(stream, circuit); fprintf(stream, "\": 1\n");
+    }
     fprintf(stream, "  },\n");
     if (output_vector)
     {
+        // single DFS over the non-zero amplitudes instead of 2^n lookups
+        dense_vector_t vec;
+        vec.amps = calloc(1ULL<<(circuit->qreg_size), sizeof(complex_t));
+        vec.nqubits = circuit->qreg_size;
+        vec.reversed = circuit->reversed_qubit_order;
+        qmdd_foreach_amplitude(stats.final_state, circuit->qreg_size, 0.0, false, dense_vector_cb, &vec);
         fprintf(stream, "  \"state_vector\": [\n");
         for (int k = 0; k < (1<<(circuit->qreg_size)); k++) {
-            bool *x = int_to_bitarray(k, circuit->qreg_size, !(circuit->reversed_qubit_order));
-            complex_t c = qmdd_get_amplitude(stats.final_state, x, circuit->qreg_size);
+            complex_t c = vec.amps[k];
             fprintf(stream, "    [\n");
             fprintf(stream, "      %.16lf,\n", c.r);
             fprintf(stream, "      %.16lf\n", c.i);
@@ -157,28 +449,128 @@ void fprint_stats(FILE *stream, quantum_circuit_t* circuit)
                 fprintf(stream, "    ]\n");
             else
                 fprintf(stream, "    ],\n");
-            free(x);
         }
+        free(vec.amps);
         fprintf(stream, "  ],\n");
     }
+    if (n_amp_queries > 0) {
+        fprintf(stream, "  \"amplitudes\": {\n");
+        for (int k = 0; k < n_amp_queries; k++) {
+            complex_t c = (stats.amplitudes != NULL) ? stats.amplitudes[k] :
+                                                       query_amplitude(circuit, amp_queries[k]);
+            fprintf(stream, "    \"%s\": [%.16lf, %.16lf]%s\n", amp_queries[k], c.r, c.i,
+                    (k < n_amp_queries-1) ? "," : "");
+        }
+        fprintf(stream, "  },\n");
+    }
     fprintf(stream, "  \"statistics\": {\n");
+    if (approx_max_nodes > 0 || approx_wgt_fill > 0) {
+        fprintf(stream, "    \"approx_rounds\": %" PRIu64 ",\n", stats.approx_rounds);
+    }
     fprintf(stream, "    \"applied_gates\": %" PRIu64 ",\n", stats.applied_gates);
     fprintf(stream, "    \"benchmark\": \"%s\",\n", circuit->name);
+    if (clifford_prefix) {
+        fprintf(stream, "    \"clifford_prefix_gates\": %" PRIu64 ",\n", stats.clifford_prefix_gates);
+        fprintf(stream, "    \"clifford_prefix_time\": %lf,\n", stats.clifford_prefix_time);
+    }
+    if (dense_block_levels > 0) {
+        fprintf(stream, "    \"dense_block_levels\": %d,\n", dense_block_levels);
+        fprintf(stream, "    \"dense_blocks\": %" PRIu64 ",\n", stats.dense_blocks);
+        fprintf(stream, "    \"dense_level\": %d,\n", stats.dense_level);
+    }
+    if (density_matrix) {
+        fprintf(stream, "    \"density_matrix\": 1,\n");
+    }
+    if (approx_max_nodes > 0 || approx_wgt_fill > 0) {
+        fprintf(stream, "    \"fidelity_bound\": %.5e,\n", stats.fidelity_bound);
+    }
     fprintf(stream, "    \"final_nodes\": %" PRIu64 ",\n", stats.final_nodes);
+    if (hsf_cut > 0) {
+        fprintf(stream, "    \"hsf_cross_gates\": %" PRIu64 ",\n", stats.hsf_cross_gates);
+        fprintf(stream, "    \"hsf_cut\": %d,\n", hsf_cut);
+        fprintf(stream, "    \"hsf_paths\": %" PRIu64 ",\n", stats.hsf_paths);
+        fprintf(stream, "    \"hsf_rank\": %" PRIu64 ",\n", stats.hsf_rank);
+    }
     fprintf(stream, "    \"max_nodes\": %" PRIu64 ",\n", stats.max_nodes);
+    if (memory_cap > 0) {
+        fprintf(stream, "    \"memory_cap\": %zu,\n", memory_cap);
+        fprintf(stream, "    \"memory_cap_nodes\": %zu,\n", stats.budget_nodes);
+        fprintf(stream, "    \"memory_cap_cache\": %zu,\n", stats.budget_cache);
+        fprintf(stream, "    \"memory_cap_wgts\": %zu,\n", stats.budget_wgts);
+        fprintf(stream, "    \"memory_rebalances\": %" PRIu64 ",\n", stats.budget_rebalances);
+        fprintf(stream, "    \"oom_fidelity\": %.5e,\n", stats.oom_fidelity);
+        fprintf(stream, "    \"oom_recoveries\": %" PRIu64 ",\n", stats.oom_recoveries);
+        fprintf(stream, "    \"out_of_memory\": %d,\n", stats.out_of_memory);
+    }
     fprintf(stream, "    \"n_qubits\": %d,\n", circuit->qreg_size);
+    if (trajectories > 0 || density_matrix) {
+        fprintf(stream, "    \"noise_amplitude_damping\": %.5e,\n", noise_damping);
+        fprintf(stream, "    \"noise_depolarizing\": %.5e,\n", noise_depolarizing);
+        if (trajectories > 0) {
+            fprintf(stream, "    \"noise_events\": %" PRIu64 ",\n", stats.noise_events);
+        }
+        fprintf(stream, "    \"noise_readout\": %.5e,\n", noise_readout);
+    }
     fprintf(stream, "    \"norm\": %.5e,\n", stats.norm);
+    if (partition_qubits > 0) {
+        fprintf(stream, "    \"partition_bytes\": %" PRIu64 ",\n", stats.partition_bytes);
+        fprintf(stream, "    \"partition_exchanges\": %" PRIu64 ",\n", stats.partition_exchanges);
+        fprintf(stream, "    \"partition_qubits\": %d,\n", partition_qubits);
+    }
+    if (density_matrix) {
+        fprintf(stream, "    \"purity\": %.5e,\n", stats.purity);
+    }
     fprintf(stream, "    \"reorder\": %d,\n", reorder_qubits);
+    if (interaction_order) {
+        fprintf(stream, "    \"predicted_peak_nodes\": %.0lf,\n", stats.predicted_peak_nodes);
+        fprintf(stream, "    \"predicted_peak_nodes_circuit_order\": %.0lf,\n", stats.predicted_peak_nodes_circuit);
+    }
+    if (dynamic_reorder > 0) {
+        fprintf(stream, "    \"dynamic_reorder\": %lf,\n", dynamic_reorder);
+        fprintf(stream, "    \"sifts\": %" PRIu64 ",\n", stats.sifts);
+        fprintf(stream, "    \"level_swaps\": %" PRIu64 ",\n", stats.level_swaps);
+        fprintf(stream, "    \"reorder_time\": %lf,\n", stats.reorder_time);
+    }
     fprintf(stream, "    \"seed\": %d,\n", rseed);
     fprintf(stream, "    \"shots\": %" PRIu64 ",\n", stats.shots);
+    if (vector_outputfile != NULL) {
+        fprintf(stream, "    \"state_vector_entries\": %" PRIu64 ",\n", stats.vector_entries);
+        fprintf(stream, "    \"state_vector_time\": %lf,\n", stats.vector_time);
+    }
     fprintf(stream, "    \"simulation_time\": %lf,\n", stats.simulation_time);
+    if (placement_report) {
+        sylvan_table_pages_t pages[16];
+        int n = sylvan_table_pages(pages, 16);
+        fprintf(stream, "    \"table_pages\": {\n");
+        for (int k = 0; k < n; k++) {
+            fprintf(stream, "      \"%s\": {\"size\": %zu, \"page_size\": %zu, \"resident\": %zu, \"huge\": %zu, \"numa_nodes\": %d}%s\n",
+                    pages[k].name, pages[k].size, pages[k].page_size, pages[k].resident,
+                    pages[k].huge, pages[k].numa_nodes, k < n-1 ? "," : "");
+        }
+        fprintf(stream, "    },\n");
+        fprintf(stream, "    \"pinned_workers\": %d,\n", stats.pinned_workers);
+        if (out_of_core_dir != NULL) {
+            fprintf(stream, "    \"out_of_core\": \"%s\",\n", out_of_core_dir);
+        }
+        fprintf(stream, "    \"major_page_faults\": %" PRIu64 ",\n", stats.major_faults);
+        fprintf(stream, "    \"minor_page_faults\": %" PRIu64 ",\n", stats.minor_faults);
+        fprintf(stream, "    \"major_page_faults_per_sec\": %lf,\n",
+                stats.simulation_time > 0 ? stats.major_faults / stats.simulation_time : 0);
+    }
     fprintf(stream, "    \"tolerance\": %.5e,\n", tolerance);
+    if (trajectories > 0) {
+        fprintf(stream, "    \"trajectories\": %" PRIu64 ",\n", trajectories);
+    }
     fprintf(stream, "    \"wgt_inv_caching\": %d,\n", wgt_inv_caching);
     fprintf(stream, "    \"wgt_norm_strat\": %d,\n", wgt_norm_strat);
     fprintf(stream, "    \"min_node_tab_size\": %" PRId64 ",\n", min_tablesize);
     fprintf(stream, "    \"max_node_tab_size\": %" PRId64 ",\n", max_tablesize);
     fprintf(stream, "    \"min_wgt_tab_size\": %" PRId64 ",\n", min_wgt_tab_size);
     fprintf(stream, "    \"max_wgt_tab_size\": %" PRId64 ",\n", max_wgt_tab_size);
+    int edge_wgt_bits, edge_ptr_bits;
+    evbdd_get_edge_layout(&edge_wgt_bits, &edge_ptr_bits);
+    fprintf(stream, "    \"edge_wgt_bits\": %d,\n", edge_wgt_bits);
+    fprintf(stream, "    \"edge_ptr_bits\": %d,\n", edge_ptr_bits);
     fprintf(stream, "    \"workers\": %d\n", workers);
     fprintf(stream, "  }\n");
     fprintf(stream, "}\n");
@@ -192,6 +584,43 @@ wctime()
     return (tv.tv_sec + 1E-6 * tv.tv_usec);
 }
 
+/**
+ * The gates of apply_gate, on either a state vector or (with --density-matrix)
+ * a density matrix rho, as U rho U^dagger.
+ */
+static QMDD
+do_gate(QMDD state, gate_id_t gate, BDDVAR t)
+{
+    if (density_matrix) return qmdd_dm_gate(state, gate, t);
+    return qmdd_gate(state, gate, t);
+}
+
+static QMDD
+do_cgate3(QMDD state, gate_id_t gate, BDDVAR c1, BDDVAR c2, BDDVAR c3, BDDVAR t, BDDVAR nqubits)
+{
+    if (density_matrix) return _qmdd_dm_cgate(state, gate, c1, c2, c3, t);
+    return _qmdd_cgate(state, gate, c1, c2, c3, t, nqubits);
+}
+
+static QMDD
+do_cgate2(QMDD state, gate_id_t gate, BDDVAR c1, BDDVAR c2, BDDVAR t, BDDVAR nqubits)
+{
+    return do_cgate3(state, gate, c1, c2, EVBDD_INVALID_VAR, t, nqubits);
+}
+
+static QMDD
+do_cgate(QMDD state, gate_id_t gate, BDDVAR c, BDDVAR t, BDDVAR nqubits)
+{
+    return do_cgate3(state, gate, c, EVBDD_INVALID_VAR, EVBDD_INVALID_VAR, t, nqubits);
+}
+
+static QMDD
+do_swap(QMDD state, BDDVAR a, BDDVAR b)
+{
+    if (density_matrix) return qmdd_dm_swap(state, a, b);
+    return qmdd_circuit_swap(state, a, b);
+}
+
 /**
  * Here we match the name of a gate in QASM to
  * the GATEID 
@@ -207,140 +636,140 @@ QMDD apply_gate(QMDD state, quantum_op_t* gate, BDDVAR nqubits)
         return state;
     }
     else if (strcmp(gate->name, "x") == 0) {
-        return qmdd_gate(state, GATEID_X, gate->targets[0]);
+        return do_gate(state, GATEID_X, gate->targets[0]);
     }
     else if (strcmp(gate->name, "y") == 0) {
-        return qmdd_gate(state, GATEID_Y, gate->targets[0]);
+        return do_gate(state, GATEID_Y, gate->targets[0]);
     }
     else if (strcmp(gate->name, "z") == 0) {
-        return qmdd_gate(state, GATEID_Z, gate->targets[0]);
+        return do_gate(state, GATEID_Z, gate->targets[0]);
     }
     else if (strcmp(gate->name, "h") == 0) {
-        return qmdd_gate(state, GATEID_H, gate->targets[0]);
+        return do_gate(state, GATEID_H, gate->targets[0]);
     }
     else if (strcmp(gate->name, "s") == 0) {
-        return qmdd_gate(state, GATEID_S, gate->targets[0]);
+        return do_gate(state, GATEID_S, gate->targets[0]);
     }
     else if (strcmp(gate->name, "sdg") == 0) {
-        return qmdd_gate(state, GATEID_Sdag, gate->targets[0]);
+        return do_gate(state, GATEID_Sdag, gate->targets[0]);
     }
     else if (strcmp(gate->name, "t") == 0) {
-        return qmdd_gate(state, GATEID_T, gate->targets[0]);
+        return do_gate(state, GATEID_T, gate->targets[0]);
     }
     else if (strcmp(gate->name, "tdg") == 0) {
-        return qmdd_gate(state, GATEID_Tdag, gate->targets[0]);
+        return do_gate(state, GATEID_Tdag, gate->targets[0]);
     }
     else if (strcmp(gate->name, "sx") == 0) {
-        return qmdd_gate(state, GATEID_sqrtX, gate->targets[0]);
+        return do_gate(state, GATEID_sqrtX, gate->targets[0]);
     }
     else if (strcmp(gate->name, "sxdg") == 0) {
-        return qmdd_gate(state, GATEID_sqrtXdag, gate->targets[0]);
+        return do_gate(state, GATEID_sqrtXdag, gate->targets[0]);
     }
     else if (strcmp(gate->name, "rx") == 0) {
-        return qmdd_gate(state, GATEID_Rx(gate->angle[0]), gate->targets[0]);
+        return do_gate(state, GATEID_Rx(gate->angle[0]), gate->targets[0]);
     }
     else if (strcmp(gate->name, "ry") == 0) {
-        return qmdd_gate(state, GATEID_Ry(gate->angle[0]), gate->targets[0]);
+        return do_gate(state, GATEID_Ry(gate->angle[0]), gate->targets[0]);
     }
     else if (strcmp(gate->name, "rz") == 0) {
-        return qmdd_gate(state, GATEID_Rz(gate->angle[0]), gate->targets[0]);
+        return do_gate(state, GATEID_Rz(gate->angle[0]), gate->targets[0]);
     }
     else if (strcmp(gate->name, "p") == 0) {
-        return qmdd_gate(state, GATEID_Phase(gate->angle[0]), gate->targets[0]);
+        return do_gate(state, GATEID_Phase(gate->angle[0]), gate->targets[0]);
     }
     else if (strcmp(gate->name, "u2") == 0) {
         fl_t pi_over_2 = flt_acos(0.0);
-        return qmdd_gate(state, GATEID_U(pi_over_2, gate->angle[0], gate->angle[1]), gate->targets[0]);
+        return do_gate(state, GATEID_U(pi_over_2, gate->angle[0], gate->angle[1]), gate->targets[0]);
     }
     else if (strcmp(gate->name, "u") == 0) {
-        return qmdd_gate(state, GATEID_U(gate->angle[0], gate->angle[1], gate->angle[2]), gate->targets[0]);
+        return do_gate(state, GATEID_U(gate->angle[0], gate->angle[1], gate->angle[2]), gate->targets[0]);
     }
     else if (strcmp(gate->name, "cx") == 0) {
-        return qmdd_cgate(state, GATEID_X, gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_X, gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "cy") == 0) {
-        return qmdd_cgate(state, GATEID_Y, gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_Y, gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "cz") == 0) {
-        return qmdd_cgate(state, GATEID_Z, gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_Z, gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "ch") == 0) {
-        return qmdd_cgate(state, GATEID_H, gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_H, gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "csx") == 0) {
-        return qmdd_cgate(state, GATEID_sqrtX, gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_sqrtX, gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "crx") == 0) {
-        return qmdd_cgate(state, GATEID_Rx(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_Rx(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "cry") == 0) {
-        return qmdd_cgate(state, GATEID_Ry(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_Ry(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "crz") == 0) {
-        return qmdd_cgate(state, GATEID_Rz(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_Rz(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "cp") == 0) {
-        return qmdd_cgate(state, GATEID_Phase(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_Phase(gate->angle[0]), gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "cu") == 0) {
-        return qmdd_cgate(state, GATEID_U(gate->angle[0], gate->angle[1], gate->angle[2]), gate->ctrls[0], gate->targets[0], nqubits);
+        return do_cgate(state, GATEID_U(gate->angle[0], gate->angle[1], gate->angle[2]), gate->ctrls[0], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "ccx") == 0) {
-        return qmdd_cgate2(state, GATEID_X, gate->ctrls[0], gate->ctrls[1], gate->targets[0], nqubits);
+        return do_cgate2(state, GATEID_X, gate->ctrls[0], gate->ctrls[1], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "c3x") == 0) {
-        return qmdd_cgate3(state, GATEID_X, gate->ctrls[0], gate->ctrls[1], gate->ctrls[2], gate->targets[0], nqubits);
+        return do_cgate3(state, GATEID_X, gate->ctrls[0], gate->ctrls[1], gate->ctrls[2], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "c3sx") == 0) {
-        return qmdd_cgate3(state, GATEID_sqrtX, gate->ctrls[0], gate->ctrls[1], gate->ctrls[2], gate->targets[0], nqubits);
+        return do_cgate3(state, GATEID_sqrtX, gate->ctrls[0], gate->ctrls[1], gate->ctrls[2], gate->targets[0], nqubits);
     }
     else if (strcmp(gate->name, "swap") == 0) {
         // no native SWAP gates in Q-Sylvan
         stats.applied_gates += 4;
-        return qmdd_circuit_swap(state, gate->targets[0], gate->targets[1]);
+        return do_swap(state, gate->targets[0], gate->targets[1]);
     }
     else if (strcmp(gate->name, "cswap") == 0) {
         // no native CSWAP gates in Q-Sylvan
         stats.applied_gates += 4;
         // CCNOT
-        state = qmdd_cgate2(state, GATEID_X, gate->ctrls[0], gate->targets[0], gate->targets[1], nqubits);
+        state = do_cgate2(state, GATEID_X, gate->ctrls[0], gate->targets[0], gate->targets[1], nqubits);
         // upside down CCNOT (equivalent)
-        state = qmdd_cgate(state, GATEID_H, gate->ctrls[0], gate->targets[0], nqubits);
-        state = qmdd_cgate2(state, GATEID_Z, gate->ctrls[0], gate->targets[0], gate->targets[1], nqubits);
-        state = qmdd_cgate(state, GATEID_H, gate->ctrls[0], gate->targets[0], nqubits);
+        state = do_cgate(state, GATEID_H, gate->ctrls[0], gate->targets[0], nqubits);
+        state = do_cgate2(state, GATEID_Z, gate->ctrls[0], gate->targets[0], gate->targets[1], nqubits);
+        state = do_cgate(state, GATEID_H, gate->ctrls[0], gate->targets[0], nqubits);
         // CCNOT
-        state = qmdd_cgate2(state, GATEID_X, gate->ctrls[0], gate->targets[0], gate->targets[1], nqubits);
+        state = do_cgate2(state, GATEID_X, gate->ctrls[0], gate->targets[0], gate->targets[1], nqubits);
 
         return state;
     }
     else if (strcmp(gate->name, "rccx") == 0) {
         // no native RCCX (simplified Toffoli) gates in Q-Sylvan
         stats.applied_gates += 3;
-        state = qmdd_cgate2(state, GATEID_X, gate->ctrls[0], gate->ctrls[1], gate->targets[0], nqubits);
-        state = qmdd_gate(state, GATEID_X, gate->ctrls[1]);
-        state = qmdd_cgate2(state, GATEID_Z, gate->ctrls[0], gate->ctrls[1], gate->targets[0], nqubits);
-        state = qmdd_gate(state, GATEID_X, gate->ctrls[1]);
+        state = do_cgate2(state, GATEID_X, gate->ctrls[0], gate->ctrls[1], gate->targets[0], nqubits);
+        state = do_gate(state, GATEID_X, gate->ctrls[1]);
+        state = do_cgate2(state, GATEID_Z, gate->ctrls[0], gate->ctrls[1], gate->targets[0], nqubits);
+        state = do_gate(state, GATEID_X, gate->ctrls[1]);
         return state;
     }
     else if (strcmp(gate->name, "rzz") == 0 ) {
         // no native RZZ gates in Q-Sylvan
         stats.applied_gates += 2;
-        state = qmdd_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
-        state = qmdd_gate(state, GATEID_Phase(gate->angle[0]), gate->targets[1]);
-        state = qmdd_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
+        state = do_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
+        state = do_gate(state, GATEID_Phase(gate->angle[0]), gate->targets[1]);
+        state = do_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
         return state;
     }
     else if (strcmp(gate->name, "rxx") == 0) {
         // no native RXX gates in Q-Sylvan
         fl_t pi = flt_acos(0.0) * 2;
         stats.applied_gates += 6;
-        state = qmdd_gate(state, GATEID_U(pi/2.0, gate->angle[0], 0), gate->targets[0]);
-        state = qmdd_gate(state, GATEID_H, gate->targets[1]);
-        state = qmdd_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
-        state = qmdd_gate(state, GATEID_Phase(-(gate->angle[0])), gate->targets[1]);
-        state = qmdd_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
-        state = qmdd_gate(state, GATEID_H, gate->targets[1]);
-        state = qmdd_gate(state, GATEID_U(pi/2.0, -pi, pi - gate->angle[0]), gate->targets[0]);
+        state = do_gate(state, GATEID_U(pi/2.0, gate->angle[0], 0), gate->targets[0]);
+        state = do_gate(state, GATEID_H, gate->targets[1]);
+        state = do_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
+        state = do_gate(state, GATEID_Phase(-(gate->angle[0])), gate->targets[1]);
+        state = do_cgate(state, GATEID_X, gate->targets[0], gate->targets[1], nqubits);
+        state = do_gate(state, GATEID_H, gate->targets[1]);
+        state = do_gate(state, GATEID_U(pi/2.0, -pi, pi - gate->angle[0]), gate->targets[0]);
         return state;
     }
     else {
@@ -350,30 +779,210 @@ QMDD apply_gate(QMDD state, quantum_op_t* gate, BDDVAR nqubits)
 }
 
 
-QMDD measure(QMDD state, quantum_op_t *meas, quantum_circuit_t* circuit)
+/**
+ * Applies the gate to the stabilizer tableau if it is a Clifford gate, and 
+ * returns false otherwise. Qubit q is mapped to levels[q] (if not NULL).
+ */
+bool apply_gate_stabilizer(stabilizer_t *stab, quantum_op_t* gate, const BDDVAR *levels)
+{
+    BDDVAR t = gate->targets[0], c = gate->ctrls[0];
+    if (levels != NULL) {
+        t = levels[t];
+        if (gate->ctrls[0] != -1) c = levels[c];
+    }
+
+    if (strcmp(gate->name, "id") == 0) {
+        return true;
+    }
+    else if (strcmp(gate->name, "x") == 0) {
+        return stabilizer_gate(stab, GATEID_X, t);
+    }
+    else if (strcmp(gate->name, "y") == 0) {
+        return stabilizer_gate(stab, GATEID_Y, t);
+    }
+    else if (strcmp(gate->name, "z") == 0) {
+        return stabilizer_gate(stab, GATEID_Z, t);
+    }
+    else if (strcmp(gate->name, "h") == 0) {
+        return stabilizer_gate(stab, GATEID_H, t);
+    }
+    else if (strcmp(gate->name, "s") == 0) {
+        return stabilizer_gate(stab, GATEID_S, t);
+    }
+    else if (strcmp(gate->name, "sdg") == 0) {
+        return stabilizer_gate(stab, GATEID_Sdag, t);
+    }
+    else if (strcmp(gate->name, "sx") == 0) {
+        return stabilizer_gate(stab, GATEID_sqrtX, t);
+    }
+    else if (strcmp(gate->name, "sxdg") == 0) {
+        return stabilizer_gate(stab, GATEID_sqrtXdag, t);
+    }
+    else if (strcmp(gate->name, "cx") == 0) {
+        return stabilizer_cgate(stab, GATEID_X, c, t);
+    }
+    else if (strcmp(gate->name, "cy") == 0) {
+        return stabilizer_cgate(stab, GATEID_Y, c, t);
+    }
+    else if (strcmp(gate->name, "cz") == 0) {
+        return stabilizer_cgate(stab, GATEID_Z, c, t);
+    }
+    else if (strcmp(gate->name, "swap") == 0) {
+        BDDVAR t2 = (levels != NULL) ? levels[gate->targets[1]] : (BDDVAR) gate->targets[1];
+        stabilizer_cgate(stab, GATEID_X, t, t2);
+        stabilizer_cgate(stab, GATEID_X, t2, t);
+        stabilizer_cgate(stab, GATEID_X, t, t2);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+
+QMDD measure_with(QMDD state, quantum_op_t *meas, quantum_circuit_t* circuit, double rnd)
 {
     double p;
     int m;
     printf("measure qubit %d, store result in creg[%d]\n", meas->targets[0], meas->meas_dest);
-    qmdd_measure_qubit(state, meas->targets[0], circuit->qreg_size, &m, &p);
+    qmdd_measure_qubit_with(state, meas->targets[0], circuit->qreg_size, rnd, &m, &p);
     circuit->creg[meas->meas_dest] = m;
     return state;
 }
 
 
+QMDD measure(QMDD state, quantum_op_t *meas, quantum_circuit_t* circuit)
+{
+    float rnd = ((float)rand())/((float)RAND_MAX);
+    return measure_with(state, meas, circuit, rnd);
+}
+
+
+/**
+ * Applies the gate to *state, recovering from full tables (--memory-cap): 
+ * the tables are cleaned up (which may also rebalance the memory budget) and
+ * the gate is applied again. If that fails as well, and approximation is 
+ * enabled, the state is approximated (in rounds, as long as the fidelity 
+ * floor allows) before every next attempt. *state should be protected.
+ * 
+ * @return false if the gate could not be applied.
+ */
+static bool
+apply_gate_recover(QMDD *state, quantum_op_t* gate, BDDVAR nqubits)
+{
+    uint64_t applied_gates = stats.applied_gates;
+    QMDD res = apply_gate(*state, gate, nqubits);
+    for (int attempt = 0; evbdd_out_of_memory(); attempt++) {
+        evbdd_clear_out_of_memory();
+        evbdd_gc_wgt_table();
+        sylvan_gc();
+        if (attempt > 0) {
+            if (approx_max_nodes == 0 && approx_wgt_fill == 0) return false;
+            double fid;
+            QMDD approx = qmdd_approximate(*state, nqubits, 1.0 - approx_round_fidelity, &fid);
+            if (evbdd_out_of_memory() || fid == 1.0 || stats.oom_fidelity * fid < fidelity_floor) {
+                evbdd_clear_out_of_memory();
+                return false;
+            }
+            *state = approx;
+            stats.oom_fidelity *= fid;
+        }
+        stats.oom_recoveries++;
+        stats.applied_gates = applied_gates;
+        res = apply_gate(*state, gate, nqubits);
+    }
+    *state = res;
+    return true;
+}
+
+
+/**
+ * As apply_gate_recover, for an intermediate measurement: the tables are 
+ * cleaned up and the measurement is done again (once), with the same coin 
+ * flip, so a seed gives the same outcomes with and without --memory-cap. 
+ * *state should be protected.
+ * 
+ * @return false if the measurement could not be done.
+ */
+static bool
+measure_recover(QMDD *state, quantum_op_t *meas, quantum_circuit_t* circuit)
+{
+    float rnd = ((float)rand())/((float)RAND_MAX);
+    QMDD res = measure_with(*state, meas, circuit, rnd);
+    for (int attempt = 0; evbdd_out_of_memory(); attempt++) {
+        evbdd_clear_out_of_memory();
+        evbdd_gc_wgt_table();
+        sylvan_gc();
+        if (attempt > 0) return false;
+        stats.oom_recoveries++;
+        res = measure_with(*state, meas, circuit, rnd);
+    }
+    *state = res;
+    return true;
+}
+
+
 void simulate_circuit(quantum_circuit_t* circuit)
 {
     double t_start = wctime();
-    QMDD state = qmdd_create_all_zero_state(circuit->qreg_size);
+    QMDD state;
     quantum_op_t *op = circuit->operations;
+    if (clifford_prefix) {
+        // the tableau directly uses the levels of the (static) qubit order
+        stabilizer_t *stab = stabilizer_create(circuit->qreg_size);
+        BDDVAR *levels = interaction_order ? stats.qubit_levels : NULL;
+        while (op != NULL) {
+            if (op->type == op_gate) {
+                if (!apply_gate_stabilizer(stab, op, levels)) break;
+                stats.clifford_prefix_gates++;
+            }
+            else if (op->type != op_blank) {
+                break;
+            }
+            op = op->next;
+        }
+        state = qmdd_from_stabilizer(stab);
+        stabilizer_free(stab);
+        stats.clifford_prefix_time = wctime() - t_start;
+        if (count_nodes) stats.max_nodes = evbdd_countnodes(state);
+    }
+    else {
+        state = qmdd_create_all_zero_state(circuit->qreg_size);
+    }
+    if (dynamic_reorder > 0 || interaction_order) {
+        qmdd_set_auto_reorder(circuit->qreg_size, dynamic_reorder);
+        if (interaction_order) qmdd_set_qubit_levels(stats.qubit_levels);
+    }
+    if (approx_max_nodes > 0 || approx_wgt_fill > 0) {
+        qmdd_set_approximation(circuit->qreg_size, approx_max_nodes, approx_wgt_fill, 
+                               approx_round_fidelity, fidelity_floor);
+    }
+    if (dense_block_levels > 0) {
+        qmdd_set_dense_blocks(circuit->qreg_size, dense_block_levels, dense_block_density);
+    }
+    evbdd_protect(&state);
     while (op != NULL) {
         if (op->type == op_gate) {
-            state = apply_gate(state, op, circuit->qreg_size);
-
+            if (memory_cap == 0) {
+                state = apply_gate(state, op, circuit->qreg_size);
+            }
+            else if (!apply_gate_recover(&state, op, circuit->qreg_size)) {
+                // stop, and output the stats of the state before this gate
+                fprintf(stderr, "Out of memory at gate %" PRIu64 ", stopping\n", stats.applied_gates);
+                stats.out_of_memory = true;
+                break;
+            }
         }
         else if (op->type == op_measurement) {
             if (circuit->has_intermediate_measurements) {
-                state = measure(state, op, circuit);
+                if (memory_cap == 0) {
+                    state = measure(state, op, circuit);
+                }
+                else if (!measure_recover(&state, op, circuit)) {
+                    fprintf(stderr, "Out of memory at measurement of qubit %d, stopping\n", op->targets[0]);
+                    stats.out_of_memory = true;
+                    break;
+                }
             }
             else {
                 double p;
@@ -391,46 +1000,1059 @@ void simulate_circuit(quantum_circuit_t* circuit)
         }
         op = op->next;
     }
+    evbdd_unprotect(&state);
+    stats.final_nodes = evbdd_countnodes(state);
+    if (dynamic_reorder > 0 || interaction_order) {
+        // output (state vector, norm, ..) is in the original qubit order
+        state = qmdd_restore_qubit_order(state);
+        qmdd_get_reorder_stats(&stats.sifts, &stats.level_swaps, &stats.reorder_time);
+        qmdd_set_auto_reorder(0, 0);
+    }
+    if (approx_max_nodes > 0 || approx_wgt_fill > 0) {
+        qmdd_get_approximation_stats(&stats.fidelity_bound, &stats.approx_rounds);
+        qmdd_set_approximation(0, 0, 0, 1.0, 1.0);
+    }
+    if (dense_block_levels > 0) {
+        qmdd_get_dense_block_stats(&stats.dense_level, &stats.dense_blocks);
+        qmdd_set_dense_blocks(0, 0, 1.0);
+    }
     stats.simulation_time = wctime() - t_start;
     stats.final_state = state;
     stats.shots = 1;
-    stats.final_nodes = evbdd_countnodes(state);
     stats.norm = qmdd_get_norm(state, circuit->qreg_size);
 }
 
 
+/**
+ * Small random number generator (splitmix64) with a separate state for every
+ * trajectory. rand() is not thread-safe, and a generator per trajectory 
+ * (instead of per worker) keeps the results independent of the scheduling.
+ */
+static uint64_t
+rng_next(uint64_t *s)
+{
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double
+rng_uniform(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * 0x1.0p-53;
+}
+
+// BDDs for q_k = 0 and q_k = 1, used to project with qmdd_apply_diagonal
+static MTBDD *qubit_is_0 = NULL;
+static MTBDD *qubit_is_1 = NULL;
+
+static void
+init_qubit_projectors(BDDVAR nqubits)
+{
+    qubit_is_0 = malloc(sizeof(MTBDD) * nqubits);
+    qubit_is_1 = malloc(sizeof(MTBDD) * nqubits);
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        qubit_is_0[k] = sylvan_nithvar(k);
+        mtbdd_protect(&qubit_is_0[k]);
+        qubit_is_1[k] = sylvan_ithvar(k);
+        mtbdd_protect(&qubit_is_1[k]);
+    }
+}
+
+static void
+free_qubit_projectors(BDDVAR nqubits)
+{
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        mtbdd_unprotect(&qubit_is_0[k]);
+        mtbdd_unprotect(&qubit_is_1[k]);
+    }
+    free(qubit_is_0);
+    free(qubit_is_1);
+}
+
+/**
+ * Probability of measuring q_k = 1, i.e. || (|1><1|)_k |psi> ||^2.
+ */
+static double
+prob_qubit_one(QMDD state, BDDVAR k, BDDVAR nqubits)
+{
+    QMDD one = evbdd_refs_push(qmdd_apply_diagonal(state, qubit_is_0[k], EVBDD_ZERO));
+    double p1 = qmdd_get_norm(one, nqubits);
+    evbdd_refs_pop(1);
+    return p1;
+}
+
+/**
+ * Projects q_k of *state onto |m>, where p is the probability of outcome m.
+ */
+static void
+project_qubit(QMDD *state, BDDVAR k, int m, double p)
+{
+    *state = qmdd_apply_diagonal(*state, (m == 0) ? qubit_is_1[k] : qubit_is_0[k], EVBDD_ZERO);
+    AMP root = wgt_div(EVBDD_WEIGHT(*state), qmdd_amp_from_prob(p));
+    *state = evbdd_bundle(EVBDD_TARGET(*state), root);
+}
+
+/**
+ * Measures q_k of *state (in place), with the randomness taken from rng.
+ */
+static int
+measure_trajectory(QMDD *state, BDDVAR k, BDDVAR nqubits, uint64_t *rng)
+{
+    double p1 = prob_qubit_one(*state, k, nqubits);
+    int m = (rng_uniform(rng) < p1) ? 1 : 0;
+    project_qubit(state, k, m, (m == 1) ? p1 : 1.0 - p1);
+    return m;
+}
+
+/**
+ * Applies the noise channels to qubit k of *state (in place), by sampling
+ * one of the Kraus operators K_i of every channel with probability 
+ * ||K_i |psi>||^2. Returns the number of non-identity operators applied.
+ */
+static uint64_t
+apply_noise(QMDD *state, BDDVAR k, BDDVAR nqubits, uint64_t *rng)
+{
+    uint64_t events = 0;
+    if (noise_depolarizing > 0) {
+        // K_0 = sqrt(1-p) I, K_1,2,3 = sqrt(p/3) X,Y,Z
+        double r = rng_uniform(rng);
+        if (r < noise_depolarizing) {
+            gate_id_t pauli = GATEID_Z;
+            if (r < noise_depolarizing/3.0) pauli = GATEID_X;
+            else if (r < 2.0*noise_depolarizing/3.0) pauli = GATEID_Y;
+            *state = qmdd_gate(*state, pauli, k);
+            events++;
+        }
+    }
+    if (noise_damping > 0) {
+        // K_0 = |0><0| + sqrt(1-gamma) |1><1|, K_1 = sqrt(gamma) |0><1|
+        double p1 = prob_qubit_one(*state, k, nqubits);
+        double p_jump = noise_damping * p1;
+        if (rng_uniform(rng) < p_jump) {
+            project_qubit(state, k, 1, p1);
+            *state = qmdd_gate(*state, GATEID_X, k);
+            events++;
+        }
+        else if (p1 > 0) {
+            *state = qmdd_apply_diagonal(*state, qubit_is_1[k], qmdd_amp_from_prob(1.0 - noise_damping));
+            AMP root = wgt_div(EVBDD_WEIGHT(*state), qmdd_amp_from_prob(1.0 - p_jump));
+            *state = evbdd_bundle(EVBDD_TARGET(*state), root);
+        }
+    }
+    return events;
+}
+
+/**
+ * Simulates trajectory i: the noise channels are applied to the qubits of 
+ * every gate after the gate, and every measurement is sampled (and possibly 
+ * flipped by the readout error).
+ */
+static void
+simulate_trajectory(quantum_circuit_t *circuit, uint64_t i)
+{
+    trajectory_t *t = &traj[i];
+    BDDVAR nqubits = circuit->qreg_size;
+    bool *creg = calloc(circuit->creg_size, sizeof(bool));
+    uint64_t seed = ((uint64_t)rseed << 32) ^ i;
+    uint64_t rng = rng_next(&seed);
+
+    QMDD state = qmdd_create_all_zero_state(nqubits);
+    evbdd_protect(&state);
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type == op_gate) {
+            state = apply_gate(state, op, nqubits);
+            int qubits[5] = {op->targets[0], op->targets[1], op->ctrls[0], op->ctrls[1], op->ctrls[2]};
+            for (int j = 0; j < 5; j++) {
+                if (qubits[j] != -1) t->noise_events += apply_noise(&state, qubits[j], nqubits, &rng);
+            }
+        }
+        else if (op->type == op_measurement) {
+            int m = measure_trajectory(&state, op->targets[0], nqubits, &rng);
+            if (noise_readout > 0 && rng_uniform(&rng) < noise_readout) {
+                m = !m;
+                t->noise_events++;
+            }
+            creg[op->meas_dest] = m;
+        }
+        if (count_nodes) {
+            // (marks nodes, only done when trajectories run one at a time)
+            uint64_t count = evbdd_countnodes(state);
+            if (count > t->max_nodes) t->max_nodes = count;
+        }
+    }
+    t->norm = qmdd_get_norm(state, nqubits);
+    t->final_state = state;
+    evbdd_protect(&t->final_state);
+    evbdd_unprotect(&state);
+
+    t->outcome = malloc(circuit->creg_size + 1);
+    for (int k = 0; k < circuit->creg_size; k++) {
+        t->outcome[k] = creg[circuit->creg_size-1-k] ? '1' : '0';
+    }
+    t->outcome[circuit->creg_size] = '\0';
+    free(creg);
+}
+
+/**
+ * Task tree over the trajectories [from, to).
+ */
+VOID_TASK_3(simulate_trajectory_range, quantum_circuit_t*, circuit, uint64_t, from, uint64_t, to)
+{
+    if (to - from == 1) {
+        simulate_trajectory(circuit, from);
+        return;
+    }
+    uint64_t mid = from + (to - from) / 2;
+    SPAWN(simulate_trajectory_range, circuit, mid, to);
+    CALL(simulate_trajectory_range, circuit, from, mid);
+    SYNC(simulate_trajectory_range);
+}
+
+/**
+ * Whether the circuit has parameterized gates. These (re)use GATEID_dynamic
+ * and can therefore not be applied in concurrent trajectories.
+ */
+static bool
+has_dynamic_gates(quantum_circuit_t *circuit)
+{
+    static const char *names[] = {"rx", "ry", "rz", "p", "u2", "u", "crx", "cry",
+                                  "crz", "cp", "cu", "rzz", "rxx"};
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type != op_gate) continue;
+        for (size_t k = 0; k < sizeof(names)/sizeof(names[0]); k++) {
+            if (strcmp(op->name, names[k]) == 0) return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Monte-Carlo simulation of the noisy circuit: samples 'trajectories' pure 
+ * state trajectories, in batches of concurrent tasks which share the node 
+ * and edge weight tables (so common parts of the trajectories are shared).
+ */
+void simulate_trajectories(quantum_circuit_t* circuit)
+{
+    double t_start = wctime();
+    BDDVAR nqubits = circuit->qreg_size;
+    traj = calloc(trajectories, sizeof(trajectory_t));
+    init_qubit_projectors(nqubits);
+
+    uint64_t batch = 1;
+    if (lace_workers() > 1 && !count_nodes && !has_dynamic_gates(circuit)) {
+        // the edge weight table can only be cleaned up between batches
+        evbdd_set_auto_gc_wgt_table(false);
+        batch = lace_workers();
+    }
+    for (uint64_t from = 0; from < trajectories; from += batch) {
+        uint64_t to = (from + batch < trajectories) ? from + batch : trajectories;
+        RUN(simulate_trajectory_range, circuit, from, to);
+        if (evbdd_out_of_memory()) {
+            // clean up the tables and simulate the batch once more
+            evbdd_clear_out_of_memory();
+            for (uint64_t i = from; i < to; i++) {
+                evbdd_unprotect(&traj[i].final_state);
+                free(traj[i].outcome);
+                memset(&traj[i], 0, sizeof(trajectory_t));
+            }
+            evbdd_gc_wgt_table();
+            sylvan_gc();
+            stats.oom_recoveries++;
+            RUN(simulate_trajectory_range, circuit, from, to);
+            if (evbdd_out_of_memory()) {
+                fprintf(stderr, "Out of memory at trajectory %" PRIu64 ", stopping\n", from);
+                stats.out_of_memory = true;
+                for (uint64_t i = from; i < to; i++) {
+                    evbdd_unprotect(&traj[i].final_state);
+                    free(traj[i].outcome);
+                }
+                trajectories = from;
+                break;
+            }
+        }
+        for (uint64_t i = from; i < to; i++) {
+            traj[i].final_nodes = evbdd_countnodes(traj[i].final_state);
+            evbdd_unprotect(&traj[i].final_state);
+            if (traj[i].final_nodes > stats.final_nodes) stats.final_nodes = traj[i].final_nodes;
+            if (traj[i].max_nodes > stats.max_nodes) stats.max_nodes = traj[i].max_nodes;
+            stats.noise_events += traj[i].noise_events;
+            stats.norm += traj[i].norm / trajectories;
+        }
+        if (batch > 1 && evbdd_test_gc_wgt_table()) {
+            evbdd_gc_wgt_table();
+        }
+    }
+    evbdd_set_auto_gc_wgt_table(true);
+
+    free_qubit_projectors(nqubits);
+    stats.simulation_time = wctime() - t_start;
+    stats.shots = trajectories;
+}
+
+
+static bool
+readout_error()
+{
+    return noise_readout > 0 && ((double)rand())/((double)RAND_MAX) < noise_readout;
+}
+
+/**
+ * Simulates the density matrix of the circuit. The noise channels are applied
+ * (exactly) to the qubits of every gate after the gate, as in trajectory mode,
+ * and the measurements are sampled from the resulting mixed state (and
+ * possibly flipped by the readout error).
+ */
+void simulate_density_matrix(quantum_circuit_t* circuit)
+{
+    double t_start = wctime();
+    BDDVAR nqubits = circuit->qreg_size;
+    QMDD rho = qmdd_dm_from_state(qmdd_create_all_zero_state(nqubits));
+    evbdd_protect(&rho);
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type == op_gate) {
+            rho = apply_gate(rho, op, nqubits);
+            int qubits[5] = {op->targets[0], op->targets[1], op->ctrls[0], op->ctrls[1], op->ctrls[2]};
+            for (int j = 0; j < 5; j++) {
+                if (qubits[j] == -1) continue;
+                if (noise_depolarizing > 0) rho = qmdd_dm_depolarize(rho, noise_depolarizing, qubits[j]);
+                if (noise_damping > 0) rho = qmdd_dm_amplitude_damp(rho, noise_damping, qubits[j]);
+            }
+        }
+        else if (op->type == op_measurement) {
+            if (circuit->has_intermediate_measurements) {
+                int m;
+                double p;
+                rho = qmdd_dm_measure_qubit(rho, op->targets[0], nqubits, &m, &p);
+                circuit->creg[op->meas_dest] = readout_error() ? !m : m;
+            }
+            else {
+                double p;
+                // don't set rho = post measurement state
+                qmdd_dm_measure_all(rho, nqubits, circuit->creg, &p);
+                if (circuit->reversed_qubit_order) {
+                    reverse_bit_array(circuit->creg, nqubits);
+                }
+                for (BDDVAR k = 0; k < nqubits; k++) {
+                    if (readout_error()) circuit->creg[k] = !circuit->creg[k];
+                }
+                break;
+            }
+        }
+        if (count_nodes) {
+            uint64_t count = evbdd_countnodes(rho);
+            if (count > stats.max_nodes) stats.max_nodes = count;
+        }
+    }
+    evbdd_unprotect(&rho);
+    stats.final_nodes = evbdd_countnodes(rho);
+    stats.simulation_time = wctime() - t_start;
+    stats.final_state = rho;
+    stats.shots = 1;
+    stats.norm = qmdd_dm_trace(rho, nqubits);
+    stats.purity = qmdd_dm_purity(rho, nqubits);
+}
+
+
+/**
+ * Hybrid Schrödinger-Feynman simulation. The qubits are split at the cut c in
+ * the blocks [0, c) and [c, n), which are simulated as separate (smaller) 
+ * QMDDs. A controlled gate across the cut, with m of its controls in the other
+ * block than its target, is a sum of m+1 product terms: term j < m projects
+ * the first j of these controls on |1> and the next one on |0> (and does 
+ * nothing in the target block), term m projects all of them on |1> and applies
+ * the gate, with its remaining controls, in the target block. Every choice of
+ * terms is a path, and the final state is the sum over all paths p of 
+ * |a_p> (x) |b_p>. The paths are independent, and are simulated concurrently
+ * in the same way as trajectories.
+ */
+#define HSF_MAX_PATHS (1ULL<<16)
+// Residual norm (relative) below which a block state is linearly dependent
+#define HSF_RANK_TOL 1e-10
+
+typedef struct hsf_op_s {
+    quantum_op_t op;    // the gate, with qubits numbered within their block,
+                        // or as in the circuit for a gate across the cut
+    int block;          // block of the qubits, -1 for a gate across the cut
+    int nterms;         // number of terms (1 for a gate within a block)
+} hsf_op_t;
+
+static hsf_op_t *hsf_ops = NULL;
+static int hsf_nops = 0;
+static BDDVAR hsf_nqubits[2];
+static QMDD *hsf_a = NULL;      // final block states of the paths in the
+static QMDD *hsf_b = NULL;      // current batch, [p - hsf_from] for path p
+static uint64_t hsf_from = 0;
+static QMDD *hsf_chi = NULL;    // final state = sum_j |chi_j> (x) |phi_j>
+static QMDD *hsf_phi = NULL;    // with orthonormal phi_j
+
+static inline int
+hsf_block(int q)
+{
+    return (q < hsf_cut) ? 0 : 1;
+}
+
+static inline int
+hsf_local(int q)
+{
+    return (q < hsf_cut || q == -1) ? q : q - hsf_cut;
+}
+
+/**
+ * Gate of the (single target) controlled gates, without the controls.
+ */
+static bool
+controlled_gate_base(quantum_op_t *op, gate_id_t *gate)
+{
+    const char *name = op->name;
+    if (strcmp(name, "cx") == 0 || strcmp(name, "ccx") == 0 || strcmp(name, "c3x") == 0)
+        *gate = GATEID_X;
+    else if (strcmp(name, "csx") == 0 || strcmp(name, "c3sx") == 0)
+        *gate = GATEID_sqrtX;
+    else if (strcmp(name, "cy") == 0) *gate = GATEID_Y;
+    else if (strcmp(name, "cz") == 0) *gate = GATEID_Z;
+    else if (strcmp(name, "ch") == 0) *gate = GATEID_H;
+    else if (strcmp(name, "crx") == 0) *gate = GATEID_Rx(op->angle[0]);
+    else if (strcmp(name, "cry") == 0) *gate = GATEID_Ry(op->angle[0]);
+    else if (strcmp(name, "crz") == 0) *gate = GATEID_Rz(op->angle[0]);
+    else if (strcmp(name, "cp") == 0) *gate = GATEID_Phase(op->angle[0]);
+    else if (strcmp(name, "cu") == 0) *gate = GATEID_U(op->angle[0], op->angle[1], op->angle[2]);
+    else return false;
+    return true;
+}
+
+static void
+hsf_push(quantum_op_t *op)
+{
+    if ((hsf_nops & (hsf_nops - 1)) == 0) {
+        hsf_ops = realloc(hsf_ops, sizeof(hsf_op_t) * (hsf_nops == 0 ? 16 : 2*hsf_nops));
+    }
+    hsf_op_t *h = &hsf_ops[hsf_nops++];
+    h->op = *op;
+    h->op.next = NULL;
+
+    int blocks = 0, m = 0;
+    int qubits[5] = {op->targets[0], op->targets[1], op->ctrls[0], op->ctrls[1], op->ctrls[2]};
+    for (int j = 0; j < 5; j++) {
+        if (qubits[j] != -1) blocks |= 1 << hsf_block(qubits[j]);
+    }
+    if (blocks != 3) {
+        h->block = (blocks == 2) ? 1 : 0;
+        h->nterms = 1;
+        h->op.targets[0] = hsf_local(op->targets[0]);
+        h->op.targets[1] = hsf_local(op->targets[1]);
+        for (int j = 0; j < 3; j++) h->op.ctrls[j] = hsf_local(op->ctrls[j]);
+        return;
+    }
+    for (int j = 0; j < 3; j++) {
+        if (op->ctrls[j] != -1 && hsf_block(op->ctrls[j]) != hsf_block(op->targets[0])) m++;
+    }
+    h->block = -1;
+    h->nterms = m + 1;
+}
+
+static void
+hsf_push_gate(const char *name, int c, int t, double angle)
+{
+    quantum_op_t op;
+    memset(&op, 0, sizeof(quantum_op_t));
+    op.type = op_gate;
+    strcpy(op.name, name);
+    op.angle[0] = angle;
+    op.targets[0] = t;
+    op.targets[1] = -1;
+    op.ctrls[0] = c;
+    op.ctrls[1] = op.ctrls[2] = -1;
+    hsf_push(&op);
+}
+
+/**
+ * Splits the gates of the circuit over the blocks. SWAP and RZZ gates across
+ * the cut are replaced by CNOTs (and a phase gate), other gates across the 
+ * cut must be controlled gates with a single target. Returns the number of
+ * paths (0 if more than HSF_MAX_PATHS).
+ */
+static uint64_t
+hsf_split(quantum_circuit_t *circuit)
+{
+    uint64_t paths = 1;
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type != op_gate) continue;
+        int n = hsf_nops;
+        gate_id_t gate;
+        bool cross = (op->targets[1] != -1 && hsf_block(op->targets[0]) != hsf_block(op->targets[1]));
+        if (cross && strcmp(op->name, "swap") == 0) {
+            hsf_push_gate("cx", op->targets[0], op->targets[1], 0);
+            hsf_push_gate("cx", op->targets[1], op->targets[0], 0);
+            hsf_push_gate("cx", op->targets[0], op->targets[1], 0);
+        }
+        else if (cross && strcmp(op->name, "rzz") == 0) {
+            hsf_push_gate("cx", op->targets[0], op->targets[1], 0);
+            hsf_push_gate("p", -1, op->targets[1], op->angle[0]);
+            hsf_push_gate("cx", op->targets[0], op->targets[1], 0);
+        }
+        else {
+            hsf_push(op);
+            if (hsf_ops[n].block == -1 && (op->targets[1] != -1 || !controlled_gate_base(op, &gate))) {
+                fprintf(stderr, "Gate '%s' across the cut is not supported by --hsf-cut\n", op->name);
+                exit(1);
+            }
+        }
+        for (int k = n; k < hsf_nops; k++) {
+            if (hsf_ops[k].block != -1) continue;
+            stats.hsf_cross_gates++;
+            paths *= hsf_ops[k].nterms;
+            if (paths > HSF_MAX_PATHS) return 0;
+        }
+    }
+    return paths;
+}
+
+/**
+ * Applies the given term of a gate across the cut to the block states. Returns
+ * whether the gate itself was applied (and not only a projection).
+ */
+static bool
+hsf_apply_cross(QMDD *state, hsf_op_t *h, int term)
+{
+    quantum_op_t *op = &h->op;
+    int tb = hsf_block(op->targets[0]);
+    BDDVAR cs[3] = {EVBDD_INVALID_VAR, EVBDD_INVALID_VAR, EVBDD_INVALID_VAR};
+    int n_local = 0, j = 0;
+    for (int k = 0; k < 3 && op->ctrls[k] != -1; k++) {
+        BDDVAR c = hsf_local(op->ctrls[k]);
+        if (hsf_block(op->ctrls[k]) == tb) {
+            cs[n_local++] = c;
+            continue;
+        }
+        // project (without normalizing) control c in the other block
+        if (j <= term) {
+            MTBDD zero_if = (j < term) ? qubit_is_0[c] : qubit_is_1[c];
+            state[1-tb] = qmdd_apply_diagonal(state[1-tb], zero_if, EVBDD_ZERO);
+        }
+        j++;
+    }
+    if (term < j) return false;
+
+    gate_id_t gate;
+    controlled_gate_base(op, &gate);
+    BDDVAR t = hsf_local(op->targets[0]);
+    if (n_local == 0)
+        state[tb] = qmdd_gate(state[tb], gate, t);
+    else
+        state[tb] = _qmdd_cgate(state[tb], gate, cs[0], cs[1], cs[2], t, hsf_nqubits[tb]);
+    return true;
+}
+
+/**
+ * Simulates path p, the term of the i-th gate across the cut is digit i of p
+ * (in the mixed radix given by the numbers of terms).
+ */
+static void
+hsf_simulate_path(uint64_t p)
+{
+    QMDD state[2];
+    state[0] = qmdd_create_all_zero_state(hsf_nqubits[0]);
+    state[1] = qmdd_create_all_zero_state(hsf_nqubits[1]);
+    evbdd_protect(&state[0]);
+    evbdd_protect(&state[1]);
+    uint64_t digits = p, cross_gates = 0;
+    for (int i = 0; i < hsf_nops; i++) {
+        hsf_op_t *h = &hsf_ops[i];
+        if (h->block != -1) {
+            state[h->block] = apply_gate(state[h->block], &h->op, hsf_nqubits[h->block]);
+        }
+        else {
+            cross_gates += hsf_apply_cross(state, h, digits % h->nterms);
+            digits /= h->nterms;
+        }
+    }
+    // one update per path, the paths of a batch run in parallel
+    stats.applied_gates += cross_gates;
+    hsf_a[p - hsf_from] = state[0];
+    hsf_b[p - hsf_from] = state[1];
+    evbdd_protect(&hsf_a[p - hsf_from]);
+    evbdd_protect(&hsf_b[p - hsf_from]);
+    evbdd_unprotect(&state[0]);
+    evbdd_unprotect(&state[1]);
+}
+
+/**
+ * Task tree over the paths [from, to).
+ */
+VOID_TASK_2(hsf_path_range, uint64_t, from, uint64_t, to)
+{
+    if (to - from == 1) {
+        hsf_simulate_path(from);
+        return;
+    }
+    uint64_t mid = from + (to - from) / 2;
+    SPAWN(hsf_path_range, mid, to);
+    CALL(hsf_path_range, from, mid);
+    SYNC(hsf_path_range);
+}
+
+static QMDD
+hsf_scale(QMDD q, complex_t c)
+{
+    if (EVBDD_WEIGHT(q) == EVBDD_ZERO) return q;
+    if (c.r == 0 && c.i == 0) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    return evbdd_bundle(EVBDD_TARGET(q), wgt_mul(EVBDD_WEIGHT(q), weight_lookup(&c)));
+}
+
+static QMDD
+hsf_normalize(QMDD q, double norm)
+{
+    return evbdd_bundle(EVBDD_TARGET(q), wgt_div(EVBDD_WEIGHT(q), qmdd_amp_from_prob(norm)));
+}
+
+/**
+ * Folds the paths [from, to) of the current batch into the orthonormalized
+ * block 1 states (modified Gram-Schmidt): |b_p> = sum_j c_pj |phi_j>, so the
+ * final state is sum_j |chi_j> (x) |phi_j> with |chi_j> = sum_p c_pj |a_p>.
+ * Afterwards the states of the batch are released, so only the chi_j and
+ * phi_j are kept between batches. Returns the new number of phi_j (the
+ * Schmidt rank over the cut is at most this number).
+ */
+static uint64_t
+hsf_fold(uint64_t from, uint64_t to, uint64_t rank)
+{
+    BDDVAR nb = hsf_nqubits[1];
+    for (uint64_t i = 0; i < to - from; i++) {
+        double n0 = qmdd_get_norm(hsf_b[i], nb);
+        if (n0 == 0 || EVBDD_WEIGHT(hsf_a[i]) == EVBDD_ZERO) continue;
+        QMDD v = hsf_b[i];
+        evbdd_protect(&v);
+        for (uint64_t j = 0; j < rank; j++) {
+            complex_t c;
+            weight_value(evbdd_inner_product(v, hsf_phi[j], nb), &c);
+            v = evbdd_plus(v, hsf_scale(hsf_phi[j], cmake(-c.r, -c.i)));
+            hsf_chi[j] = evbdd_plus(hsf_chi[j], hsf_scale(hsf_a[i], c));
+        }
+        double n2 = qmdd_get_norm(v, nb);
+        if (n2 > HSF_RANK_TOL * n0) {
+            hsf_phi[rank] = hsf_normalize(v, n2);
+            hsf_chi[rank] = hsf_scale(hsf_a[i], cmake(flt_sqrt(n2), 0));
+            evbdd_protect(&hsf_phi[rank]);
+            evbdd_protect(&hsf_chi[rank]);
+            rank++;
+        }
+        evbdd_unprotect(&v);
+    }
+    for (uint64_t i = 0; i < to - from; i++) {
+        evbdd_unprotect(&hsf_a[i]);
+        evbdd_unprotect(&hsf_b[i]);
+    }
+    return rank;
+}
+
+static void
+hsf_amplitudes(const bool *x, complex_t *chi_x, uint64_t rank)
+{
+    // qmdd_get_amplitude takes q_{n-1}, .., q_0
+    bool *be = malloc(sizeof(bool) * hsf_nqubits[0]);
+    for (BDDVAR k = 0; k < hsf_nqubits[0]; k++) be[k] = x[hsf_nqubits[0]-1-k];
+    for (uint64_t j = 0; j < rank; j++) chi_x[j] = qmdd_get_amplitude(hsf_chi[j], be, hsf_nqubits[0]);
+    free(be);
+}
+
+/**
+ * Samples all qubits: |<x_0|chi_j>|^2 summed over j is the marginal of block 0
+ * (since the phi_j are orthonormal), so pick j with probability ||chi_j||^2 
+ * and measure chi_j, then measure block 1 in sum_j <x_0|chi_j> |phi_j>.
+ */
+static void
+hsf_sample(bool *x, uint64_t rank, double norm)
+{
+    double p, r = norm * ((double)rand())/((double)RAND_MAX);
+    uint64_t j = 0;
+    double w = qmdd_get_norm(hsf_chi[0], hsf_nqubits[0]);
+    while (j < rank-1 && r > w) {
+        r -= w;
+        w = qmdd_get_norm(hsf_chi[++j], hsf_nqubits[0]);
+    }
+    qmdd_measure_all(hsf_normalize(hsf_chi[j], w), hsf_nqubits[0], x, &p);
+
+    complex_t *chi_x = malloc(sizeof(complex_t) * rank);
+    hsf_amplitudes(x, chi_x, rank);
+    QMDD b = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    evbdd_protect(&b);
+    for (j = 0; j < rank; j++) b = evbdd_plus(b, hsf_scale(hsf_phi[j], chi_x[j]));
+    qmdd_measure_all(hsf_normalize(b, qmdd_get_norm(b, hsf_nqubits[1])), hsf_nqubits[1], x + hsf_cut, &p);
+    evbdd_unprotect(&b);
+    free(chi_x);
+}
+
+void simulate_hsf(quantum_circuit_t* circuit)
+{
+    double t_start = wctime();
+    BDDVAR nqubits = circuit->qreg_size;
+    if (hsf_cut >= circuit->qreg_size) {
+        fprintf(stderr, "--hsf-cut must be smaller than the number of qubits (%d)\n", circuit->qreg_size);
+        exit(1);
+    }
+    if (circuit->has_intermediate_measurements) {
+        fprintf(stderr, "--hsf-cut does not support intermediate measurements\n");
+        exit(1);
+    }
+    hsf_nqubits[0] = hsf_cut;
+    hsf_nqubits[1] = nqubits - hsf_cut;
+    uint64_t paths = hsf_split(circuit);
+    if (paths == 0) {
+        fprintf(stderr, "More than %llu paths, choose a cut with fewer gates across it\n", HSF_MAX_PATHS);
+        exit(1);
+    }
+    init_qubit_projectors(nqubits);
+
+    uint64_t batch = 1, rank = 0;
+    if (lace_workers() > 1 && !has_dynamic_gates(circuit)) {
+        // the edge weight table can only be cleaned up between batches
+        evbdd_set_auto_gc_wgt_table(false);
+        batch = lace_workers();
+    }
+    hsf_a = calloc(batch, sizeof(QMDD));
+    hsf_b = calloc(batch, sizeof(QMDD));
+    hsf_chi = malloc(sizeof(QMDD) * paths);
+    hsf_phi = malloc(sizeof(QMDD) * paths);
+    for (uint64_t from = 0; from < paths; from += batch) {
+        uint64_t to = (from + batch < paths) ? from + batch : paths;
+        hsf_from = from;
+        RUN(hsf_path_range, from, to);
+        if (count_nodes) {
+            for (uint64_t i = 0; i < to - from; i++) {
+                uint64_t count = evbdd_countnodes(hsf_a[i]) + evbdd_countnodes(hsf_b[i]);
+                if (count > stats.max_nodes) stats.max_nodes = count;
+            }
+        }
+        rank = hsf_fold(from, to, rank);
+        if (batch > 1 && evbdd_test_gc_wgt_table()) {
+            evbdd_gc_wgt_table();
+        }
+    }
+    evbdd_set_auto_gc_wgt_table(true);
+    free(hsf_a);
+    free(hsf_b);
+
+    stats.norm = 0;
+    for (uint64_t j = 0; j < rank; j++) {
+        stats.norm += qmdd_get_norm(hsf_chi[j], hsf_nqubits[0]);
+        stats.final_nodes += evbdd_countnodes(hsf_chi[j]) + evbdd_countnodes(hsf_phi[j]);
+    }
+
+    bool measured = false;
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type == op_measurement) measured = true;
+    }
+    if (measured && rank > 0) {
+        hsf_sample(circuit->creg, rank, stats.norm);
+        if (circuit->reversed_qubit_order) {
+            reverse_bit_array(circuit->creg, circuit->qreg_size);
+        }
+    }
+
+    free_qubit_projectors(nqubits);
+    stats.hsf_paths = paths;
+    stats.hsf_rank = rank;
+    stats.simulation_time = wctime() - t_start;
+    stats.shots = 1;
+}
+
+/**
+ * Amplitude of the basis state given as bit string q_{n-1}..q_0 (of the qubits
+ * as in the QASM file, which are reversed if the circuit was reordered).
+ */
+static complex_t
+query_amplitude(quantum_circuit_t *circuit, const char *bits)
+{
+    BDDVAR n = circuit->qreg_size;
+    if (strlen(bits) != n) {
+        fprintf(stderr, "Amplitude '%s' should have %d bits\n", bits, n);
+        return cmake(0, 0);
+    }
+    // x[q] is the value of (simulated) qubit q
+    bool *x = malloc(sizeof(bool) * n);
+    for (BDDVAR q = 0; q < n; q++) {
+        x[q] = bits[circuit->reversed_qubit_order ? q : n-1-q] == '1';
+    }
+    complex_t res = cmake(0, 0);
+    if (hsf_cut > 0) {
+        complex_t *chi_x = malloc(sizeof(complex_t) * stats.hsf_rank);
+        hsf_amplitudes(x, chi_x, stats.hsf_rank);
+        bool *be = malloc(sizeof(bool) * hsf_nqubits[1]);
+        for (BDDVAR k = 0; k < hsf_nqubits[1]; k++) be[k] = x[n-1-k];
+        for (uint64_t j = 0; j < stats.hsf_rank; j++) {
+            res = cadd(res, cmul(chi_x[j], qmdd_get_amplitude(hsf_phi[j], be, hsf_nqubits[1])));
+        }
+        free(be);
+        free(chi_x);
+    }
+    else {
+        bool *be = malloc(sizeof(bool) * n);
+        for (BDDVAR k = 0; k < n; k++) be[k] = x[n-1-k];
+        res = qmdd_get_amplitude(stats.final_state, be, n);
+        free(be);
+    }
+    free(x);
+    return res;
+}
+
+
+
+/**
+ * Partitioned simulation over 2^k processes (see qsylvan_partition.h), every
+ * process runs this for its own part of the state. Only gates which change the
+ * value of a partitioned qubit require an exchange with the partner process:
+ * controls are never changed, and diagonal gates only change the phase.
+ */
+static int
+partition_moved_qubits(quantum_op_t *op, int *qubits)
+{
+    static const char *diagonal[] = {"id", "z", "s", "sdg", "t", "tdg", "rz", "p",
+                                     "cz", "crz", "cp", "rzz"};
+    for (size_t i = 0; i < sizeof(diagonal) / sizeof(diagonal[0]); i++) {
+        if (strcmp(op->name, diagonal[i]) == 0) return 0;
+    }
+    qubits[0] = op->targets[0];
+    if (strcmp(op->name, "swap") == 0 || strcmp(op->name, "cswap") == 0 ||
+        strcmp(op->name, "rxx") == 0) {
+        qubits[1] = op->targets[1];
+        return 2;
+    }
+    return 1;
+}
+
+typedef struct partition_result_s {
+    double norm;
+    uint64_t max_nodes;
+    uint64_t final_nodes;
+    uint64_t bytes_sent;
+} partition_result_t;
+
+void simulate_partitioned(quantum_circuit_t* circuit)
+{
+    double t_start = wctime();
+    BDDVAR nqubits = circuit->qreg_size;
+    uint32_t nranks = partition->nranks;
+    if (dense_block_levels > 0) {
+        qmdd_set_dense_blocks(nqubits, dense_block_levels, dense_block_density);
+    }
+
+    QMDD state = qmdd_partition_project(partition, qmdd_create_all_zero_state(nqubits));
+    evbdd_protect(&state);
+    bool measure = false;
+    for (quantum_op_t *op = circuit->operations; op != NULL; op = op->next) {
+        if (op->type == op_gate) {
+            state = apply_gate(state, op, nqubits);
+            // swap the amplitudes which moved out of this part with the partner
+            int moved[2];
+            int m = partition_moved_qubits(op, moved);
+            for (int j = 0; j < m; j++) {
+                if (moved[j] < (int) partition->k) {
+                    state = qmdd_partition_exchange(partition, state, moved[j]);
+                }
+            }
+        }
+        else if (op->type == op_measurement) {
+            measure = true;
+            break;
+        }
+        if (count_nodes) {
+            uint64_t count = evbdd_countnodes(state);
+            if (count > stats.max_nodes) stats.max_nodes = count;
+        }
+    }
+    evbdd_unprotect(&state);
+    stats.final_state = state;
+    stats.simulation_time = wctime() - t_start;
+    stats.shots = 1;
+
+    // collect the statistics of all parts at rank 0
+    partition_result_t mine = {qmdd_get_norm(state, nqubits), stats.max_nodes,
+                               evbdd_countnodes(state), partition->bytes_sent};
+    partition_result_t *all = malloc(sizeof(partition_result_t) * nranks);
+    qmdd_partition_gather(partition, &mine, all, sizeof(partition_result_t));
+    if (partition->rank == 0) {
+        stats.norm = 0;
+        stats.final_nodes = 0;
+        stats.partition_bytes = 0;
+        for (uint32_t r = 0; r < nranks; r++) {
+            stats.norm += all[r].norm;
+            stats.final_nodes += all[r].final_nodes;
+            stats.partition_bytes += all[r].bytes_sent;
+            if (all[r].max_nodes > stats.max_nodes) stats.max_nodes = all[r].max_nodes;
+        }
+        stats.partition_exchanges = partition->exchanges;
+    }
+
+    // an amplitude is the sum of the amplitudes of all parts (all but one are 0)
+    if (n_amp_queries > 0) {
+        complex_t *amps = malloc(sizeof(complex_t) * n_amp_queries);
+        complex_t *all_amps = malloc(sizeof(complex_t) * n_amp_queries * nranks);
+        for (int k = 0; k < n_amp_queries; k++) {
+            amps[k] = query_amplitude(circuit, amp_queries[k]);
+        }
+        qmdd_partition_gather(partition, amps, all_amps, sizeof(complex_t) * n_amp_queries);
+        if (partition->rank == 0) {
+            stats.amplitudes = malloc(sizeof(complex_t) * n_amp_queries);
+            for (int k = 0; k < n_amp_queries; k++) {
+                stats.amplitudes[k] = cmake(0, 0);
+                for (uint32_t r = 0; r < nranks; r++) {
+                    stats.amplitudes[k] = cadd(stats.amplitudes[k], all_amps[r * n_amp_queries + k]);
+                }
+            }
+        }
+        free(amps);
+        free(all_amps);
+    }
+
+    // sample a part with probability proportional to its norm, and measure it
+    if (measure) {
+        uint32_t owner = 0;
+        if (partition->rank == 0) {
+            double r = stats.norm * ((double)rand())/((double)RAND_MAX);
+            double w = all[0].norm;
+            while ((w < r || all[owner].norm == 0) && owner < nranks - 1) {
+                w += all[++owner].norm;
+            }
+        }
+        qmdd_partition_bcast(partition, &owner, sizeof(owner));
+        bool *bits = calloc(nqubits, sizeof(bool));
+        bool *all_bits = malloc(sizeof(bool) * nqubits * nranks);
+        if (partition->rank == owner) {
+            double p;
+            QMDD normed = evbdd_bundle(EVBDD_TARGET(state), 
+                                       wgt_div(EVBDD_WEIGHT(state), qmdd_amp_from_prob(mine.norm)));
+            qmdd_measure_all(normed, nqubits, bits, &p);
+        }
+        qmdd_partition_gather(partition, bits, all_bits, sizeof(bool) * nqubits);
+        if (partition->rank == 0) {
+            memcpy(circuit->creg, all_bits + owner * nqubits, sizeof(bool) * nqubits);
+            if (circuit->reversed_qubit_order) {
+                reverse_bit_array(circuit->creg, nqubits);
+            }
+        }
+        free(bits);
+        free(all_bits);
+    }
+    free(all);
+}
+
 int main(int argc, char *argv[])
 {
     argp_parse(&argp, argc, argv, 0, 0, 0);
     quantum_circuit_t* circuit = parse_qasm_file(qasm_inputfile);
     if (reorder_qubits)
         optimize_qubit_order(circuit, reorder_qubits == 2);
+    if (interaction_order) {
+        int *pos = malloc(sizeof(int) * circuit->qreg_size);
+        interaction_qubit_order(circuit, pos);
+        stats.qubit_levels = malloc(sizeof(BDDVAR) * circuit->qreg_size);
+        for (int k = 0; k < circuit->qreg_size; k++) stats.qubit_levels[k] = pos[k];
+        stats.predicted_peak_nodes = predict_peak_nodes(circuit, pos);
+        stats.predicted_peak_nodes_circuit = predict_peak_nodes(circuit, NULL);
+        free(pos);
+    }
 
     if (rseed == 0) rseed = time(NULL);
     srand(rseed);
+
+    if (partition_qubits > 0) {
+        if (partition_qubits >= circuit->qreg_size) {
+            fprintf(stderr, "--partition-qubits must be smaller than the number of qubits (%d)\n", circuit->qreg_size);
+            exit(1);
+        }
+        if (circuit->has_intermediate_measurements) {
+            fprintf(stderr, "--partition-qubits does not support intermediate measurements\n");
+            exit(1);
+        }
+        // every process starts its own Lace workers and Sylvan tables below
+        partition = qmdd_partition_fork(circuit->qreg_size, partition_qubits);
+    }
     
     // Standard Lace initialization
     lace_start(workers, 0);
 
+    if (pin_workers) stats.pinned_workers = sylvan_pin_workers();
+
     // Simple Sylvan initialization
-    sylvan_set_sizes(min_tablesize, max_tablesize, min_cachesize, max_cachesize);
+    sylvan_set_placement(table_pages, table_numa);
+    sylvan_set_out_of_core(out_of_core_dir);
+    if (memory_cap > 0) {
+        // 1/4 of the budget for the edge weight table, rest for nodes + cache
+        evbdd_set_limits(memory_cap, 1, 5, 0.25);
+        evbdd_set_recoverable_oom(true);
+        stats.oom_fidelity = 1.0;
+    }
+    else {
+        sylvan_set_sizes(min_tablesize, max_tablesize, min_cachesize, max_cachesize);
+    }
     sylvan_init_package();
+    sylvan_init_mtbdd();
     qsylvan_init_simulator(min_wgt_tab_size, max_wgt_tab_size, tolerance, COMP_HASHMAP, wgt_norm_strat);
     wgt_set_inverse_chaching(wgt_inv_caching);
+    if (placement_report) sylvan_table_placement_report(stderr);
 
-    simulate_circuit(circuit);
+    uint64_t major_faults, minor_faults;
+    sylvan_page_faults(&major_faults, &minor_faults);
+    if (trajectories > 0)
+        simulate_trajectories(circuit);
+    else if (hsf_cut > 0)
+        simulate_hsf(circuit);
+    else if (partition != NULL)
+        simulate_partitioned(circuit);
+    else if (density_matrix)
+        simulate_density_matrix(circuit);
+    else
+        simulate_circuit(circuit);
+    sylvan_page_faults(&stats.major_faults, &stats.minor_faults);
+    stats.major_faults -= major_faults;
+    stats.minor_faults -= minor_faults;
 
-    if (json_outputfile != NULL) {
+    if (vector_outputfile != NULL) {
+        FILE *fp = fopen(vector_outputfile, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "Could not open %s\n", vector_outputfile);
+            exit(1);
+        }
+        double t_start = wctime();
+        stats.vector_entries = qmdd_amplitudes_tofile(fp, stats.final_state, circuit->qreg_size,
+                                                      amp_threshold, vector_ordered,
+                                                      circuit->reversed_qubit_order);
+        stats.vector_time = wctime() - t_start;
+        bool failed = ferror(fp);
+        if (fclose(fp) != 0 || failed) {
+            fprintf(stderr, "Could not write %s\n", vector_outputfile);
+            exit(1);
+        }
+    }
+
+    if (memory_cap > 0) {
+        evbdd_get_limits(&stats.budget_nodes, &stats.budget_cache, &stats.budget_wgts,
+                         &stats.budget_rebalances);
+    }
+    // with --partition-qubits, only rank 0 outputs the (collected) results
+    bool output = (partition == NULL || partition->rank == 0);
+    if (output && json_outputfile != NULL) {
         FILE *fp = fopen(json_outputfile, "w");
         fprint_stats(fp, circuit);
         fclose(fp);
-    } else {
+    } else if (output) {
         fprint_stats(stdout, circuit);
     }
 
     sylvan_quit();
     lace_stop();
     free_quantum_circuit(circuit);
+    free(stats.amplitudes);
+    if (partition != NULL && qmdd_partition_finish(partition) != 0) {
+        fprintf(stderr, "Not all partition processes finished successfully\n");
+        return 1;
+    }
+    if (traj != NULL) {
+        for (uint64_t i = 0; i < trajectories; i++) free(traj[i].outcome);
+        free(traj);
+    }
 
-    return 0;
+    return stats.out_of_memory ? 2 : 0;
 }
@@ -34,9 +34,22 @@ def get_vector(qasm_file : str, args : list):
     return vector
 
 
+def get_histogram(qasm_file : str, args : list):
+    """
+    Sample trajectories of given quantum circuit and return the histogram.
+    """
+    filepath = os.path.join(QASM_DIR, qasm_file)
+    output = subprocess.run([SIM_QASM, filepath, *args],
+                            stdout=subprocess.PIPE, check=False)
+    data = json.loads(output.stdout)
+    return data['measurement_results']
+
+
 @pytest.mark.parametrize("cl_args",
                          [['-s', 'low'], ['-s', 'max'], ['-s', 'min'], ['-s', 'l2'],
-                          ['--reorder'], ['--reorder-swap'], ['--node-tab-size', '25']])
+                          ['--reorder'], ['--reorder-swap'], ['--node-tab-size', '25'],
+                          ['--reorder-interaction'], ['--dynamic-reorder', '1.01'],
+                          ['--memory-cap', '4']])
 class TestCircuits:
     """
     Test on all given circuits, with CL arguments given above.
@@ -393,3 +406,73 @@ class TestCircuits:
                         4.08247823e-01+4.08247823e-01j, 0.00000000e+00+0.00000000e+00j,
                         0.00000000e+00+0.00000000e+00j, 0.00000000e+00+0.00000000e+00j])
         assert abs(fidelity(vector, ref) - 1) < TOLERANCE
+
+
+def test_trajectories(tmp_path):
+    """
+    Test the (noisy) trajectory mode on bell_state.qasm
+    """
+    # without noise only 01 and 10 occur
+    hist = get_histogram('bell_state.qasm', ['--trajectories', '1000'])
+    assert set(hist.keys()) <= {'01', '10'}
+    assert sum(hist.values()) == 1000
+
+    # readout error 1 flips both bits of the deterministic outcome 01 (q0 = 1)
+    x_q0 = tmp_path / 'x_q0.qasm'
+    x_q0.write_text('OPENQASM 2.0;\ninclude "qelib1.inc";\nqreg q[2];\ncreg c[2];\n'
+                    'x q[0];\nmeasure q[0] -> c[0];\nmeasure q[1] -> c[1];\n')
+    hist = get_histogram(str(x_q0), ['--readout-error', '1'])
+    assert hist == {'10': 1000}
+
+    # amplitude damping with gamma = 1 resets the qubits after every gate
+    hist = get_histogram('bell_state.qasm', ['--amplitude-damping', '1'])
+    assert hist == {'00': 1000}
+
+    # every trajectory has its own random number generator
+    args = ['--depolarizing', '0.1', '-r', '42']
+    assert get_histogram('bell_state.qasm', [*args, '-w', '1']) == \
+           get_histogram('bell_state.qasm', [*args, '-w', '2'])
+
+
+def get_amplitudes(qasm_file : str, n : int, args : list):
+    """
+    Simulate given quantum circuit and return all amplitudes, queried with
+    --amplitude.
+    """
+    filepath = os.path.join(QASM_DIR, qasm_file)
+    bits = [format(x, f'0{n}b') for x in range(2**n)]
+    queries = [arg for b in bits for arg in ['--amplitude', b]]
+    output = subprocess.run([SIM_QASM, filepath, *queries, *args],
+                            stdout=subprocess.PIPE, check=False)
+    data = json.loads(output.stdout)
+    return np.array([complex(*data['amplitudes'][b]) for b in bits])
+
+
+@pytest.mark.parametrize("qasm_file,n,cut",
+                         [('adder_n4.qasm', 4, 2), ('fredkin_n3.qasm', 3, 1),
+                          ('ghz_n8.qasm', 8, 4), ('qft_n4.qasm', 4, 2),
+                          ('simon_n6.qasm', 6, 3), ('vqe_n4.qasm', 4, 1)])
+def test_hsf(qasm_file : str, n : int, cut : int):
+    """
+    Test the hybrid Schrödinger-Feynman mode against the full simulation
+    """
+    ref = get_amplitudes(qasm_file, n, [])
+    amps = get_amplitudes(qasm_file, n, ['--hsf-cut', str(cut), '-w', '2'])
+    assert np.allclose(amps, ref, atol=TOLERANCE)
+
+
+@pytest.mark.parametrize("qasm_file,n,k,args",
+                         [('adder_n4.qasm', 4, 2, []), ('dnn_n8.qasm', 8, 3, []),
+                          ('ghz_n8.qasm', 8, 1, []), ('qft_n4.qasm', 4, 3, []),
+                          ('simon_n6.qasm', 6, 2, []), ('vqe_n4.qasm', 4, 2, []),
+                          # small edge weight tables, which are cleaned during exchanges
+                          ('dnn_n8.qasm', 8, 2, ['--wgt-tab-size', '12']),
+                          ('dnn_n8.qasm', 8, 3, ['--wgt-tab-size', '14'])])
+def test_partition(qasm_file : str, n : int, k : int, args : list):
+    """
+    Test the multi-process simulation over the top k qubits against the full
+    simulation
+    """
+    ref = get_amplitudes(qasm_file, n, args)
+    amps = get_amplitudes(qasm_file, n, ['--partition-qubits', str(k), *args])
+    assert np.allclose(amps, ref, atol=TOLERANCE)
@@ -48,6 +48,31 @@ struct cmap_s {
     // long doubles for the real and imaginary components?
 };
 
+static void *
+cmap_default_alloc(const char *name, size_t size)
+{
+    (void)name;
+    return calloc(1, size);
+}
+
+static void
+cmap_default_dealloc(void *ptr, size_t size)
+{
+    (void)size;
+    free(ptr);
+}
+
+static void *(*table_alloc)(const char *name, size_t size) = &cmap_default_alloc;
+static void (*table_dealloc)(void *ptr, size_t size) = &cmap_default_dealloc;
+
+void
+cmap_set_allocator(void *(*alloc)(const char *name, size_t size),
+                   void (*dealloc)(void *ptr, size_t size))
+{
+    table_alloc = alloc;
+    table_dealloc = dealloc;
+}
+
 static void __attribute__((unused))
 print_bucket_floats(bucket_t *b)
 {
@@ -193,7 +218,11 @@ cmap_create(uint64_t size, double tolerance)
     cmap_t  *cmap = calloc (1, sizeof(cmap_t));
     cmap->size = size;
     cmap->mask = cmap->size - 1;
-    cmap->table = calloc (cmap->size, sizeof(bucket_t));
+    cmap->table = table_alloc ("edge weights", cmap->size * sizeof(bucket_t));
+    if (cmap->table == NULL) {
+        fprintf(stderr, "cmap_create: Unable to allocate memory!\n");
+        exit(1);
+    }
     for (unsigned int c = 0; c < cmap->size; c++) {
         cmap->table[c].d[0] = EMPTY;
     }
@@ -207,6 +236,6 @@ void
 cmap_free(void *dbs)
 {
     cmap_t * cmap = (cmap_t *) dbs;
-    free (cmap->table);
+    table_dealloc (cmap->table, cmap->size * sizeof(bucket_t));
     free (cmap);
 }
@@ -41,6 +41,15 @@ extern double cmap_get_tolerance();
 */
 extern void cmap_free(void *dbs);
 
+/**
+\brief Set the functions used to allocate and free the table of the map (by
+default calloc and free), e.g. to control its page size and NUMA placement.
+\param alloc Returns zeroed memory of the given size for the named table
+\param dealloc Frees memory obtained with alloc
+*/
+extern void cmap_set_allocator(void *(*alloc)(const char *name, size_t size),
+                               void (*dealloc)(void *ptr, size_t size));
+
 /**
 \brief Find a vector with respect to a database and insert it if it cannot be fo
 und.
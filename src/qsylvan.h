@@ -3,3 +3,5 @@
 #include <sylvan_evbdd.h>
 #include <sylvan_edge_weights.h>
 #include <qsylvan_simulator.h>
+#include <qsylvan_stabilizer.h>
+#include <qsylvan_partition.h>
@@ -5,7 +5,7 @@
 
 static long double Pi;    // set value of global Pi
 
-uint64_t gates[n_predef_gates+256+256][4];
+uint64_t gates[n_predef_gates+256+256+QMDD_MAX_INTERNED_GATES][4];
 
 /********************** <dynamic custom rotation gates> ***********************/
 
@@ -117,6 +117,154 @@ GATEID_U(fl_t theta, fl_t phi, fl_t lambda)
 /********************* </dynamic custom rotation gates> ***********************/
 
 
+/*************************** <interned custom gates> **************************/
+
+// store complex values of interned gates to re-initialize them after gc
+static complex_t interned_gate[QMDD_MAX_INTERNED_GATES][4];
+static uint32_t num_interned = 0;
+
+// open addressing hash table on the edge weights of the interned gates,
+// with entries k+1 for interned gate k (0 = empty)
+#define INTERNED_INDEX_SIZE (2*QMDD_MAX_INTERNED_GATES)
+static uint32_t interned_index[INTERNED_INDEX_SIZE];
+
+static uint32_t
+interned_hash(const uint64_t *w)
+{
+    uint64_t h = sylvan_fnvhash16(w[0] | (w[1] << 32), w[2] | (w[3] << 32), 0);
+    return h % INTERNED_INDEX_SIZE;
+}
+
+/**
+ * Returns the slot of interned_index with the gate with edge weights w, or
+ * the empty slot where it should be inserted.
+ */
+static uint32_t
+interned_find(const uint64_t *w)
+{
+    uint32_t i = interned_hash(w);
+    while (interned_index[i] != 0) {
+        uint64_t *g = gates[num_static_gates + interned_index[i] - 1];
+        if (g[0] == w[0] && g[1] == w[1] && g[2] == w[2] && g[3] == w[3]) break;
+        i = (i + 1) % INTERNED_INDEX_SIZE;
+    }
+    return i;
+}
+
+/**
+ * (Re-)initializes the edge weights of the interned gates and their index.
+ */
+static void
+interned_gates_init()
+{
+    memset(interned_index, 0, sizeof(interned_index));
+    for (uint32_t k = 0; k < num_interned; k++) {
+        uint64_t *g = gates[num_static_gates + k];
+        for (int i = 0; i < 4; i++) g[i] = weight_lookup(&interned_gate[k][i]);
+        uint32_t slot = interned_find(g);
+        if (interned_index[slot] == 0) interned_index[slot] = k + 1;
+    }
+}
+
+uint32_t
+GATEID_interned(const complex_t *m)
+{
+    complex_t c[4];
+    uint64_t w[4];
+    for (int i = 0; i < 4; i++) {
+        c[i] = m[i];
+        w[i] = weight_lookup(&c[i]);
+    }
+
+    uint32_t slot = interned_find(w);
+    if (interned_index[slot] != 0) {
+        return num_static_gates + interned_index[slot] - 1;
+    }
+
+    if (num_interned == QMDD_MAX_INTERNED_GATES) {
+        fprintf(stderr, "GATEID_interned: more than %d interned gates\n", QMDD_MAX_INTERNED_GATES);
+        exit(1);
+    }
+    uint32_t k = num_interned++;
+    for (int i = 0; i < 4; i++) {
+        interned_gate[k][i] = c[i];
+        gates[num_static_gates + k][i] = w[i];
+    }
+    interned_index[slot] = k + 1;
+    return num_static_gates + k;
+}
+
+uint32_t
+GATEID_Rx_interned(fl_t theta)
+{
+    complex_t m[4];
+    m[0] = cmake(flt_cos(theta/2.0), 0.0);
+    m[1] = cmake(0.0, -flt_sin(theta/2.0));
+    m[2] = cmake(0.0, -flt_sin(theta/2.0));
+    m[3] = cmake(flt_cos(theta/2.0), 0.0);
+    return GATEID_interned(m);
+}
+
+uint32_t
+GATEID_Ry_interned(fl_t theta)
+{
+    complex_t m[4];
+    m[0] = cmake( flt_cos(theta/2.0), 0.0);
+    m[1] = cmake(-flt_sin(theta/2.0), 0.0);
+    m[2] = cmake( flt_sin(theta/2.0), 0.0);
+    m[3] = cmake( flt_cos(theta/2.0), 0.0);
+    return GATEID_interned(m);
+}
+
+uint32_t
+GATEID_Rz_interned(fl_t theta)
+{
+    complex_t m[4];
+    m[0] = cmake_angle(-theta/2.0, 1);
+    m[1] = czero();
+    m[2] = czero();
+    m[3] = cmake_angle(theta/2.0, 1);
+    return GATEID_interned(m);
+}
+
+uint32_t
+GATEID_Phase_interned(fl_t theta)
+{
+    complex_t m[4];
+    m[0] = cmake(1.0, 0.0);
+    m[1] = cmake(0.0, 0.0);
+    m[2] = cmake(0.0, 0.0);
+    m[3] = cmake_angle(theta, 1);
+    return GATEID_interned(m);
+}
+
+uint32_t
+qmdd_gates_num_interned()
+{
+    return num_interned;
+}
+
+void
+qmdd_gates_clear_interned()
+{
+    // clear cache to invalidate cached results for the re-used gate IDs
+    sylvan_clear_cache();
+    num_interned = 0;
+    memset(interned_index, 0, sizeof(interned_index));
+}
+
+void
+qmdd_gates_release_interned(uint32_t keep)
+{
+    if (keep >= num_interned) return;
+    sylvan_clear_cache();
+    num_interned = keep;
+    interned_gates_init();
+}
+
+/************************** </interned custom gates> **************************/
+
+
 /*************************** <dynamic custom gates> ***************************/
 void
 qmdd_gates_init()
@@ -196,6 +344,9 @@ qmdd_gates_init()
     gates[k][1] = weight_lookup(&dynamic_gate[1]);
     gates[k][2] = weight_lookup(&dynamic_gate[2]);
     gates[k][3] = weight_lookup(&dynamic_gate[3]);
+
+    // re-init interned gates
+    interned_gates_init();
 }
 
 void
@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include <edge_weight_storage/flt.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 typedef uint64_t AMP; // TODO: replace with EVBDD_WGT?
 
 // GATE_ID's (gates are initialized in qmdd_gates_init)
@@ -30,12 +34,16 @@ typedef enum predef_gates {
 
 static const uint64_t num_static_gates  = n_predef_gates+256+256; // predef gates + phase gates
 
+// The gate IDs after the static gates are used for interned gates
+// (see GATEID_interned).
+#define QMDD_MAX_INTERNED_GATES (1<<14)
+
 // 2x2 gates, k := GATEID_U 
 // gates[k][0] = u00 (top left)
 // gates[k][1] = u01 (top right)
 // gates[k][2] = u10 (bottom left)
 // gates[k][3] = u11 (bottom right)
-extern uint64_t gates[n_predef_gates+256+256][4]; // max 2^24 gates atm
+extern uint64_t gates[n_predef_gates+256+256+QMDD_MAX_INTERNED_GATES][4]; // max 2^24 gates atm
 
 void qmdd_gates_init();
 // The next 255 gates are reserved for parameterized phase gates.
@@ -93,4 +101,44 @@ uint32_t GATEID_Phase(fl_t theta);
  */
 uint32_t GATEID_U(fl_t theta, fl_t phi, fl_t lambda);
 
+/**
+ * Interned 2x2 matrix {m00, m01, m10, m11}. Unlike the parametrized gates
+ * above, the returned ID keeps corresponding to this matrix (and results
+ * cached for it stay valid) until qmdd_gates_clear_interned() is called, and
+ * interning the same matrix (up to the tolerance of the edge weight table)
+ * again returns the same ID. So several interned gates can be applied at the
+ * same time, e.g. in concurrent Lace tasks.
+ * NOTE: Interning itself is not thread-safe. Exits if more than
+ * QMDD_MAX_INTERNED_GATES different matrices are interned.
+ */
+uint32_t GATEID_interned(const complex_t *m);
+
+/**
+ * Interned versions of GATEID_Rx, GATEID_Ry, GATEID_Rz and GATEID_Phase.
+ */
+uint32_t GATEID_Rx_interned(fl_t theta);
+uint32_t GATEID_Ry_interned(fl_t theta);
+uint32_t GATEID_Rz_interned(fl_t theta);
+uint32_t GATEID_Phase_interned(fl_t theta);
+
+/**
+ * Returns the number of interned gates.
+ */
+uint32_t qmdd_gates_num_interned();
+
+/**
+ * Forgets all interned gates (so their IDs are re-used) and clears the cache.
+ */
+void qmdd_gates_clear_interned();
+
+/**
+ * Forgets the interned gates from the <keep>-th on (as returned by an earlier
+ * qmdd_gates_num_interned()) and clears the cache.
+ */
+void qmdd_gates_release_interned(uint32_t keep);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
 #endif
@@ -0,0 +1,292 @@
+/**
+ * Copyright 2024 System Verification Lab, LIACS, Leiden University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE // for open_memstream / fmemopen
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <qsylvan_partition.h>
+
+
+/*****************************<Socket transport>*******************************/
+
+static void
+partition_fail(qmdd_partition_t *part, const char *what)
+{
+    fprintf(stderr, "Partition %u: %s failed (%s)\n", part->rank, what, strerror(errno));
+    exit(1);
+}
+
+static void
+write_all(qmdd_partition_t *part, int fd, const void *data, size_t size)
+{
+    const char *p = (const char *) data;
+    while (size > 0) {
+        // MSG_NOSIGNAL: get EPIPE instead of SIGPIPE if the other side died
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) partition_fail(part, "send");
+        p += n;
+        size -= n;
+    }
+}
+
+static void
+read_all(qmdd_partition_t *part, int fd, void *data, size_t size)
+{
+    char *p = (char *) data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) errno = ECONNRESET;
+        if (n <= 0) partition_fail(part, "recv");
+        p += n;
+        size -= n;
+    }
+}
+
+/**
+ * Sends <q> as a binary EVBDD file, preceded by its size.
+ */
+static void
+send_qmdd(qmdd_partition_t *part, int fd, QMDD q)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&buf, &size);
+    if (f == NULL) partition_fail(part, "open_memstream");
+    if (evbdd_writer_tobinary(f, &q, 1) != 0) partition_fail(part, "evbdd_writer_tobinary");
+    fclose(f);
+    uint64_t len = size;
+    write_all(part, fd, &len, sizeof(len));
+    write_all(part, fd, buf, size);
+    free(buf);
+    part->bytes_sent += sizeof(len) + size;
+}
+
+static QMDD
+recv_qmdd(qmdd_partition_t *part, int fd)
+{
+    uint64_t len;
+    read_all(part, fd, &len, sizeof(len));
+    char *buf = malloc(len);
+    read_all(part, fd, buf, len);
+    part->bytes_received += sizeof(len) + len;
+    QMDD q;
+    FILE *f = fmemopen(buf, len, "r");
+    if (f == NULL) partition_fail(part, "fmemopen");
+    if (evbdd_reader_frombinary(f, &q, 1) != 0) partition_fail(part, "evbdd_reader_frombinary");
+    fclose(f);
+    free(buf);
+    return q;
+}
+
+/****************************</Socket transport>*******************************/
+
+
+/*************************<Partitioned simulation>*****************************/
+
+qmdd_partition_t *
+qmdd_partition_fork(BDDVAR nqubits, BDDVAR k)
+{
+    qmdd_partition_t *part = calloc(1, sizeof(qmdd_partition_t));
+    part->nqubits = nqubits;
+    part->k = k;
+    part->nranks = 1u << k;
+    part->peer = malloc(sizeof(int) * k);
+    part->ctrl = malloc(sizeof(int) * part->nranks);
+    part->pids = malloc(sizeof(int) * part->nranks);
+
+    // pairs[(g * nranks + r) * 2 + side] for every r with bit g = 0, side 0 for
+    // rank r and side 1 for rank r | (1 << g)
+    uint32_t npairs = k * part->nranks;
+    int *pairs = malloc(sizeof(int) * 2 * npairs);
+    int *ctrls = malloc(sizeof(int) * 2 * part->nranks);
+    for (BDDVAR g = 0; g < k; g++) {
+        for (uint32_t r = 0; r < part->nranks; r++) {
+            int *sv = &pairs[(g * part->nranks + r) * 2];
+            sv[0] = sv[1] = -1;
+            if ((r >> g) & 1) continue;
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) partition_fail(part, "socketpair");
+        }
+    }
+    ctrls[0] = ctrls[1] = -1;
+    for (uint32_t r = 1; r < part->nranks; r++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, &ctrls[2*r]) != 0) partition_fail(part, "socketpair");
+    }
+
+    // don't let the children flush the buffered output of the parent again
+    fflush(stdout);
+    fflush(stderr);
+    part->rank = 0;
+    for (uint32_t r = 1; r < part->nranks; r++) {
+        pid_t pid = fork();
+        if (pid < 0) partition_fail(part, "fork");
+        if (pid == 0) {
+            part->rank = r;
+            break;
+        }
+        part->pids[r] = pid;
+    }
+
+    // keep only the sockets of this rank
+    for (BDDVAR g = 0; g < k; g++) {
+        for (uint32_t r = 0; r < part->nranks; r++) {
+            if ((r >> g) & 1) continue;
+            int *sv = &pairs[(g * part->nranks + r) * 2];
+            if (part->rank == r) {
+                part->peer[g] = sv[0];
+                close(sv[1]);
+            }
+            else if (part->rank == (r | (1u << g))) {
+                part->peer[g] = sv[1];
+                close(sv[0]);
+            }
+            else {
+                close(sv[0]);
+                close(sv[1]);
+            }
+        }
+    }
+    for (uint32_t r = 1; r < part->nranks; r++) {
+        if (part->rank == 0) {
+            part->ctrl[r] = ctrls[2*r];
+            close(ctrls[2*r+1]);
+        }
+        else if (part->rank == r) {
+            part->ctrl[0] = ctrls[2*r+1];
+            close(ctrls[2*r]);
+        }
+        else {
+            close(ctrls[2*r]);
+            close(ctrls[2*r+1]);
+        }
+    }
+    free(pairs);
+    free(ctrls);
+    return part;
+}
+
+int
+qmdd_partition_finish(qmdd_partition_t *part)
+{
+    int res = 0;
+    for (BDDVAR g = 0; g < part->k; g++) close(part->peer[g]);
+    if (part->rank == 0) {
+        for (uint32_t r = 1; r < part->nranks; r++) close(part->ctrl[r]);
+        for (uint32_t r = 1; r < part->nranks; r++) {
+            int status;
+            if (waitpid(part->pids[r], &status, 0) != part->pids[r] ||
+                !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                res = -1;
+            }
+        }
+    }
+    else {
+        close(part->ctrl[0]);
+    }
+    free(part->peer);
+    free(part->ctrl);
+    free(part->pids);
+    free(part);
+    return res;
+}
+
+QMDD
+qmdd_partition_project(qmdd_partition_t *part, QMDD state)
+{
+    evbdd_refs_pushptr(&state);
+    for (BDDVAR g = 0; g < part->k; g++) {
+        // set the amplitudes with q_g != bit g of rank to 0
+        bool b = (part->rank >> g) & 1;
+        MTBDD other = mtbdd_refs_push(b ? sylvan_nithvar(g) : sylvan_ithvar(g));
+        state = qmdd_apply_diagonal(state, other, EVBDD_ZERO);
+        mtbdd_refs_pop(1);
+    }
+    evbdd_refs_popptr(1);
+    return state;
+}
+
+QMDD
+qmdd_partition_exchange(qmdd_partition_t *part, QMDD state, BDDVAR g)
+{
+    bool b = (part->rank >> g) & 1;
+    int fd = part->peer[g];
+
+    // qmdd_apply_diagonal can gc the edge weight table, which only updates
+    // the weights of protected QMDDs
+    QMDD zero = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    QMDD mine = zero, theirs = zero, received = zero;
+    evbdd_protect(&state);
+    evbdd_protect(&mine);
+    evbdd_protect(&theirs);
+    evbdd_protect(&received);
+    MTBDD is_b = mtbdd_refs_push(b ? sylvan_ithvar(g) : sylvan_nithvar(g));
+    MTBDD not_b = mtbdd_refs_push(sylvan_not(is_b));
+    mine = qmdd_apply_diagonal(state, not_b, EVBDD_ZERO);
+    theirs = qmdd_apply_diagonal(state, is_b, EVBDD_ZERO);
+
+    // the rank with q_g = 0 sends first, so the two never block each other
+    if (!b) {
+        send_qmdd(part, fd, theirs);
+        received = recv_qmdd(part, fd);
+    }
+    else {
+        received = recv_qmdd(part, fd);
+        send_qmdd(part, fd, theirs);
+    }
+    QMDD res = evbdd_plus(mine, received);
+    evbdd_unprotect(&state);
+    evbdd_unprotect(&mine);
+    evbdd_unprotect(&theirs);
+    evbdd_unprotect(&received);
+    mtbdd_refs_pop(2);
+    part->exchanges++;
+    return res;
+}
+
+void
+qmdd_partition_gather(qmdd_partition_t *part, const void *data, void *all, size_t size)
+{
+    if (part->rank == 0) {
+        memcpy(all, data, size);
+        for (uint32_t r = 1; r < part->nranks; r++) {
+            read_all(part, part->ctrl[r], (char *) all + r * size, size);
+        }
+    }
+    else {
+        write_all(part, part->ctrl[0], data, size);
+    }
+}
+
+void
+qmdd_partition_bcast(qmdd_partition_t *part, void *data, size_t size)
+{
+    if (part->rank == 0) {
+        for (uint32_t r = 1; r < part->nranks; r++) {
+            write_all(part, part->ctrl[r], data, size);
+        }
+    }
+    else {
+        read_all(part, part->ctrl[0], data, size);
+    }
+}
+
+/*************************</Partitioned simulation>****************************/
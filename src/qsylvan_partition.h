@@ -0,0 +1,106 @@
+/**
+ * Copyright 2024 System Verification Lab, LIACS, Leiden University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef QSYLVAN_PARTITION_H
+#define QSYLVAN_PARTITION_H
+
+#include <qsylvan_simulator.h>
+
+#ifdef __cplusplus
+namespace sylvan {
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*************************<Partitioned simulation>*****************************/
+
+/**
+ * Shared-nothing simulation of an n-qubit state over 2^k local processes.
+ *
+ * The state is split on the top k qubits (q_0 .. q_k-1): process r (its rank)
+ * owns the amplitudes of the basis states with q_g = bit g of r, i.e. its
+ * part of the state is P_r |psi>, stored as an ordinary n-qubit QMDD in its
+ * own node and edge weight tables. Since the top k levels of such a QMDD are a
+ * single path, gates can be applied with the usual qmdd_gate / qmdd_cgate
+ * kernels, and controls on q_0 .. q_k-1 simply act on the fixed value.
+ *
+ * After a gate which (non-diagonally) changes partitioned qubit q_g, part of
+ * the local state has q_g flipped and belongs to the partner rank r ^ (1 << g).
+ * qmdd_partition_exchange() swaps this part out to the partner and swaps in
+ * the part the partner computed for this rank. The parts are sent as binary
+ * EVBDD files (see evbdd_writer_tobinary) over Unix-domain sockets, so only
+ * the nodes of the exchanged sub-QMDDs are transferred.
+ */
+typedef struct qmdd_partition_s {
+    BDDVAR nqubits;
+    BDDVAR k;               // number of partitioned (top) qubits
+    uint32_t rank;          // bit g of rank is the value of q_g
+    uint32_t nranks;        // 2^k
+    int *peer;              // peer[g]: socket to rank ^ (1 << g)
+    int *ctrl;              // rank 0: ctrl[r] socket to rank r, else ctrl[0]
+    int *pids;              // rank 0: process ids of the other ranks
+    uint64_t exchanges;     // number of exchanges with a partner
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+} qmdd_partition_t;
+
+/**
+ * Creates the sockets and forks 2^k - 1 processes, and returns (in every
+ * process) its partition with its own rank. The calling process gets rank 0.
+ * Should be called before lace_start() and sylvan_init_package(), every
+ * process then initializes its own Lace workers and tables.
+ */
+qmdd_partition_t *qmdd_partition_fork(BDDVAR nqubits, BDDVAR k);
+
+/**
+ * Waits for the other processes (rank 0) and frees the partition. Returns 0 if
+ * all processes exited normally, -1 otherwise.
+ */
+int qmdd_partition_finish(qmdd_partition_t *part);
+
+/**
+ * Returns the part P_r |psi> of the given (full) state owned by this rank,
+ * e.g. to start from qmdd_create_all_zero_state().
+ */
+QMDD qmdd_partition_project(qmdd_partition_t *part, QMDD state);
+
+/**
+ * Sends the part of the local state with q_g flipped to the partner rank and
+ * adds the part received from it. Every rank has to call this (collectively)
+ * after a gate on q_g. Exits the process if the partner can not be reached.
+ */
+QMDD qmdd_partition_exchange(qmdd_partition_t *part, QMDD state, BDDVAR g);
+
+/**
+ * Collects <size> bytes of <data> of every rank at rank 0, in <all> (which
+ * should have room for nranks * size bytes, only used at rank 0).
+ */
+void qmdd_partition_gather(qmdd_partition_t *part, const void *data, void *all, size_t size);
+
+/**
+ * Sends <size> bytes of <data> from rank 0 to all other ranks.
+ */
+void qmdd_partition_bcast(qmdd_partition_t *part, void *data, size_t size);
+
+/*************************</Partitioned simulation>****************************/
+
+#ifdef __cplusplus
+}
+}
+#endif /* __cplusplus */
+
+#endif
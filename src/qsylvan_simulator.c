@@ -16,7 +16,10 @@
  */
 
 #include <qsylvan_simulator.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <sys/time.h>
+#include <sylvan_sl.h>
 
 static bool testing_mode = 0; // turns on/off (expensive) sanity checks
 static int granularity = 1; // operation cache access granularity
@@ -63,6 +66,8 @@ GATE_OPID_64(uint32_t gateid, BDDVAR a, BDDVAR b, BDDVAR c, BDDVAR d, BDDVAR e)
 void
 qsylvan_init_simulator(size_t min_tablesize, size_t max_tablesize, double wgt_tab_tolerance, int edge_weigth_backend, int norm_strat)
 {
+    // (gates interned before a previous sylvan_quit() are not re-initialized)
+    qmdd_gates_clear_interned();
     sylvan_init_evbdd(min_tablesize, max_tablesize, wgt_tab_tolerance, edge_weigth_backend, norm_strat, &qmdd_gates_init);
 }
 
@@ -305,19 +310,213 @@ qmdd_create_all_control_phase(BDDVAR n, bool *x)
 
 
 
+/*****************************<Dense leaf blocks>******************************/
+
+static BDDVAR dense_nqubits = 0;
+static BDDVAR dense_max_levels = 0;     // 0 = dense blocks disabled
+static double dense_min_density = 1.0;
+// read by concurrent gates, updated by qmdd_do_before_gate
+static _Atomic(BDDVAR) dense_level = EVBDD_INVALID_VAR; // no dense blocks (at the moment)
+static _Atomic(uint64_t) dense_gates = 0;
+static uint64_t dense_blocks = 0;
+
+void
+qmdd_set_dense_blocks(BDDVAR nqubits, BDDVAR k, double min_density)
+{
+    if (k > QMDD_DENSE_MAX_LEVELS) k = QMDD_DENSE_MAX_LEVELS;
+    dense_nqubits = nqubits;
+    dense_max_levels = k;
+    dense_min_density = min_density;
+    dense_level = EVBDD_INVALID_VAR;
+    dense_gates = 0;
+    dense_blocks = 0;
+}
+
+void
+qmdd_get_dense_block_stats(BDDVAR *level, uint64_t *blocks)
+{
+    BDDVAR l = dense_level;
+    *level = (l == EVBDD_INVALID_VAR) ? dense_nqubits : l;
+    *blocks = dense_blocks;
+}
+
+/**
+ * Sets dense_level to the smallest level >= nqubits - k such that every level
+ * below it is at least dense_min_density "complete". A state with nodes below
+ * level nqubits - 1 (i.e. with more qubits) gets no dense blocks.
+ */
+static void
+qmdd_dense_update_level(QMDD qmdd)
+{
+    BDDVAR n = dense_nqubits;
+    uint64_t *counts = malloc(sizeof(uint64_t) * (n + 1));
+    evbdd_countnodes_levels(qmdd, counts, 0, n);
+    if (counts[n] > 0) {
+        dense_level = EVBDD_INVALID_VAR;
+        free(counts);
+        return;
+    }
+
+    BDDVAR first = (dense_max_levels < n) ? n - dense_max_levels : 0;
+    BDDVAR level = n - 1;
+    while (level > first && counts[level-1] > 0 &&
+           counts[level] >= 2.0 * dense_min_density * counts[level-1]) {
+        level--;
+    }
+    dense_level = (level + 2 <= n) ? level : EVBDD_INVALID_VAR;
+    free(counts);
+}
+
+/**
+ * Writes the amplitudes of q (times acc) in re/im. Level var is the most
+ * significant bit of the index, so the low half of a (sub)block comes first.
+ * Returns false if q has nodes at or below level nqubits (the state has more
+ * qubits than the dense blocks are set up for). Levels skipped above the
+ * terminal are expanded as copies, which is correct for states with fewer
+ * qubits too (qmdd_dense_build merges them again).
+ */
+static bool
+qmdd_dense_expand(QMDD q, BDDVAR var, BDDVAR nqubits, complex_t acc, fl_t *re, fl_t *im, uint64_t index)
+{
+    // the arrays are zero initialized
+    if (EVBDD_WEIGHT(q) == EVBDD_ZERO) return true;
+    complex_t w;
+    weight_value(EVBDD_WEIGHT(q), &w);
+    acc = cmul(acc, w);
+
+    if (var == nqubits) {
+        if (EVBDD_TARGET(q) != EVBDD_TERMINAL) return false;
+        re[index] = acc.r;
+        im[index] = acc.i;
+        return true;
+    }
+
+    BDDVAR topvar;
+    QMDD low, high;
+    evbdd_get_topvar(q, var, &topvar, &low, &high);
+    return qmdd_dense_expand(low,  var+1, nqubits, acc, re, im, 2*index) &&
+           qmdd_dense_expand(high, var+1, nqubits, acc, re, im, 2*index + 1);
+}
+
+/**
+ * Applies the single qubit gate u to every pair of amplitudes which are
+ * <stride> apart. The real and imaginary parts are kept in separate arrays
+ * so the inner loop vectorizes (for stride >= the vector width).
+ */
+static void
+qmdd_dense_kernel(fl_t *restrict re, fl_t *restrict im, uint64_t size, uint64_t stride, const complex_t *u)
+{
+    const fl_t u00r = u[0].r, u00i = u[0].i, u01r = u[1].r, u01i = u[1].i;
+    const fl_t u10r = u[2].r, u10i = u[2].i, u11r = u[3].r, u11i = u[3].i;
+    for (uint64_t base = 0; base < size; base += 2*stride) {
+        fl_t *restrict re0 = re + base, *restrict re1 = re + base + stride;
+        fl_t *restrict im0 = im + base, *restrict im1 = im + base + stride;
+        for (uint64_t j = 0; j < stride; j++) {
+            const fl_t ar = re0[j], ai = im0[j], br = re1[j], bi = im1[j];
+            re0[j] = u00r*ar - u00i*ai + u01r*br - u01i*bi;
+            im0[j] = u00r*ai + u00i*ar + u01r*bi + u01i*br;
+            re1[j] = u10r*ar - u10i*ai + u11r*br - u11i*bi;
+            im1[j] = u10r*ai + u10i*ar + u11r*bi + u11i*br;
+        }
+    }
+}
+
+/**
+ * Builds the QMDD for the 2^(nqubits-var) amplitudes in re/im.
+ */
+static QMDD
+qmdd_dense_build(const fl_t *re, const fl_t *im, BDDVAR var, BDDVAR nqubits)
+{
+    if (var == nqubits) {
+        if (re[0] == 0 && im[0] == 0) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+        complex_t c = cmake(re[0], im[0]);
+        return evbdd_bundle(EVBDD_TERMINAL, weight_lookup(&c));
+    }
+    uint64_t half = 1ULL << (nqubits - var - 1);
+    QMDD low = evbdd_refs_push(qmdd_dense_build(re, im, var+1, nqubits));
+    QMDD high = qmdd_dense_build(re + half, im + half, var+1, nqubits);
+    evbdd_refs_pop(1);
+    return evbdd_makenode(var, low, high);
+}
+
+/**
+ * Applies gate to the target level (< nqubits) of the (root weight 1) block
+ * rooted at node q at level var, with the result in *res. Returns false
+ * (and leaves *res alone) if the block is deeper than nqubits - var levels.
+ */
+static bool
+qmdd_dense_block_gate(EVBDD_TARG q, gate_id_t gate, BDDVAR var, BDDVAR target, BDDVAR n, QMDD *res)
+{
+    uint64_t size = 1ULL << (n - var);
+    fl_t *re = calloc(2*size, sizeof(fl_t));
+    fl_t *im = re + size;
+    if (!qmdd_dense_expand(evbdd_bundle(q, EVBDD_ONE), var, n, cmake(1.0, 0.0), re, im, 0)) {
+        free(re);
+        return false;
+    }
+
+    complex_t u[4];
+    for (int i = 0; i < 4; i++) weight_value(gates[gate][i], &u[i]);
+    qmdd_dense_kernel(re, im, size, 1ULL << (n - 1 - target), u);
+
+    *res = qmdd_dense_build(re, im, var, n);
+    free(re);
+    __sync_fetch_and_add(&dense_blocks, 1);
+    return true;
+}
+
+/****************************</Dense leaf blocks>*****************************/
+
+
+
+
+
 /*******************************<Applying gates>*******************************/
 
 static int periodic_gc_nodetable = 0; // trigger for gc of node table
 static uint64_t gate_counter = 0;
 
+// Current qubit order (NULL = identity), see "Dynamic qubit reordering"
+static BDDVAR *qubit_level = NULL;  // qubit -> level (var in the QMDD)
+static BDDVAR *level_qubit = NULL;  // level -> qubit
+static BDDVAR reorder_nqubits = 0;
+static double reorder_growth = 0;   // auto sifting when nodes > growth * last
+static uint64_t reorder_last_nodes = 0;
+static bool reorder_suspended = false;
+
+// Approximate simulation, see "Approximate simulation"
+static BDDVAR approx_nqubits = 0;
+static uint64_t approx_max_nodes = 0;
+static double approx_max_wgt_fill = 0;
+static double approx_round_fidelity = 1.0;
+static double approx_fidelity_floor = 1.0;
+static double approx_fidelity = 1.0;
+static uint64_t approx_rounds = 0;
+static uint64_t reorder_sifts = 0;
+static uint64_t reorder_swaps = 0;
+static double reorder_time = 0;
+
+static inline BDDVAR
+qmdd_level_of(BDDVAR qubit)
+{
+    if (qubit_level == NULL || qubit == EVBDD_INVALID_VAR) return qubit;
+    return qubit_level[qubit];
+}
+
+static void qmdd_approximate_if_needed(QMDD *qmdd);
+
 static void
-qmdd_do_before_gate(QMDD* qmdd)
+qmdd_gc_before_gate(QMDD* qmdd)
 {
-    // check if ctable needs gc
-    if (evbdd_test_gc_wgt_table()) {
+    // the result is discarded anyway after an out-of-memory
+    if (evbdd_out_of_memory()) return;
+
+    // check if ctable needs gc (not while concurrent gates may be running)
+    if (evbdd_get_auto_gc_wgt_table() && evbdd_test_gc_wgt_table()) {
         evbdd_protect(qmdd);
         evbdd_gc_wgt_table();
         evbdd_unprotect(qmdd);
+        if (evbdd_budget_thrashing(EVBDD_OOM_WGTS)) evbdd_signal_out_of_memory(EVBDD_OOM_WGTS);
     }
 
     if (periodic_gc_nodetable) {
@@ -328,6 +527,28 @@ qmdd_do_before_gate(QMDD* qmdd)
             evbdd_unprotect(qmdd);
         }
     }
+}
+
+static void
+qmdd_do_before_gate(QMDD* qmdd)
+{
+    // prune the state if it has grown too large
+    if (approx_nqubits != 0) qmdd_approximate_if_needed(qmdd);
+
+    qmdd_gc_before_gate(qmdd);
+
+    // sift if the state has grown too much since the last reordering
+    if (reorder_growth > 0 && !reorder_suspended) {
+        uint64_t nodes = evbdd_countnodes(*qmdd);
+        if (nodes > QMDD_REORDER_MIN_NODES && nodes > reorder_growth * reorder_last_nodes) {
+            *qmdd = qmdd_sift(*qmdd);
+        }
+    }
+
+    // pick the level below which gates are applied on dense blocks
+    if (dense_max_levels != 0 && (dense_gates++ % QMDD_DENSE_RECHECK) == 0) {
+        qmdd_dense_update_level(*qmdd);
+    }
 
     // log stuff (if logging is enabled)
     qmdd_stats_log(*qmdd);
@@ -344,7 +565,7 @@ static bool
 check_ctrls_before_targ(BDDVAR *c1, BDDVAR *c2, BDDVAR *c3, BDDVAR t)
 {
     // sort controls
-    if (*c1 > *c3) swap(c1, c2);
+    if (*c1 > *c3) swap(c1, c3);
     if (*c1 > *c2) swap(c1, c2);
     if (*c2 > *c3) swap(c2, c3);
 
@@ -359,6 +580,7 @@ check_ctrls_before_targ(BDDVAR *c1, BDDVAR *c2, BDDVAR *c3, BDDVAR t)
 TASK_IMPL_3(QMDD, qmdd_gate, QMDD, qmdd, gate_id_t, gate, BDDVAR, target)
 {
     qmdd_do_before_gate(&qmdd);
+    target = qmdd_level_of(target);
     evbdd_refs_push(qmdd);
     QMDD res = qmdd_gate_rec(qmdd, gate, target);
     evbdd_refs_pop(1);
@@ -368,6 +590,11 @@ TASK_IMPL_3(QMDD, qmdd_gate, QMDD, qmdd, gate_id_t, gate, BDDVAR, target)
 /* Wrapper for applying controlled gates with 1, 2, or 3 control qubits. */
 QMDD _qmdd_cgate(QMDD state, gate_id_t gate, BDDVAR c1, BDDVAR c2, BDDVAR c3, BDDVAR t, BDDVAR n)
 {
+    if (qubit_level != NULL) {
+        // qubits are mapped to levels (and sorted) after possible reordering
+        BDDVAR cs[4] = {c1, c2, c3, EVBDD_INVALID_VAR};
+        return RUN(qmdd_cgate, state, gate, cs, t);
+    }
     if (check_ctrls_before_targ(&c1, &c2, &c3, t)) {
         BDDVAR cs[4] = {c1, c2, c3, EVBDD_INVALID_VAR}; // last pos is to mark end
         return RUN(qmdd_cgate, state, gate, cs, t);//qmdd_cgate_rec(state, gate, cs, t);
@@ -381,6 +608,21 @@ QMDD _qmdd_cgate(QMDD state, gate_id_t gate, BDDVAR c1, BDDVAR c2, BDDVAR c3, BD
 TASK_IMPL_4(QMDD, qmdd_cgate, QMDD, state, gate_id_t, gate, BDDVAR*, cs, BDDVAR, t)
 {
     qmdd_do_before_gate(&state);
+    if (qubit_level != NULL) {
+        BDDVAR c1 = qmdd_level_of(cs[0]);
+        BDDVAR c2 = (cs[0] == EVBDD_INVALID_VAR) ? EVBDD_INVALID_VAR : qmdd_level_of(cs[1]);
+        BDDVAR c3 = (c2 == EVBDD_INVALID_VAR) ? EVBDD_INVALID_VAR : qmdd_level_of(cs[2]);
+        t = qmdd_level_of(t);
+        if (!check_ctrls_before_targ(&c1, &c2, &c3, t)) {
+            QMDD gate_matrix = _qmdd_create_cgate(reorder_nqubits, c1, c2, c3, t, gate);
+            return evbdd_matvec_mult(gate_matrix, state, reorder_nqubits);
+        }
+        BDDVAR mapped[4] = {c1, c2, c3, EVBDD_INVALID_VAR};
+        evbdd_refs_push(state);
+        QMDD res = qmdd_cgate_rec(state, gate, mapped, t);
+        evbdd_refs_pop(1);
+        return res;
+    }
     evbdd_refs_push(state);
     QMDD res = qmdd_cgate_rec(state, gate, cs, t);
     evbdd_refs_pop(1);
@@ -390,6 +632,8 @@ TASK_IMPL_4(QMDD, qmdd_cgate, QMDD, state, gate_id_t, gate, BDDVAR*, cs, BDDVAR,
 /* Wrapper for applying a controlled gate where the controls are a range. */
 TASK_IMPL_5(QMDD, qmdd_cgate_range, QMDD, qmdd, gate_id_t, gate, BDDVAR, c_first, BDDVAR, c_last, BDDVAR, t)
 {
+    // (a range of qubits is generally not a range of levels after reordering)
+    assert(qubit_level == NULL && "qmdd_cgate_range does not support qubit reordering");
     qmdd_do_before_gate(&qmdd);
     return qmdd_cgate_range_rec(qmdd,gate,c_first,c_last,t);
 }
@@ -416,7 +660,12 @@ TASK_IMPL_3(QMDD, qmdd_gate_rec, QMDD, q, gate_id_t, gate, BDDVAR, target)
         }
     }
 
-    if (var == target) {
+    BDDVAR n = dense_nqubits;
+    if (var >= dense_level && target < n &&
+        qmdd_dense_block_gate(EVBDD_TARGET(q), gate, var, target, n, &res)) {
+        // applied on the dense block
+    }
+    else if (var == target) {
         AMP a_u00 = wgt_mul(EVBDD_WEIGHT(low), gates[gate][0]);
         AMP a_u10 = wgt_mul(EVBDD_WEIGHT(low), gates[gate][2]);
         AMP b_u01 = wgt_mul(EVBDD_WEIGHT(high), gates[gate][1]);
@@ -809,6 +1058,93 @@ qmdd_all_control_phase(QMDD qmdd, BDDVAR n, bool *x)
     return qmdd_all_control_phase_rec(qmdd, 0, n, x);
 }
 
+TASK_DECL_3(QMDD, qmdd_apply_diagonal_rec, QMDD, MTBDD, AMP);
+#define qmdd_apply_diagonal_rec(q,f,phase) (RUN(qmdd_apply_diagonal_rec,q,f,phase))
+TASK_IMPL_3(QMDD, qmdd_apply_diagonal_rec, QMDD, q, MTBDD, f, AMP, phase)
+{
+    // Trivial cases
+    if (f == mtbdd_false) return q;
+    if (EVBDD_WEIGHT(q) == EVBDD_ZERO) return q;
+    if (f == mtbdd_true) {
+        AMP w = wgt_mul(EVBDD_WEIGHT(q), phase);
+        // (phase = 0 can be used to project out the part where f holds)
+        if (w == EVBDD_ZERO) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+        return evbdd_bundle(EVBDD_TARGET(q), w);
+    }
+    if (mtbdd_isleaf(f)) {
+        assert(mtbdd_gettype(f) == 1);
+        complex_t c = cmake_angle(mtbdd_getdouble(f), 1.0);
+        AMP w = weight_lookup(&c);
+        return evbdd_bundle(EVBDD_TARGET(q), wgt_mul(EVBDD_WEIGHT(q), w));
+    }
+
+    // (q is expanded at the top var of f if it skips it)
+    BDDVAR var;
+    QMDD res, low, high;
+    evbdd_get_topvar(q, mtbdd_getvar(f), &var, &low, &high);
+    MTBDD f0 = f, f1 = f;
+    if (mtbdd_getvar(f) == var) {
+        f0 = mtbdd_getlow(f);
+        f1 = mtbdd_gethigh(f);
+    }
+
+    // Check cache
+    bool cachenow = ((var % granularity) == 0);
+    if (cachenow) {
+        if (cache_get3(CACHE_QMDD_DIAGONAL, EVBDD_TARGET(q), f, phase, &res)) {
+            sylvan_stats_count(QMDD_DIAGONAL_CACHED);
+            // Multiply root of res with root of input qmdd
+            return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(q), EVBDD_WEIGHT(res)));
+        }
+    }
+
+    evbdd_refs_spawn(SPAWN(qmdd_apply_diagonal_rec, high, f1, phase));
+    low = evbdd_refs_push(CALL(qmdd_apply_diagonal_rec, low, f0, phase));
+    high = evbdd_refs_sync(SYNC(qmdd_apply_diagonal_rec));
+    evbdd_refs_pop(1);
+    res = evbdd_makenode(var, low, high);
+
+    // Store not yet "root normalized" result in cache
+    if (cachenow) {
+        if (cache_put3(CACHE_QMDD_DIAGONAL, EVBDD_TARGET(q), f, phase, res))
+            sylvan_stats_count(QMDD_DIAGONAL_CACHEDPUT);
+    }
+    // Multiply amp res with amp of input qmdd
+    return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(q), EVBDD_WEIGHT(res)));
+}
+
+TASK_IMPL_3(QMDD, qmdd_apply_diagonal, QMDD, qmdd, MTBDD, f, AMP, phase)
+{
+    sylvan_stats_count(QMDD_DIAGONAL);
+    mtbdd_refs_push(f);
+    // (the edge weight table might be rebuilt, which invalidates phase)
+    complex_t c;
+    weight_value(phase, &c);
+    qmdd_do_before_gate(&qmdd);
+    phase = weight_lookup(&c);
+    if (qubit_level != NULL) {
+        // the variables of f are qubits, rename them to their current level
+        MTBDDMAP map = mtbdd_map_empty();
+        MTBDD support = mtbdd_support(f);
+        mtbdd_refs_pushptr(&map);
+        mtbdd_refs_pushptr(&support);
+        for (MTBDD s = support; s != mtbdd_true; s = mtbdd_gethigh(s)) {
+            BDDVAR k = mtbdd_getvar(s);
+            MTBDD v = mtbdd_refs_push(mtbdd_ithvar(qmdd_level_of(k)));
+            map = mtbdd_map_add(map, k, v);
+            mtbdd_refs_pop(1);
+        }
+        f = mtbdd_compose(f, map);
+        mtbdd_refs_popptr(2);
+        mtbdd_refs_push(f);
+    }
+    evbdd_refs_push(qmdd);
+    QMDD res = qmdd_apply_diagonal_rec(qmdd, f, phase);
+    evbdd_refs_pop(1);
+    mtbdd_refs_pop(qubit_level != NULL ? 2 : 1);
+    return res;
+}
+
 /********************</Applying (controlled) sub-circuits>*********************/
 
 
@@ -817,18 +1153,39 @@ qmdd_all_control_phase(QMDD qmdd, BDDVAR n, bool *x)
 
 /***********************<Measurements and probabilities>***********************/
 
+static QMDD qmdd_measure_q0_with(QMDD qmdd, BDDVAR nvars, double rnd, int *m, double *p);
+
 QMDD
 qmdd_measure_qubit(QMDD qmdd, BDDVAR k, BDDVAR nvars, int *m, double *p)
 {
-    if (k == 0) return qmdd_measure_q0(qmdd, nvars, m, p);
-    qmdd = qmdd_circuit_swap(qmdd, 0, k);
-    qmdd = qmdd_measure_q0(qmdd, nvars, m, p);
-    qmdd = qmdd_circuit_swap(qmdd, 0, k);
+    float rnd = ((float)rand())/((float)RAND_MAX);
+    return qmdd_measure_qubit_with(qmdd, k, nvars, rnd, m, p);
+}
+
+QMDD
+qmdd_measure_qubit_with(QMDD qmdd, BDDVAR k, BDDVAR nvars, double rnd, int *m, double *p)
+{
+    // qubit which is currently at the top level
+    BDDVAR top = (level_qubit == NULL) ? 0 : level_qubit[0];
+    if (k == top) return qmdd_measure_q0_with(qmdd, nvars, rnd, m, p);
+    bool suspended = reorder_suspended;
+    reorder_suspended = true;
+    qmdd = qmdd_circuit_swap(qmdd, top, k);
+    qmdd = qmdd_measure_q0_with(qmdd, nvars, rnd, m, p);
+    qmdd = qmdd_circuit_swap(qmdd, top, k);
+    reorder_suspended = suspended;
     return qmdd;
 }
 
 QMDD
 qmdd_measure_q0(QMDD qmdd, BDDVAR nvars, int *m, double *p)
+{
+    float rnd = ((float)rand())/((float)RAND_MAX);
+    return qmdd_measure_q0_with(qmdd, nvars, rnd, m, p);
+}
+
+static QMDD
+qmdd_measure_q0_with(QMDD qmdd, BDDVAR nvars, double rnd, int *m, double *p)
 {  
     // get probabilities for q0 = |0> and q0 = |1>
     double prob_low, prob_high, prob_root;
@@ -851,7 +1208,6 @@ qmdd_measure_q0(QMDD qmdd, BDDVAR nvars, int *m, double *p)
     }
 
     // flip a coin
-    float rnd = ((float)rand())/((float)RAND_MAX);
     *m = (rnd < prob_low) ? 0 : 1;
     *p = prob_low;
 
@@ -942,6 +1298,14 @@ qmdd_measure_all(QMDD qmdd, BDDVAR n, bool* ms, double *p)
         // add node to unique table
         prev = evbdd_makenode(k, low, high);
     }
+
+    // report outcomes in qubit order (ms is in level order above)
+    if (level_qubit != NULL) {
+        bool *levels = malloc(sizeof(bool) * n);
+        memcpy(levels, ms, sizeof(bool) * n);
+        for (BDDVAR k = 0; k < n; k++) ms[level_qubit[k]] = levels[k];
+        free(levels);
+    }
     return prev;
 }
 
@@ -1000,67 +1364,1775 @@ qmdd_get_amplitude(QMDD q, bool *x, BDDVAR nqubits)
 {
     // QMDD is indexed q_0, ..., q_{n-1} but |x> is assumed q_{n-1}, ..., q_0,
     // so we temporarily reverse x.
-    reverse_bit_array(x, nqubits);
     complex_t res;
+    if (level_qubit != NULL) {
+        bool *levels = malloc(sizeof(bool) * nqubits);
+        for (BDDVAR k = 0; k < nqubits; k++) levels[k] = x[nqubits-1 - level_qubit[k]];
+        weight_value(evbdd_getvalue(q, levels), &res);
+        free(levels);
+        return res;
+    }
+    reverse_bit_array(x, nqubits);
     weight_value(evbdd_getvalue(q, x), &res);
     reverse_bit_array(x, nqubits);
     return res;
 }
 
-double
-qmdd_amp_to_prob(AMP a)
+typedef struct qmdd_amp_query_s {
+    const bool *x;
+    uint64_t index; // position in input / output array
+    BDDVAR nqubits;
+} qmdd_amp_query_t;
+
+// Bit of q_k in query (x is q_{n-1}, ..., q_0)
+static inline bool
+qmdd_amp_query_bit(const qmdd_amp_query_t *query, BDDVAR k)
 {
-    complex_t c;
-    weight_value(a, &c);
-    double abs = flt_sqrt( c.r*c.r + c.i*c.i );
-    return (abs*abs);
+    return query->x[query->nqubits - 1 - k];
 }
 
-AMP
-qmdd_amp_from_prob(double a)
+// Lexicographic order on (q_0, q_1, ..., q_{n-1})
+static int
+qmdd_amp_query_cmp(const void *a, const void *b)
 {
-    complex_t c;
-    c.r = flt_sqrt(a);
-    c.i = 0;
-    return weight_lookup(&c);
+    const qmdd_amp_query_t *qa = (const qmdd_amp_query_t *) a;
+    const qmdd_amp_query_t *qb = (const qmdd_amp_query_t *) b;
+    for (BDDVAR k = 0; k < qa->nqubits; k++) {
+        bool ba = qmdd_amp_query_bit(qa, k);
+        bool bb = qmdd_amp_query_bit(qb, k);
+        if (ba != bb) return ba ? 1 : -1;
+    }
+    return 0;
 }
 
-double qmdd_fidelity(QMDD a, QMDD b, BDDVAR nvars)
+typedef struct qmdd_amp_batch_s {
+    qmdd_amp_query_t *queries; // sorted
+    complex_t *amps;
+    BDDVAR nqubits;
+} qmdd_amp_batch_t;
+
+/**
+ * Queries [from, to) all agree on q_0, ..., q_{var-1}, and acc is the product
+ * of the edge weights along that prefix (including the weight on q).
+ */
+VOID_TASK_6(qmdd_get_amplitudes_rec, qmdd_amp_batch_t*, batch, QMDD, q, BDDVAR, var, uint64_t, from, uint64_t, to, complex_t, acc)
 {
-    // c = <a|b>
-    AMP prod = evbdd_inner_product(a, b, nvars);
-    complex_t c;
-    weight_value(prod, &c);
+    if (EVBDD_TARGET(q) == EVBDD_TERMINAL || EVBDD_WEIGHT(q) == EVBDD_ZERO) {
+        if (EVBDD_WEIGHT(q) == EVBDD_ZERO) acc = czero();
+        for (uint64_t i = from; i < to; i++) {
+            batch->amps[batch->queries[i].index] = acc;
+        }
+        return;
+    }
 
-    // fid = |c|^2 = |c.r + c.i|^2 = sqrt(c.r^2 + c.i^2)^2 = c.r^2 + c.i^2
-    double fid = c.r*c.r + c.i*c.i;
-    return fid;
+    // Skip to the next level where the queries or the QMDD branch
+    BDDVAR topvar = evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(q)));
+    uint64_t split;
+    for (;;) {
+        // queries are sorted on q_var within [from, to), find first with q_var = 1
+        uint64_t lo = from, hi = to;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (qmdd_amp_query_bit(&batch->queries[mid], var)) hi = mid;
+            else lo = mid + 1;
+        }
+        split = lo;
+        if (var == topvar || (split != from && split != to)) break;
+        var++; // all queries agree on this skipped variable
+    }
+
+    QMDD low, high;
+    BDDVAR nodevar;
+    evbdd_get_topvar(q, var, &nodevar, &low, &high);
+
+    complex_t acc_low = czero(), acc_high = czero(), w;
+    if (split > from) {
+        weight_value(EVBDD_WEIGHT(low), &w);
+        acc_low = cmul(acc, w);
+    }
+    if (to > split) {
+        weight_value(EVBDD_WEIGHT(high), &w);
+        acc_high = cmul(acc, w);
+    }
+
+    if (split > from && to > split) {
+        SPAWN(qmdd_get_amplitudes_rec, batch, high, var+1, split, to, acc_high);
+        CALL(qmdd_get_amplitudes_rec, batch, low, var+1, from, split, acc_low);
+        SYNC(qmdd_get_amplitudes_rec);
+    }
+    else if (split > from) {
+        CALL(qmdd_get_amplitudes_rec, batch, low, var+1, from, split, acc_low);
+    }
+    else {
+        CALL(qmdd_get_amplitudes_rec, batch, high, var+1, split, to, acc_high);
+    }
 }
 
-/**********************</Measurements and probabilities>***********************/
+void
+qmdd_get_amplitudes(QMDD qmdd, bool **x, uint64_t count, BDDVAR nqubits, complex_t *amps)
+{
+    if (count == 0) return;
+    qmdd_amp_batch_t batch;
+    batch.queries = malloc(sizeof(qmdd_amp_query_t) * count);
+    batch.amps = amps;
+    batch.nqubits = nqubits;
+    for (uint64_t i = 0; i < count; i++) {
+        batch.queries[i].x = x[i];
+        batch.queries[i].index = i;
+        batch.queries[i].nqubits = nqubits;
+    }
+    qsort(batch.queries, count, sizeof(qmdd_amp_query_t), qmdd_amp_query_cmp);
 
+    complex_t root;
+    weight_value(EVBDD_WEIGHT(qmdd), &root);
+    RUN(qmdd_get_amplitudes_rec, &batch, qmdd, 0, 0, count, root);
+    free(batch.queries);
+}
 
+typedef struct qmdd_amp_iter_s {
+    BDDVAR nqubits;
+    double threshold;
+    bool ordered;
+    bool prune;
+    qmdd_amp_cb cb;
+    void *context;
+} qmdd_amp_iter_t;
+
+static inline double
+qmdd_complex_abs_sqr(complex_t c)
+{
+    return c.r*c.r + c.i*c.i;
+}
 
+/**
+ * Returns acc * value(EVBDD_WEIGHT(q)), and whether the sub-QMDD below q can
+ * still contain amplitudes above the threshold.
+ */
+static inline bool
+qmdd_amp_iter_child(qmdd_amp_iter_t *it, QMDD q, complex_t acc, complex_t *res)
+{
+    if (EVBDD_WEIGHT(q) == EVBDD_ZERO) return false;
+    complex_t w;
+    weight_value(EVBDD_WEIGHT(q), &w);
+    *res = cmul(acc, w);
+    if (it->prune && qmdd_complex_abs_sqr(*res) <= it->threshold) return false;
+    return true;
+}
 
+TASK_5(uint64_t, qmdd_foreach_amplitude_rec, qmdd_amp_iter_t*, it, QMDD, q, BDDVAR, var, uint64_t, index, complex_t, acc)
+{
+    // acc includes the weight on q itself
+    if (var == it->nqubits) {
+        assert(EVBDD_TARGET(q) == EVBDD_TERMINAL);
+        double p = qmdd_complex_abs_sqr(acc);
+        if (p > it->threshold && p > 0) {
+            it->cb(index, acc, it->context);
+            return 1;
+        }
+        return 0;
+    }
 
-/*******************************<Miscellaneous>********************************/
+    BDDVAR topvar;
+    QMDD low, high;
+    evbdd_get_topvar(q, var, &topvar, &low, &high);
+
+    complex_t acc_low, acc_high;
+    bool do_low  = qmdd_amp_iter_child(it, low, acc, &acc_low);
+    bool do_high = qmdd_amp_iter_child(it, high, acc, &acc_high);
+    uint64_t index_high = index | (1ULL << var);
+
+    uint64_t count = 0;
+    if (do_low && do_high && !it->ordered) {
+        SPAWN(qmdd_foreach_amplitude_rec, it, high, var+1, index_high, acc_high);
+        count += CALL(qmdd_foreach_amplitude_rec, it, low, var+1, index, acc_low);
+        count += SYNC(qmdd_foreach_amplitude_rec);
+    }
+    else {
+        if (do_low)  count += CALL(qmdd_foreach_amplitude_rec, it, low, var+1, index, acc_low);
+        if (do_high) count += CALL(qmdd_foreach_amplitude_rec, it, high, var+1, index_high, acc_high);
+    }
+    return count;
+}
 
-QMDD
-qmdd_remove_global_phase(QMDD qmdd)
+uint64_t
+qmdd_foreach_amplitude(QMDD qmdd, BDDVAR nqubits, double threshold, bool ordered, qmdd_amp_cb cb, void *context)
 {
-    // Remove global phase by replacing amp of qmdd with absolute value of amp
-    AMP abs = wgt_abs(EVBDD_WEIGHT(qmdd));
-    QMDD res = evbdd_bundle(EVBDD_TARGET(qmdd), abs);
+    assert(nqubits <= 64);
+    qmdd_amp_iter_t it;
+    it.nqubits   = nqubits;
+    it.threshold = threshold;
+    it.ordered   = ordered;
+    it.prune     = (weight_norm_strat == NORM_MAX || weight_norm_strat == NORM_L2);
+    it.cb        = cb;
+    it.context   = context;
+
+    complex_t acc;
+    if (!qmdd_amp_iter_child(&it, qmdd, cone(), &acc)) return 0;
+    return RUN(qmdd_foreach_amplitude_rec, &it, qmdd, 0, 0, acc);
+}
+
+#define QMDD_AMP_BUFSIZE 4096
+#define QMDD_AMP_RUNSIZE (1ULL << 20)
+
+/**
+ * Writes <count> records to <out>, and reports the first write which fails
+ * (later writes are skipped).
+ */
+static void
+qmdd_amp_write(FILE *out, const qmdd_amp_record_t *recs, size_t count, uint64_t *written, bool *failed)
+{
+    if (*failed || count == 0) return;
+    size_t n = fwrite(recs, sizeof(qmdd_amp_record_t), count, out);
+    *written += n;
+    if (n < count) {
+        fprintf(stderr, "qmdd_amplitudes_tofile: write failed (%s)\n", strerror(errno));
+        *failed = true;
+    }
+}
+
+typedef struct qmdd_amp_writer_s {
+    FILE *out;
+    BDDVAR nqubits;
+    bool MSB_first;
+    pthread_mutex_t lock;
+    qmdd_amp_record_t **buffers; // one buffer per worker
+    size_t *fill;
+    uint64_t written;
+    bool failed;
+} qmdd_amp_writer_t;
+
+static void
+qmdd_amp_writer_flush(qmdd_amp_writer_t *w, int worker)
+{
+    pthread_mutex_lock(&w->lock);
+    qmdd_amp_write(w->out, w->buffers[worker], w->fill[worker], &w->written, &w->failed);
+    pthread_mutex_unlock(&w->lock);
+    w->fill[worker] = 0;
+}
+
+static uint64_t
+qmdd_reverse_index(uint64_t index, BDDVAR nqubits)
+{
+    uint64_t res = 0;
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        res = (res << 1) | ((index >> k) & 1);
+    }
     return res;
 }
 
-void
-qmdd_set_periodic_gc_nodetable(int every_n_gates)
+static void
+qmdd_amp_writer_cb(uint64_t index, complex_t amp, void *context)
 {
-    periodic_gc_nodetable = every_n_gates;
+    qmdd_amp_writer_t *w = (qmdd_amp_writer_t *) context;
+    int worker = lace_get_worker()->worker;
+    qmdd_amp_record_t *rec = &w->buffers[worker][w->fill[worker]++];
+    rec->index = w->MSB_first ? qmdd_reverse_index(index, w->nqubits) : index;
+    rec->re = (double) amp.r;
+    rec->im = (double) amp.i;
+    if (w->fill[worker] == QMDD_AMP_BUFSIZE) qmdd_amp_writer_flush(w, worker);
 }
 
-/******************************</Miscellaneous>********************************/
+/**
+ * With q_0 as the least significant bit the (ordered) DFS visits the indices
+ * in bit-reversed order. The records are then sorted in runs of at most
+ * QMDD_AMP_RUNSIZE records, which are merged through a temporary file if
+ * there is more than one.
+ */
+typedef struct qmdd_amp_sorter_s {
+    qmdd_amp_record_t *run;
+    size_t fill;
+    FILE *runs;         // the earlier (full) runs
+    uint64_t nruns;
+    uint64_t spilled;   // records written to <runs>
+    bool failed;
+} qmdd_amp_sorter_t;
+
+typedef struct qmdd_amp_run_s {
+    qmdd_amp_record_t buf[QMDD_AMP_BUFSIZE];
+    size_t pos, len;
+    uint64_t next, end; // records of this run in <runs> not read yet
+} qmdd_amp_run_t;
+
+static int
+qmdd_amp_record_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const qmdd_amp_record_t *) a)->index;
+    uint64_t y = ((const qmdd_amp_record_t *) b)->index;
+    return (x > y) - (x < y);
+}
+
+static void
+qmdd_amp_sorter_cb(uint64_t index, complex_t amp, void *context)
+{
+    qmdd_amp_sorter_t *srt = (qmdd_amp_sorter_t *) context;
+    qmdd_amp_record_t *rec = &srt->run[srt->fill++];
+    rec->index = index;
+    rec->re = (double) amp.r;
+    rec->im = (double) amp.i;
+    if (srt->fill == QMDD_AMP_RUNSIZE) {
+        if (srt->runs == NULL && (srt->runs = tmpfile()) == NULL) {
+            fprintf(stderr, "qmdd_amplitudes_tofile: no temporary file (%s)\n", strerror(errno));
+            srt->failed = true;
+        }
+        qsort(srt->run, srt->fill, sizeof(qmdd_amp_record_t), qmdd_amp_record_cmp);
+        if (srt->runs != NULL) qmdd_amp_write(srt->runs, srt->run, srt->fill, &srt->spilled, &srt->failed);
+        srt->nruns++;
+        srt->fill = 0;
+    }
+}
+
+static bool
+qmdd_amp_run_refill(qmdd_amp_run_t *r, FILE *runs)
+{
+    if (r->next == r->end) return false;
+    size_t n = (r->end - r->next < QMDD_AMP_BUFSIZE) ? r->end - r->next : QMDD_AMP_BUFSIZE;
+    if (fseeko(runs, r->next * sizeof(qmdd_amp_record_t), SEEK_SET) != 0) return false;
+    r->len = fread(r->buf, sizeof(qmdd_amp_record_t), n, runs);
+    r->pos = 0;
+    r->next += r->len;
+    return r->len > 0;
+}
+
+static inline uint64_t
+qmdd_amp_run_head(qmdd_amp_run_t *runs, uint64_t r)
+{
+    return runs[r].buf[runs[r].pos].index;
+}
+
+/**
+ * Merges the sorted runs in srt->runs (all but the last one have
+ * QMDD_AMP_RUNSIZE records) to <out>, with a binary heap of the runs.
+ */
+static void
+qmdd_amp_merge_runs(qmdd_amp_sorter_t *srt, FILE *out, uint64_t total, uint64_t *written, bool *failed)
+{
+    uint64_t n = srt->nruns, size = 0;
+    qmdd_amp_run_t *runs = malloc(sizeof(qmdd_amp_run_t) * n);
+    uint64_t *heap = malloc(sizeof(uint64_t) * n);
+    for (uint64_t r = 0; r < n; r++) {
+        runs[r].next = r * QMDD_AMP_RUNSIZE;
+        runs[r].end = (r + 1 < n) ? (r + 1) * QMDD_AMP_RUNSIZE : total;
+        if (!qmdd_amp_run_refill(&runs[r], srt->runs)) continue;
+        // sift up
+        uint64_t k = size++;
+        while (k > 0 && qmdd_amp_run_head(runs, heap[(k-1)/2]) > qmdd_amp_run_head(runs, r)) {
+            heap[k] = heap[(k-1)/2];
+            k = (k-1)/2;
+        }
+        heap[k] = r;
+    }
+
+    qmdd_amp_record_t *buf = malloc(sizeof(qmdd_amp_record_t) * QMDD_AMP_BUFSIZE);
+    size_t fill = 0;
+    while (size > 0) {
+        uint64_t r = heap[0];
+        buf[fill++] = runs[r].buf[runs[r].pos++];
+        if (fill == QMDD_AMP_BUFSIZE) {
+            qmdd_amp_write(out, buf, fill, written, failed);
+            fill = 0;
+        }
+        if (runs[r].pos == runs[r].len && !qmdd_amp_run_refill(&runs[r], srt->runs)) {
+            r = heap[--size];
+        }
+        // sift down
+        uint64_t k = 0;
+        while (2*k + 1 < size) {
+            uint64_t c = 2*k + 1;
+            if (c + 1 < size && qmdd_amp_run_head(runs, heap[c+1]) < qmdd_amp_run_head(runs, heap[c])) c++;
+            if (qmdd_amp_run_head(runs, heap[c]) >= qmdd_amp_run_head(runs, r)) break;
+            heap[k] = heap[c];
+            k = c;
+        }
+        if (size > 0) heap[k] = r;
+    }
+    qmdd_amp_write(out, buf, fill, written, failed);
+    free(buf);
+    free(heap);
+    free(runs);
+}
+
+static uint64_t
+qmdd_amplitudes_tofile_sorted(FILE *out, QMDD qmdd, BDDVAR nqubits, double threshold)
+{
+    qmdd_amp_sorter_t srt;
+    srt.run = malloc(sizeof(qmdd_amp_record_t) * QMDD_AMP_RUNSIZE);
+    srt.fill = 0;
+    srt.runs = NULL;
+    srt.nruns = 0;
+    srt.spilled = 0;
+    srt.failed = false;
+
+    uint64_t count = qmdd_foreach_amplitude(qmdd, nqubits, threshold, true, qmdd_amp_sorter_cb, &srt);
+    qsort(srt.run, srt.fill, sizeof(qmdd_amp_record_t), qmdd_amp_record_cmp);
+
+    uint64_t written = 0;
+    bool failed = srt.failed;
+    if (srt.nruns == 0) {
+        qmdd_amp_write(out, srt.run, srt.fill, &written, &failed);
+    }
+    else if (!failed) {
+        // the last run is spilled too, after which the run buffer is not needed
+        qmdd_amp_write(srt.runs, srt.run, srt.fill, &srt.spilled, &srt.failed);
+        free(srt.run);
+        srt.run = NULL;
+        if (srt.fill > 0) srt.nruns++;
+        if (!srt.failed) qmdd_amp_merge_runs(&srt, out, count, &written, &failed);
+    }
+    if (srt.runs != NULL) fclose(srt.runs);
+    free(srt.run);
+    return written;
+}
+
+uint64_t
+qmdd_amplitudes_tofile(FILE *out, QMDD qmdd, BDDVAR nqubits, double threshold, bool ordered, bool MSB_first)
+{
+    if (ordered && !MSB_first) {
+        return qmdd_amplitudes_tofile_sorted(out, qmdd, nqubits, threshold);
+    }
+
+    qmdd_amp_writer_t w;
+    w.out = out;
+    w.nqubits = nqubits;
+    w.MSB_first = MSB_first;
+    w.written = 0;
+    w.failed = false;
+    pthread_mutex_init(&w.lock, NULL);
+    unsigned int n_workers = lace_workers();
+    w.buffers = malloc(sizeof(qmdd_amp_record_t*) * n_workers);
+    w.fill = calloc(n_workers, sizeof(size_t));
+    for (unsigned int k = 0; k < n_workers; k++) {
+        w.buffers[k] = malloc(sizeof(qmdd_amp_record_t) * QMDD_AMP_BUFSIZE);
+    }
+
+    qmdd_foreach_amplitude(qmdd, nqubits, threshold, ordered, qmdd_amp_writer_cb, &w);
+
+    for (unsigned int k = 0; k < n_workers; k++) {
+        if (w.fill[k] > 0) qmdd_amp_writer_flush(&w, k);
+        free(w.buffers[k]);
+    }
+    free(w.buffers);
+    free(w.fill);
+    pthread_mutex_destroy(&w.lock);
+    return w.written;
+}
+
+double
+qmdd_amp_to_prob(AMP a)
+{
+    complex_t c;
+    weight_value(a, &c);
+    double abs = flt_sqrt( c.r*c.r + c.i*c.i );
+    return (abs*abs);
+}
+
+AMP
+qmdd_amp_from_prob(double a)
+{
+    complex_t c;
+    c.r = flt_sqrt(a);
+    c.i = 0;
+    return weight_lookup(&c);
+}
+
+double qmdd_fidelity(QMDD a, QMDD b, BDDVAR nvars)
+{
+    // c = <a|b>
+    AMP prod = evbdd_inner_product(a, b, nvars);
+    complex_t c;
+    weight_value(prod, &c);
+
+    // fid = |c|^2 = |c.r + c.i|^2 = sqrt(c.r^2 + c.i^2)^2 = c.r^2 + c.i^2
+    double fid = c.r*c.r + c.i*c.i;
+    return fid;
+}
+
+typedef struct qmdd_pauli_ctx_s {
+    const char *pauli;
+    uint64_t *suffix_key; // cache key for the Pauli suffix starting at var k
+    int last;             // last qubit on which pauli is not I
+    BDDVAR nqubits;
+} qmdd_pauli_ctx_t;
+
+static uint64_t qmdd_pauli_call_id = 0;
+
+static inline uint64_t
+qmdd_pauli_code(char p)
+{
+    switch (p) {
+        case 'I': return 0;
+        case 'X': return 1;
+        case 'Y': return 2;
+        case 'Z': return 3;
+        default:
+            fprintf(stderr, "ERROR: invalid Pauli '%c'\n", p);
+            exit(1);
+    }
+}
+
+/**
+ * Computes sum_x conj(a(x)) * (P_{k..n-1} b)(x), with P_{k..n-1} the suffix of
+ * the Pauli string which starts at qubit k.
+ */
+TASK_4(EVBDD_WGT, qmdd_expectation_pauli_rec, qmdd_pauli_ctx_t*, ctx, QMDD, a, QMDD, b, BDDVAR, k)
+{
+    if (EVBDD_WEIGHT(a) == EVBDD_ZERO) return EVBDD_ZERO;
+    if (EVBDD_WEIGHT(b) == EVBDD_ZERO) return EVBDD_ZERO;
+
+    // Only identities left: ordinary inner product <a|b>
+    if ((int)k > ctx->last) {
+        return CALL(evbdd_inner_product, b, a, ctx->nqubits, k);
+    }
+
+    // Check cache (w/o root weights)
+    EVBDD_WGT res;
+    uint64_t key_b = EVBDD_TARGET(b) | ((uint64_t)QMDD_PARAM_PACK_16(k, ctx->nqubits)) << 40;
+    bool cachenow = ((k % granularity) == 0);
+    if (cachenow) {
+        if (cache_get3(CACHE_QMDD_EXP_PAULI, EVBDD_TARGET(a), key_b, ctx->suffix_key[k], &res)) {
+            sylvan_stats_count(QMDD_EXP_PAULI_CACHED);
+            res = wgt_mul(res, wgt_conj(EVBDD_WEIGHT(a)));
+            res = wgt_mul(res, EVBDD_WEIGHT(b));
+            return res;
+        }
+    }
+
+    BDDVAR topvar;
+    QMDD a0, a1, b0, b1;
+    evbdd_get_topvar(a, k, &topvar, &a0, &a1);
+    evbdd_get_topvar(b, k, &topvar, &b0, &b1);
+
+    // (P b)_0 = p00 b0 + p01 b1, (P b)_1 = p10 b0 + p11 b1
+    EVBDD_WGT r0, r1;
+    char p = ctx->pauli[k];
+    if (p == 'X' || p == 'Y') {
+        SPAWN(qmdd_expectation_pauli_rec, ctx, a1, b0, k+1);
+        r0 = CALL(qmdd_expectation_pauli_rec, ctx, a0, b1, k+1);
+        r1 = SYNC(qmdd_expectation_pauli_rec);
+    }
+    else {
+        SPAWN(qmdd_expectation_pauli_rec, ctx, a1, b1, k+1);
+        r0 = CALL(qmdd_expectation_pauli_rec, ctx, a0, b0, k+1);
+        r1 = SYNC(qmdd_expectation_pauli_rec);
+    }
+
+    switch (p) {
+        case 'I':
+        case 'X':
+            res = wgt_add(r0, r1);
+            break;
+        case 'Y': {
+            complex_t i = cmake(0.0, 1.0);
+            res = wgt_mul(wgt_sub(r1, r0), weight_lookup(&i));
+            break;
+        }
+        default: // 'Z'
+            res = wgt_sub(r0, r1);
+            break;
+    }
+
+    if (cachenow) {
+        if (cache_put3(CACHE_QMDD_EXP_PAULI, EVBDD_TARGET(a), key_b, ctx->suffix_key[k], res))
+            sylvan_stats_count(QMDD_EXP_PAULI_CACHEDPUT);
+    }
+
+    // Multiply with (conjugate of) root weight of a and root weight of b
+    res = wgt_mul(res, wgt_conj(EVBDD_WEIGHT(a)));
+    res = wgt_mul(res, EVBDD_WEIGHT(b));
+    return res;
+}
+
+static void
+qmdd_pauli_ctx_init(qmdd_pauli_ctx_t *ctx, const char *pauli, BDDVAR nqubits)
+{
+    ctx->pauli = pauli;
+    ctx->nqubits = nqubits;
+    ctx->last = -1;
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        if (qmdd_pauli_code(pauli[k]) != 0) ctx->last = k;
+    }
+
+    // The suffix P_k..P_last (P_last != I) is identified by packing 2 bits per
+    // Pauli if it fits in 62 bits. Longer suffixes get a key which is unique
+    // to this call, so they are only shared within the traversal itself.
+    uint64_t call_key = (1ULL << 63) | __sync_add_and_fetch(&qmdd_pauli_call_id, 1);
+    ctx->suffix_key = malloc(sizeof(uint64_t) * (nqubits + 1));
+    uint64_t packed = 0;
+    for (int k = ctx->last; k >= 0; k--) {
+        if (ctx->last - k < 31) {
+            packed = (packed << 2) | qmdd_pauli_code(pauli[k]);
+            ctx->suffix_key[k] = packed;
+        }
+        else {
+            ctx->suffix_key[k] = call_key;
+        }
+    }
+}
+
+static double
+qmdd_pauli_result(EVBDD_WGT res)
+{
+    // <psi|P|psi> is real for Hermitian P
+    complex_t c;
+    weight_value(res, &c);
+    return c.r;
+}
+
+double
+qmdd_expectation_pauli(QMDD qmdd, const char *pauli, BDDVAR nqubits)
+{
+    sylvan_stats_count(QMDD_EXP_PAULI);
+    qmdd_pauli_ctx_t ctx;
+    qmdd_pauli_ctx_init(&ctx, pauli, nqubits);
+    EVBDD_WGT res = RUN(qmdd_expectation_pauli_rec, &ctx, qmdd, qmdd, 0);
+    free(ctx.suffix_key);
+    return qmdd_pauli_result(res);
+}
+
+typedef struct qmdd_hamiltonian_s {
+    QMDD qmdd;
+    char **paulis;
+    const double *coeffs;
+    BDDVAR nqubits;
+    double *term_values;
+} qmdd_hamiltonian_t;
+
+TASK_3(double, qmdd_expectation_hamiltonian_rec, qmdd_hamiltonian_t*, h, uint32_t, from, uint32_t, to)
+{
+    if (to - from == 1) {
+        sylvan_stats_count(QMDD_EXP_PAULI);
+        qmdd_pauli_ctx_t ctx;
+        qmdd_pauli_ctx_init(&ctx, h->paulis[from], h->nqubits);
+        EVBDD_WGT res = CALL(qmdd_expectation_pauli_rec, &ctx, h->qmdd, h->qmdd, 0);
+        free(ctx.suffix_key);
+        double exp = qmdd_pauli_result(res);
+        if (h->term_values != NULL) h->term_values[from] = exp;
+        return h->coeffs[from] * exp;
+    }
+    uint32_t mid = from + (to - from) / 2;
+    SPAWN(qmdd_expectation_hamiltonian_rec, h, mid, to);
+    double low  = CALL(qmdd_expectation_hamiltonian_rec, h, from, mid);
+    double high = SYNC(qmdd_expectation_hamiltonian_rec);
+    return low + high;
+}
+
+double
+qmdd_expectation_hamiltonian(QMDD qmdd, char **paulis, const double *coeffs, uint32_t nterms, BDDVAR nqubits, double *term_values)
+{
+    if (nterms == 0) return 0.0;
+    qmdd_hamiltonian_t h;
+    h.qmdd = qmdd;
+    h.paulis = paulis;
+    h.coeffs = coeffs;
+    h.nqubits = nqubits;
+    h.term_values = term_values;
+    return RUN(qmdd_expectation_hamiltonian_rec, &h, 0, nterms);
+}
+
+/**********************</Measurements and probabilities>***********************/
+
+
+
+
+
+/*******************************<Miscellaneous>********************************/
+
+QMDD
+qmdd_remove_global_phase(QMDD qmdd)
+{
+    // Remove global phase by replacing amp of qmdd with absolute value of amp
+    AMP abs = wgt_abs(EVBDD_WEIGHT(qmdd));
+    QMDD res = evbdd_bundle(EVBDD_TARGET(qmdd), abs);
+    return res;
+}
+
+void
+qmdd_set_periodic_gc_nodetable(int every_n_gates)
+{
+    periodic_gc_nodetable = every_n_gates;
+}
+
+/******************************</Miscellaneous>********************************/
+
+
+
+
+
+/**************************<Dynamic qubit reordering>**************************/
+
+static double
+reorder_wctime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec + 1E-6 * tv.tv_usec);
+}
+
+void
+qmdd_set_auto_reorder(BDDVAR nqubits, double growth)
+{
+    free(qubit_level);
+    free(level_qubit);
+    qubit_level = NULL;
+    level_qubit = NULL;
+    reorder_nqubits = nqubits;
+    reorder_growth = growth;
+    reorder_last_nodes = 0;
+    reorder_sifts = 0;
+    reorder_swaps = 0;
+    reorder_time = 0;
+    if (nqubits == 0) return;
+
+    qubit_level = malloc(sizeof(BDDVAR) * nqubits);
+    level_qubit = malloc(sizeof(BDDVAR) * nqubits);
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        qubit_level[k] = k;
+        level_qubit[k] = k;
+    }
+}
+
+BDDVAR
+qmdd_get_qubit_level(BDDVAR qubit)
+{
+    return qmdd_level_of(qubit);
+}
+
+void
+qmdd_set_qubit_levels(const BDDVAR *levels)
+{
+    assert(qubit_level != NULL);
+    for (BDDVAR k = 0; k < reorder_nqubits; k++) {
+        qubit_level[k] = levels[k];
+        level_qubit[levels[k]] = k;
+    }
+}
+
+QMDD
+qmdd_swap_levels(QMDD qmdd, BDDVAR k)
+{
+    assert(level_qubit != NULL && k+1 < reorder_nqubits);
+    qmdd = evbdd_swap_adjacent(qmdd, k);
+    BDDVAR a = level_qubit[k], b = level_qubit[k+1];
+    level_qubit[k] = b;   qubit_level[b] = k;
+    level_qubit[k+1] = a; qubit_level[a] = k+1;
+    reorder_swaps++;
+    return qmdd;
+}
+
+// Moves the qubit at level <from> to level <to> with adjacent swaps
+static QMDD
+qmdd_move_level(QMDD qmdd, BDDVAR from, BDDVAR to)
+{
+    for (; from < to; from++) qmdd = qmdd_swap_levels(qmdd, from);
+    for (; from > to; from--) qmdd = qmdd_swap_levels(qmdd, from-1);
+    return qmdd;
+}
+
+/**
+ * Updates the node counts per level after levels k and k+1 have been swapped,
+ * and returns the new total. Only these two levels change: the nodes above 
+ * still represent the same (distinct) sub-functions, and the nodes below are
+ * not touched.
+ */
+static uint64_t
+qmdd_sift_update_counts(QMDD qmdd, uint64_t *counts, BDDVAR k, uint64_t total)
+{
+    total -= counts[k] + counts[k+1];
+    evbdd_countnodes_levels(qmdd, counts, k, k+1);
+    total += counts[k] + counts[k+1];
+    if (testing_mode) assert(total == evbdd_countnodes(qmdd));
+    return total;
+}
+
+QMDD
+qmdd_sift(QMDD qmdd)
+{
+    assert(level_qubit != NULL);
+    double t_start = reorder_wctime();
+    BDDVAR n = reorder_nqubits;
+    evbdd_protect(&qmdd);
+
+    // keep track of the node count per level instead of recounting all nodes
+    // after every swap (+ 1 for the terminal, as evbdd_countnodes)
+    uint64_t *counts = malloc(sizeof(uint64_t) * n);
+    evbdd_countnodes_per_level(qmdd, counts, n);
+    uint64_t nodes = 1;
+    for (BDDVAR k = 0; k < n; k++) nodes += counts[k];
+
+    uint64_t best = nodes;
+    for (BDDVAR q = 0; q < n; q++) {
+        // Try all positions for qubit q: first move it to the closest end, 
+        // then to the other end, while keeping track of the best position.
+        BDDVAR pos = qubit_level[q];
+        BDDVAR best_pos = pos;
+        BDDVAR ends[2] = {0, n-1};
+        if (pos >= n/2) { ends[0] = n-1; ends[1] = 0; }
+        for (int e = 0; e < 2; e++) {
+            while (pos != ends[e]) {
+                BDDVAR next = (pos < ends[e]) ? pos + 1 : pos - 1;
+                BDDVAR k = (pos < next) ? pos : next;
+                qmdd = qmdd_swap_levels(qmdd, k);
+                nodes = qmdd_sift_update_counts(qmdd, counts, k, nodes);
+                pos = next;
+                if (nodes < best) {
+                    best = nodes;
+                    best_pos = pos;
+                }
+                // don't continue in this direction if it blows up too much
+                else if (nodes > QMDD_REORDER_MAX_GROWTH * best) break;
+            }
+        }
+        for (; pos < best_pos; pos++) {
+            qmdd = qmdd_swap_levels(qmdd, pos);
+            nodes = qmdd_sift_update_counts(qmdd, counts, pos, nodes);
+        }
+        for (; pos > best_pos; pos--) {
+            qmdd = qmdd_swap_levels(qmdd, pos-1);
+            nodes = qmdd_sift_update_counts(qmdd, counts, pos-1, nodes);
+        }
+    }
+
+    free(counts);
+    evbdd_unprotect(&qmdd);
+    reorder_last_nodes = best;
+    reorder_sifts++;
+    reorder_time += reorder_wctime() - t_start;
+    return qmdd;
+}
+
+QMDD
+qmdd_restore_qubit_order(QMDD qmdd)
+{
+    if (level_qubit == NULL) return qmdd;
+    evbdd_protect(&qmdd);
+    for (BDDVAR q = 0; q < reorder_nqubits; q++) {
+        qmdd = qmdd_move_level(qmdd, qubit_level[q], q);
+    }
+    evbdd_unprotect(&qmdd);
+    reorder_last_nodes = 0;
+    return qmdd;
+}
+
+void
+qmdd_get_reorder_stats(uint64_t *sifts, uint64_t *swaps, double *time)
+{
+    *sifts = reorder_sifts;
+    *swaps = reorder_swaps;
+    *time  = reorder_time;
+}
+
+/*************************</Dynamic qubit reordering>**************************/
+
+
+
+
+
+/***************************<Approximate simulation>***************************/
+
+/**
+ * Nodes are numbered 1..N in post-order, so children have lower numbers than
+ * their parents.
+ */
+VOID_TASK_2(qmdd_approx_number_rec, sylvan_skiplist_t, sl, QMDD, q)
+{
+    if (EVBDD_TARGET(q) == EVBDD_TERMINAL) return;
+    if (sylvan_skiplist_get(sl, EVBDD_TARGET(q)) != 0) return;
+    QMDD low, high;
+    evbddnode_getchilderen(EVBDD_GETNODE(EVBDD_TARGET(q)), &low, &high);
+    CALL(qmdd_approx_number_rec, sl, low);
+    CALL(qmdd_approx_number_rec, sl, high);
+    CALL(sylvan_skiplist_assign_next, sl, EVBDD_TARGET(q));
+}
+
+typedef struct qmdd_approx_edge_s {
+    double mass;    // probability mass of all paths through this edge
+    uint64_t id;    // 2 * node number + (0 = low, 1 = high)
+} qmdd_approx_edge_t;
+
+static int
+qmdd_approx_edge_cmp(const void *a, const void *b)
+{
+    double ma = ((const qmdd_approx_edge_t*)a)->mass;
+    double mb = ((const qmdd_approx_edge_t*)b)->mass;
+    return (ma > mb) - (ma < mb);
+}
+
+static BDDVAR
+qmdd_approx_var(QMDD q, BDDVAR nqubits)
+{
+    if (EVBDD_TARGET(q) == EVBDD_TERMINAL) return nqubits;
+    return evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(q)));
+}
+
+QMDD
+qmdd_approximate(QMDD qmdd, BDDVAR nqubits, double budget, double *fidelity)
+{
+    *fidelity = 1.0;
+    if (EVBDD_TARGET(qmdd) == EVBDD_TERMINAL || budget <= 0) return qmdd;
+
+    // the skiplist numbers only the nodes of qmdd (from 1, so the count with
+    // the terminal is its size), and can't have 2^31 or more buckets
+    uint64_t size = evbdd_countnodes(qmdd);
+    if (size >= 0x80000000) return qmdd;
+    sylvan_skiplist_t sl = sylvan_skiplist_alloc(size);
+    RUN(qmdd_approx_number_rec, sl, qmdd);
+    uint64_t N = sylvan_skiplist_count(sl);
+
+    // the nodes of qmdd are looked up by number while the result is built
+    evbdd_protect(&qmdd);
+
+    // Mass flowing into every node (sum of |path weight|^2 from the root, 
+    // where each skipped level doubles the number of paths)
+    double *in_mass = calloc(N + 1, sizeof(double));
+    BDDVAR root_var = qmdd_approx_var(qmdd, nqubits);
+    in_mass[N] = qmdd_amp_to_prob(EVBDD_WEIGHT(qmdd)) * ldexp(1.0, root_var);
+    qmdd_approx_edge_t *edges = malloc(sizeof(qmdd_approx_edge_t) * 2 * N);
+    uint64_t nedges = 0;
+    for (uint64_t i = N; i >= 1; i--) {
+        evbddnode_t node = EVBDD_GETNODE(sylvan_skiplist_getr(sl, i));
+        BDDVAR var = evbddnode_getvar(node);
+        QMDD child[2];
+        evbddnode_getchilderen(node, &child[0], &child[1]);
+        for (int b = 0; b < 2; b++) {
+            if (EVBDD_WEIGHT(child[b]) == EVBDD_ZERO) continue;
+            edges[nedges].mass = in_mass[i] * qmdd_unnormed_prob(child[b], var+1, nqubits);
+            edges[nedges].id = 2*i + b;
+            nedges++;
+            if (EVBDD_TARGET(child[b]) != EVBDD_TERMINAL) {
+                BDDVAR skipped = qmdd_approx_var(child[b], nqubits) - var - 1;
+                uint64_t c = sylvan_skiplist_get(sl, EVBDD_TARGET(child[b]));
+                in_mass[c] += in_mass[i] * qmdd_amp_to_prob(EVBDD_WEIGHT(child[b])) * ldexp(1.0, skipped);
+            }
+        }
+    }
+
+    // Prune the lightest edges while the removed mass is within the budget
+    double total = qmdd_unnormed_prob(qmdd, 0, nqubits);
+    bool *pruned = calloc(2 * (N + 1), sizeof(bool));
+    qsort(edges, nedges, sizeof(qmdd_approx_edge_t), qmdd_approx_edge_cmp);
+    double removed = 0;
+    for (uint64_t e = 0; e < nedges; e++) {
+        if (removed + edges[e].mass > budget * total) break;
+        removed += edges[e].mass;
+        pruned[edges[e].id] = true;
+    }
+
+    // Rebuild bottom-up without the pruned edges
+    QMDD res = qmdd;
+    if (removed > 0) {
+        QMDD *rebuilt = malloc(sizeof(QMDD) * (N + 1));
+        for (uint64_t i = 1; i <= N; i++) {
+            evbddnode_t node = EVBDD_GETNODE(sylvan_skiplist_getr(sl, i));
+            QMDD child[2];
+            evbddnode_getchilderen(node, &child[0], &child[1]);
+            for (int b = 0; b < 2; b++) {
+                if (pruned[2*i + b]) {
+                    child[b] = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+                }
+                else if (EVBDD_TARGET(child[b]) != EVBDD_TERMINAL) {
+                    QMDD r = rebuilt[sylvan_skiplist_get(sl, EVBDD_TARGET(child[b]))];
+                    child[b] = evbdd_bundle(EVBDD_TARGET(r), wgt_mul(EVBDD_WEIGHT(r), EVBDD_WEIGHT(child[b])));
+                }
+            }
+            rebuilt[i] = evbdd_refs_push(evbdd_makenode(evbddnode_getvar(node), child[0], child[1]));
+        }
+        res = rebuilt[N];
+        res = evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(res), EVBDD_WEIGHT(qmdd)));
+        evbdd_refs_pop(N);
+        free(rebuilt);
+
+        // |psi'> is |psi> restricted to the remaining basis states, so
+        // |<psi|psi'>|^2 / (<psi|psi><psi'|psi'>) = <psi'|psi'> / <psi|psi>
+        double kept = qmdd_unnormed_prob(res, 0, nqubits);
+        *fidelity = kept / total;
+        complex_t c = cmake(sqrt(total / kept), 0.0);
+        res = evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(res), weight_lookup(&c)));
+    }
+
+    evbdd_unprotect(&qmdd);
+    free(pruned);
+    free(edges);
+    free(in_mass);
+    sylvan_skiplist_free(sl);
+    return res;
+}
+
+static void
+qmdd_approximate_if_needed(QMDD *qmdd)
+{
+    // budget for this round, such that the total stays above the floor
+    double round = approx_round_fidelity;
+    if (approx_fidelity * round < approx_fidelity_floor) {
+        round = approx_fidelity_floor / approx_fidelity;
+    }
+    if (round >= 1.0 - 1e-12) return;
+
+    bool needed = false;
+    if (approx_max_wgt_fill > 0) {
+        double fill = (double)wgt_table_entries_estimate() / (double)sylvan_get_edge_weight_table_size();
+        needed = (fill > approx_max_wgt_fill);
+    }
+    if (!needed && approx_max_nodes > 0) {
+        needed = (evbdd_countnodes(*qmdd) > approx_max_nodes);
+    }
+    if (!needed) return;
+
+    double fidelity;
+    evbdd_protect(qmdd);
+    *qmdd = qmdd_approximate(*qmdd, approx_nqubits, 1.0 - round, &fidelity);
+    evbdd_unprotect(qmdd);
+    if (fidelity < 1.0) {
+        approx_fidelity *= fidelity;
+        approx_rounds++;
+    }
+}
+
+void
+qmdd_set_approximation(BDDVAR nqubits, uint64_t max_nodes, double max_wgt_fill, double round_fidelity, double fidelity_floor)
+{
+    approx_nqubits = nqubits;
+    approx_max_nodes = max_nodes;
+    approx_max_wgt_fill = max_wgt_fill;
+    approx_round_fidelity = round_fidelity;
+    approx_fidelity_floor = fidelity_floor;
+    approx_fidelity = 1.0;
+    approx_rounds = 0;
+}
+
+void
+qmdd_get_approximation_stats(double *fidelity, uint64_t *rounds)
+{
+    *fidelity = approx_fidelity;
+    *rounds = approx_rounds;
+}
+
+/**************************</Approximate simulation>***************************/
+
+
+
+
+
+/*****************************<Density matrices>*******************************/
+
+// Qubit of the top variable of a density matrix (EVBDD_INVALID_VAR if none)
+static inline BDDVAR
+qmdd_dm_topqubit(QMDD rho)
+{
+    if (EVBDD_TARGET(rho) == EVBDD_TERMINAL) return EVBDD_INVALID_VAR;
+    return evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(rho))) / 2;
+}
+
+/**
+ * Gets the 2x2 blocks B[row][col] of qubit k of rho (w/o the root weight of
+ * rho), where rho has no variables above 2k. Skipped variables give the same
+ * block for both values.
+ */
+static void
+qmdd_dm_get_blocks(QMDD rho, BDDVAR k, QMDD B[2][2])
+{
+    BDDVAR var;
+    QMDD col[2];
+    evbdd_get_topvar(rho, 2*k, &var, &col[0], &col[1]);
+    for (int c = 0; c < 2; c++) {
+        evbdd_get_topvar(col[c], 2*k+1, &var, &B[0][c], &B[1][c]);
+        for (int r = 0; r < 2; r++) {
+            AMP w = wgt_mul(EVBDD_WEIGHT(col[c]), EVBDD_WEIGHT(B[r][c]));
+            B[r][c] = evbdd_bundle(EVBDD_TARGET(B[r][c]), w);
+        }
+    }
+}
+
+// Inverse of qmdd_dm_get_blocks
+static QMDD
+qmdd_dm_makenode(BDDVAR k, QMDD B[2][2])
+{
+    QMDD col0 = evbdd_refs_push(evbdd_makenode(2*k+1, B[0][0], B[1][0]));
+    QMDD col1 = evbdd_makenode(2*k+1, B[0][1], B[1][1]);
+    evbdd_refs_pop(1);
+    return evbdd_makenode(2*k, col0, col1);
+}
+
+static QMDD
+qmdd_dm_scale(QMDD rho, double s)
+{
+    complex_t c = cmake(s, 0.0);
+    AMP w = wgt_mul(EVBDD_WEIGHT(rho), weight_lookup(&c));
+    if (w == EVBDD_ZERO) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    return evbdd_bundle(EVBDD_TARGET(rho), w);
+}
+
+TASK_IMPL_2(QMDD, qmdd_dm_outer_product, QMDD, a, QMDD, b)
+{
+    AMP root = wgt_mul(EVBDD_WEIGHT(a), wgt_conj(EVBDD_WEIGHT(b)));
+    if (root == EVBDD_ZERO) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL && EVBDD_TARGET(b) == EVBDD_TERMINAL) {
+        return evbdd_bundle(EVBDD_TERMINAL, root);
+    }
+
+    // Check cache (w/o root weights)
+    QMDD res;
+    if (cache_get3(CACHE_QMDD_DM_OUTER_PRODUCT, EVBDD_TARGET(a), EVBDD_TARGET(b), 0, &res)) {
+        return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(root, EVBDD_WEIGHT(res)));
+    }
+
+    BDDVAR var_a = EVBDD_INVALID_VAR, var_b = EVBDD_INVALID_VAR, k;
+    if (EVBDD_TARGET(a) != EVBDD_TERMINAL) var_a = evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(a)));
+    if (EVBDD_TARGET(b) != EVBDD_TERMINAL) var_b = evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(b)));
+    k = (var_a < var_b) ? var_a : var_b;
+
+    QMDD as[2], bs[2], B[2][2];
+    evbdd_get_topvar(a, k, &var_a, &as[0], &as[1]);
+    evbdd_get_topvar(b, k, &var_b, &bs[0], &bs[1]);
+
+    // block (r,c) of |a><b| is |a_r><b_c|
+    evbdd_refs_spawn(SPAWN(qmdd_dm_outer_product, as[1], bs[1]));
+    evbdd_refs_spawn(SPAWN(qmdd_dm_outer_product, as[1], bs[0]));
+    evbdd_refs_spawn(SPAWN(qmdd_dm_outer_product, as[0], bs[1]));
+    B[0][0] = evbdd_refs_push(CALL(qmdd_dm_outer_product, as[0], bs[0]));
+    B[0][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_outer_product)));
+    B[1][0] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_outer_product)));
+    B[1][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_outer_product)));
+    res = qmdd_dm_makenode(k, B);
+    evbdd_refs_pop(4);
+
+    cache_put3(CACHE_QMDD_DM_OUTER_PRODUCT, EVBDD_TARGET(a), EVBDD_TARGET(b), 0, res);
+    return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(root, EVBDD_WEIGHT(res)));
+}
+
+/**
+ * Block <il> = (i,l) of L B R^dagger, for the blocks B (B[2*row + col]) of
+ * rho at the target qubit, with L and R either U or I.
+ */
+TASK_4(QMDD, qmdd_dm_gate_block, QMDD*, B, AMP*, L, AMP*, R, uint32_t, il)
+{
+    uint32_t i = il >> 1, l = il & 1;
+    QMDD res = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    int pushed = 0;
+    for (int j = 0; j < 2; j++) {
+        for (int m = 0; m < 2; m++) {
+            // (L B R^dagger)_il = sum_jm L_ij B_jm conj(R_lm)
+            AMP w = wgt_mul(L[2*i+j], wgt_conj(R[2*l+m]));
+            if (w == EVBDD_ZERO || EVBDD_WEIGHT(B[2*j+m]) == EVBDD_ZERO) continue;
+            w = wgt_mul(w, EVBDD_WEIGHT(B[2*j+m]));
+            QMDD term = evbdd_bundle(EVBDD_TARGET(B[2*j+m]), w);
+            res = evbdd_refs_push(CALL(evbdd_plus, res, term));
+            pushed++;
+        }
+    }
+    evbdd_refs_pop(pushed);
+    return res;
+}
+
+// U on the rows and/or U^dagger on the columns, as given by <sides>
+static void
+qmdd_dm_gate_sides(gate_id_t gate, uint32_t sides, AMP *L, AMP *R)
+{
+    for (int i = 0; i < 4; i++) {
+        AMP id = (i == 0 || i == 3) ? EVBDD_ONE : EVBDD_ZERO;
+        L[i] = (sides & 1) ? gates[gate][i] : id;
+        R[i] = (sides & 2) ? gates[gate][i] : id;
+    }
+}
+
+/**
+ * Block <il> of the result at the target qubit if there are controls after
+ * the target, where B are the blocks of rho at the target (with their root
+ * weights). As above the target, <sides> is narrowed down at every control,
+ * and after the last control this is qmdd_dm_gate_block for these sides.
+ */
+TASK_6(QMDD, qmdd_dm_gate_below, QMDD*, B, gate_id_t, gate, BDDVAR*, cs, uint32_t, ci, uint32_t, il, uint32_t, sides)
+{
+    // Trivial cases
+    if (sides == 0) return B[il];
+    if (ci == MAX_CONTROLS || cs[ci] == EVBDD_INVALID_VAR) {
+        AMP L[4], Rt[4];
+        qmdd_dm_gate_sides(gate, sides, L, Rt);
+        return CALL(qmdd_dm_gate_block, B, L, Rt, il);
+    }
+
+    BDDVAR c = cs[ci], k = c;
+    bool zero = true;
+    for (int j = 0; j < 4; j++) {
+        BDDVAR var = qmdd_dm_topqubit(B[j]);
+        if (var < k) k = var;
+        if (EVBDD_WEIGHT(B[j]) != EVBDD_ZERO) zero = false;
+    }
+    if (zero) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+
+    // Check cache (the blocks are combined, so the root weights are part of
+    // the key)
+    QMDD res;
+    uint64_t opid = GATE_OPID_64(gate, ci, cs[0], cs[1], cs[2], 0);
+    bool cachenow = ((k % granularity) == 0);
+    if (cachenow) {
+        if (cache_get6(CACHE_QMDD_DM_GATE_BELOW | (sides << 2) | il, B[0], B[1], B[2], B[3], opid, &res, NULL)) {
+            sylvan_stats_count(QMDD_DM_GATE_CACHED);
+            return res;
+        }
+    }
+
+    // C[r][col] are the sub-blocks (r,col) at qubit k of the four blocks
+    QMDD C[2][2][4], R[2][2];
+    for (int j = 0; j < 4; j++) {
+        QMDD b[2][2];
+        qmdd_dm_get_blocks(B[j], k, b);
+        for (int r = 0; r < 2; r++) {
+            for (int col = 0; col < 2; col++) {
+                AMP w = wgt_mul(EVBDD_WEIGHT(B[j]), EVBDD_WEIGHT(b[r][col]));
+                C[r][col][j] = (w == EVBDD_ZERO) ? evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO)
+                                                 : evbdd_bundle(EVBDD_TARGET(b[r][col]), w);
+            }
+        }
+    }
+    uint32_t s[2][2] = {{sides, sides}, {sides, sides}};
+    uint32_t next = ci;
+    if (k == c) {
+        for (int r = 0; r < 2; r++) {
+            for (int col = 0; col < 2; col++) {
+                s[r][col] = sides & ((r ? 1 : 0) | (col ? 2 : 0));
+            }
+        }
+        next = ci + 1;
+    }
+    evbdd_refs_spawn(SPAWN(qmdd_dm_gate_below, C[1][1], gate, cs, next, il, s[1][1]));
+    evbdd_refs_spawn(SPAWN(qmdd_dm_gate_below, C[1][0], gate, cs, next, il, s[1][0]));
+    evbdd_refs_spawn(SPAWN(qmdd_dm_gate_below, C[0][1], gate, cs, next, il, s[0][1]));
+    R[0][0] = evbdd_refs_push(CALL(qmdd_dm_gate_below, C[0][0], gate, cs, next, il, s[0][0]));
+    R[0][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_below)));
+    R[1][0] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_below)));
+    R[1][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_below)));
+    res = qmdd_dm_makenode(k, R);
+    evbdd_refs_pop(4);
+
+    if (cachenow) {
+        if (cache_put6(CACHE_QMDD_DM_GATE_BELOW | (sides << 2) | il, B[0], B[1], B[2], B[3], opid, res, 0))
+            sylvan_stats_count(QMDD_DM_GATE_CACHEDPUT);
+    }
+    return res;
+}
+
+TASK_IMPL_6(QMDD, qmdd_dm_gate_rec, QMDD, rho, gate_id_t, gate, BDDVAR*, cs, uint32_t, ci, BDDVAR, t, uint32_t, sides)
+{
+    // Trivial cases
+    if (sides == 0 || EVBDD_WEIGHT(rho) == EVBDD_ZERO) return rho;
+
+    // Next control qubit before the target, or the target
+    BDDVAR c = (ci < MAX_CONTROLS && cs[ci] != EVBDD_INVALID_VAR && cs[ci] < t) ? cs[ci] : t;
+    BDDVAR k = qmdd_dm_topqubit(rho);
+    if (k > c) k = c;
+
+    // Check cache
+    QMDD res;
+    uint64_t opid = GATE_OPID_64(gate, ci, cs[0], cs[1], cs[2], t);
+    bool cachenow = ((k % granularity) == 0);
+    if (cachenow) {
+        if (cache_get3(CACHE_QMDD_DM_GATE, sides, EVBDD_TARGET(rho), opid, &res)) {
+            sylvan_stats_count(QMDD_DM_GATE_CACHED);
+            // Multiply root amp of res with input root amp
+            AMP new_root_amp = wgt_mul(EVBDD_WEIGHT(rho), EVBDD_WEIGHT(res));
+            return evbdd_bundle(EVBDD_TARGET(res), new_root_amp);
+        }
+    }
+
+    QMDD B[2][2], R[2][2];
+    qmdd_dm_get_blocks(rho, k, B);
+
+    if (k == t && ci < MAX_CONTROLS && cs[ci] != EVBDD_INVALID_VAR) {
+        // Controls after the target: combine the blocks of the target further
+        // down, where it is known to which sub-blocks U applies
+        QMDD *Bs = &B[0][0];
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_below, Bs, gate, cs, ci, 3, sides));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_below, Bs, gate, cs, ci, 2, sides));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_below, Bs, gate, cs, ci, 1, sides));
+        R[0][0] = evbdd_refs_push(CALL(qmdd_dm_gate_below, Bs, gate, cs, ci, 0, sides));
+        R[0][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_below)));
+        R[1][0] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_below)));
+        R[1][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_below)));
+    }
+    else if (k == t) {
+        // U on the rows and/or U^dagger on the columns of the blocks
+        AMP L[4], Rt[4];
+        qmdd_dm_gate_sides(gate, sides, L, Rt);
+        QMDD *Bs = &B[0][0];
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_block, Bs, L, Rt, 3));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_block, Bs, L, Rt, 2));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_block, Bs, L, Rt, 1));
+        R[0][0] = evbdd_refs_push(CALL(qmdd_dm_gate_block, Bs, L, Rt, 0));
+        R[0][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_block)));
+        R[1][0] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_block)));
+        R[1][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_block)));
+    }
+    else {
+        // Above the target all blocks get the gate. At a control, U is only
+        // applied to rows (columns) where the control is |1>, so block (0,0)
+        // is left as is and blocks (0,1) and (1,0) only get it on one side.
+        uint32_t s[2][2] = {{sides, sides}, {sides, sides}};
+        uint32_t next = ci;
+        if (k == c) {
+            for (int r = 0; r < 2; r++) {
+                for (int col = 0; col < 2; col++) {
+                    s[r][col] = sides & ((r ? 1 : 0) | (col ? 2 : 0));
+                }
+            }
+            next = ci + 1;
+        }
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_rec, B[1][1], gate, cs, next, t, s[1][1]));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_rec, B[1][0], gate, cs, next, t, s[1][0]));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_gate_rec, B[0][1], gate, cs, next, t, s[0][1]));
+        R[0][0] = evbdd_refs_push(CALL(qmdd_dm_gate_rec, B[0][0], gate, cs, next, t, s[0][0]));
+        R[0][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_rec)));
+        R[1][0] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_rec)));
+        R[1][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_gate_rec)));
+    }
+    res = qmdd_dm_makenode(k, R);
+    evbdd_refs_pop(4);
+
+    // Store not yet "root normalized" result in cache
+    if (cachenow) {
+        if (cache_put3(CACHE_QMDD_DM_GATE, sides, EVBDD_TARGET(rho), opid, res))
+            sylvan_stats_count(QMDD_DM_GATE_CACHEDPUT);
+    }
+    // Multiply root amp of res with input root amp
+    AMP new_root_amp = wgt_mul(EVBDD_WEIGHT(rho), EVBDD_WEIGHT(res));
+    return evbdd_bundle(EVBDD_TARGET(res), new_root_amp);
+}
+
+TASK_IMPL_4(QMDD, qmdd_dm_cgate, QMDD, rho, gate_id_t, gate, BDDVAR*, cs, BDDVAR, t)
+{
+    sylvan_stats_count(QMDD_DM_GATE);
+    // reordering, approximation and dense blocks don't apply to density matrices
+    qmdd_gc_before_gate(&rho);
+    qmdd_stats_log(rho);
+    evbdd_refs_push(rho);
+    QMDD res = CALL(qmdd_dm_gate_rec, rho, gate, cs, 0, t, 3);
+    evbdd_refs_pop(1);
+    return res;
+}
+
+QMDD
+_qmdd_dm_cgate(QMDD rho, gate_id_t gate, BDDVAR c1, BDDVAR c2, BDDVAR c3, BDDVAR t)
+{
+    assert(qubit_level == NULL && "density matrices do not support qubit reordering");
+    check_ctrls_before_targ(&c1, &c2, &c3, t); // (sorts the controls)
+    BDDVAR cs[4] = {c1, c2, c3, EVBDD_INVALID_VAR}; // last pos is to mark end
+    return RUN(qmdd_dm_cgate, rho, gate, cs, t);
+}
+
+QMDD
+qmdd_dm_swap(QMDD rho, BDDVAR qubit1, BDDVAR qubit2)
+{
+    if (qubit1 > qubit2) {
+        BDDVAR tmp = qubit2;
+        qubit2 = qubit1;
+        qubit1 = tmp;
+    }
+
+    // CNOT
+    rho = qmdd_dm_cgate(rho, GATEID_X, qubit1, qubit2);
+    // upside down CNOT (equivalent)
+    rho = qmdd_dm_gate(rho, GATEID_H, qubit1);
+    rho = qmdd_dm_cgate(rho, GATEID_Z, qubit1, qubit2);
+    rho = qmdd_dm_gate(rho, GATEID_H, qubit1);
+    // CNOT
+    rho = qmdd_dm_cgate(rho, GATEID_X, qubit1, qubit2);
+    return rho;
+}
+
+QMDD
+qmdd_dm_kraus(QMDD rho, const complex_t *kraus, uint32_t nkraus, BDDVAR t)
+{
+    // interned gate IDs keep their cached results (a dynamic gate clears the
+    // cache), so the same channel on every gate reuses the results of earlier
+    // applications on the same (sub)matrices
+    if (qmdd_gates_num_interned() + nkraus > QMDD_MAX_INTERNED_GATES) {
+        qmdd_gates_clear_interned();
+    }
+    gate_id_t *ids = malloc(sizeof(gate_id_t) * nkraus);
+    for (uint32_t i = 0; i < nkraus; i++) ids[i] = GATEID_interned(&kraus[4*i]);
+
+    // every K_i rho K_i^dagger is a gate (and possibly a gc of the edge
+    // weight table) so rho and the sum so far need to be protected
+    QMDD res = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    evbdd_protect(&rho);
+    evbdd_protect(&res);
+    for (uint32_t i = 0; i < nkraus; i++) {
+        QMDD term = evbdd_refs_push(qmdd_dm_gate(rho, ids[i], t));
+        res = evbdd_plus(res, term);
+        evbdd_refs_pop(1);
+    }
+    evbdd_unprotect(&rho);
+    evbdd_unprotect(&res);
+    free(ids);
+    return res;
+}
+
+QMDD
+qmdd_dm_depolarize(QMDD rho, double p, BDDVAR t)
+{
+    if (p == 0) return rho;
+
+    // X, Y and Z are static gates, so (like the interned gates used for
+    // qmdd_dm_kraus) these don't invalidate the operation cache
+    gate_id_t paulis[3] = {GATEID_X, GATEID_Y, GATEID_Z};
+    QMDD res = qmdd_dm_scale(rho, 1.0 - p);
+    evbdd_protect(&rho);
+    evbdd_protect(&res);
+    for (int i = 0; i < 3; i++) {
+        QMDD term = qmdd_dm_scale(qmdd_dm_gate(rho, paulis[i], t), p / 3.0);
+        evbdd_refs_push(term);
+        res = evbdd_plus(res, term);
+        evbdd_refs_pop(1);
+    }
+    evbdd_unprotect(&rho);
+    evbdd_unprotect(&res);
+    return res;
+}
+
+QMDD
+qmdd_dm_amplitude_damp(QMDD rho, double gamma, BDDVAR t)
+{
+    if (gamma == 0) return rho;
+    complex_t kraus[8] = {
+        cone(),  czero(), czero(), cmake(flt_sqrt(1.0 - gamma), 0.0), // K_0
+        czero(), cmake(flt_sqrt(gamma), 0.0), czero(), czero()         // K_1
+    };
+    return qmdd_dm_kraus(rho, kraus, 2, t);
+}
+
+TASK_IMPL_2(QMDD, qmdd_dm_partial_trace, QMDD, rho, BDDVAR, q)
+{
+    if (EVBDD_WEIGHT(rho) == EVBDD_ZERO) return rho;
+
+    BDDVAR k = qmdd_dm_topqubit(rho);
+    if (k > q) k = q;
+
+    // Check cache (w/o root weight)
+    QMDD res;
+    bool cachenow = ((k % granularity) == 0);
+    if (cachenow) {
+        if (cache_get3(CACHE_QMDD_DM_PTRACE, EVBDD_TARGET(rho), q, 0, &res)) {
+            return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(rho), EVBDD_WEIGHT(res)));
+        }
+    }
+
+    QMDD B[2][2];
+    qmdd_dm_get_blocks(rho, k, B);
+    if (k == q) {
+        // B_00 + B_11, with the qubits below q moved up one level
+        QMDD b0 = evbdd_refs_push(evbdd_increase_all_vars(B[0][0], -2));
+        QMDD b1 = evbdd_refs_push(evbdd_increase_all_vars(B[1][1], -2));
+        res = CALL(evbdd_plus, b0, b1);
+        evbdd_refs_pop(2);
+    }
+    else {
+        QMDD R[2][2];
+        evbdd_refs_spawn(SPAWN(qmdd_dm_partial_trace, B[1][1], q));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_partial_trace, B[1][0], q));
+        evbdd_refs_spawn(SPAWN(qmdd_dm_partial_trace, B[0][1], q));
+        R[0][0] = evbdd_refs_push(CALL(qmdd_dm_partial_trace, B[0][0], q));
+        R[0][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_partial_trace)));
+        R[1][0] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_partial_trace)));
+        R[1][1] = evbdd_refs_push(evbdd_refs_sync(SYNC(qmdd_dm_partial_trace)));
+        res = qmdd_dm_makenode(k, R);
+        evbdd_refs_pop(4);
+    }
+
+    if (cachenow) {
+        cache_put3(CACHE_QMDD_DM_PTRACE, EVBDD_TARGET(rho), q, 0, res);
+    }
+    return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(rho), EVBDD_WEIGHT(res)));
+}
+
+/**
+ * Computes Tr(rho_k P_{k..n-1}), with rho_k a block of rho for qubits k..n-1
+ * and P_{k..n-1} the suffix of the Pauli string which starts at qubit k.
+ */
+TASK_3(EVBDD_WGT, qmdd_dm_expectation_pauli_rec, qmdd_pauli_ctx_t*, ctx, QMDD, rho, BDDVAR, k)
+{
+    if (EVBDD_WEIGHT(rho) == EVBDD_ZERO) return EVBDD_ZERO;
+    if (k == ctx->nqubits) return EVBDD_WEIGHT(rho);
+
+    // Past the last non-I Pauli only the trace is left, which has key 0
+    bool trace = ((int)k > ctx->last);
+    char p = trace ? 'I' : ctx->pauli[k];
+    uint64_t suffix_key = trace ? 0 : ctx->suffix_key[k];
+
+    // Check cache (w/o root weight)
+    EVBDD_WGT res;
+    uint64_t key = QMDD_PARAM_PACK_16(k, ctx->nqubits);
+    bool cachenow = ((k % granularity) == 0);
+    if (cachenow) {
+        if (cache_get3(CACHE_QMDD_DM_EXP_PAULI, EVBDD_TARGET(rho), key, suffix_key, &res)) {
+            return wgt_mul(res, EVBDD_WEIGHT(rho));
+        }
+    }
+
+    // Tr(M P) = sum_rc M_rc P_cr, so I and Z take the diagonal blocks of rho
+    // and X and Y the off-diagonal ones
+    QMDD B[2][2];
+    EVBDD_WGT r0, r1;
+    qmdd_dm_get_blocks(rho, k, B);
+    if (p == 'X' || p == 'Y') {
+        SPAWN(qmdd_dm_expectation_pauli_rec, ctx, B[1][0], k+1);
+        r0 = CALL(qmdd_dm_expectation_pauli_rec, ctx, B[0][1], k+1);
+        r1 = SYNC(qmdd_dm_expectation_pauli_rec);
+    }
+    else {
+        SPAWN(qmdd_dm_expectation_pauli_rec, ctx, B[1][1], k+1);
+        r0 = CALL(qmdd_dm_expectation_pauli_rec, ctx, B[0][0], k+1);
+        r1 = SYNC(qmdd_dm_expectation_pauli_rec);
+    }
+
+    switch (p) {
+        case 'I':
+        case 'X':
+            res = wgt_add(r0, r1);
+            break;
+        case 'Y': {
+            complex_t i = cmake(0.0, 1.0);
+            res = wgt_mul(wgt_sub(r0, r1), weight_lookup(&i));
+            break;
+        }
+        default: // 'Z'
+            res = wgt_sub(r0, r1);
+            break;
+    }
+
+    if (cachenow) {
+        cache_put3(CACHE_QMDD_DM_EXP_PAULI, EVBDD_TARGET(rho), key, suffix_key, res);
+    }
+    return wgt_mul(res, EVBDD_WEIGHT(rho));
+}
+
+double
+qmdd_dm_expectation_pauli(QMDD rho, const char *pauli, BDDVAR nqubits)
+{
+    qmdd_pauli_ctx_t ctx;
+    qmdd_pauli_ctx_init(&ctx, pauli, nqubits);
+    EVBDD_WGT res = RUN(qmdd_dm_expectation_pauli_rec, &ctx, rho, 0);
+    free(ctx.suffix_key);
+    return qmdd_pauli_result(res);
+}
+
+double
+qmdd_dm_trace(QMDD rho, BDDVAR nqubits)
+{
+    qmdd_pauli_ctx_t ctx;
+    ctx.pauli = NULL;
+    ctx.suffix_key = NULL;
+    ctx.last = -1;
+    ctx.nqubits = nqubits;
+    EVBDD_WGT res = RUN(qmdd_dm_expectation_pauli_rec, &ctx, rho, 0);
+    return qmdd_pauli_result(res);
+}
+
+QMDD
+qmdd_dm_measure_qubit(QMDD rho, BDDVAR k, BDDVAR nqubits, int *m, double *p)
+{
+    evbdd_protect(&rho);
+    QMDD rho0 = qmdd_dm_gate(rho, GATEID_proj0, k);
+    evbdd_protect(&rho0);
+    double prob_low = qmdd_dm_trace(rho0, nqubits) / qmdd_dm_trace(rho, nqubits);
+
+    // flip a coin
+    float rnd = ((float)rand())/((float)RAND_MAX);
+    *m = (rnd < prob_low) ? 0 : 1;
+    *p = (*m == 0) ? prob_low : 1.0 - prob_low;
+
+    // produce post-measurement state
+    QMDD res = (*m == 0) ? rho0 : qmdd_dm_gate(rho, GATEID_proj1, k);
+    res = qmdd_dm_scale(res, 1.0 / qmdd_dm_trace(res, nqubits));
+    evbdd_unprotect(&rho);
+    evbdd_unprotect(&rho0);
+    return res;
+}
+
+QMDD
+qmdd_dm_measure_all(QMDD rho, BDDVAR nqubits, bool *ms, double *p)
+{
+    *p = 1.0;
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        int m;
+        double p_k;
+        rho = qmdd_dm_measure_qubit(rho, k, nqubits, &m, &p_k);
+        ms[k] = m;
+        *p *= p_k;
+    }
+    return rho;
+}
+
+/****************************</Density matrices>******************************/
+
+
+
+
+
+/************************<Parameter-shift gradients>***************************/
+
+static uint32_t
+qmdd_pgate_id(const qmdd_pgate_t *g, double theta)
+{
+    switch (g->type) {
+        case QMDD_PGATE_RX: return GATEID_Rx_interned(theta);
+        case QMDD_PGATE_RY: return GATEID_Ry_interned(theta);
+        case QMDD_PGATE_RZ: return GATEID_Rz_interned(theta);
+        case QMDD_PGATE_PHASE: return GATEID_Phase_interned(theta);
+        default: return g->gate;
+    }
+}
+
+static QMDD
+qmdd_pgate_apply(const qmdd_pcircuit_t *pc, QMDD state, uint32_t i, uint32_t gate)
+{
+    const qmdd_pgate_t *g = &pc->gates[i];
+    if (g->type != QMDD_PGATE_FIXED || g->c1 == EVBDD_INVALID_VAR) {
+        return qmdd_gate(state, gate, g->t);
+    }
+    return _qmdd_cgate(state, gate, g->c1, g->c2, g->c3, g->t, pc->nqubits);
+}
+
+QMDD
+qmdd_pcircuit_run(const qmdd_pcircuit_t *pc, const double *theta)
+{
+    QMDD state = qmdd_create_all_zero_state(pc->nqubits);
+    evbdd_protect(&state);
+    for (uint32_t i = 0; i < pc->ngates; i++) {
+        const qmdd_pgate_t *g = &pc->gates[i];
+        double angle = (g->type == QMDD_PGATE_FIXED) ? 0.0 : theta[g->param];
+        state = qmdd_pgate_apply(pc, state, i, qmdd_pgate_id(g, angle));
+    }
+    evbdd_unprotect(&state);
+    return state;
+}
+
+typedef struct qmdd_pshift_s {
+    const qmdd_pcircuit_t *pc;
+    uint32_t *ids;          // ids[i]: gate ID of gate i at theta
+    uint32_t *rot;          // rot[j]: position of rotation j in the circuit
+    uint32_t *shifted;      // shifted[2j], shifted[2j+1]: rotation j at +-pi/2
+    QMDD *checkpoint;       // checkpoint[j]: state before rotation j
+    char **paulis;
+    const double *coeffs;
+    uint32_t nterms;
+    double *value;          // value[s]: E of shifted suffix s
+} qmdd_pshift_t;
+
+/**
+ * Runs the shifted suffixes [from, to), where suffix s starts at checkpoint
+ * s/2 with rotation s/2 shifted by +pi/2 (s even) or -pi/2 (s odd).
+ */
+VOID_TASK_3(qmdd_pshift_rec, qmdd_pshift_t*, ps, uint32_t, from, uint32_t, to)
+{
+    if (to - from == 1) {
+        uint32_t j = from / 2;
+        QMDD state = ps->checkpoint[j];
+        evbdd_protect(&state);
+        state = qmdd_pgate_apply(ps->pc, state, ps->rot[j], ps->shifted[from]);
+        for (uint32_t i = ps->rot[j] + 1; i < ps->pc->ngates; i++) {
+            state = qmdd_pgate_apply(ps->pc, state, i, ps->ids[i]);
+        }
+        qmdd_hamiltonian_t h;
+        h.qmdd = state;
+        h.paulis = ps->paulis;
+        h.coeffs = ps->coeffs;
+        h.nqubits = ps->pc->nqubits;
+        h.term_values = NULL;
+        ps->value[from] = (ps->nterms == 0) ? 0.0 : CALL(qmdd_expectation_hamiltonian_rec, &h, 0, ps->nterms);
+        evbdd_unprotect(&state);
+        return;
+    }
+    uint32_t mid = from + (to - from) / 2;
+    SPAWN(qmdd_pshift_rec, ps, mid, to);
+    CALL(qmdd_pshift_rec, ps, from, mid);
+    SYNC(qmdd_pshift_rec);
+}
+
+double
+qmdd_param_shift_gradient(const qmdd_pcircuit_t *pc, const double *theta, char **paulis, const double *coeffs, uint32_t nterms, double *grad)
+{
+    assert(qubit_level == NULL && reorder_growth == 0 && approx_nqubits == 0 && dense_max_levels == 0);
+
+    qmdd_pshift_t ps;
+    ps.pc = pc;
+    ps.paulis = paulis;
+    ps.coeffs = coeffs;
+    ps.nterms = nterms;
+    ps.ids = malloc(sizeof(uint32_t) * pc->ngates);
+    ps.rot = malloc(sizeof(uint32_t) * pc->ngates);
+    uint32_t nrot = 0;
+    for (uint32_t i = 0; i < pc->ngates; i++) {
+        if (pc->gates[i].type != QMDD_PGATE_FIXED) {
+            assert(pc->gates[i].c1 == EVBDD_INVALID_VAR && "parameter-shift rule needs uncontrolled rotations");
+            ps.rot[nrot++] = i;
+        }
+    }
+
+    // intern all (shifted) rotations before any of them are applied
+    if (qmdd_gates_num_interned() + 3 * nrot > QMDD_MAX_INTERNED_GATES) {
+        qmdd_gates_clear_interned();
+    }
+    ps.shifted = malloc(sizeof(uint32_t) * 2 * nrot);
+    for (uint32_t i = 0; i < pc->ngates; i++) {
+        const qmdd_pgate_t *g = &pc->gates[i];
+        ps.ids[i] = qmdd_pgate_id(g, (g->type == QMDD_PGATE_FIXED) ? 0.0 : theta[g->param]);
+    }
+    uint32_t unshifted = qmdd_gates_num_interned();
+    for (uint32_t j = 0; j < nrot; j++) {
+        const qmdd_pgate_t *g = &pc->gates[ps.rot[j]];
+        ps.shifted[2*j]   = qmdd_pgate_id(g, theta[g->param] + M_PI_2);
+        ps.shifted[2*j+1] = qmdd_pgate_id(g, theta[g->param] - M_PI_2);
+    }
+
+    // forward run, with a checkpoint before every rotation
+    ps.checkpoint = malloc(sizeof(QMDD) * nrot);
+    QMDD state = qmdd_create_all_zero_state(pc->nqubits);
+    evbdd_protect(&state);
+    for (uint32_t i = 0, j = 0; i < pc->ngates; i++) {
+        if (j < nrot && ps.rot[j] == i) {
+            ps.checkpoint[j] = state;
+            evbdd_protect(&ps.checkpoint[j]);
+            j++;
+        }
+        state = qmdd_pgate_apply(pc, state, i, ps.ids[i]);
+    }
+    double energy = qmdd_expectation_hamiltonian(state, paulis, coeffs, nterms, pc->nqubits, NULL);
+    evbdd_unprotect(&state);
+
+    // shifted suffixes, in batches if they run concurrently
+    ps.value = malloc(sizeof(double) * 2 * nrot);
+    uint32_t batch = 2 * nrot;
+    bool auto_gc = evbdd_get_auto_gc_wgt_table();
+    if (lace_workers() > 1 && nrot > 0) {
+        // the edge weight table can only be cleaned up between batches
+        evbdd_set_auto_gc_wgt_table(false);
+        batch = 2 * lace_workers();
+    }
+    for (uint32_t from = 0; from < 2 * nrot; from += batch) {
+        uint32_t to = (from + batch < 2 * nrot) ? from + batch : 2 * nrot;
+        RUN(qmdd_pshift_rec, &ps, from, to);
+        if (auto_gc && evbdd_test_gc_wgt_table()) {
+            evbdd_gc_wgt_table();
+        }
+    }
+    evbdd_set_auto_gc_wgt_table(auto_gc);
+
+    for (uint32_t p = 0; p < pc->nparams; p++) grad[p] = 0.0;
+    for (uint32_t j = 0; j < nrot; j++) {
+        grad[pc->gates[ps.rot[j]].param] += (ps.value[2*j] - ps.value[2*j+1]) / 2.0;
+        evbdd_unprotect(&ps.checkpoint[j]);
+    }
+
+    // the shifted rotations are not needed after this call
+    qmdd_gates_release_interned(unshifted);
+
+    free(ps.ids);
+    free(ps.rot);
+    free(ps.shifted);
+    free(ps.checkpoint);
+    free(ps.value);
+    return energy;
+}
+
+/***********************</Parameter-shift gradients>***************************/
 
 
 
@@ -25,9 +25,19 @@
 #ifndef QSYLVAN_SIMULATOR_H
 #define QSYLVAN_SIMULATOR_H
 
+#ifdef __cplusplus
+// sylvan_int.h (C11 atomics) cannot be compiled as C++, only the public headers
+#include <sylvan.h>
+#include <sylvan_edge_weights.h>
+#else
 #include <sylvan_int.h>
+#endif
 #include <qsylvan_gates.h>
 
+#ifdef __cplusplus
+namespace sylvan {
+#endif
+
 typedef EVBDD QMDD; // QMDD edge (contains AMP and PTR)
 typedef EVBDD_WGT AMP; // edge weight index
 typedef EVBDD_TARG PTR; // node index
@@ -191,6 +201,13 @@ QMDD qmdd_create_all_control_phase(BDDVAR n, bool *x);
 QMDD qmdd_measure_qubit(QMDD qqd, BDDVAR k, BDDVAR nvars, int *m, double *p);
 QMDD qmdd_measure_q0(QMDD qmdd, BDDVAR nvars, int *m, double *p);
 
+/**
+ * As qmdd_measure_qubit, but with the coin flip rnd (uniform in [0,1]) given
+ * by the caller instead of drawn with rand(), e.g. to measure again with the
+ * same outcome after the first attempt ran out of memory.
+ */
+QMDD qmdd_measure_qubit_with(QMDD qmdd, BDDVAR k, BDDVAR nvars, double rnd, int *m, double *p);
+
 /**
  * Computational basis measurement of all n qubits in the qmdd.
  * 
@@ -227,6 +244,71 @@ TASK_DECL_3(double, qmdd_unnormed_prob, QMDD, BDDVAR, BDDVAR);
  */
 complex_t qmdd_get_amplitude(QMDD qmdd, bool *basis_state, BDDVAR nqubits);
 
+/**
+ * Get the amplitudes of a batch of basis states. The queries are sorted such
+ * that shared prefixes (in the QMDD variable order) are traversed only once,
+ * and independent parts of the batch are handled by different workers.
+ * 
+ * @param qmdd A QMDD encoding some quantum state |psi>.
+ * @param basis_states Array of <count> bitstrings, each in the format of
+ * qmdd_get_amplitude (i.e. q_{n-1}, ..., q_0).
+ * @param count Number of queries.
+ * @param nqubits Number of qubits of the state.
+ * @param amps Output array of length <count>, amps[i] = <x_i|psi>.
+ */
+void qmdd_get_amplitudes(QMDD qmdd, bool **basis_states, uint64_t count, BDDVAR nqubits, complex_t *amps);
+
+/**
+ * Callback for qmdd_foreach_amplitude. The basis state |x> is given as an
+ * index with qubit q_k in bit k (so q_0 is the least significant bit).
+ */
+typedef void (*qmdd_amp_cb)(uint64_t index, complex_t amp, void *context);
+
+/**
+ * Calls <cb> for every basis state |x> of an n qubit state |psi> with 
+ * |<x|psi>|^2 > threshold (threshold = 0 gives all non-zero amplitudes), by a
+ * DFS over the QMDD which carries the product of the edge weights down.
+ * Zero edges are skipped, and with NORM_MAX / NORM_L2 (where all edge weights
+ * below the root are <= 1 in absolute value) so are all sub-QMDDs whose
+ * accumulated weight is already below the threshold.
+ * 
+ * @param qmdd A QMDD encoding some quantum state |psi>.
+ * @param nqubits Number of qubits of the state (at most 64).
+ * @param threshold Only amplitudes with |amp|^2 > threshold are visited.
+ * @param ordered If true, the DFS is sequential and visits the basis states in
+ * lexicographic order of (q_0, q_1, ..., q_{n-1}). If false, the DFS runs in
+ * parallel, and <cb> can be called concurrently in any order.
+ * 
+ * @return The number of amplitudes <cb> has been called for.
+ */
+uint64_t qmdd_foreach_amplitude(QMDD qmdd, BDDVAR nqubits, double threshold, bool ordered, qmdd_amp_cb cb, void *context);
+
+/**
+ * Record written by qmdd_amplitudes_tofile.
+ */
+typedef struct qmdd_amp_record_s {
+    uint64_t index;
+    double re;
+    double im;
+} qmdd_amp_record_t;
+
+/**
+ * Streams all amplitudes with |amp|^2 > threshold to <out> as a sequence of
+ * binary qmdd_amp_record_t records, using a fixed size buffer per worker.
+ * 
+ * @param MSB_first If true q_0 is the most significant bit of the index (as
+ * with int_to_bitarray), otherwise q_0 is the least significant bit.
+ * @param ordered If true, the records are sorted by index. The DFS visits the
+ * indices in order if <MSB_first> is true. Otherwise the records are sorted
+ * in runs of 2^20 records (24 MB), which are merged through a temporary file.
+ * 
+ * See qmdd_foreach_amplitude for the other parameters.
+ * 
+ * @return The number of records written. If a write fails, this is reported
+ * on stderr, the remaining records are skipped, and ferror(out) is set.
+ */
+uint64_t qmdd_amplitudes_tofile(FILE *out, QMDD qmdd, BDDVAR nqubits, double threshold, bool ordered, bool MSB_first);
+
 /**
  * Computes the probability from a given edge weight index.
  * 
@@ -249,6 +331,35 @@ AMP qmdd_amp_from_prob(double a);
  */
 double qmdd_fidelity(QMDD a, QMDD b, BDDVAR nvars);
 
+/**
+ * Computes the expectation value <psi|P|psi> of a Pauli string P, in a single
+ * simultaneous traversal of |psi> with itself (without constructing P).
+ * Results are cached per (pair of nodes, Pauli suffix), so Pauli strings 
+ * which share a suffix share the sub-results of that suffix.
+ * 
+ * @param qmdd A QMDD encoding an n qubit state |psi>.
+ * @param pauli String of length n over {I,X,Y,Z}, pauli[k] acts on qubit k.
+ * @param nqubits Number of qubits.
+ * 
+ * @return <psi|P|psi>
+ */
+double qmdd_expectation_pauli(QMDD qmdd, const char *pauli, BDDVAR nqubits);
+
+/**
+ * Computes <psi|H|psi> for H = sum_i coeffs[i] * P_i, where the terms are
+ * evaluated in parallel with qmdd_expectation_pauli.
+ * 
+ * @param qmdd A QMDD encoding an n qubit state |psi>.
+ * @param paulis Array of <nterms> Pauli strings (see qmdd_expectation_pauli).
+ * @param coeffs Array of <nterms> real coefficients.
+ * @param nterms Number of terms of H.
+ * @param nqubits Number of qubits.
+ * @param term_values If not NULL, term_values[i] is set to <psi|P_i|psi>.
+ * 
+ * @return <psi|H|psi>
+ */
+double qmdd_expectation_hamiltonian(QMDD qmdd, char **paulis, const double *coeffs, uint32_t nterms, BDDVAR nqubits, double *term_values);
+
 /**********************</Measurements and probabilities>***********************/
 
 
@@ -366,6 +477,25 @@ TASK_DECL_6(QMDD, qmdd_ccircuit, QMDD, circuit_id_t, BDDVAR*, uint32_t, BDDVAR,
  */
 QMDD qmdd_all_control_phase(QMDD qmdd, BDDVAR n, bool *x);
 
+/**
+ * Applies the diagonal operator sum_x (f(x) ? phase : 1) |x><x|, i.e. 
+ * multiplies the amplitude of every |x> for which the BDD f holds with the 
+ * given phase, in a single simultaneous traversal of the QMDD and f. Variable
+ * k of f refers to qubit k. Oracles can be built with the usual BDD 
+ * operations, e.g. a CNF formula with sylvan_and / sylvan_or.
+ * 
+ * f can also be an MTBDD with double leaves theta(x), in which case psi(x) is
+ * multiplied with e^(i theta(x)) (mtbdd_false leaves leave psi(x) unchanged).
+ * 
+ * @param qmdd A QMDD encoding some quantum state |psi>.
+ * @param f BDD or MTBDD (with double leaves) over the qubits.
+ * @param phase Edge weight to multiply with where f is mtbdd_true. This does
+ * not need to be a phase, e.g. phase = 0 projects onto the states where f
+ * does not hold (the result is not normalized).
+ */
+#define qmdd_apply_diagonal(qmdd,f,phase) (RUN(qmdd_apply_diagonal,qmdd,f,phase))
+TASK_DECL_3(QMDD, qmdd_apply_diagonal, QMDD, MTBDD, AMP);
+
 /********************</Applying (controlled) sub-circuits>*********************/
 
 
@@ -390,6 +520,373 @@ void qmdd_set_periodic_gc_nodetable(int every_n_gates);
 
 
 
+/**************************<Dynamic qubit reordering>**************************/
+
+/**
+ * By default qubit k is variable (level) k of the QMDD. With reordering 
+ * enabled the levels can be permuted at run time by (automatic) sifting. The
+ * permutation is tracked globally (for a single state), and qmdd_gate, 
+ * qmdd_cgate(2/3), qmdd_measure_qubit, qmdd_measure_all and 
+ * qmdd_get_amplitude take / report qubits in the original order. Other 
+ * functions (sub-circuits, amplitude iterators, ..) act on levels, so
+ * qmdd_restore_qubit_order should be called before using those, and 
+ * qmdd_cgate_range asserts that reordering is disabled.
+ */
+
+// Automatic sifting is only considered for states with more nodes than this
+#define QMDD_REORDER_MIN_NODES 64
+// Sifting stops moving a qubit in one direction when nodes > this * best
+#define QMDD_REORDER_MAX_GROWTH 2.0
+
+/**
+ * Enables qubit reordering for states with <nqubits> qubits, starting from
+ * the identity order (nqubits = 0 disables reordering again).
+ * 
+ * @param growth If > 0, qmdd_sift is triggered before a gate when the node
+ * count of the state exceeds <growth> times the node count after the last
+ * sifting.
+ */
+void qmdd_set_auto_reorder(BDDVAR nqubits, double growth);
+
+/**
+ * Returns the level in the QMDD at which the given qubit currently is.
+ */
+BDDVAR qmdd_get_qubit_level(BDDVAR qubit);
+
+/**
+ * Sets the level of every qubit (a permutation of 0..nqubits-1), without 
+ * changing any QMDD. Only valid while the state is invariant under this 
+ * permutation, e.g. for a static order chosen before the simulation starts
+ * from |0...0>. Requires reordering to be enabled.
+ */
+void qmdd_set_qubit_levels(const BDDVAR *levels);
+
+/**
+ * Swaps the qubits at levels k and k+1 of the state, and updates the tracked
+ * qubit order.
+ */
+QMDD qmdd_swap_levels(QMDD qmdd, BDDVAR k);
+
+/**
+ * Sifting: moves every qubit through all levels (with adjacent level swaps)
+ * and leaves it at the level which gives the smallest number of nodes.
+ */
+QMDD qmdd_sift(QMDD qmdd);
+
+/**
+ * Permutes the levels of the state back to the original qubit order.
+ */
+QMDD qmdd_restore_qubit_order(QMDD qmdd);
+
+/**
+ * Number of siftings, number of adjacent level swaps, and total time spent 
+ * on sifting since reordering was enabled.
+ */
+void qmdd_get_reorder_stats(uint64_t *sifts, uint64_t *swaps, double *time);
+
+/*************************</Dynamic qubit reordering>**************************/
+
+
+
+
+
+/***************************<Approximate simulation>***************************/
+
+/**
+ * Approximates the state by pruning the edges which carry the least 
+ * probability mass (computed with qmdd_unnormed_prob), until at most 
+ * <budget> of the total mass has been removed, and renormalizes. States with
+ * 2^31 or more nodes are returned as they are (with fidelity 1).
+ * 
+ * @param qmdd A QMDD encoding an n qubit state |psi>.
+ * @param nqubits Number of qubits.
+ * @param budget Fraction of the probability mass which may be removed.
+ * @param fidelity Returns |<psi|psi'>|^2 of the approximation |psi'>.
+ * 
+ * @return The (normalized) approximation |psi'>.
+ */
+QMDD qmdd_approximate(QMDD qmdd, BDDVAR nqubits, double budget, double *fidelity);
+
+/**
+ * Enables approximate simulation (for states with <nqubits> qubits): before
+ * a gate is applied, the state is approximated with qmdd_approximate when it
+ * has more than <max_nodes> nodes (0 = ignore), or when the edge weight table
+ * is more than <max_wgt_fill> full (0 = ignore). Every round keeps a 
+ * fidelity of at least <round_fidelity>, and no rounds are done anymore once
+ * the accumulated fidelity would drop below <fidelity_floor>.
+ */
+void qmdd_set_approximation(BDDVAR nqubits, uint64_t max_nodes, double max_wgt_fill, double round_fidelity, double fidelity_floor);
+
+/**
+ * Product of the fidelities of all approximation rounds since approximation
+ * was enabled, and the number of rounds.
+ */
+void qmdd_get_approximation_stats(double *fidelity, uint64_t *rounds);
+
+/**************************</Approximate simulation>***************************/
+
+
+
+
+
+/*****************************<Dense leaf blocks>******************************/
+
+/**
+ * For highly entangled states the bottom levels of the QMDD are (nearly)
+ * complete binary trees, where applying a gate recursively costs a cache
+ * lookup, an addition and a new node for every single amplitude. With dense
+ * leaf blocks enabled, qmdd_gate (and the target of qmdd_cgate once all
+ * controls are above the block) handles a sub-QMDD rooted at or below the
+ * block level as a dense array of at most 2^k amplitudes: the sub-QMDD is
+ * expanded, the gate is applied with a vectorizable kernel on separate
+ * real/imaginary arrays, and the result is built back bottom-up (and thereby
+ * interned in the unique table). Results are cached like regular gate
+ * results, so a block shared by several paths is only computed once.
+ *
+ * Blocks are not kept as arrays between gates: every gate on a block still
+ * creates its nodes and looks up its edge weights (once per node instead of
+ * once per recursive call), so this saves the recursion, not the node table
+ * and edge weight table work.
+ *
+ * The block level adapts to the state: every QMDD_DENSE_RECHECK gates the
+ * number of nodes per level is counted, and the block level becomes the
+ * topmost level >= nqubits - k from which on every level has at least
+ * <min_density> times the nodes of a complete binary tree (i.e. level l+1 has
+ * at least 2 * min_density times the nodes of level l). Blocks span at least
+ * two levels, otherwise no dense blocks are used.
+ *
+ * The block level is a heuristic only: gates on other states (with more or
+ * fewer qubits) are still correct. A block with nodes below level nqubits - 1
+ * is applied recursively instead, and gates on targets >= nqubits never use
+ * dense blocks. The recheck is not meant for concurrent gates on different
+ * states though (e.g. qmdd_param_shift_gradient requires dense blocks off).
+ */
+
+// Maximum number of levels in a dense block
+#define QMDD_DENSE_MAX_LEVELS 16
+// Number of gates after which the block level is determined again
+#define QMDD_DENSE_RECHECK 8
+
+/**
+ * Enables dense leaf blocks of up to <k> levels for states with <nqubits>
+ * qubits (k = 0 disables them again).
+ */
+void qmdd_set_dense_blocks(BDDVAR nqubits, BDDVAR k, double min_density);
+
+/**
+ * Current block level (nqubits if no dense blocks are used at the moment),
+ * and the number of blocks to which a gate has been applied densely.
+ */
+void qmdd_get_dense_block_stats(BDDVAR *level, uint64_t *blocks);
+
+/****************************</Dense leaf blocks>*****************************/
+
+
+
+
+
+/*****************************<Density matrices>*******************************/
+
+/**
+ * A density matrix rho of an n qubit (mixed) state is stored as a matrix QMDD
+ * over 2n variables, with the same layout as the gate matrices (see
+ * qmdd_create_all_identity_matrix): for qubit k, variable 2k selects the
+ * column and variable 2k+1 the row. The functions below work on rho directly,
+ * e.g. a gate U gives U rho U^dagger in a single traversal of rho (instead of
+ * two matrix-matrix products), where U is applied to the row and U^dagger to
+ * the column variables of the 2x2 blocks at the target qubit.
+ *
+ * Density matrices can not be combined with dynamic qubit reordering,
+ * approximation or dense leaf blocks, which all assume a state vector.
+ *
+ * The cost of a gate is proportional to the number of nodes of rho. For a
+ * pure state this is up to the square of the number of nodes of the state
+ * vector, and noise channels make rho (nearly) full rank, so an n qubit rho
+ * approaches 4^n nodes (against at most 2^n for a vector). E.g. the final
+ * state of qasm/circuits/dnn_n8.qasm has 253 nodes and takes 2 s, but as a
+ * density matrix it has 55022 nodes and takes 450 s (1 worker). For larger
+ * noisy circuits, sampling trajectories is usually much cheaper.
+ */
+
+/**
+ * Returns the matrix |a><b| of two n qubit state vectors |a> and |b>, and the
+ * density matrix |psi><psi| of a state vector |psi>.
+ */
+#define qmdd_dm_outer_product(a,b) (RUN(qmdd_dm_outer_product,a,b))
+#define qmdd_dm_from_state(qmdd) (RUN(qmdd_dm_outer_product,qmdd,qmdd))
+TASK_DECL_2(QMDD, qmdd_dm_outer_product, QMDD, QMDD);
+
+/**
+ * Applies the given (controlled) gate U to rho, i.e. returns U rho U^dagger.
+ * Controls after the target are handled in the same recursion (so unlike
+ * qmdd_cgate this does not need the number of qubits).
+ */
+#define qmdd_dm_gate(rho,gate,t) _qmdd_dm_cgate(rho,gate,EVBDD_INVALID_VAR,EVBDD_INVALID_VAR,EVBDD_INVALID_VAR,t)
+#define qmdd_dm_cgate(rho,gate,c,t) _qmdd_dm_cgate(rho,gate,c,EVBDD_INVALID_VAR,EVBDD_INVALID_VAR,t)
+#define qmdd_dm_cgate2(rho,gate,c1,c2,t) _qmdd_dm_cgate(rho,gate,c1,c2,EVBDD_INVALID_VAR,t)
+#define qmdd_dm_cgate3(rho,gate,c1,c2,c3,t) _qmdd_dm_cgate(rho,gate,c1,c2,c3,t)
+QMDD _qmdd_dm_cgate(QMDD rho, gate_id_t gate, BDDVAR c1, BDDVAR c2, BDDVAR c3, BDDVAR t);
+TASK_DECL_4(QMDD, qmdd_dm_cgate, QMDD, gate_id_t, BDDVAR*, BDDVAR);
+
+/**
+ * Recursive implementation of qmdd_dm_cgate. Bit 0 of <sides> tells whether U
+ * still has to be applied to the rows, bit 1 whether U^dagger still has to be
+ * applied to the columns (the blocks of rho where a control is |0> on one
+ * side only get U on the other side only). For controls after the target the
+ * blocks at the target are combined below it.
+ */
+TASK_DECL_6(QMDD, qmdd_dm_gate_rec, QMDD, gate_id_t, BDDVAR*, uint32_t, BDDVAR, uint32_t);
+
+/**
+ * Swaps qubits qubit1 and qubit2 of rho (with CNOT gates, see
+ * qmdd_circuit_swap).
+ */
+QMDD qmdd_dm_swap(QMDD rho, BDDVAR qubit1, BDDVAR qubit2);
+
+/**
+ * Applies the channel rho -> sum_i K_i rho K_i^dagger on qubit t, where
+ * kraus[4*i .. 4*i+3] = {k00, k01, k10, k11} is the Kraus operator K_i.
+ * The Kraus operators are interned (see GATEID_interned), so applying the
+ * same channel again reuses the cached results.
+ */
+QMDD qmdd_dm_kraus(QMDD rho, const complex_t *kraus, uint32_t nkraus, BDDVAR t);
+
+/**
+ * Depolarizing channel on qubit t:
+ * rho -> (1-p) rho + p/3 (X rho X + Y rho Y + Z rho Z).
+ */
+QMDD qmdd_dm_depolarize(QMDD rho, double p, BDDVAR t);
+
+/**
+ * Amplitude damping channel on qubit t, with Kraus operators
+ * K_0 = |0><0| + sqrt(1-gamma) |1><1| and K_1 = sqrt(gamma) |0><1|.
+ */
+QMDD qmdd_dm_amplitude_damp(QMDD rho, double gamma, BDDVAR t);
+
+/**
+ * Traces out qubit q of an n qubit density matrix. The result is a density
+ * matrix of n-1 qubits, where qubits q+1 .. n-1 have become q .. n-2. (So to
+ * trace out several qubits, trace out the highest one first.)
+ */
+#define qmdd_dm_partial_trace(rho,q) (RUN(qmdd_dm_partial_trace,rho,q))
+TASK_DECL_2(QMDD, qmdd_dm_partial_trace, QMDD, BDDVAR);
+
+/**
+ * Computes Tr(rho P) for a Pauli string P (see qmdd_expectation_pauli), by
+ * summing the blocks of rho selected by P in a single traversal. Results are
+ * cached per (node, Pauli suffix) like those of qmdd_expectation_pauli.
+ */
+double qmdd_dm_expectation_pauli(QMDD rho, const char *pauli, BDDVAR nqubits);
+
+/**
+ * Computes Tr(rho).
+ */
+double qmdd_dm_trace(QMDD rho, BDDVAR nqubits);
+
+/**
+ * Computes the purity Tr(rho^2), which for Hermitian rho is the sum of the
+ * squared absolute values of its entries.
+ */
+#define qmdd_dm_purity(rho,nqubits) qmdd_get_norm(rho, 2*(nqubits))
+
+/**
+ * Computational basis measurement of qubit k of rho (with Tr(rho) = 1).
+ *
+ * @param m Return of measurement outcome (0 or 1).
+ * @param p Return of the probability of outcome m.
+ *
+ * @return The post-measurement density matrix |m><m|_k rho |m><m|_k / p.
+ */
+QMDD qmdd_dm_measure_qubit(QMDD rho, BDDVAR k, BDDVAR nqubits, int *m, double *p);
+
+/**
+ * Computational basis measurement of all n qubits of rho (with Tr(rho) = 1).
+ *
+ * @param ms Array of length n where the measurement outcomes are put.
+ * @param p Return of measurement probability <ms|rho|ms>.
+ *
+ * @return The post-measurement density matrix |ms><ms|.
+ */
+QMDD qmdd_dm_measure_all(QMDD rho, BDDVAR nqubits, bool *ms, double *p);
+
+/****************************</Density matrices>******************************/
+
+
+
+
+/************************<Parameter-shift gradients>***************************/
+
+/**
+ * Type of a gate of a parameterized circuit: a fixed (controlled) gate, or a
+ * rotation Rx, Ry, Rz or Phase over one of the parameters. Rotations have no
+ * controls, so the two-term parameter-shift rule holds for them.
+ */
+typedef enum qmdd_pgate_type {
+    QMDD_PGATE_FIXED,
+    QMDD_PGATE_RX,
+    QMDD_PGATE_RY,
+    QMDD_PGATE_RZ,
+    QMDD_PGATE_PHASE
+} qmdd_pgate_type_t;
+
+typedef struct qmdd_pgate_s {
+    qmdd_pgate_type_t type;
+    gate_id_t gate;     // QMDD_PGATE_FIXED: (static) gate
+    uint32_t param;     // rotations: index of the angle in theta
+    BDDVAR c1, c2, c3;  // QMDD_PGATE_FIXED: controls (or EVBDD_INVALID_VAR)
+    BDDVAR t;
+} qmdd_pgate_t;
+
+/**
+ * Parameterized circuit on |0..0> (e.g. a variational ansatz), where the
+ * angles theta[0 .. nparams-1] are given when it is run. A parameter can be
+ * used by several rotations.
+ */
+typedef struct qmdd_pcircuit_s {
+    BDDVAR nqubits;
+    uint32_t nparams;
+    uint32_t ngates;
+    qmdd_pgate_t *gates;
+} qmdd_pcircuit_t;
+
+/**
+ * Returns the state of the parameterized circuit for the given angles. The
+ * rotations use interned gate IDs (see GATEID_interned).
+ */
+QMDD qmdd_pcircuit_run(const qmdd_pcircuit_t *pc, const double *theta);
+
+/**
+ * Computes E(theta) = <psi(theta)|H|psi(theta)> for H = sum_j coeffs[j]
+ * paulis[j] (see qmdd_expectation_hamiltonian) and the gradient
+ * grad[p] = dE/dtheta[p] with the parameter-shift rule: for every rotation
+ * over theta[p], E is evaluated with the angle of (only) that rotation
+ * shifted by +pi/2 and by -pi/2, and grad[p] sums (E_+ - E_-) / 2 over these
+ * rotations.
+ *
+ * The common circuit prefix is only simulated once: the state before every
+ * rotation is kept as a (protected) checkpoint, from which the two shifted
+ * suffixes are run as parallel Lace tasks. All rotation gates (also the
+ * shifted ones) are interned before, so the operation cache stays valid
+ * across the shifted runs. The rotations at theta stay interned, so calls
+ * with (partly) the same angles re-use them, but the shifted ones are
+ * released again at the end of the call (which clears the cache). If there is
+ * no room for these gates, all interned gates are cleared first.
+ *
+ * Like the trajectory mode of run_qasm_on_qmdd, this can not be combined with
+ * dynamic qubit reordering, approximation or dense leaf blocks, and with
+ * multiple workers the edge weight table is only cleaned up between batches
+ * of suffixes.
+ *
+ * @return E(theta)
+ */
+double qmdd_param_shift_gradient(const qmdd_pcircuit_t *pc, const double *theta, char **paulis, const double *coeffs, uint32_t nterms, double *grad);
+
+/***********************</Parameter-shift gradients>***************************/
+
+
+
+
+
 /*******************************<Logging stats>********************************/
 
 void qmdd_stats_start(FILE *out);
@@ -431,6 +928,7 @@ double qmdd_get_magnitude(QMDD qmdd, BDDVAR n);
 
 #ifdef __cplusplus
 }
+}
 #endif /* __cplusplus */
 
 #endif
@@ -0,0 +1,617 @@
+/**
+ * Copyright 2024 System Verification Lab, LIACS, Leiden University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <qsylvan_stabilizer.h>
+#include <sylvan_hash.h>
+
+
+/****************************<Tableau rows>************************************/
+
+static inline uint64_t *
+stab_x(stabilizer_t *stab, uint32_t i)
+{
+    return stab->x + (size_t)i * stab->words;
+}
+
+static inline uint64_t *
+stab_z(stabilizer_t *stab, uint32_t i)
+{
+    return stab->z + (size_t)i * stab->words;
+}
+
+static inline int
+get_bit(const uint64_t *row, BDDVAR k)
+{
+    return (row[k >> 6] >> (k & 63)) & 1;
+}
+
+static inline void
+flip_bit(uint64_t *row, BDDVAR k)
+{
+    row[k >> 6] ^= (1ULL << (k & 63));
+}
+
+static inline int
+parity(const uint64_t *a, const uint64_t *b, uint32_t words)
+{
+    uint64_t p = 0;
+    for (uint32_t w = 0; w < words; w++) p ^= a[w] & b[w];
+    return __builtin_popcountll(p) & 1;
+}
+
+/**
+ * Row h <-- row i * row h, with the phase computed as in the "rowsum" of CHP.
+ * Both rows are assumed to commute.
+ */
+static void
+stab_rowmult(stabilizer_t *stab, uint32_t h, uint32_t i)
+{
+    uint64_t *x1 = stab_x(stab, i), *z1 = stab_z(stab, i);
+    uint64_t *x2 = stab_x(stab, h), *z2 = stab_z(stab, h);
+    int sum = 2*stab->r[h] + 2*stab->r[i];
+    for (uint32_t w = 0; w < stab->words; w++) {
+        // exponent of i of P1*P2 per qubit: +1 for XY, YZ, ZX and -1 for YX,
+        // ZY, XZ
+        uint64_t y1 = x1[w] & z1[w], xo1 = x1[w] & ~z1[w], zo1 = ~x1[w] & z1[w];
+        uint64_t y2 = x2[w] & z2[w], xo2 = x2[w] & ~z2[w], zo2 = ~x2[w] & z2[w];
+        uint64_t plus  = (xo1 & y2) | (y1 & zo2) | (zo1 & xo2);
+        uint64_t minus = (y1 & xo2) | (zo1 & y2) | (xo1 & zo2);
+        sum += __builtin_popcountll(plus) - __builtin_popcountll(minus);
+        x2[w] ^= x1[w];
+        z2[w] ^= z1[w];
+    }
+    sum = ((sum % 4) + 4) % 4;
+    assert(sum == 0 || sum == 2);
+    stab->r[h] = (sum == 2);
+}
+
+static void
+stab_swaprows(stabilizer_t *stab, uint32_t a, uint32_t b)
+{
+    if (a == b) return;
+    uint64_t *xa = stab_x(stab, a), *za = stab_z(stab, a);
+    uint64_t *xb = stab_x(stab, b), *zb = stab_z(stab, b);
+    for (uint32_t w = 0; w < stab->words; w++) {
+        uint64_t t = xa[w]; xa[w] = xb[w]; xb[w] = t;
+        t = za[w]; za[w] = zb[w]; zb[w] = t;
+    }
+    uint8_t t = stab->r[a]; stab->r[a] = stab->r[b]; stab->r[b] = t;
+}
+
+/**
+ * Phase (in units of pi/4) of the coefficient c with P|b> = c|b ^ x_P>, for
+ * row i: c = (-1)^r i^|x & z| (-1)^(z.b).
+ */
+static int
+stab_row_phase(stabilizer_t *stab, uint32_t i)
+{
+    uint64_t *x = stab_x(stab, i), *z = stab_z(stab, i);
+    int m = 4 * stab->r[i];
+    for (uint32_t w = 0; w < stab->words; w++) {
+        m += 2 * __builtin_popcountll(x[w] & z[w]);
+    }
+    for (BDDVAR k = 0; k < stab->nqubits; k++) {
+        if (stab->b[k] && get_bit(z, k)) m += 4;
+    }
+    return m & 7;
+}
+
+/***************************</Tableau rows>************************************/
+
+
+/**********************<Conjugation of the generators>*************************/
+
+static void
+tab_h(stabilizer_t *stab, BDDVAR k)
+{
+    for (uint32_t i = 0; i < stab->nqubits; i++) {
+        uint64_t *x = stab_x(stab, i), *z = stab_z(stab, i);
+        int xk = get_bit(x, k), zk = get_bit(z, k);
+        stab->r[i] ^= xk & zk;
+        if (xk != zk) {
+            flip_bit(x, k);
+            flip_bit(z, k);
+        }
+    }
+}
+
+static void
+tab_s(stabilizer_t *stab, BDDVAR k, bool dag)
+{
+    for (uint32_t i = 0; i < stab->nqubits; i++) {
+        uint64_t *x = stab_x(stab, i), *z = stab_z(stab, i);
+        int xk = get_bit(x, k), zk = get_bit(z, k);
+        // S: X -> Y, Y -> -X, Sdag: X -> -Y, Y -> X
+        stab->r[i] ^= dag ? (xk & !zk) : (xk & zk);
+        if (xk) flip_bit(z, k);
+    }
+}
+
+static void
+tab_pauli(stabilizer_t *stab, BDDVAR k, int px, int pz)
+{
+    // P = X^px Z^pz anti-commutes with the generators which have an X (Z) on
+    // qubit k if pz (px) is set
+    for (uint32_t i = 0; i < stab->nqubits; i++) {
+        int xk = get_bit(stab_x(stab, i), k), zk = get_bit(stab_z(stab, i), k);
+        stab->r[i] ^= (xk & pz) ^ (zk & px);
+    }
+}
+
+static void
+tab_cx(stabilizer_t *stab, BDDVAR c, BDDVAR t)
+{
+    for (uint32_t i = 0; i < stab->nqubits; i++) {
+        uint64_t *x = stab_x(stab, i), *z = stab_z(stab, i);
+        int xc = get_bit(x, c), zc = get_bit(z, c);
+        int xt = get_bit(x, t), zt = get_bit(z, t);
+        stab->r[i] ^= xc & zt & (xt ^ zc ^ 1);
+        if (xc) flip_bit(x, t);
+        if (zt) flip_bit(z, c);
+    }
+}
+
+/*********************</Conjugation of the generators>*************************/
+
+
+/*************************<Tracked amplitude <b|psi>>**************************/
+
+/**
+ * Restores the pivots after column k of the X parts changed: every pivot
+ * column piv_col[i] is set only in the X part of row i, and rows without a
+ * pivot have an empty X part. Since only column k changed, at most the row
+ * with pivot k and the rows without a pivot need (new) pivots, each of which
+ * takes one pass over the rows, instead of a full Gaussian elimination.
+ */
+static void
+stab_reduce_column(stabilizer_t *stab, BDDVAR k)
+{
+    if (stab->piv_row[k] >= 0) {
+        stab->piv_col[stab->piv_row[k]] = -1;
+        stab->piv_row[k] = -1;
+    }
+    for (uint32_t j = 0; j < stab->nqubits; j++) {
+        if (stab->piv_col[j] >= 0) continue;
+        // row j is zero on all pivot columns, so eliminating another column
+        // with it keeps the other pivots intact
+        uint64_t *x = stab_x(stab, j);
+        uint32_t w = 0;
+        while (w < stab->words && x[w] == 0) w++;
+        if (w == stab->words) continue;
+        BDDVAR c = 64 * w + __builtin_ctzll(x[w]);
+        for (uint32_t i = 0; i < stab->nqubits; i++) {
+            if (i != j && get_bit(stab_x(stab, i), c)) stab_rowmult(stab, i, j);
+        }
+        stab->piv_row[c] = j;
+        stab->piv_col[j] = c;
+    }
+}
+
+/**
+ * Looks for a stabilizer with X part e_k, i.e. whether |b ^ e_k> is in the
+ * support as well. With the pivots of stab_reduce_column, this can only be
+ * the row with pivot k (the X parts of the other products of generators are
+ * either set on another pivot column or are empty).
+ *
+ * @return -1 if there is no such stabilizer, otherwise the phase (in units of
+ * pi/4) of <b^e_k|psi> / <b|psi>.
+ */
+static int
+stab_flip_ratio(stabilizer_t *stab, BDDVAR k)
+{
+    int i = stab->piv_row[k];
+    if (i < 0) return -1;
+    uint64_t *x = stab_x(stab, i);
+    for (uint32_t w = 0; w < stab->words; w++) {
+        if (x[w] != ((w == (k >> 6)) ? (1ULL << (k & 63)) : 0)) return -1;
+    }
+    return stab_row_phase(stab, i);
+}
+
+/**
+ * Multiplies the tracked amplitude with g / sqrt(2), for a non-zero Gaussian
+ * integer g = gr + i*gi with |g|^2 in {1, 2, 4}.
+ */
+static void
+stab_amp_mult(stabilizer_t *stab, int gr, int gi)
+{
+    static const int phase_of[3][3] = {{5, 4, 3}, {6, -1, 2}, {7, 0, 1}};
+    int abs_sqr = gr*gr + gi*gi;
+    if (abs_sqr == 4) { gr /= 2; gi /= 2; }
+    stab->amp_phase = (stab->amp_phase + phase_of[gr+1][gi+1]) & 7;
+    // |g| / sqrt(2) = sqrt(2)^-1, sqrt(2)^0, sqrt(2)^1
+    stab->amp_sqrt2 += (abs_sqr == 1) ? 1 : (abs_sqr == 2) ? 0 : -1;
+}
+
+static void
+stab_apply_h(stabilizer_t *stab, BDDVAR k)
+{
+    // H|psi>(x) = (psi(x with x_k=0) + (-1)^x_k psi(x with x_k=1)) / sqrt(2),
+    // evaluated for x = b and x = b^e_k, with psi(b^e_k) = beta psi(b)
+    int br = 0, bi = 0;
+    int m = stab_flip_ratio(stab, k);
+    if (m >= 0) {
+        br = (m == 0) ? 1 : (m == 4) ? -1 : 0;
+        bi = (m == 2) ? 1 : (m == 6) ? -1 : 0;
+    }
+    int gr, gi;
+    if (stab->b[k]) { gr = br - 1; gi = bi; }
+    else            { gr = br + 1; gi = bi; }
+    if (gr == 0 && gi == 0) {
+        // amplitude of b vanishes, continue with b^e_k
+        if (stab->b[k]) { gr = br + 1; gi = bi; }
+        else            { gr = 1 - br; gi = -bi; }
+        stab->b[k] = !stab->b[k];
+    }
+    stab_amp_mult(stab, gr, gi);
+    tab_h(stab, k);
+    stab_reduce_column(stab, k);
+}
+
+static void
+stab_apply_s(stabilizer_t *stab, BDDVAR k, bool dag)
+{
+    if (stab->b[k]) stab->amp_phase = (stab->amp_phase + (dag ? 6 : 2)) & 7;
+    tab_s(stab, k, dag);
+}
+
+static void
+stab_apply_pauli(stabilizer_t *stab, BDDVAR k, int px, int pz)
+{
+    // X^px Z^pz |b_k> = (-1)^(pz b_k) |b_k ^ px>, Y = i XZ
+    if (pz && stab->b[k]) stab->amp_phase = (stab->amp_phase + 4) & 7;
+    if (px && pz) stab->amp_phase = (stab->amp_phase + 2) & 7;
+    if (px) stab->b[k] = !stab->b[k];
+    tab_pauli(stab, k, px, pz);
+}
+
+static void
+stab_apply_cx(stabilizer_t *stab, BDDVAR c, BDDVAR t)
+{
+    if (stab->b[c]) stab->b[t] = !stab->b[t];
+    tab_cx(stab, c, t);
+    stab_reduce_column(stab, t);
+}
+
+/************************</Tracked amplitude <b|psi>>**************************/
+
+
+stabilizer_t *
+stabilizer_create(BDDVAR nqubits)
+{
+    stabilizer_t *stab = malloc(sizeof(stabilizer_t));
+    stab->nqubits = nqubits;
+    stab->words = (nqubits + 63) / 64;
+    stab->x = calloc((size_t)(nqubits + 1) * stab->words, sizeof(uint64_t));
+    stab->z = calloc((size_t)(nqubits + 1) * stab->words, sizeof(uint64_t));
+    stab->r = calloc(nqubits + 1, sizeof(uint8_t));
+    stab->b = calloc(nqubits, sizeof(bool));
+    stab->piv_row = malloc(sizeof(int) * nqubits);
+    stab->piv_col = malloc(sizeof(int) * nqubits);
+    for (BDDVAR k = 0; k < nqubits; k++) {
+        flip_bit(stab_z(stab, k), k);
+        stab->piv_row[k] = -1;
+        stab->piv_col[k] = -1;
+    }
+    stab->amp_phase = 0;
+    stab->amp_sqrt2 = 0;
+    return stab;
+}
+
+void
+stabilizer_free(stabilizer_t *stab)
+{
+    free(stab->x);
+    free(stab->z);
+    free(stab->r);
+    free(stab->b);
+    free(stab->piv_row);
+    free(stab->piv_col);
+    free(stab);
+}
+
+bool
+stabilizer_gate(stabilizer_t *stab, gate_id_t gate, BDDVAR t)
+{
+    switch (gate) {
+    case GATEID_I:
+        break;
+    case GATEID_X:
+        stab_apply_pauli(stab, t, 1, 0);
+        break;
+    case GATEID_Y:
+        stab_apply_pauli(stab, t, 1, 1);
+        break;
+    case GATEID_Z:
+        stab_apply_pauli(stab, t, 0, 1);
+        break;
+    case GATEID_H:
+        stab_apply_h(stab, t);
+        break;
+    case GATEID_S:
+        stab_apply_s(stab, t, false);
+        break;
+    case GATEID_Sdag:
+        stab_apply_s(stab, t, true);
+        break;
+    case GATEID_sqrtX: // = H S H
+        stab_apply_h(stab, t);
+        stab_apply_s(stab, t, false);
+        stab_apply_h(stab, t);
+        break;
+    case GATEID_sqrtXdag: // = H Sdag H
+        stab_apply_h(stab, t);
+        stab_apply_s(stab, t, true);
+        stab_apply_h(stab, t);
+        break;
+    case GATEID_sqrtY: // = e^(i pi/4) H Z
+        stab_apply_pauli(stab, t, 0, 1);
+        stab_apply_h(stab, t);
+        stab->amp_phase = (stab->amp_phase + 1) & 7;
+        break;
+    case GATEID_sqrtYdag: // = e^(-i pi/4) Z H
+        stab_apply_h(stab, t);
+        stab_apply_pauli(stab, t, 0, 1);
+        stab->amp_phase = (stab->amp_phase + 7) & 7;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+bool
+stabilizer_cgate(stabilizer_t *stab, gate_id_t gate, BDDVAR c, BDDVAR t)
+{
+    switch (gate) {
+    case GATEID_X:
+        stab_apply_cx(stab, c, t);
+        break;
+    case GATEID_Y: // = (I \tensor S) CX (I \tensor Sdag)
+        stab_apply_s(stab, t, true);
+        stab_apply_cx(stab, c, t);
+        stab_apply_s(stab, t, false);
+        break;
+    case GATEID_Z: // = (I \tensor H) CX (I \tensor H)
+        stab_apply_h(stab, t);
+        stab_apply_cx(stab, c, t);
+        stab_apply_h(stab, t);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+
+/*****************************<Materialization>********************************/
+
+/**
+ * With the generators in reduced row echelon form (rows [0, rank) with pivot
+ * qubit piv[i] in their X part, ascending), the support of the state is
+ * {b ^ sum_{i in S} x_i}, and for S = {i_1 < ... < i_m}
+ *   psi(b ^ sum x_i) = psi(b) prod_{i in S} c_i prod_{j < i in S} (-1)^(z_i.x_j)
+ * with c_i the row phase (stab_row_phase). Going down the qubits, the sub-
+ * state below qubit k only depends on the X parts collected so far (u, only
+ * the bits of qubits >= k) and on the signs (-1)^(z_i.u) of the remaining
+ * pivot rows (w). The pair (k, u, w) is the memoization key.
+ */
+typedef struct stab_build_s {
+    stabilizer_t *stab;
+    uint32_t rank;
+    int *row_of;            // pivot row of qubit k, or -1
+    int *phase;             // c_i, in units of pi/4
+    uint64_t *sign;         // rank x rwords, bit j of row i: z_j.x_i (j > i)
+    uint32_t rwords;
+    uint32_t keylen;        // 1 + words + rwords
+    uint64_t *buf;          // (n+1) x keylen, the key of the call at level k
+    EVBDD_WGT phase_wgt[8];
+    // memo (open addressing)
+    uint64_t *keys;
+    QMDD *vals;
+    uint64_t size;
+    uint64_t count;
+} stab_build_t;
+
+static uint64_t
+stab_key_hash(const uint64_t *key, uint32_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < len; i++) h = sylvan_fnvhash8(key[i], h);
+    return h;
+}
+
+static void stab_memo_put(stab_build_t *ctx, const uint64_t *key, QMDD val);
+
+static inline bool
+stab_memo_empty(stab_build_t *ctx, uint64_t i)
+{
+    return ctx->keys[i * ctx->keylen] == UINT64_MAX; // level of the key
+}
+
+static void
+stab_memo_grow(stab_build_t *ctx)
+{
+    uint64_t old_size = ctx->size;
+    uint64_t *old_keys = ctx->keys;
+    QMDD *old_vals = ctx->vals;
+    ctx->size = old_size ? 2 * old_size : 1024;
+    ctx->keys = malloc(sizeof(uint64_t) * ctx->keylen * ctx->size);
+    ctx->vals = malloc(sizeof(QMDD) * ctx->size);
+    for (uint64_t i = 0; i < ctx->size; i++) ctx->keys[i * ctx->keylen] = UINT64_MAX;
+    ctx->count = 0;
+    for (uint64_t i = 0; i < old_size; i++) {
+        if (old_keys[i * ctx->keylen] != UINT64_MAX) stab_memo_put(ctx, &old_keys[i * ctx->keylen], old_vals[i]);
+    }
+    free(old_keys);
+    free(old_vals);
+}
+
+static bool
+stab_memo_get(stab_build_t *ctx, const uint64_t *key, QMDD *val)
+{
+    if (ctx->size == 0) return false;
+    uint64_t i = stab_key_hash(key, ctx->keylen) & (ctx->size - 1);
+    while (!stab_memo_empty(ctx, i)) {
+        if (memcmp(&ctx->keys[i * ctx->keylen], key, sizeof(uint64_t) * ctx->keylen) == 0) {
+            *val = ctx->vals[i];
+            return true;
+        }
+        i = (i + 1) & (ctx->size - 1);
+    }
+    return false;
+}
+
+static void
+stab_memo_put(stab_build_t *ctx, const uint64_t *key, QMDD val)
+{
+    if (2 * (ctx->count + 1) > ctx->size) stab_memo_grow(ctx);
+    uint64_t i = stab_key_hash(key, ctx->keylen) & (ctx->size - 1);
+    while (!stab_memo_empty(ctx, i)) i = (i + 1) & (ctx->size - 1);
+    memcpy(&ctx->keys[i * ctx->keylen], key, sizeof(uint64_t) * ctx->keylen);
+    ctx->vals[i] = val;
+    ctx->count++;
+}
+
+static QMDD
+stab_build_rec(stab_build_t *ctx, BDDVAR k)
+{
+    stabilizer_t *stab = ctx->stab;
+    if (k == stab->nqubits) return evbdd_bundle(EVBDD_TERMINAL, EVBDD_ONE);
+
+    uint64_t *key = &ctx->buf[k * ctx->keylen];
+    uint64_t *next = &ctx->buf[(k+1) * ctx->keylen];
+    QMDD res;
+    if (stab_memo_get(ctx, key, &res)) return res;
+
+    uint64_t *u = key + 1, *w = key + 1 + stab->words;
+    QMDD zero = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO);
+    QMDD low, high;
+    int i = ctx->row_of[k];
+    if (i < 0) {
+        // x_k is fixed by the pivot rows chosen above
+        int xk = stab->b[k] ^ get_bit(u, k);
+        memcpy(next, key, sizeof(uint64_t) * ctx->keylen);
+        next[0] = k+1;
+        if (get_bit(u, k)) flip_bit(next + 1, k);
+        QMDD child = stab_build_rec(ctx, k+1);
+        low  = xk ? zero : child;
+        high = xk ? child : zero;
+    }
+    else {
+        // s_i = 0
+        memcpy(next, key, sizeof(uint64_t) * ctx->keylen);
+        next[0] = k+1;
+        if (get_bit(w, i)) flip_bit(next + 1 + stab->words, i);
+        QMDD without = stab_build_rec(ctx, k+1);
+
+        // s_i = 1: collect x_i and the signs it implies for the rows below
+        int m = (ctx->phase[i] + 4 * get_bit(w, i)) & 7;
+        memcpy(next, key, sizeof(uint64_t) * ctx->keylen);
+        next[0] = k+1;
+        uint64_t *xi = stab_x(stab, i);
+        for (uint32_t v = 0; v < stab->words; v++) next[1 + v] ^= xi[v];
+        flip_bit(next + 1, k);
+        for (uint32_t v = 0; v < ctx->rwords; v++) next[1 + stab->words + v] ^= ctx->sign[i * ctx->rwords + v];
+        if (get_bit(w, i)) flip_bit(next + 1 + stab->words, i);
+        QMDD with = stab_build_rec(ctx, k+1);
+        with = evbdd_bundle(EVBDD_TARGET(with), wgt_mul(EVBDD_WEIGHT(with), ctx->phase_wgt[m]));
+
+        low  = stab->b[k] ? with : without;
+        high = stab->b[k] ? without : with;
+    }
+    res = evbdd_makenode(k, low, high);
+    evbdd_refs_push(res);
+    stab_memo_put(ctx, key, res);
+    return res;
+}
+
+QMDD
+qmdd_from_stabilizer(stabilizer_t *stab)
+{
+    BDDVAR n = stab->nqubits;
+    stab_build_t ctx;
+    ctx.stab = stab;
+    ctx.row_of = malloc(sizeof(int) * n);
+
+    // reduced row echelon form of the X parts
+    uint32_t rank = 0;
+    for (BDDVAR k = 0; k < n; k++) {
+        ctx.row_of[k] = -1;
+        uint32_t p = rank;
+        while (p < n && !get_bit(stab_x(stab, p), k)) p++;
+        if (p == n) continue;
+        stab_swaprows(stab, p, rank);
+        for (uint32_t i = 0; i < n; i++) {
+            if (i != rank && get_bit(stab_x(stab, i), k)) stab_rowmult(stab, i, rank);
+        }
+        ctx.row_of[k] = rank;
+        rank++;
+    }
+    ctx.rank = rank;
+    // the echelon form has pivots as well (at the leading ones)
+    for (BDDVAR k = 0; k < n; k++) {
+        stab->piv_row[k] = ctx.row_of[k];
+        stab->piv_col[k] = -1;
+    }
+    for (BDDVAR k = 0; k < n; k++) {
+        if (ctx.row_of[k] >= 0) stab->piv_col[ctx.row_of[k]] = k;
+    }
+    ctx.rwords = (rank + 63) / 64 + (rank == 0);
+    ctx.phase = malloc(sizeof(int) * (rank + 1));
+    ctx.sign = calloc((size_t)(rank + 1) * ctx.rwords, sizeof(uint64_t));
+    for (uint32_t i = 0; i < rank; i++) {
+        ctx.phase[i] = stab_row_phase(stab, i);
+        for (uint32_t j = i + 1; j < rank; j++) {
+            if (parity(stab_z(stab, j), stab_x(stab, i), stab->words)) {
+                flip_bit(&ctx.sign[i * ctx.rwords], j);
+            }
+        }
+    }
+    fl_t s = flt_sqrt(0.5);
+    const fl_t re[8] = {1, s, 0, -s, -1, -s,  0,  s};
+    const fl_t im[8] = {0, s, 1,  s,  0, -s, -1, -s};
+    for (int m = 0; m < 8; m++) {
+        complex_t c = cmake(re[m], im[m]);
+        ctx.phase_wgt[m] = weight_lookup(&c);
+    }
+
+    ctx.keylen = 1 + stab->words + ctx.rwords;
+    ctx.buf = calloc((size_t)(n + 1) * ctx.keylen, sizeof(uint64_t));
+    ctx.keys = NULL;
+    ctx.vals = NULL;
+    ctx.size = 0;
+    ctx.count = 0;
+
+    QMDD res = stab_build_rec(&ctx, 0);
+    evbdd_refs_pop(ctx.count);
+
+    // multiply with <b|psi>
+    complex_t amp = cmake_angle(flt_acos(0.0) * stab->amp_phase / 2.0,
+                                pow(2.0, -stab->amp_sqrt2 / 2.0));
+    res = evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(res), weight_lookup(&amp)));
+
+    free(ctx.row_of);
+    free(ctx.phase);
+    free(ctx.sign);
+    free(ctx.buf);
+    free(ctx.keys);
+    free(ctx.vals);
+    return res;
+}
+
+/****************************</Materialization>********************************/
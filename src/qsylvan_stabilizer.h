@@ -0,0 +1,110 @@
+/**
+ * Copyright 2024 System Verification Lab, LIACS, Leiden University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef QSYLVAN_STABILIZER_H
+#define QSYLVAN_STABILIZER_H
+
+#include <qsylvan_simulator.h>
+
+#ifdef __cplusplus
+namespace sylvan {
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * Stabilizer tableau (as in CHP, S. Aaronson and D. Gottesman, "Improved
+ * simulation of stabilizer circuits", PRA 70, 2004) of an n-qubit state.
+ *
+ * Row i (0 <= i < n) is the Pauli string (-1)^r[i] P_0 ... P_{n-1}, with
+ * P_k = X^x Z^z (and Y for x = z = 1), where the bits of qubit k are stored
+ * in bit k%64 of word k/64 of the row. Row n is scratch space. Since only
+ * unitary Clifford gates are supported (no measurements), the destabilizers
+ * are not needed and not stored. To find the stabilizers needed for the
+ * tracked amplitude below without a Gaussian elimination per gate, the X
+ * parts are kept reduced: every row has at most one pivot column, which is
+ * set in the X part of that row only, and the rows without a pivot have an
+ * empty X part.
+ *
+ * The tableau only fixes the state up to a global phase. To be able to
+ * materialize the exact state, the amplitude of one basis state |b> in the
+ * support of the state is tracked as well:
+ *   <b|psi> = e^(i pi amp_phase/4) / sqrt(2)^amp_sqrt2.
+ */
+typedef struct stabilizer_s {
+    BDDVAR nqubits;
+    uint32_t words;     // number of 64-bit words per row
+    uint64_t *x;        // (n+1) * words
+    uint64_t *z;        // (n+1) * words
+    uint8_t *r;         // n+1 sign bits
+    bool *b;            // basis state with non-zero amplitude
+    int *piv_row;       // row with pivot column k in its X part, or -1
+    int *piv_col;       // pivot column of row i, or -1
+    int amp_phase;      // in units of pi/4, mod 8
+    int amp_sqrt2;
+} stabilizer_t;
+
+
+/***************************<Stabilizer tableau>*******************************/
+
+/**
+ * Creates a tableau for the n-qubit state |00...0> (stabilized by Z_0..Z_n-1).
+ * The returned tableau should be freed with stabilizer_free().
+ */
+stabilizer_t *stabilizer_create(BDDVAR nqubits);
+
+/**
+ * Frees all memory of the tableau.
+ */
+void stabilizer_free(stabilizer_t *stab);
+
+/**
+ * Applies a single qubit gate to qubit t. Only the Clifford gates I, X, Y, Z,
+ * H, S, Sdag, sqrtX, sqrtXdag, sqrtY, sqrtYdag are supported.
+ *
+ * @return false (and leaves the tableau unchanged) if the gate is not one of
+ * the supported Clifford gates.
+ */
+bool stabilizer_gate(stabilizer_t *stab, gate_id_t gate, BDDVAR t);
+
+/**
+ * Applies a single qubit gate to qubit t, controlled by qubit c. Only
+ * controlled X, Y and Z are supported.
+ *
+ * @return false (and leaves the tableau unchanged) if the gate is not X, Y
+ * or Z.
+ */
+bool stabilizer_cgate(stabilizer_t *stab, gate_id_t gate, BDDVAR c, BDDVAR t);
+
+/**
+ * Creates the QMDD of the (exact) state represented by the tableau, in a
+ * single top-down pass over the qubits. The stabilizer generators are first
+ * brought into reduced row echelon form (w.r.t. their X parts), after which
+ * the amplitude of every basis state in the support follows from the tracked
+ * amplitude <b|psi> and the generators involved. Sub-QMDDs are shared by
+ * memoizing on the part of the construction state which affects the qubits
+ * below the current one.
+ */
+QMDD qmdd_from_stabilizer(stabilizer_t *stab);
+
+/**************************</Stabilizer tableau>*******************************/
+
+#ifdef __cplusplus
+}
+}
+#endif /* __cplusplus */
+
+#endif
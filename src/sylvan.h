@@ -23,6 +23,7 @@
 #include <sylvan_config.h>
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>      // for FILE
@@ -54,15 +55,14 @@ namespace sylvan {
  */
 
 #include <sylvan_common.h>
+#include <sylvan_mem.h>
 #include <sylvan_stats.h>
 #include <sylvan_mt.h>
 #include <sylvan_mtbdd.h>
 #include <sylvan_bdd.h>
 #include <sylvan_ldd.h>
 
-#ifndef __cplusplus
-#include <sylvan_evbdd.h> // (need this here but issue w/ including in C++)
-#endif
+#include <sylvan_evbdd.h>
 #include <sylvan_zdd.h>
 
 #ifdef __cplusplus
@@ -237,8 +237,8 @@ cache_create(size_t _cache_size, size_t _max_size)
         exit(1);
     }
 
-    cache_table = (cache_entry_t)alloc_aligned(cache_max * sizeof(struct cache_entry));
-    cache_status = (uint32_t*)alloc_aligned(cache_max * sizeof(uint32_t));
+    cache_table = (cache_entry_t)sylvan_table_alloc("cache", cache_max * sizeof(struct cache_entry));
+    cache_status = (uint32_t*)sylvan_table_alloc("cache (status)", cache_max * sizeof(uint32_t));
     if (cache_table == 0 || cache_status == 0) {
         fprintf(stderr, "cache_create: Unable to allocate memory: %s!\n", strerror(errno));
         exit(1);
@@ -250,8 +250,8 @@ cache_create(size_t _cache_size, size_t _max_size)
 void
 cache_free()
 {
-    free_aligned(cache_table, cache_max * sizeof(struct cache_entry));
-    free_aligned(cache_status, cache_max * sizeof(uint32_t));
+    sylvan_table_free(cache_table, cache_max * sizeof(struct cache_entry));
+    sylvan_table_free(cache_status, cache_max * sizeof(uint32_t));
 }
 
 void
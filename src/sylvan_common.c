@@ -135,6 +135,9 @@ VOID_TASK_IMPL_0(sylvan_rehash_all)
         fprintf(stderr, "sylvan_gc_rehash error: not all nodes could be rehashed!\n");
         exit(1);
     }
+
+    // drop the pages of free data regions (out-of-core mode)
+    CALL(llmsset_discard_unmarked, nodes);
 }
 
 /**
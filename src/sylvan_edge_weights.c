@@ -21,6 +21,8 @@ void init_edge_weight_functions(edge_weight_type_t edge_weight_type);
 void init_edge_weight_storage(size_t size, double tol, wgt_storage_backend_t backend, void **wgt_store);
 void (*init_wgt_table_entries)(); // set by sylvan_init_evbdd
 uint64_t sylvan_get_edge_weight_table_size();
+uint64_t sylvan_get_edge_weight_table_max_size();
+void sylvan_set_edge_weight_table_max_size(uint64_t size);
 double sylvan_edge_weights_tolerance();
 uint64_t sylvan_edge_weights_count_entries();
 void sylvan_edge_weights_free();
@@ -111,6 +113,7 @@ init_edge_weight_storage(size_t size, double tol, wgt_storage_backend_t backend,
     wgt_backend = backend;
 
     init_wgt_storage_functions(backend);
+    cmap_set_allocator(&sylvan_table_alloc_pageable, &sylvan_table_free);
 
     // create actual table
     *wgt_store = wgt_store_create(table_size, tolerance);
@@ -125,6 +128,19 @@ sylvan_get_edge_weight_table_size()
     return table_size;
 }
 
+uint64_t
+sylvan_get_edge_weight_table_max_size()
+{
+    return max_tablesize;
+}
+
+void
+sylvan_set_edge_weight_table_max_size(uint64_t size)
+{
+    // (the table is resized at the next gc of the edge weight table)
+    max_tablesize = size;
+}
+
 double
 sylvan_edge_weights_tolerance() // accuracy, eps
 {
@@ -5,6 +5,10 @@
 #include <stdio.h>
 #include <edge_weight_storage/wgt_storage_interface.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 typedef uint64_t EVBDD_WGT;  // EVBDD edge weights (indices to table entries)
 
 extern EVBDD_WGT EVBDD_ONE;
@@ -34,6 +38,8 @@ extern void init_edge_weight_storage(size_t size, double tol, wgt_storage_backen
 extern void (*init_wgt_table_entries)(); // set by sylvan_init_evbdd
 
 extern uint64_t sylvan_get_edge_weight_table_size();
+extern uint64_t sylvan_get_edge_weight_table_max_size();
+extern void sylvan_set_edge_weight_table_max_size(uint64_t size);
 extern double sylvan_edge_weights_tolerance();
 extern uint64_t sylvan_edge_weights_count_entries();
 extern void sylvan_edge_weights_free();
@@ -182,4 +188,8 @@ void wgt_fprint(FILE *stream, EVBDD_WGT a);
 
 /************************<Printing & utility functions>************************/
 
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
 #endif // SYLVAN_EDGE_WEIGHTS_H
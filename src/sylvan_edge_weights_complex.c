@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "sylvan_edge_weights_complex.h"
+#include <sylvan_int.h>
 
 
 /**********************<Some static utility functions>*************************/
@@ -49,6 +50,11 @@ _weight_complex_lookup_ptr(complex_t *a, void *wgt_store)
     uint64_t res;
     bool success;
 
+    // the result is discarded after an out-of-memory, and probing a full 
+    // table for every next weight is expensive (this doesn't apply to filling
+    // the new table when cleaning up)
+    if (wgt_store == wgt_storage && evbdd_out_of_memory()) return EVBDD_ZERO;
+
     int present = wgt_store_find_or_put(wgt_store, a, &res);
     if (present == -1) {
         success = false;
@@ -60,8 +66,9 @@ _weight_complex_lookup_ptr(complex_t *a, void *wgt_store)
     }
 
     if (!success) {
-        fprintf(stderr, "Amplitude table full!\n");
-        exit(1);
+        // exits, unless the caller recovers from this itself
+        evbdd_signal_out_of_memory(EVBDD_OOM_WGTS);
+        return EVBDD_ZERO;
     }
     return (EVBDD_WGT) res; 
 }
@@ -15,14 +15,19 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <sylvan_int.h>
 #include <sylvan_evbdd.h>
 #include <sylvan_refs.h>
+#include <sylvan_sl.h>
 
 static int granularity = 1; // operation cache access granularity
 
@@ -102,6 +107,18 @@ VOID_TASK_0(evbdd_gc_mark_external_refs)
     }
 }
 
+// c*I on the qubits k..identity_nvars-1 in identity_edges[k], see
+// evbdd_identity_levels
+static EVBDD *identity_edges = NULL;
+static BDDVAR identity_nvars = 0;
+
+/* Called during garbage collection */
+VOID_TASK_0(evbdd_gc_mark_identity)
+{
+    // identity_edges[0] contains the identity matrices of all other levels
+    if (identity_nvars > 0) CALL(evbdd_gc_mark_rec, identity_edges[0]);
+}
+
 /* Called during garbage collection */
 VOID_TASK_0(evbdd_gc_mark_protected)
 {
@@ -327,12 +344,21 @@ evbdd_refs_sync(EVBDD result)
 static int auto_gc_wgt_table  = 1;
 static double wgt_table_gc_thres = 0.5;
 
+static size_t budget_cap = 0; // 0 = no memory budget (see <Memory budget> below)
+static void evbdd_budget_wgts_cleaned();
+
 void
 evbdd_set_auto_gc_wgt_table(bool enabled)
 {
     auto_gc_wgt_table = enabled;
 }
 
+bool
+evbdd_get_auto_gc_wgt_table()
+{
+    return auto_gc_wgt_table;
+}
+
 void
 evbdd_set_gc_wgt_table_thres(double fraction_filled)
 {
@@ -368,32 +394,47 @@ evbdd_gc_wgt_table()
     // 4. Any cache we migh have is now invalid because the same edge weights 
     //    might now have different indices in the edge weight table
     sylvan_clear_cache();
+
+    // The identity matrices of the multiplications have the old weights, they
+    // are built again for the next multiplication
+    identity_nvars = 0;
+
+    if (budget_cap > 0) evbdd_budget_wgts_cleaned();
 }
 
-TASK_IMPL_1(EVBDD, _fill_new_wgt_table, EVBDD, a)
+TASK_IMPL_2(EVBDD, _fill_new_wgt_table, EVBDD, a, bool, is_new)
 {
     // Check cache
     EVBDD res;
     bool cachenow = 1;
     if (cachenow) {
-        if (cache_get3(CACHE_EVBDD_CLEAN_WGT_TABLE, 0LL, a, 0LL, &res)) {
+        if (cache_get3(CACHE_EVBDD_CLEAN_WGT_TABLE, 0LL, a, is_new, &res)) {
             return res;
         }
     }
 
     // Move weight from old to new table, get new index
-    EVBDD_WGT new_wgt = wgt_table_gc_keep(EVBDD_WEIGHT(a));
-    a = evbdd_bundle(EVBDD_TARGET(a), new_wgt);
+    EVBDD_WGT new_wgt = is_new ? EVBDD_WEIGHT(a) : wgt_table_gc_keep(EVBDD_WEIGHT(a));
 
     // If terminal, return
-    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return a;
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return evbdd_bundle(EVBDD_TERMINAL, new_wgt);
     
     // Recursive for children
     EVBDD low, high;
     evbddnode_t n = EVBDD_GETNODE(EVBDD_TARGET(a));
     evbddnode_getchilderen(n, &low, &high);
-    evbdd_refs_spawn(SPAWN(_fill_new_wgt_table, high));
-    low = CALL(_fill_new_wgt_table, low);
+
+    // Unless NORM_L2 is used, the weight of one of the children is not stored
+    // in the node but implied (EVBDD_ZERO or EVBDD_ONE, see evbddnode_pack),
+    // so it is unpacked with the index it has in the new table (which can be
+    // different from the old one if the table has grown).
+    bool low_is_new = false, high_is_new = false;
+    if (weight_norm_strat != NORM_L2) {
+        low_is_new  = ((n->low & evbdd_wgt_pos_mask) == 0);
+        high_is_new = !low_is_new;
+    }
+    evbdd_refs_spawn(SPAWN(_fill_new_wgt_table, high, high_is_new));
+    low = CALL(_fill_new_wgt_table, low, low_is_new);
     evbdd_refs_push(low);
     high = evbdd_refs_sync(SYNC(_fill_new_wgt_table));
     evbdd_refs_pop(1);
@@ -405,7 +446,7 @@ TASK_IMPL_1(EVBDD, _fill_new_wgt_table, EVBDD, a)
 
     // Put in cache, return
     res = evbdd_bundle(ptr, new_wgt);
-    if (cachenow) cache_put3(CACHE_EVBDD_CLEAN_WGT_TABLE, 0LL, a, 0LL, res);
+    if (cachenow) cache_put3(CACHE_EVBDD_CLEAN_WGT_TABLE, 0LL, a, is_new, res);
     return res;
 }
 
@@ -423,6 +464,253 @@ evbdd_test_gc_wgt_table()
 
 
 
+/*****************************<Memory budget>**********************************/
+
+// bytes per entry (see sylvan_common.h for the nodes table and cache)
+static const size_t budget_node_bytes  = 24;
+static const size_t budget_cache_bytes = 36;
+static const size_t budget_wgt_bytes   = sizeof(complex_t);
+
+static double budget_wgt_fraction;
+static int budget_initial_ratio;
+static size_t budget_nodes, budget_cache, budget_wgts; // current shares
+static size_t budget_nodes_min, budget_cache_min; // initial sizes
+static size_t budget_wgts_limit; // largest share the edge layout allows
+static uint64_t budget_rebalances;
+static _Atomic(int) budget_pressure = EVBDD_OOM_NONE; // tables which were full
+static int budget_futile_gcs[EVBDD_OOM_WGTS+1]; // consecutive gcs per table which freed (almost) nothing
+static const int budget_max_futile_gcs = 3;
+
+static bool recoverable_oom = false;
+static _Atomic(int) oom_tables = EVBDD_OOM_NONE;
+
+/**
+ * Keeps track of consecutive gcs of a table at its share which left it (almost)
+ * full. Such gcs would just be repeated for every next few nodes / gates.
+ */
+static void
+evbdd_budget_count_gc(evbdd_oom_t table, bool futile)
+{
+    budget_futile_gcs[table] = futile ? budget_futile_gcs[table] + 1 : 0;
+}
+
+bool
+evbdd_budget_thrashing(evbdd_oom_t table)
+{
+    return recoverable_oom && budget_cap > 0 && budget_futile_gcs[table] >= budget_max_futile_gcs;
+}
+
+void
+evbdd_set_limits(size_t memorycap, int table_ratio, int initial_ratio, double wgt_fraction)
+{
+    // the nodes table and cache are allocated (virtually) for the full cap,
+    // so that they can grow into the share of the edge weight table
+    sylvan_set_limits(memorycap, table_ratio, initial_ratio);
+    budget_cap = memorycap;
+    budget_wgt_fraction = wgt_fraction;
+    budget_initial_ratio = initial_ratio;
+}
+
+void
+evbdd_get_limits(size_t *nodes_max, size_t *cache_max, size_t *wgts_max, uint64_t *rebalances)
+{
+    if (budget_cap == 0) {
+        *nodes_max = llmsset_get_max_size(nodes);
+        *cache_max = cache_getmaxsize();
+        *wgts_max  = sylvan_get_edge_weight_table_max_size();
+        *rebalances = 0;
+        return;
+    }
+    *nodes_max = budget_nodes;
+    *cache_max = budget_cache;
+    *wgts_max  = budget_wgts;
+    *rebalances = budget_rebalances;
+}
+
+static size_t
+floor_pow2(double x)
+{
+    size_t p = 1;
+    while (2.0*p <= x) p *= 2;
+    return p;
+}
+
+static size_t
+budget_bytes(size_t n, size_t c, size_t w)
+{
+    return n * budget_node_bytes + c * budget_cache_bytes + w * budget_wgt_bytes;
+}
+
+/**
+ * Resizing heuristic (main gc hook) when a memory budget is set. As 
+ * sylvan_gc_normal_resize, but the nodes table and cache only grow up to 
+ * their share, and the share of the nodes table is first increased at the
+ * expense of the edge weight table if possible. If the share has been 
+ * decreased in favor of the edge weight table, the tables shrink instead.
+ */
+VOID_TASK_0(evbdd_gc_budget_resize)
+{
+    size_t nodes_size = llmsset_get_size(nodes);
+    size_t cache_size = cache_getsize();
+    size_t marked = llmsset_count_marked(nodes);
+    bool pressure = (marked*2 > nodes_size) || (budget_pressure & EVBDD_OOM_NODES);
+    atomic_fetch_and(&budget_pressure, ~EVBDD_OOM_NODES);
+
+    if (pressure && nodes_size >= budget_nodes && 2*budget_nodes <= llmsset_get_max_size(nodes)) {
+        // shrink the share of the edge weight table down to its current size
+        size_t wgts = budget_wgts;
+        while (budget_bytes(2*budget_nodes, 2*budget_cache, wgts) > budget_cap &&
+               wgts/2 >= sylvan_get_edge_weight_table_size()) {
+            wgts /= 2;
+        }
+        if (budget_bytes(2*budget_nodes, 2*budget_cache, wgts) <= budget_cap) {
+            budget_nodes *= 2;
+            budget_cache *= 2;
+            budget_wgts = wgts;
+            sylvan_set_edge_weight_table_max_size(wgts);
+            budget_rebalances++;
+        }
+    }
+
+    if (nodes_size > budget_nodes) {
+        if (marked*2 <= budget_nodes) llmsset_set_size(nodes, budget_nodes);
+    }
+    else if (pressure && nodes_size < budget_nodes) {
+        llmsset_set_size(nodes, 2*nodes_size);
+    }
+    if (cache_size > budget_cache) cache_setsize(budget_cache);
+    else if (pressure && cache_size < budget_cache) cache_setsize(2*cache_size);
+
+    // futile if less than 1/16 of the table (at its share) is free
+    nodes_size = llmsset_get_size(nodes);
+    evbdd_budget_count_gc(EVBDD_OOM_NODES, nodes_size >= budget_nodes && marked*16 > nodes_size*15);
+}
+
+/**
+ * Called after the edge weight table has been cleaned. If it is at its share
+ * and still relatively full (or it overflowed since the last time), its share
+ * is increased at the expense of the nodes table and cache if possible.
+ */
+static void
+evbdd_budget_wgts_cleaned()
+{
+    size_t size = sylvan_get_edge_weight_table_size();
+    bool pressure = ((double)wgt_table_entries_estimate() >= 0.5 * wgt_table_gc_thres * size) ||
+                    (budget_pressure & EVBDD_OOM_WGTS);
+    atomic_fetch_and(&budget_pressure, ~EVBDD_OOM_WGTS);
+
+    // futile if the table can't grow and will be cleaned again before the next gate
+    bool futile = (size >= budget_wgts) && evbdd_test_gc_wgt_table();
+    if (!pressure || size < budget_wgts || 2*budget_wgts > budget_wgts_limit) {
+        evbdd_budget_count_gc(EVBDD_OOM_WGTS, futile);
+        return;
+    }
+
+    // the nodes table and cache shrink at the next gc (if the nodes fit)
+    size_t n = budget_nodes, c = budget_cache;
+    while (budget_bytes(n, c, 2*budget_wgts) > budget_cap && 
+           n/2 >= budget_nodes_min && c/2 >= budget_cache_min) {
+        n /= 2;
+        c /= 2;
+    }
+    if (budget_bytes(n, c, 2*budget_wgts) > budget_cap) {
+        evbdd_budget_count_gc(EVBDD_OOM_WGTS, futile);
+        return;
+    }
+    budget_nodes = n;
+    budget_cache = c;
+    budget_wgts *= 2;
+    sylvan_set_edge_weight_table_max_size(budget_wgts);
+    budget_rebalances++;
+
+    if (llmsset_get_size(nodes) > budget_nodes) sylvan_gc();
+    evbdd_gc_wgt_table(); // grows the table into the new share
+}
+
+/**
+ * Divides the budget over the tables (which have been created by 
+ * sylvan_init_package() for the full cap), and returns the largest possible
+ * edge weight table size, which determines the edge layout.
+ */
+static size_t
+evbdd_budget_init(size_t *min_wgt_tablesize)
+{
+    size_t nodes_limit = llmsset_get_max_size(nodes);
+    budget_wgts_limit = floor_pow2((double)budget_cap / budget_wgt_bytes);
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    if (budget_wgts_limit > (1ULL<<QSYLVAN_EDGE_WGT_BITS)) budget_wgts_limit = 1ULL<<QSYLVAN_EDGE_WGT_BITS;
+#else
+    // with larger weight indices, the nodes table can have at most 2^30 nodes
+    if (budget_wgts_limit > (1ULL<<33)) budget_wgts_limit = 1ULL<<33;
+    if (nodes_limit > (1ULL<<30) && budget_wgts_limit > (1ULL<<23)) budget_wgts_limit = 1ULL<<23;
+#endif
+
+    budget_wgts = floor_pow2(budget_wgt_fraction * budget_cap / budget_wgt_bytes);
+    if (budget_wgts > budget_wgts_limit) budget_wgts = budget_wgts_limit;
+    // as the nodes table and cache, start at a fraction of the share
+    size_t initial_wgts = budget_wgts >> budget_initial_ratio;
+    if (initial_wgts == 0) initial_wgts = 1;
+    if (*min_wgt_tablesize > initial_wgts) *min_wgt_tablesize = initial_wgts;
+
+    // nodes table and cache get the rest (but at least their initial size)
+    budget_nodes_min = llmsset_get_size(nodes);
+    budget_cache_min = cache_getsize();
+    budget_nodes = nodes_limit;
+    budget_cache = cache_getmaxsize();
+    while (budget_bytes(budget_nodes, budget_cache, budget_wgts) > budget_cap &&
+           budget_nodes/2 >= budget_nodes_min && budget_cache/2 >= budget_cache_min) {
+        budget_nodes /= 2;
+        budget_cache /= 2;
+    }
+    budget_rebalances = 0;
+    budget_pressure = EVBDD_OOM_NONE;
+    memset(budget_futile_gcs, 0, sizeof(budget_futile_gcs));
+    sylvan_gc_hook_main(TASK(evbdd_gc_budget_resize));
+    return budget_wgts_limit;
+}
+
+void
+evbdd_set_recoverable_oom(bool enabled)
+{
+    recoverable_oom = enabled;
+}
+
+int
+evbdd_out_of_memory()
+{
+    return oom_tables;
+}
+
+void
+evbdd_clear_out_of_memory()
+{
+    oom_tables = EVBDD_OOM_NONE;
+    sylvan_clear_cache();
+}
+
+void
+evbdd_signal_out_of_memory(evbdd_oom_t table)
+{
+    if (!recoverable_oom) {
+        if (table == EVBDD_OOM_NODES) {
+            fprintf(stderr, "EVBDD/BDD Unique table full, %zu of %zu buckets filled!\n", 
+                    llmsset_count_marked(nodes), llmsset_get_size(nodes));
+        }
+        else {
+            fprintf(stderr, "Amplitude table full!\n");
+        }
+        exit(1);
+    }
+    atomic_fetch_or(&oom_tables, table);
+    atomic_fetch_or(&budget_pressure, table); // (the next gc rebalances)
+}
+
+/****************************</Memory budget>**********************************/
+
+
+
+
+
 /******************************<Initialization>********************************/
 
 /**
@@ -433,6 +721,9 @@ static int evbdd_initialized = 0;
 static void
 evbdd_quit()
 {
+    free(identity_edges);
+    identity_edges = NULL;
+    identity_nvars = 0;
     refs_free(&evbdd_refs);
     if (evbdd_protected_created) {
         protect_free(&evbdd_protected);
@@ -440,6 +731,7 @@ evbdd_quit()
     }
     RUN(evbdd_refs_cleanup);
     evbdd_initialized = 0;
+    budget_cap = 0;
     sylvan_edge_weights_free();
 }
 
@@ -451,17 +743,34 @@ sylvan_init_evbdd(size_t min_wgt_tablesize, size_t max_wgt_tablesize,
     if (evbdd_initialized) return;
     evbdd_initialized = 1;
 
+    if (budget_cap > 0) {
+        max_wgt_tablesize = evbdd_budget_init(&min_wgt_tablesize);
+    }
+
     int index_size = (int) ceil(log2(max_wgt_tablesize));
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    if (index_size > QSYLVAN_EDGE_WGT_BITS) {
+        fprintf(stderr,"max edge weight storage size is 2^%d\n", QSYLVAN_EDGE_WGT_BITS);
+        exit(1);
+    }
+    if (llmsset_get_max_size(nodes) > (1ULL << EVBDD_PTR_BITS)) {
+        fprintf(stderr,"max node table size is 2^%d\n", EVBDD_PTR_BITS);
+        exit(1);
+    }
+    larger_wgt_indices = false;
+#else
     if (index_size > 33) {
         fprintf(stderr,"max edge weight storage size is 2^33\n");
         exit(1);
     }
     if (index_size > 23) larger_wgt_indices = true;
     else larger_wgt_indices = false;
+#endif
 
     sylvan_register_quit(evbdd_quit);
     sylvan_gc_add_mark(TASK(evbdd_gc_mark_external_refs));
     sylvan_gc_add_mark(TASK(evbdd_gc_mark_protected));
+    sylvan_gc_add_mark(TASK(evbdd_gc_mark_identity));
 
     refs_create(&evbdd_refs, 1024);
     if (!evbdd_protected_created) {
@@ -474,6 +783,7 @@ sylvan_init_evbdd(size_t min_wgt_tablesize, size_t max_wgt_tablesize,
     sylvan_init_edge_weights(min_wgt_tablesize, max_wgt_tablesize, 
                              wgt_tab_tolerance, WGT_COMPLEX_128, 
                              edge_weigth_backend);
+    if (budget_cap > 0) sylvan_set_edge_weight_table_max_size(budget_wgts);
     
     init_wgt_table_entries = init_wgt_tab_entries;
     if (init_wgt_table_entries != NULL) {
@@ -517,6 +827,18 @@ evbdd_set_caching_granularity(int g)
     granularity = g;
 }
 
+void
+evbdd_get_edge_layout(int *wgt_bits, int *ptr_bits)
+{
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    *wgt_bits = QSYLVAN_EDGE_WGT_BITS;
+    *ptr_bits = EVBDD_PTR_BITS;
+#else
+    *wgt_bits = larger_wgt_indices ? 33 : 23;
+    *ptr_bits = larger_wgt_indices ? 30 : 40;
+#endif
+}
+
 /*****************************</Initialization>********************************/
 
 
@@ -644,11 +966,167 @@ TASK_IMPL_2(EVBDD, evbdd_plus, EVBDD, a, EVBDD, b)
 
 
 
+/**
+ * Checks if the matrix node t (with an even variable 2k) is c*I \tensor X, 
+ * i.e. [[x,0],[0,x]] with x = c*X. If so, returns x in <child>.
+ */
+static bool
+evbdd_identity_level(EVBDD_TARG t, EVBDD *child)
+{
+    if (t == EVBDD_TERMINAL) return false;
+    evbddnode_t n = EVBDD_GETNODE(t);
+    BDDVAR var = evbddnode_getvar(n);
+    if (var % 2 != 0) return false;
+
+    EVBDD low, high, u00, u10, u01, u11;
+    evbddnode_getchilderen(n, &low, &high);
+    if (EVBDD_WEIGHT(low) != EVBDD_WEIGHT(high) || EVBDD_WEIGHT(low) == EVBDD_ZERO)
+        return false;
+    if (EVBDD_TARGET(low) == EVBDD_TERMINAL || EVBDD_TARGET(high) == EVBDD_TERMINAL)
+        return false;
+    evbddnode_t nl = EVBDD_GETNODE(EVBDD_TARGET(low));
+    evbddnode_t nh = EVBDD_GETNODE(EVBDD_TARGET(high));
+    if (evbddnode_getvar(nl) != var+1 || evbddnode_getvar(nh) != var+1) return false;
+    evbddnode_getchilderen(nl, &u00, &u10);
+    evbddnode_getchilderen(nh, &u01, &u11);
+    if (EVBDD_WEIGHT(u10) != EVBDD_ZERO || EVBDD_WEIGHT(u01) != EVBDD_ZERO || u00 != u11)
+        return false;
+
+    *child = evbdd_bundle(EVBDD_TARGET(u00), wgt_mul(EVBDD_WEIGHT(low), EVBDD_WEIGHT(u00)));
+    return true;
+}
+
+/**
+ * If t is c*I \tensor ... \tensor I on consecutive qubit levels ending in the
+ * terminal, returns the qubit level below the last one (and c in <scale>), 
+ * otherwise 0.
+ */
+static BDDVAR
+evbdd_identity_tail(EVBDD_TARG t, EVBDD_WGT *scale)
+{
+    uint64_t res;
+    if (cache_get3(CACHE_EVBDD_IS_IDENTITY, t, 0, 0, &res)) {
+        *scale = res >> 24;
+        return res & 0xffffff;
+    }
+
+    // identity at this level, with an identity directly below it
+    EVBDD child;
+    BDDVAR end = 0;
+    *scale = EVBDD_ZERO;
+    if (evbdd_identity_level(t, &child)) {
+        BDDVAR var = evbddnode_getvar(EVBDD_GETNODE(t));
+        if (EVBDD_TARGET(child) == EVBDD_TERMINAL) {
+            end = var/2 + 1;
+            *scale = EVBDD_WEIGHT(child);
+        }
+        else if (evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(child))) == var + 2) {
+            EVBDD_WGT below;
+            end = evbdd_identity_tail(EVBDD_TARGET(child), &below);
+            *scale = wgt_mul(EVBDD_WEIGHT(child), below);
+        }
+    }
+
+    cache_put3(CACHE_EVBDD_IS_IDENTITY, t, 0, 0, ((uint64_t)*scale << 24) | end);
+    return end;
+}
+
+/**
+ * If the matrix a is c*I on qubits nextvar..nvars-1 returns true, and the 
+ * weight of a times c in <scale>. 
+ */
+static bool
+evbdd_identity_remaining(EVBDD a, BDDVAR nextvar, BDDVAR nvars, EVBDD_WGT *scale)
+{
+    if (EVBDD_WEIGHT(a) == EVBDD_ZERO) return false;
+    if (nextvar == nvars) {
+        *scale = EVBDD_WEIGHT(a);
+        return EVBDD_TARGET(a) == EVBDD_TERMINAL;
+    }
+    // skipped levels would mean a constant block rather than I
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return false;
+    if (evbddnode_getvar(EVBDD_GETNODE(EVBDD_TARGET(a))) != 2*nextvar) return false;
+    EVBDD_WGT c;
+    if (evbdd_identity_tail(EVBDD_TARGET(a), &c) != nvars) return false;
+    *scale = wgt_mul(EVBDD_WEIGHT(a), c);
+    return true;
+}
+
+bool
+evbdd_is_identity_matrix(EVBDD a, BDDVAR nextvar, BDDVAR nvars)
+{
+    EVBDD_WGT scale;
+    return evbdd_identity_remaining(a, nextvar, nvars, &scale);
+}
+
+/**
+ * Builds the identity matrices on qubits k..nvars-1 for every level k (bottom
+ * up, as qmdd_stack_matrix does), unless they exist already for nvars. Since
+ * nodes are unique, the recursive multiplications can then check whether the
+ * rest of a matrix is c*I by comparing a single pointer. Not thread safe for
+ * concurrent multiplications with different numbers of qubits.
+ */
+static void
+evbdd_identity_levels(BDDVAR nvars)
+{
+    if (identity_nvars == nvars) return;
+    identity_nvars = 0;
+    identity_edges = realloc(identity_edges, sizeof(EVBDD) * (nvars + 1));
+    identity_edges[nvars] = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ONE);
+    for (BDDVAR k = nvars; k-- > 0; ) {
+        EVBDD below = identity_edges[k+1];
+        EVBDD one  = evbdd_bundle(EVBDD_TARGET(below), EVBDD_ONE);
+        EVBDD zero = evbdd_bundle(EVBDD_TARGET(below), EVBDD_ZERO);
+        EVBDD low  = evbdd_refs_push(evbdd_makenode(2*k+1, one, zero));
+        EVBDD high = evbdd_refs_push(evbdd_makenode(2*k+1, zero, one));
+        EVBDD res  = evbdd_makenode(2*k, low, high);
+        evbdd_refs_pop(2);
+        res = evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(below), EVBDD_WEIGHT(res)));
+        identity_edges[k] = evbdd_refs_push(res);
+    }
+    evbdd_refs_pop(nvars);
+    identity_nvars = nvars; // (from now on kept by evbdd_gc_mark_identity)
+}
+
+/**
+ * If the matrix a (below level nextvar) is c*I on all remaining qubits, returns
+ * true and c in <scale>.
+ */
+static inline bool
+evbdd_identity_below(EVBDD a, BDDVAR nextvar, EVBDD_WGT *scale)
+{
+    if (nextvar >= identity_nvars) return false;
+    EVBDD id = identity_edges[nextvar];
+    if (EVBDD_TARGET(a) != EVBDD_TARGET(id)) return false;
+    *scale = (EVBDD_WEIGHT(id) == EVBDD_ONE) ? EVBDD_WEIGHT(a) : wgt_div(EVBDD_WEIGHT(a), EVBDD_WEIGHT(id));
+    return true;
+}
+
+/**
+ * Returns 1 if the 2x2 block matrix [[u00,u01],[u10,u11]] is diagonal, -1 if
+ * it is anti-diagonal and 0 otherwise.
+ */
+static inline int
+evbdd_diag_kind(EVBDD u00, EVBDD u01, EVBDD u10, EVBDD u11)
+{
+    if (EVBDD_WEIGHT(u01) == EVBDD_ZERO && EVBDD_WEIGHT(u10) == EVBDD_ZERO) return 1;
+    if (EVBDD_WEIGHT(u00) == EVBDD_ZERO && EVBDD_WEIGHT(u11) == EVBDD_ZERO) return -1;
+    return 0;
+}
+
 /* Wrapper for matrix vector multiplication. */
 TASK_IMPL_3(EVBDD, evbdd_matvec_mult, EVBDD, mat, EVBDD, vec, BDDVAR, nvars)
 {
     evbdd_do_before_mult(&mat, &vec);
+
+    // (c*I)|vec> = c|vec>
+    EVBDD_WGT scale;
+    if (evbdd_identity_remaining(mat, 0, nvars, &scale)) {
+        return evbdd_bundle(EVBDD_TARGET(vec), wgt_mul(scale, EVBDD_WEIGHT(vec)));
+    }
+
     evbdd_refs_push(mat); evbdd_refs_push(vec);
+    evbdd_identity_levels(nvars);
     EVBDD res = CALL(evbdd_matvec_mult_rec, mat, vec, nvars, 0);
     evbdd_refs_pop(2);
     return res;
@@ -658,7 +1136,18 @@ TASK_IMPL_3(EVBDD, evbdd_matvec_mult, EVBDD, mat, EVBDD, vec, BDDVAR, nvars)
 TASK_IMPL_3(EVBDD, evbdd_matmat_mult, EVBDD, a, EVBDD, b, BDDVAR, nvars)
 {
     evbdd_do_before_mult(&a, &b);
+
+    // (c*I)B = cB and A(c*I) = cA
+    EVBDD_WGT scale;
+    if (evbdd_identity_remaining(a, 0, nvars, &scale)) {
+        return evbdd_bundle(EVBDD_TARGET(b), wgt_mul(scale, EVBDD_WEIGHT(b)));
+    }
+    if (evbdd_identity_remaining(b, 0, nvars, &scale)) {
+        return evbdd_bundle(EVBDD_TARGET(a), wgt_mul(EVBDD_WEIGHT(a), scale));
+    }
+
     evbdd_refs_push(a); evbdd_refs_push(b);
+    evbdd_identity_levels(nvars);
     EVBDD res = CALL(evbdd_matmat_mult_rec, a, b, nvars, 0);
     evbdd_refs_pop(2);
     return res;
@@ -678,6 +1167,12 @@ TASK_IMPL_4(EVBDD, evbdd_matvec_mult_rec, EVBDD, mat, EVBDD, vec, BDDVAR, nvars,
         return evbdd_bundle(EVBDD_TERMINAL, prod);
     }
 
+    // Identity on all remaining levels: mat * |vec> = c|vec>
+    EVBDD_WGT scale;
+    if (evbdd_identity_below(mat, nextvar, &scale)) {
+        return evbdd_bundle(EVBDD_TARGET(vec), wgt_mul(scale, EVBDD_WEIGHT(vec)));
+    }
+
     sylvan_gc_test();
 
     // Check cache
@@ -709,25 +1204,40 @@ TASK_IMPL_4(EVBDD, evbdd_matvec_mult_rec, EVBDD, mat, EVBDD, vec, BDDVAR, nvars,
     u01 = evbdd_bundle(EVBDD_TARGET(u01), wgt_mul(EVBDD_WEIGHT(u01), EVBDD_WEIGHT(mat_high)));
     u11 = evbdd_bundle(EVBDD_TARGET(u11), wgt_mul(EVBDD_WEIGHT(u11), EVBDD_WEIGHT(mat_high)));
 
-    // 3. recursive calls (4 tasks: SPAWN 3, CALL 1)
-    // |u00 u01| |vec_low | = vec_low|u00| + vec_high|u01|
-    // |u10 u11| |vec_high|          |u10|           |u11|
-    EVBDD res_low00, res_low10, res_high01, res_high11; //                                       [GC refs stack]
-    evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, u00, vec_low,  nvars, nextvar+1));  // fork 1
-    evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, u10, vec_low,  nvars, nextvar+1));  // fork 2
-    evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, u01, vec_high, nvars, nextvar+1));  // fork 3
-    res_high11 = evbdd_refs_push(CALL(evbdd_matvec_mult_rec, u11, vec_high, nvars, nextvar+1));// [res_high11]
-    res_high01 = evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec));                        // join 3   [res_high11]
-    evbdd_refs_pop(1);                                                               //          []
-    EVBDD res_high = evbdd_refs_push(evbdd_makenode(nextvar, res_high01, res_high11)); //          [res_high]
-    res_low10  = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec)));        // join 2   [res_low10,res_high]
-    res_low00  = evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec));                        // join 1   [res_low10,res_high]
-    evbdd_refs_pop(1);                                                               //          [res_high]
-    EVBDD res_low  = evbdd_refs_push(evbdd_makenode(nextvar, res_low00,  res_low10));  //          [res_low,res_high]
-
-    // 4. add resulting EVBDDs
-    res = CALL(evbdd_plus, res_low, res_high);                                       //          [res_low,res_high]
-    evbdd_refs_pop(2);                                                               //          []
+    // 3a. (anti-)diagonal matrix at this level (I, Z, X, controls, ...): 
+    // only 2 recursive calls, and no need to add the results
+    int kind = evbdd_diag_kind(u00, u01, u10, u11);
+    if (kind != 0) {
+        bool diag = (kind == 1);
+        EVBDD res_0, res_1;
+        evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, diag ? u00 : u01, diag ? vec_low : vec_high, nvars, nextvar+1));
+        res_1 = CALL(evbdd_matvec_mult_rec, diag ? u11 : u10, diag ? vec_high : vec_low, nvars, nextvar+1);
+        evbdd_refs_push(res_1);
+        res_0 = evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec));
+        evbdd_refs_pop(1);
+        res = evbdd_makenode(nextvar, res_0, res_1);
+    }
+    else {
+        // 3. recursive calls (4 tasks: SPAWN 3, CALL 1)
+        // |u00 u01| |vec_low | = vec_low|u00| + vec_high|u01|
+        // |u10 u11| |vec_high|          |u10|           |u11|
+        EVBDD res_low00, res_low10, res_high01, res_high11; //                                       [GC refs stack]
+        evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, u00, vec_low,  nvars, nextvar+1));  // fork 1
+        evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, u10, vec_low,  nvars, nextvar+1));  // fork 2
+        evbdd_refs_spawn(SPAWN(evbdd_matvec_mult_rec, u01, vec_high, nvars, nextvar+1));  // fork 3
+        res_high11 = evbdd_refs_push(CALL(evbdd_matvec_mult_rec, u11, vec_high, nvars, nextvar+1));// [res_high11]
+        res_high01 = evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec));                        // join 3   [res_high11]
+        evbdd_refs_pop(1);                                                               //          []
+        EVBDD res_high = evbdd_refs_push(evbdd_makenode(nextvar, res_high01, res_high11)); //          [res_high]
+        res_low10  = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec)));        // join 2   [res_low10,res_high]
+        res_low00  = evbdd_refs_sync(SYNC(evbdd_matvec_mult_rec));                        // join 1   [res_low10,res_high]
+        evbdd_refs_pop(1);                                                               //          [res_high]
+        EVBDD res_low  = evbdd_refs_push(evbdd_makenode(nextvar, res_low00,  res_low10));  //          [res_low,res_high]
+
+        // 4. add resulting EVBDDs
+        res = CALL(evbdd_plus, res_low, res_high);                                       //          [res_low,res_high]
+        evbdd_refs_pop(2);                                                               //          []
+    }
 
     // Insert in cache (before multiplication w/ root weights)
     if (cachenow) {
@@ -757,6 +1267,15 @@ TASK_IMPL_4(EVBDD, evbdd_matmat_mult_rec, EVBDD, a, EVBDD, b, BDDVAR, nvars, BDD
         return evbdd_bundle(EVBDD_TERMINAL, prod);
     }
 
+    // Identity on all remaining levels: (cI)B = cB and A(cI) = cA
+    EVBDD_WGT scale;
+    if (evbdd_identity_below(a, nextvar, &scale)) {
+        return evbdd_bundle(EVBDD_TARGET(b), wgt_mul(scale, EVBDD_WEIGHT(b)));
+    }
+    if (evbdd_identity_below(b, nextvar, &scale)) {
+        return evbdd_bundle(EVBDD_TARGET(a), wgt_mul(EVBDD_WEIGHT(a), scale));
+    }
+
     sylvan_gc_test();
 
     // Check cache
@@ -794,44 +1313,74 @@ TASK_IMPL_4(EVBDD, evbdd_matmat_mult_rec, EVBDD, a, EVBDD, b, BDDVAR, nvars, BDD
     b01 = evbdd_bundle(EVBDD_TARGET(b01), wgt_mul(EVBDD_WEIGHT(b_high),EVBDD_WEIGHT(b01)));
     b11 = evbdd_bundle(EVBDD_TARGET(b11), wgt_mul(EVBDD_WEIGHT(b_high),EVBDD_WEIGHT(b11)));
 
-    // 3. recursive calls (8 tasks: SPAWN 7, CALL 1)
-    // |a00 a01| |b00 b01| = b00|a00| + b10|a01| , b01|a00| + b11|a01|
-    // |a10 a11| |b10 b11|      |a10|      |a11|      |a10|      |a11|
-    EVBDD a00_b00, a00_b01, a10_b00, a10_b01, a01_b10, a01_b11, a11_b10, a11_b11; //         [GC refs stack]
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a00, b00, nvars, nextvar+1)); // fork 1
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a10, b00, nvars, nextvar+1)); // fork 2
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a00, b01, nvars, nextvar+1)); // fork 3
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a10, b01, nvars, nextvar+1)); // fork 4
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a01, b10, nvars, nextvar+1)); // fork 5
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a11, b10, nvars, nextvar+1)); // fork 6
-    evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a01, b11, nvars, nextvar+1)); // fork 7 
-    a11_b11 = evbdd_refs_push(CALL(evbdd_matmat_mult_rec, a11, b11, nvars, nextvar+1)); //    [a11_b11]
-    a01_b11 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 7     [a11_b11]
-    evbdd_refs_pop(1);                                                         //            []
-    EVBDD rh2 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a01_b11, a11_b11));  //            [rh2]
-    a11_b10 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));     // join 6     [a11_b10,rh2]
-    a01_b10 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 5     [a11_b10,rh2]
-    evbdd_refs_pop(1);                                                         //            [rh2]
-    EVBDD lh2 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a01_b10, a11_b10));  //            [lh2,rh2]
-    a10_b01 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));     // join 4     [b10_b01,lh2,rh2]
-    a00_b01 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 3     [b10_b01,lh2,rh2]
-    evbdd_refs_pop(1);                                                         //            [lh2,rh2]
-    EVBDD rh1 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a00_b01, a10_b01));  //            [rh1,lh2,rh2]
-    a10_b00 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));     // join 2     [b10_b00,rh1,lh2,rh2]
-    a00_b00 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 1     [b10_b00,rh1,lh2,rh2]
-    evbdd_refs_pop(1);                                                         //            [rh1,lh2,rh2]
-    EVBDD lh1 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a00_b00, a10_b00));  //            [lh1,rh1,lh2,rh2]
-
-    // 4. add resulting EVBDDs
-    EVBDD lh, rh;
-    evbdd_refs_spawn(SPAWN(evbdd_plus, lh1, lh2));
-    rh = CALL(evbdd_plus, rh1, rh2);
-    evbdd_refs_push(rh);                                                       //            [rh,lh1,rh1,lh2,rh2]
-    lh = evbdd_refs_sync(SYNC(evbdd_plus));                                     //            [rh,lh1,rh1,lh2,rh2]
-    evbdd_refs_pop(5);                                                         //            []
-
-    // 5. put left and right halves of matix together
-    res = evbdd_makenode(2*nextvar, lh, rh);
+    // 3a. if either matrix is (anti-)diagonal at this level, every entry of
+    // the product is a single product of blocks (4 tasks: SPAWN 3, CALL 1)
+    EVBDD A[2][2] = {{a00, a01}, {a10, a11}};
+    EVBDD B[2][2] = {{b00, b01}, {b10, b11}};
+    int a_diag = evbdd_diag_kind(a00, a01, a10, a11);
+    int b_diag = evbdd_diag_kind(b00, b01, b10, b11);
+    if (a_diag != 0 || b_diag != 0) {
+        // res[i][j] = A[i][k] * B[k][j] for the single non-zero k
+        int k[2][2];
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                if (a_diag != 0) k[i][j] = (a_diag == 1) ? i : 1-i;
+                else             k[i][j] = (b_diag == 1) ? j : 1-j;
+            }
+        }
+        EVBDD r00, r01, r10, r11;
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, A[0][k[0][0]], B[k[0][0]][0], nvars, nextvar+1));
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, A[1][k[1][0]], B[k[1][0]][0], nvars, nextvar+1));
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, A[0][k[0][1]], B[k[0][1]][1], nvars, nextvar+1));
+        r11 = evbdd_refs_push(CALL(evbdd_matmat_mult_rec, A[1][k[1][1]], B[k[1][1]][1], nvars, nextvar+1));
+        r01 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));
+        r10 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));
+        r00 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));
+        EVBDD lh = evbdd_refs_push(evbdd_makenode(2*nextvar+1, r00, r10));
+        EVBDD rh = evbdd_makenode(2*nextvar+1, r01, r11);
+        evbdd_refs_pop(5);
+        res = evbdd_makenode(2*nextvar, lh, rh);
+    }
+    else {
+        // 3. recursive calls (8 tasks: SPAWN 7, CALL 1)
+        // |a00 a01| |b00 b01| = b00|a00| + b10|a01| , b01|a00| + b11|a01|
+        // |a10 a11| |b10 b11|      |a10|      |a11|      |a10|      |a11|
+        EVBDD a00_b00, a00_b01, a10_b00, a10_b01, a01_b10, a01_b11, a11_b10, a11_b11; //         [GC refs stack]
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a00, b00, nvars, nextvar+1)); // fork 1
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a10, b00, nvars, nextvar+1)); // fork 2
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a00, b01, nvars, nextvar+1)); // fork 3
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a10, b01, nvars, nextvar+1)); // fork 4
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a01, b10, nvars, nextvar+1)); // fork 5
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a11, b10, nvars, nextvar+1)); // fork 6
+        evbdd_refs_spawn(SPAWN(evbdd_matmat_mult_rec, a01, b11, nvars, nextvar+1)); // fork 7 
+        a11_b11 = evbdd_refs_push(CALL(evbdd_matmat_mult_rec, a11, b11, nvars, nextvar+1)); //    [a11_b11]
+        a01_b11 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 7     [a11_b11]
+        evbdd_refs_pop(1);                                                         //            []
+        EVBDD rh2 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a01_b11, a11_b11));  //            [rh2]
+        a11_b10 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));     // join 6     [a11_b10,rh2]
+        a01_b10 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 5     [a11_b10,rh2]
+        evbdd_refs_pop(1);                                                         //            [rh2]
+        EVBDD lh2 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a01_b10, a11_b10));  //            [lh2,rh2]
+        a10_b01 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));     // join 4     [b10_b01,lh2,rh2]
+        a00_b01 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 3     [b10_b01,lh2,rh2]
+        evbdd_refs_pop(1);                                                         //            [lh2,rh2]
+        EVBDD rh1 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a00_b01, a10_b01));  //            [rh1,lh2,rh2]
+        a10_b00 = evbdd_refs_push(evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec)));     // join 2     [b10_b00,rh1,lh2,rh2]
+        a00_b00 = evbdd_refs_sync(SYNC(evbdd_matmat_mult_rec));                     // join 1     [b10_b00,rh1,lh2,rh2]
+        evbdd_refs_pop(1);                                                         //            [rh1,lh2,rh2]
+        EVBDD lh1 = evbdd_refs_push(evbdd_makenode(2*nextvar+1, a00_b00, a10_b00));  //            [lh1,rh1,lh2,rh2]
+
+        // 4. add resulting EVBDDs
+        EVBDD lh, rh;
+        evbdd_refs_spawn(SPAWN(evbdd_plus, lh1, lh2));
+        rh = CALL(evbdd_plus, rh1, rh2);
+        evbdd_refs_push(rh);                                                       //            [rh,lh1,rh1,lh2,rh2]
+        lh = evbdd_refs_sync(SYNC(evbdd_plus));                                     //            [rh,lh1,rh1,lh2,rh2]
+        evbdd_refs_pop(5);                                                         //            []
+
+        // 5. put left and right halves of matix together
+        res = evbdd_makenode(2*nextvar, lh, rh);
+    }
 
     // Insert in cache
     if (cachenow) {
@@ -968,6 +1517,58 @@ evbdd_replace_terminal(EVBDD a, EVBDD_TARG b)
     return evbdd_bundle(EVBDD_TARGET(res), EVBDD_WEIGHT(a));
 }
 
+TASK_IMPL_2(EVBDD, evbdd_swap_adjacent, EVBDD, a, BDDVAR, k)
+{
+    if (EVBDD_WEIGHT(a) == EVBDD_ZERO || EVBDD_TARGET(a) == EVBDD_TERMINAL) {
+        return a;
+    }
+    evbddnode_t node = EVBDD_GETNODE(EVBDD_TARGET(a));
+    BDDVAR var = evbddnode_getvar(node);
+    if (var > k+1) return a; // a doesn't depend on x_k or x_{k+1}
+
+    sylvan_gc_test();
+
+    // Check cache (result for the node itself, i.e. for root weight 1)
+    EVBDD res;
+    if (cache_get3(CACHE_EVBDD_SWAP_LEVELS, EVBDD_TARGET(a), k, 0, &res)) {
+        return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(res), EVBDD_WEIGHT(a)));
+    }
+
+    EVBDD low, high;
+    if (var < k) {
+        // Swap in both children
+        evbddnode_getchilderen(node, &low, &high);
+        evbdd_refs_spawn(SPAWN(evbdd_swap_adjacent, high, k));
+        low  = evbdd_refs_push(CALL(evbdd_swap_adjacent, low, k));
+        high = evbdd_refs_sync(SYNC(evbdd_swap_adjacent));
+        evbdd_refs_push(high);
+        res = evbdd_makenode(var, low, high);
+        evbdd_refs_pop(2);
+    }
+    else {
+        // Cofactors f_uv for x_k = u, x_{k+1} = v (w/ "in-between" weights)
+        BDDVAR topvar;
+        EVBDD a0, a1, f00, f01, f10, f11;
+        EVBDD unit = evbdd_bundle(EVBDD_TARGET(a), EVBDD_ONE);
+        evbdd_get_topvar(unit, k, &topvar, &a0, &a1);
+        evbdd_get_topvar(a0, k+1, &topvar, &f00, &f01);
+        evbdd_get_topvar(a1, k+1, &topvar, &f10, &f11);
+        f00 = evbdd_bundle(EVBDD_TARGET(f00), wgt_mul(EVBDD_WEIGHT(f00), EVBDD_WEIGHT(a0)));
+        f01 = evbdd_bundle(EVBDD_TARGET(f01), wgt_mul(EVBDD_WEIGHT(f01), EVBDD_WEIGHT(a0)));
+        f10 = evbdd_bundle(EVBDD_TARGET(f10), wgt_mul(EVBDD_WEIGHT(f10), EVBDD_WEIGHT(a1)));
+        f11 = evbdd_bundle(EVBDD_TARGET(f11), wgt_mul(EVBDD_WEIGHT(f11), EVBDD_WEIGHT(a1)));
+
+        // New x_k (old x_{k+1}) on top, old x_k below it
+        low  = evbdd_refs_push(evbdd_makenode(k+1, f00, f10));
+        high = evbdd_refs_push(evbdd_makenode(k+1, f01, f11));
+        res = evbdd_makenode(k, low, high);
+        evbdd_refs_pop(2);
+    }
+
+    cache_put3(CACHE_EVBDD_SWAP_LEVELS, EVBDD_TARGET(a), k, 0, res);
+    return evbdd_bundle(EVBDD_TARGET(res), wgt_mul(EVBDD_WEIGHT(res), EVBDD_WEIGHT(a)));
+}
+
 EVBDD
 evbdd_tensor_prod(EVBDD a, EVBDD b, BDDVAR nvars_a)
 {
@@ -1026,6 +1627,48 @@ evbdd_countnodes(EVBDD a)
     return res;
 }
 
+static void
+evbdd_levelcount_mark(EVBDD a, uint64_t *counts)
+{
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return;
+    evbddnode_t n = EVBDD_GETNODE(EVBDD_TARGET(a));
+    if (evbddnode_getmark(n)) return;
+    evbddnode_setmark(n, 1);
+    counts[evbddnode_getvar(n)]++;
+    evbdd_levelcount_mark(evbddnode_getptrlow(n), counts);
+    evbdd_levelcount_mark(evbddnode_getptrhigh(n), counts);
+}
+
+void
+evbdd_countnodes_per_level(EVBDD a, uint64_t *counts, BDDVAR nvars)
+{
+    for (BDDVAR k = 0; k < nvars; k++) counts[k] = 0;
+    evbdd_levelcount_mark(a, counts);
+    evbdd_unmark_rec(a);
+}
+
+static void
+evbdd_levelcount_mark_range(EVBDD a, uint64_t *counts, BDDVAR from, BDDVAR to)
+{
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return;
+    evbddnode_t n = EVBDD_GETNODE(EVBDD_TARGET(a));
+    BDDVAR var = evbddnode_getvar(n);
+    if (var > to || evbddnode_getmark(n)) return;
+    evbddnode_setmark(n, 1);
+    if (var >= from) counts[var]++;
+    evbdd_levelcount_mark_range(evbddnode_getptrlow(n), counts, from, to);
+    evbdd_levelcount_mark_range(evbddnode_getptrhigh(n), counts, from, to);
+}
+
+void
+evbdd_countnodes_levels(EVBDD a, uint64_t *counts, BDDVAR from, BDDVAR to)
+{
+    for (BDDVAR k = from; k <= to; k++) counts[k] = 0;
+    evbdd_levelcount_mark_range(a, counts, from, to);
+    // (unmarking stops at the unmarked nodes below level <to>)
+    evbdd_unmark_rec(a);
+}
+
 /**************************</EVBDD utility functions>***************************/
 
 
@@ -1156,6 +1799,241 @@ evbdd_fprintdot(FILE *out, EVBDD a, bool draw_zeros)
     fprintf(out, "}\n");
 }
 
+/**
+ * Writing EVBDD files. Nodes and edge weights are assigned consecutive
+ * numbers (starting from 1) using a skiplist each. Edge weights are stored in
+ * the skiplist as weight index + 1, since the skiplist doesn't store 0.
+ */
+VOID_TASK_3(evbdd_writer_add_rec, sylvan_skiplist_t, sl_nodes, sylvan_skiplist_t, sl_wgts, EVBDD, a)
+{
+    CALL(sylvan_skiplist_assign_next, sl_wgts, EVBDD_WEIGHT(a) + 1);
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return;
+    if (sylvan_skiplist_get(sl_nodes, EVBDD_TARGET(a)) != 0) return;
+
+    EVBDD low, high;
+    evbddnode_t n = EVBDD_GETNODE(EVBDD_TARGET(a));
+    evbddnode_getchilderen(n, &low, &high);
+    CALL(evbdd_writer_add_rec, sl_nodes, sl_wgts, low);
+    CALL(evbdd_writer_add_rec, sl_nodes, sl_wgts, high);
+    CALL(sylvan_skiplist_assign_next, sl_nodes, EVBDD_TARGET(a));
+}
+
+static uint64_t
+evbdd_writer_node_id(sylvan_skiplist_t sl_nodes, uint64_t *level_id, EVBDD a)
+{
+    if (EVBDD_TARGET(a) == EVBDD_TERMINAL) return 0;
+    return level_id[sylvan_skiplist_get(sl_nodes, EVBDD_TARGET(a))];
+}
+
+static uint64_t
+evbdd_writer_wgt_id(sylvan_skiplist_t sl_wgts, EVBDD a)
+{
+    return sylvan_skiplist_get(sl_wgts, EVBDD_WEIGHT(a) + 1) - 1;
+}
+
+static size_t
+evbdd_writer_skiplist_size(size_t size)
+{
+    return size > 0x7fffffff ? 0x7fffffff : size;
+}
+
+TASK_IMPL_3(int, evbdd_writer_tobinary, FILE*, out, EVBDD*, dds, int, count)
+{
+    sylvan_skiplist_t sl_nodes = sylvan_skiplist_alloc(evbdd_writer_skiplist_size(nodes->table_size));
+    sylvan_skiplist_t sl_wgts  = sylvan_skiplist_alloc(evbdd_writer_skiplist_size(sylvan_get_edge_weight_table_size() + 1));
+    for (int i = 0; i < count; i++) {
+        CALL(evbdd_writer_add_rec, sl_nodes, sl_wgts, dds[i]);
+    }
+
+    evbdd_file_header_t header;
+    memcpy(header.magic, EVBDD_FILE_MAGIC, sizeof(header.magic));
+    header.version   = EVBDD_FILE_VERSION;
+    header.wgt_size  = sizeof(complex_t);
+    header.nodecount = sylvan_skiplist_count(sl_nodes);
+    header.wgtcount  = sylvan_skiplist_count(sl_wgts);
+    header.rootcount = count;
+    int res = 0;
+    if (header.wgtcount > UINT32_MAX) res = -1;
+
+    // Level order: sort the (post-order) skiplist numbers on descending var
+    uint64_t *level_id = NULL, *order = NULL, *offsets = NULL;
+    BDDVAR max_var = 0;
+    if (res == 0) {
+        level_id = malloc(sizeof(uint64_t) * (header.nodecount + 1));
+        order    = malloc(sizeof(uint64_t) * (header.nodecount + 1));
+        for (uint64_t i = 1; i <= header.nodecount; i++) {
+            BDDVAR var = evbddnode_getvar(EVBDD_GETNODE(sylvan_skiplist_getr(sl_nodes, i)));
+            if (var > max_var) max_var = var;
+        }
+        offsets = calloc((size_t)max_var + 2, sizeof(uint64_t));
+        for (uint64_t i = 1; i <= header.nodecount; i++) {
+            BDDVAR var = evbddnode_getvar(EVBDD_GETNODE(sylvan_skiplist_getr(sl_nodes, i)));
+            offsets[max_var - var + 1]++;
+        }
+        for (BDDVAR v = 1; v <= max_var + 1; v++) offsets[v] += offsets[v-1];
+        for (uint64_t i = 1; i <= header.nodecount; i++) {
+            BDDVAR var = evbddnode_getvar(EVBDD_GETNODE(sylvan_skiplist_getr(sl_nodes, i)));
+            uint64_t pos = offsets[max_var - var]++;
+            order[pos] = i;
+            level_id[i] = pos + 1;
+        }
+        if (fwrite(&header, sizeof(header), 1, out) != 1) res = -1;
+    }
+
+    // Edge weights
+    for (uint64_t j = 1; res == 0 && j <= header.wgtcount; j++) {
+        complex_t c;
+        weight_value(sylvan_skiplist_getr(sl_wgts, j) - 1, &c);
+        if (fwrite(&c, sizeof(complex_t), 1, out) != 1) res = -1;
+    }
+
+    // Nodes
+    for (uint64_t pos = 0; res == 0 && pos < header.nodecount; pos++) {
+        evbddnode_t n = EVBDD_GETNODE(sylvan_skiplist_getr(sl_nodes, order[pos]));
+        EVBDD low, high;
+        evbddnode_getchilderen(n, &low, &high);
+        evbdd_file_node_t fnode;
+        fnode.low      = evbdd_writer_node_id(sl_nodes, level_id, low);
+        fnode.high     = evbdd_writer_node_id(sl_nodes, level_id, high);
+        fnode.low_wgt  = (uint32_t) evbdd_writer_wgt_id(sl_wgts, low);
+        fnode.high_wgt = (uint32_t) evbdd_writer_wgt_id(sl_wgts, high);
+        fnode.var      = evbddnode_getvar(n);
+        fnode.reserved = 0;
+        if (fwrite(&fnode, sizeof(fnode), 1, out) != 1) res = -1;
+    }
+
+    // Roots
+    for (int i = 0; res == 0 && i < count; i++) {
+        evbdd_file_root_t root;
+        root.node = evbdd_writer_node_id(sl_nodes, level_id, dds[i]);
+        root.wgt  = evbdd_writer_wgt_id(sl_wgts, dds[i]);
+        if (fwrite(&root, sizeof(root), 1, out) != 1) res = -1;
+    }
+
+    free(level_id);
+    free(order);
+    free(offsets);
+    sylvan_skiplist_free(sl_nodes);
+    sylvan_skiplist_free(sl_wgts);
+    return res;
+}
+
+/**
+ * Reading EVBDD files. Returns the edge to (node) index <id> with the stored
+ * edge weight <w> multiplied in (non-trivial only if the reader uses a
+ * different normalization strategy than the writer did).
+ */
+static inline EVBDD
+evbdd_reader_edge(EVBDD *arr, uint64_t id, EVBDD_WGT w)
+{
+    return evbdd_bundle(EVBDD_TARGET(arr[id]), wgt_mul(EVBDD_WEIGHT(arr[id]), w));
+}
+
+static bool
+evbdd_reader_check_header(const evbdd_file_header_t *header, int count)
+{
+    if (memcmp(header->magic, EVBDD_FILE_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != EVBDD_FILE_VERSION) return false;
+    if (header->wgt_size != sizeof(complex_t)) return false;
+    if (header->rootcount != (uint64_t)count) return false;
+    return true;
+}
+
+static int
+evbdd_reader_build(const evbdd_file_header_t *header, const complex_t *wgts,
+                   const evbdd_file_node_t *fnodes, const evbdd_file_root_t *roots,
+                   EVBDD *dds, int count)
+{
+    EVBDD_WGT *wgt_arr = malloc(sizeof(EVBDD_WGT) * (header->wgtcount + 1));
+    for (uint64_t j = 0; j < header->wgtcount; j++) {
+        complex_t c = wgts[j];
+        wgt_arr[j] = weight_lookup(&c);
+    }
+
+    int res = 0;
+    uint64_t i;
+    EVBDD *arr = malloc(sizeof(EVBDD) * (header->nodecount + 1));
+    arr[0] = evbdd_bundle(EVBDD_TERMINAL, EVBDD_ONE);
+    for (i = 1; i <= header->nodecount; i++) {
+        const evbdd_file_node_t *fnode = &fnodes[i-1];
+        if (fnode->low >= i || fnode->high >= i ||
+            fnode->low_wgt >= header->wgtcount || fnode->high_wgt >= header->wgtcount) {
+            res = -1;
+            break;
+        }
+        EVBDD low  = evbdd_reader_edge(arr, fnode->low, wgt_arr[fnode->low_wgt]);
+        EVBDD high = evbdd_reader_edge(arr, fnode->high, wgt_arr[fnode->high_wgt]);
+        arr[i] = evbdd_refs_push(evbdd_makenode(fnode->var, low, high));
+    }
+
+    for (int k = 0; res == 0 && k < count; k++) {
+        if (roots[k].node > header->nodecount || roots[k].wgt >= header->wgtcount) {
+            res = -1;
+            break;
+        }
+        dds[k] = evbdd_reader_edge(arr, roots[k].node, wgt_arr[roots[k].wgt]);
+    }
+
+    evbdd_refs_pop(i-1);
+    free(arr);
+    free(wgt_arr);
+    return res;
+}
+
+TASK_IMPL_3(int, evbdd_reader_frombinary, FILE*, in, EVBDD*, dds, int, count)
+{
+    evbdd_file_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1) return -1;
+    if (!evbdd_reader_check_header(&header, count)) return -1;
+
+    complex_t *wgts = malloc(sizeof(complex_t) * header.wgtcount);
+    evbdd_file_node_t *fnodes = malloc(sizeof(evbdd_file_node_t) * header.nodecount);
+    evbdd_file_root_t *roots = malloc(sizeof(evbdd_file_root_t) * header.rootcount);
+    int res = -1;
+    if (fread(wgts, sizeof(complex_t), header.wgtcount, in) == header.wgtcount &&
+        fread(fnodes, sizeof(evbdd_file_node_t), header.nodecount, in) == header.nodecount &&
+        fread(roots, sizeof(evbdd_file_root_t), header.rootcount, in) == header.rootcount) {
+        res = evbdd_reader_build(&header, wgts, fnodes, roots, dds, count);
+    }
+
+    free(wgts);
+    free(fnodes);
+    free(roots);
+    return res;
+}
+
+TASK_IMPL_3(int, evbdd_reader_frommmap, const char*, filename, EVBDD*, dds, int, count)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(evbdd_file_header_t)) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    int res = -1;
+    const evbdd_file_header_t *header = (const evbdd_file_header_t *) data;
+    if (evbdd_reader_check_header(header, count)) {
+        const char *p = (const char *) data + sizeof(evbdd_file_header_t);
+        const complex_t *wgts = (const complex_t *) p;
+        p += sizeof(complex_t) * header->wgtcount;
+        const evbdd_file_node_t *fnodes = (const evbdd_file_node_t *) p;
+        p += sizeof(evbdd_file_node_t) * header->nodecount;
+        const evbdd_file_root_t *roots = (const evbdd_file_root_t *) p;
+        p += sizeof(evbdd_file_root_t) * header->rootcount;
+        if (p <= (const char *) data + st.st_size) {
+            res = evbdd_reader_build(header, wgts, fnodes, roots, dds, count);
+        }
+    }
+
+    munmap(data, st.st_size);
+    return res;
+}
+
 /**************************</Printing & file writing>**************************/
 
 
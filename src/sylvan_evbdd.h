@@ -89,6 +89,7 @@ EVBDD evbdd_refs_sync(EVBDD a);
 
 /* enabled by default */
 void evbdd_set_auto_gc_wgt_table(bool enabled);
+bool evbdd_get_auto_gc_wgt_table();
 /* default 0.5 */
 void evbdd_set_gc_wgt_table_thres(double fraction_filled);
 double evbdd_get_gc_wgt_table_thres();
@@ -97,9 +98,10 @@ bool evbdd_test_gc_wgt_table();
 
 /**
  * Recursive function for moving weights from old to new edge weight table.
+ * If <is_new> is set, the weight of <a> already refers to the new table.
  */
-#define _fill_new_wgt_table(a) (RUN(_fill_new_wgt_table, a))
-TASK_DECL_1(EVBDD, _fill_new_wgt_table, EVBDD);
+#define _fill_new_wgt_table(a) (RUN(_fill_new_wgt_table, a, false))
+TASK_DECL_2(EVBDD, _fill_new_wgt_table, EVBDD, bool);
 
 /************************</Cleaning edge weight table>*************************/
 
@@ -107,6 +109,69 @@ TASK_DECL_1(EVBDD, _fill_new_wgt_table, EVBDD);
 
 
 
+/*****************************<Memory budget>**********************************/
+
+/**
+ * Sets one memory cap (in bytes) for the nodes table, the operation cache and
+ * the edge weight table together. Call this instead of sylvan_set_limits(),
+ * before sylvan_init_package(). The edge weight table sizes passed to 
+ * sylvan_init_evbdd() are then only used to limit the initial size.
+ * 
+ * Initially a fraction <wgt_fraction> of the cap goes to the edge weight 
+ * table, and the rest to the nodes table and cache (divided as in 
+ * sylvan_set_limits() with <table_ratio>). All tables start at 1/2^
+ * <initial_ratio> of their share and grow into it. During the run,
+ * memory is moved between the nodes table and the edge weight table (in
+ * powers of two) depending on which of the two is under pressure:
+ * - the nodes table is at its share and still more than half full after gc,
+ * - the edge weight table is at its share and still more than half of the gc
+ *   threshold full right after cleaning it,
+ * while the other table has not yet grown into its share.
+ */
+void evbdd_set_limits(size_t memorycap, int table_ratio, int initial_ratio, double wgt_fraction);
+
+/**
+ * Current shares (in number of entries) of the nodes table, operation cache
+ * and edge weight table, and how often memory was moved between them.
+ */
+void evbdd_get_limits(size_t *nodes_max, size_t *cache_max, size_t *wgts_max, uint64_t *rebalances);
+
+/**
+ * Out-of-memory condition. By default, a full nodes table or edge weight 
+ * table (even after gc) exits the program. With recoverable OOM enabled, the
+ * table is instead flagged as full, and the operation continues with 
+ * placeholder nodes/weights. The result of that operation (and of everything 
+ * computed until the flag is cleared) is meaningless, but the EVBDDs computed
+ * before are not affected. The caller can therefore free memory (gc, 
+ * approximation) and redo the operation, or stop gracefully. While the flag
+ * is set, new nodes and weights are placeholders right away (without gc).
+ */
+typedef enum evbdd_oom {
+    EVBDD_OOM_NONE  = 0,
+    EVBDD_OOM_NODES = 1,
+    EVBDD_OOM_WGTS  = 2,
+} evbdd_oom_t;
+
+void evbdd_set_recoverable_oom(bool enabled);
+/* returns which tables (EVBDD_OOM_NODES | EVBDD_OOM_WGTS) have been full */
+int evbdd_out_of_memory();
+/* clears the flags, and the operation cache (which may contain bogus results) */
+void evbdd_clear_out_of_memory();
+/* called when a table is full, exits unless recoverable OOM is enabled */
+void evbdd_signal_out_of_memory(evbdd_oom_t table);
+/**
+ * With recoverable OOM and a memory budget, returns true if the last few gcs 
+ * of the table (at its share) left it (almost) full. The table is then 
+ * treated as full rather than garbage collected over and over again.
+ */
+bool evbdd_budget_thrashing(evbdd_oom_t table);
+
+/****************************</Memory budget>**********************************/
+
+
+
+
+
 /******************************<Initialization>********************************/
 
 /**
@@ -124,6 +189,13 @@ void sylvan_init_evbdd(size_t min_wgt_tablesize, size_t max_wgt_tablesize, doubl
 void sylvan_init_evbdd_defaults(size_t min_wgt_tablesize, size_t max_wgt_tablesize);
 void evbdd_set_caching_granularity(int granularity);
 
+/**
+ * Returns the number of bits of an edge used for the edge weight index and for
+ * the node index. Without QSYLVAN_EDGE_WGT_BITS this depends on the max edge
+ * weight table size passed to sylvan_init_evbdd() (23/40 or 33/30).
+ */
+void evbdd_get_edge_layout(int *wgt_bits, int *ptr_bits);
+
 /*****************************</Initialization>********************************/
 
 
@@ -153,6 +225,13 @@ TASK_DECL_3(EVBDD, evbdd_matvec_mult, EVBDD, EVBDD, BDDVAR);
 #define evbdd_matmat_mult(a,b,nvars) (RUN(evbdd_matmat_mult,a,b,nvars))
 TASK_DECL_3(EVBDD, evbdd_matmat_mult, EVBDD, EVBDD, BDDVAR);
 
+/**
+ * Returns true iff the matrix EVBDD a is (a multiple of) the identity on 
+ * qubits nextvar..nvars-1. The matrix multiplications use this to return the
+ * other operand directly when one of their (root) operands is c*I.
+ */
+bool evbdd_is_identity_matrix(EVBDD a, BDDVAR nextvar, BDDVAR nvars);
+
 /**
  * Recursive implementation of matrix-vector mult and matrix-matrix mult.
  */
@@ -181,6 +260,15 @@ EVBDD evbdd_increase_all_vars(EVBDD a, int k);
 */
 EVBDD evbdd_replace_terminal(EVBDD a, EVBDD_TARG b);
 
+/**
+ * Swaps the adjacent variables k and k+1 of a vector EVBDD, i.e. returns b with
+ * b(.., x_k = u, x_{k+1} = v, ..) = a(.., x_k = v, x_{k+1} = u, ..).
+ * Only nodes with var <= k+1 are rebuilt (and re-normalized through
+ * evbdd_makenode), nodes below are shared with a.
+ */
+#define evbdd_swap_adjacent(a,k) (RUN(evbdd_swap_adjacent,a,k))
+TASK_DECL_2(EVBDD, evbdd_swap_adjacent, EVBDD, BDDVAR);
+
 /**
  * @param a EVBDD over vars 0...n-1 (n = nvars_a)
  * @param b EVBDD over vars 0...m-1
@@ -225,6 +313,18 @@ EVBDD evbdd_tensor_prod(EVBDD a, EVBDD b, BDDVAR nvars_a);
  */
 uint64_t evbdd_countnodes(EVBDD a);
 
+/**
+ * Count the number of EVBDD nodes at every level 0..nvars-1 (the terminal is
+ * not counted).
+ */
+void evbdd_countnodes_per_level(EVBDD a, uint64_t *counts, BDDVAR nvars);
+
+/**
+ * Count the number of EVBDD nodes at the levels from..to only, in
+ * counts[from..to]. Nodes below level <to> are not visited.
+ */
+void evbdd_countnodes_levels(EVBDD a, uint64_t *counts, BDDVAR from, BDDVAR to);
+
 /**************************</EVBDD utility functions>***************************/
 
 
@@ -238,6 +338,68 @@ uint64_t evbdd_countnodes(EVBDD a);
  */
 void evbdd_fprintdot(FILE *out, EVBDD a, bool draw_zeros);
 
+/**
+ * Binary EVBDD files. The file consists of a header, followed by the array of
+ * (deduplicated) edge weight values, the node array and the root edges. All
+ * records are 8-byte aligned, so a mmap'ed file can be used as-is.
+ *
+ * Nodes are numbered from 1 (0 is the terminal) in level order: nodes with a
+ * higher variable come first, so every node only refers to earlier nodes and
+ * the file can be read back in a single pass. Node weights are stored as the
+ * writer had them normalized; the reader renormalizes with its own strategy.
+ */
+#define EVBDD_FILE_MAGIC "QSYLEVDD"
+#define EVBDD_FILE_VERSION 1
+
+typedef struct evbdd_file_header {
+    char magic[8];      // EVBDD_FILE_MAGIC
+    uint32_t version;   // EVBDD_FILE_VERSION
+    uint32_t wgt_size;  // size of a single edge weight value in bytes
+    uint64_t nodecount;
+    uint64_t wgtcount;
+    uint64_t rootcount;
+} evbdd_file_header_t;
+
+typedef struct evbdd_file_node {
+    uint64_t low;       // index of low child node (0 = terminal)
+    uint64_t high;      // index of high child node (0 = terminal)
+    uint32_t low_wgt;   // index in weight array
+    uint32_t high_wgt;  // index in weight array
+    uint32_t var;
+    uint32_t reserved;
+} evbdd_file_node_t;
+
+typedef struct evbdd_file_root {
+    uint64_t node;      // index of root node (0 = terminal)
+    uint64_t wgt;       // index in weight array
+} evbdd_file_root_t;
+
+/**
+ * Write <count> EVBDDs given in <dds> in binary form to <out>.
+ * 
+ * @return 0 if successful, -1 otherwise.
+ */
+#define evbdd_writer_tobinary(out, dds, count) (RUN(evbdd_writer_tobinary, out, dds, count))
+TASK_DECL_3(int, evbdd_writer_tobinary, FILE*, EVBDD*, int);
+
+/**
+ * Read <count> EVBDDs to <dds> from <in>, earlier written with
+ * evbdd_writer_tobinary. The edge weights are added to the edge weight table.
+ * 
+ * @return 0 if successful, -1 otherwise (e.g. when the stored count differs).
+ */
+#define evbdd_reader_frombinary(in, dds, count) (RUN(evbdd_reader_frombinary, in, dds, count))
+TASK_DECL_3(int, evbdd_reader_frombinary, FILE*, EVBDD*, int);
+
+/**
+ * Same as evbdd_reader_frombinary, but maps the file <filename> in memory
+ * instead of reading it through a stream.
+ * 
+ * @return 0 if successful, -1 otherwise.
+ */
+#define evbdd_reader_frommmap(filename, dds, count) (RUN(evbdd_reader_frommmap, filename, dds, count))
+TASK_DECL_3(int, evbdd_reader_frommmap, const char*, EVBDD*, int);
+
 /*************************</Printing & file writing>***************************/
 
 
@@ -16,6 +16,7 @@
  * TODO: Maybe handle this in a cleaner way than with global variables?
  */
 // using [wgts,ptr] [33,30] bits if set to true (default [23,40])
+// (not used when the layout is fixed with QSYLVAN_EDGE_WGT_BITS)
 extern bool larger_wgt_indices;
 extern int weight_norm_strat;
 extern EVBDD_WGT (*normalize_weights)(EVBDD_WGT *, EVBDD_WGT *);
@@ -53,8 +54,8 @@ extern EVBDD_WGT (*normalize_weights)(EVBDD_WGT *, EVBDD_WGT *);
  * -----------------------------------------------------------------------------
  * EVBDD edge structure (64 bits)
  *       1 bit:  unused
- *      23 bits: index of edge weight in weight table (EVBDD_WGT)
- *      40 bits: index of next node in node table (EVBDD_TARG)
+ *      33 bits: index of edge weight in weight table (EVBDD_WGT)
+ *      30 bits: index of next node in node table (EVBDD_TARG)
  * 
  * EVBDD node structure (128 bits)
  * 64 bits low:
@@ -69,6 +70,15 @@ extern EVBDD_WGT (*normalize_weights)(EVBDD_WGT *, EVBDD_WGT *);
  *      33 bits: index of edge weight of high edge in ctable (EVBDD_WGT)
  *      30 bits: high edge pointer to next node (EVBDD_TARG)
  * -----------------------------------------------------------------------------
+ * 
+ * 
+ * When built with QSYLVAN_EDGE_WGT_BITS = W (see src/CMakeLists.txt)
+ * -----------------------------------------------------------------------------
+ * The same structures, but with a fixed split of W bits for the edge weight
+ * index and 63-W bits for the node index, regardless of the table sizes 
+ * (e.g. [31,32] for both > 2^23 edge weights and > 2^30 nodes). The shifts 
+ * and masks are then compile time constants.
+ * -----------------------------------------------------------------------------
  */
 typedef struct __attribute__((packed)) evbddnode {
     EVBDD low, high;
@@ -83,6 +93,15 @@ static const EVBDD evbdd_wgt_mask_33  = 0x7fffffffc0000000LL; // 011111111111111
 static const EVBDD evbdd_ptr_mask_30  = 0x000000003fffffffLL; // 0000000000000000000000000000000000111111111111111111111111111111
 static const EVBDD evbdd_ptr_mask_40  = 0x000000ffffffffffLL; // 0000000000000000000000001111111111111111111111111111111111111111
 
+#ifdef QSYLVAN_EDGE_WGT_BITS
+#if QSYLVAN_EDGE_WGT_BITS < 23 || QSYLVAN_EDGE_WGT_BITS > 36
+#error "QSYLVAN_EDGE_WGT_BITS should be between 23 and 36"
+#endif
+#define EVBDD_PTR_BITS (63 - QSYLVAN_EDGE_WGT_BITS)
+static const EVBDD evbdd_wgt_mask_fixed = ((1ULL << QSYLVAN_EDGE_WGT_BITS) - 1) << EVBDD_PTR_BITS;
+static const EVBDD evbdd_ptr_mask_fixed = (1ULL << EVBDD_PTR_BITS) - 1;
+#endif
+
 
 /**
  * Gets only the EVBDD_WGT information of an EVBDD edge.
@@ -90,12 +109,16 @@ static const EVBDD evbdd_ptr_mask_40  = 0x000000ffffffffffLL; // 000000000000000
 static inline EVBDD_WGT
 EVBDD_WEIGHT(EVBDD a)
 {
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    return (a & evbdd_wgt_mask_fixed) >> EVBDD_PTR_BITS;
+#else
     if (larger_wgt_indices) {
         return (a & evbdd_wgt_mask_33) >> 30; // 33 bits
     }
     else {
         return (a & evbdd_wgt_mask_23) >> 40; // 23 bits
     }
+#endif
 }
 
 /**
@@ -104,12 +127,16 @@ EVBDD_WEIGHT(EVBDD a)
 static inline EVBDD_TARG
 EVBDD_TARGET(EVBDD a)
 {
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    return a & evbdd_ptr_mask_fixed;
+#else
     if (larger_wgt_indices) {
         return a & evbdd_ptr_mask_30; // 30 bits
     }
     else {
         return a & evbdd_ptr_mask_40; // 40 bits
     }
+#endif
 }
 
 /**
@@ -174,6 +201,11 @@ EVBDD_GETNODE(EVBDD_TARG p)
 static inline EVBDD
 evbdd_bundle(EVBDD_TARG p, EVBDD_WGT a)
 {
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    assert (p < evbdd_ptr_mask_fixed);     // avoid clash with sylvan_invalid
+    assert (a <= (1ULL<<QSYLVAN_EDGE_WGT_BITS));
+    return (a << EVBDD_PTR_BITS | p);
+#else
     if (larger_wgt_indices) {
         assert (p <= 0x000000003ffffffe);   // avoid clash with sylvan_invalid
         assert (a <= (1LL<<33));
@@ -183,6 +215,7 @@ evbdd_bundle(EVBDD_TARG p, EVBDD_WGT a)
         assert (a <= (1<<23));
         return (a << 40 | p);
     }
+#endif
 }
 
 static void __attribute__((unused))
@@ -259,12 +292,16 @@ evbddnode_pack(evbddnode_t n, BDDVAR var, EVBDD_TARG low, EVBDD_TARG high, EVBDD
 
     // organize the bit structure of low and high
     n->low  = ((uint64_t)var)<<47 | ((uint64_t)norm_pos)<<46 | ((uint64_t)norm_val)<<45 | low;
+#ifdef QSYLVAN_EDGE_WGT_BITS
+    n->high = wgt_high<<EVBDD_PTR_BITS | high;
+#else
     if (larger_wgt_indices) {
         n->high = wgt_high<<30 | high;
     }
     else {
         n->high = wgt_high<<40 | high;
     }
+#endif
 }
 
 static EVBDD_TARG __attribute__((unused))
@@ -280,15 +317,20 @@ _evbdd_makenode(BDDVAR var, EVBDD_TARG low, EVBDD_TARG high, EVBDD_WGT a, EVBDD_
     if (index == 0) {
         //printf("auto gc of node table triggered\n");
 
+        // the result of the operation is discarded after an out-of-memory,
+        // so don't gc again for every next node
+        if (evbdd_out_of_memory()) return EVBDD_TERMINAL;
+
         evbdd_refs_push(low);
         evbdd_refs_push(high);
         sylvan_gc();
         evbdd_refs_pop(2);
 
         index = llmsset_lookup(nodes, n.low, n.high, &created);
-        if (index == 0) {
-            fprintf(stderr, "EVBDD/BDD Unique table full, %zu of %zu buckets filled!\n", llmsset_count_marked(nodes), llmsset_get_size(nodes));
-            exit(1);
+        if (index == 0 || evbdd_budget_thrashing(EVBDD_OOM_NODES)) {
+            // exits, unless the caller recovers from this itself
+            evbdd_signal_out_of_memory(EVBDD_OOM_NODES);
+            return EVBDD_TERMINAL;
         }
     }
 
@@ -117,6 +117,8 @@ static const uint64_t CACHE_EVBDD_REPLACE_TERMINAL   = (74LL<<40);
 static const uint64_t CACHE_EVBDD_INC_VARS           = (75LL<<40);
 static const uint64_t CACHE_EVBDD_CLEAN_WGT_TABLE    = (76LL<<40);
 static const uint64_t CACHE_EVBDD_IS_ORDERED         = (77LL<<40);
+static const uint64_t CACHE_EVBDD_SWAP_LEVELS        = (78LL<<40);
+static const uint64_t CACHE_EVBDD_IS_IDENTITY        = (79LL<<40);
 
 // Operations on EVBDD edge weights
 static const uint64_t CACHE_WGT_ADD                 = (80LL<<40);
@@ -130,6 +132,8 @@ static const uint64_t CACHE_QMDD_CGATE              = (91LL<<40);
 static const uint64_t CACHE_QMDD_CGATE_RANGE        = (92LL<<40);
 static const uint64_t CACHE_QMDD_SUBCIRC            = (93LL<<40);
 static const uint64_t CACHE_QMDD_PROB               = (94LL<<40);
+static const uint64_t CACHE_QMDD_EXP_PAULI          = (95LL<<40);
+static const uint64_t CACHE_QMDD_DIAGONAL           = (96LL<<40);
 
 // TODO: renumber
 
@@ -149,6 +153,13 @@ static const uint64_t CACHE_ZDD_PROJECT             = (111LL<<40);
 static const uint64_t CACHE_ZDD_ISOP                = (112LL<<40);
 static const uint64_t CACHE_ZDD_COVER_TO_BDD        = (113LL<<40);
 
+// QMDD density matrix operations
+static const uint64_t CACHE_QMDD_DM_OUTER_PRODUCT   = (114LL<<40);
+static const uint64_t CACHE_QMDD_DM_GATE            = (115LL<<40);
+static const uint64_t CACHE_QMDD_DM_PTRACE          = (116LL<<40);
+static const uint64_t CACHE_QMDD_DM_EXP_PAULI       = (117LL<<40);
+static const uint64_t CACHE_QMDD_DM_GATE_BELOW      = (118LL<<40);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
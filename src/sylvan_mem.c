@@ -0,0 +1,445 @@
+/*
+ * Copyright 2024 System Verification Lab, LIACS, Leiden University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE // for sched_setaffinity / CPU_SET
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include <sylvan_int.h>
+#include <sylvan_align.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/resource.h>
+
+#if SYLVAN_USE_MMAP && defined(__linux__)
+#define SYLVAN_PLACEMENT 1
+#else
+#define SYLVAN_PLACEMENT 0
+#endif
+
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3 // from <linux/mempolicy.h>
+#endif
+
+static sylvan_pages_t placement_pages = SYLVAN_PAGES_DEFAULT;
+static sylvan_numa_t placement_numa = SYLVAN_NUMA_FIRST_TOUCH;
+static char *out_of_core_dir = NULL;
+
+/**
+ * Allocated tables, for sylvan_table_free (which needs the actual size of the
+ * mapping) and the page statistics.
+ */
+#define MAX_TABLES 16
+
+typedef struct table_region {
+    const char *name;
+    void *ptr;
+    size_t size;        // requested size
+    size_t mapped;      // size of the mapping (rounded up to the page size)
+    sylvan_pages_t pages;
+    int numa_nodes;
+    bool file_backed;
+} table_region_t;
+
+static table_region_t tables[MAX_TABLES];
+
+void
+sylvan_set_placement(sylvan_pages_t pages, sylvan_numa_t numa)
+{
+    placement_pages = pages;
+    placement_numa = numa;
+}
+
+void
+sylvan_get_placement(sylvan_pages_t *pages, sylvan_numa_t *numa)
+{
+    *pages = placement_pages;
+    *numa = placement_numa;
+}
+
+void
+sylvan_set_out_of_core(const char *dir)
+{
+    free(out_of_core_dir);
+    out_of_core_dir = dir == NULL ? NULL : strdup(dir);
+}
+
+void
+sylvan_page_faults(uint64_t *major, uint64_t *minor)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        *major = *minor = 0;
+        return;
+    }
+    *major = (uint64_t)usage.ru_majflt;
+    *minor = (uint64_t)usage.ru_minflt;
+}
+
+static table_region_t *
+find_table(void *ptr)
+{
+    for (int i = 0; i < MAX_TABLES; i++) {
+        if (tables[i].ptr == ptr) return &tables[i];
+    }
+    return NULL;
+}
+
+#if SYLVAN_PLACEMENT
+
+/**
+ * Size of the huge pages of the hugetlb pool, or 0 if unknown.
+ */
+static size_t
+hugetlb_page_size()
+{
+    static size_t size = (size_t)-1;
+    if (size != (size_t)-1) return size;
+    size = 0;
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (f == NULL) return size;
+    char line[256];
+    size_t kb;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+            size = kb * 1024;
+            break;
+        }
+    }
+    fclose(f);
+    return size;
+}
+
+/**
+ * Reads the online NUMA nodes (e.g. "0-1" or "0,2-3") into <mask>, and returns
+ * the number of nodes.
+ */
+#define MAX_NUMA_NODES 1024
+
+static int
+numa_online_nodes(unsigned long *mask)
+{
+    const int bits = 8 * sizeof(unsigned long);
+    memset(mask, 0, MAX_NUMA_NODES / 8);
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    if (f == NULL) return 0;
+    int count = 0, from, to;
+    while (fscanf(f, "%d", &from) == 1) {
+        to = from;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &to) != 1) break;
+            c = fgetc(f);
+        }
+        for (int n = from; n <= to && n < MAX_NUMA_NODES; n++) {
+            mask[n / bits] |= 1UL << (n % bits);
+            count++;
+        }
+        if (c != ',') break;
+    }
+    fclose(f);
+    return count;
+}
+
+/**
+ * Applies the page size and NUMA policy to a new mapping. Both are attributes of
+ * the mapping, so they are lost when a region is replaced by a fresh mapping (as
+ * clear_aligned does), which is why sylvan_table_clear uses MADV_DONTNEED.
+ */
+static void
+apply_placement(table_region_t *t)
+{
+    if (t->pages == SYLVAN_PAGES_THP) madvise(t->ptr, t->mapped, MADV_HUGEPAGE);
+    else if (t->pages == SYLVAN_PAGES_SMALL) madvise(t->ptr, t->mapped, MADV_NOHUGEPAGE);
+
+    t->numa_nodes = 0;
+    if (placement_numa == SYLVAN_NUMA_INTERLEAVE) {
+        unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+        int nodes = numa_online_nodes(mask);
+        if (nodes > 1 &&
+            syscall(SYS_mbind, t->ptr, t->mapped, MPOL_INTERLEAVE, mask, MAX_NUMA_NODES + 1, 0) == 0) {
+            t->numa_nodes = nodes;
+        }
+    }
+}
+
+/**
+ * Maps a sparse file of (at least) <size> bytes in the out-of-core directory.
+ * The file is unlinked right away, so it disappears when the table is unmapped
+ * (or the process dies).
+ */
+static void *
+map_table_file(size_t size)
+{
+    size_t len = strlen(out_of_core_dir) + 32;
+    char *path = malloc(len);
+    snprintf(path, len, "%s/qsylvan-XXXXXX", out_of_core_dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "sylvan_table_alloc: unable to create file %s: %s!\n", path, strerror(errno));
+        free(path);
+        return MAP_FAILED;
+    }
+    unlink(path);
+    free(path);
+    void *ptr = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    }
+    // the mapping keeps the file open
+    close(fd);
+    return ptr;
+}
+
+#endif
+
+static void *
+table_alloc(const char *name, size_t size, bool pageable)
+{
+    table_region_t t;
+    t.name = name;
+    t.size = size;
+    t.numa_nodes = 0;
+    t.file_backed = false;
+#if SYLVAN_PLACEMENT
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    t.ptr = MAP_FAILED;
+    t.pages = placement_pages;
+    if (pageable && out_of_core_dir != NULL) {
+        t.mapped = (size + page - 1) & ~(page - 1);
+        t.ptr = map_table_file(t.mapped);
+        if (t.ptr == MAP_FAILED) return 0;
+        t.file_backed = true;
+        t.pages = SYLVAN_PAGES_DEFAULT;
+    }
+    else if (placement_pages == SYLVAN_PAGES_HUGETLB) {
+        const size_t huge = hugetlb_page_size();
+        if (huge != 0) {
+            t.mapped = (size + huge - 1) & ~(huge - 1);
+            t.ptr = mmap(0, t.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        // not enough huge pages reserved: fall back to transparent huge pages
+        if (t.ptr == MAP_FAILED) t.pages = SYLVAN_PAGES_THP;
+    }
+    if (t.ptr == MAP_FAILED) {
+        t.mapped = (size + page - 1) & ~(page - 1);
+        t.ptr = mmap(0, t.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (t.ptr == MAP_FAILED) return 0;
+    }
+    if (t.file_backed) madvise(t.ptr, t.mapped, MADV_RANDOM);
+    else apply_placement(&t);
+#else
+    (void)pageable;
+    t.ptr = alloc_aligned(size);
+    if (t.ptr == 0) return 0;
+    t.mapped = size;
+    t.pages = SYLVAN_PAGES_DEFAULT;
+#endif
+    table_region_t *slot = find_table(NULL);
+    if (slot != NULL) *slot = t;
+    return t.ptr;
+}
+
+void *
+sylvan_table_alloc(const char *name, size_t size)
+{
+    return table_alloc(name, size, false);
+}
+
+void *
+sylvan_table_alloc_pageable(const char *name, size_t size)
+{
+    return table_alloc(name, size, true);
+}
+
+void
+sylvan_table_clear(void *ptr, size_t size)
+{
+#if SYLVAN_PLACEMENT
+    table_region_t *t = find_table(ptr);
+    if (t != NULL) {
+        // MADV_DONTNEED gives fresh zero pages on the next access, but unlike
+        // remapping (clear_aligned) it keeps the huge page and NUMA policies.
+        // For a file, MADV_REMOVE frees (and zeroes) the blocks on disk. The
+        // whole mapping is dropped (untouched pages cost nothing), but if
+        // that fails only the <size> bytes in use are cleared by hand.
+        int advice = t->file_backed ? MADV_REMOVE : MADV_DONTNEED;
+        if (madvise(ptr, t->mapped, advice) != 0) memset(ptr, 0, size);
+        return;
+    }
+#endif
+    clear_aligned(ptr, size);
+}
+
+void
+sylvan_table_discard(void *ptr, size_t offset, size_t size)
+{
+#if SYLVAN_PLACEMENT
+    table_region_t *t = find_table(ptr);
+    if (t == NULL || !t->file_backed) return;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t from = (offset + page - 1) & ~(page - 1);
+    size_t to = (offset + size) & ~(page - 1);
+    if (to > t->mapped) to = t->mapped;
+    if (from < to) madvise((char*)ptr + from, to - from, MADV_REMOVE);
+#else
+    (void)ptr;
+    (void)offset;
+    (void)size;
+#endif
+}
+
+void
+sylvan_table_free(void *ptr, size_t size)
+{
+    table_region_t *t = find_table(ptr);
+    if (t == NULL) {
+        free_aligned(ptr, size);
+        return;
+    }
+#if SYLVAN_PLACEMENT
+    munmap(ptr, t->mapped);
+#else
+    free_aligned(ptr, size);
+#endif
+    t->ptr = NULL;
+}
+
+int
+sylvan_table_pages(sylvan_table_pages_t *stats, int max)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_TABLES && count < max; i++) {
+        if (tables[i].ptr == NULL) continue;
+        sylvan_table_pages_t *s = &stats[count++];
+        s->name = tables[i].name;
+        s->size = tables[i].size;
+        s->pages = tables[i].pages;
+        s->numa_nodes = tables[i].numa_nodes;
+        s->file_backed = tables[i].file_backed;
+        s->page_size = (size_t)sysconf(_SC_PAGESIZE);
+        s->resident = 0;
+        s->huge = 0;
+    }
+
+#if SYLVAN_PLACEMENT
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) return count;
+
+    // for the current mapping: part of it in every table
+    double share[MAX_TABLES];
+    int overlaps = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long start, end;
+        size_t kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            overlaps = 0;
+            for (int k = 0, i = 0; i < MAX_TABLES && k < count; i++) {
+                if (tables[i].ptr == NULL) continue;
+                uintptr_t lo = (uintptr_t)tables[i].ptr, hi = lo + tables[i].mapped;
+                share[k] = 0;
+                if (lo < end && start < hi) {
+                    uintptr_t a = lo > start ? lo : start, b = hi < end ? hi : end;
+                    share[k] = (double)(b - a) / (double)(end - start);
+                    overlaps++;
+                }
+                k++;
+            }
+            continue;
+        }
+        if (overlaps == 0) continue;
+        if (sscanf(line, "KernelPageSize: %zu kB", &kb) == 1) {
+            for (int k = 0; k < count; k++) if (share[k] > 0) stats[k].page_size = kb * 1024;
+        }
+        else if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+            for (int k = 0; k < count; k++) stats[k].resident += (size_t)(share[k] * kb * 1024);
+        }
+        else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            for (int k = 0; k < count; k++) stats[k].huge += (size_t)(share[k] * kb * 1024);
+        }
+        else if (sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1 ||
+                 sscanf(line, "Shared_Hugetlb: %zu kB", &kb) == 1) {
+            // hugetlb pages are not counted in Rss
+            for (int k = 0; k < count; k++) {
+                stats[k].resident += (size_t)(share[k] * kb * 1024);
+                stats[k].huge += (size_t)(share[k] * kb * 1024);
+            }
+        }
+    }
+    fclose(f);
+#endif
+    return count;
+}
+
+void
+sylvan_table_placement_report(FILE *out)
+{
+    static const char *page_names[] = {"default", "small", "thp", "hugetlb"};
+    sylvan_table_pages_t stats[MAX_TABLES];
+    int count = sylvan_table_pages(stats, MAX_TABLES);
+    fprintf(out, "%-16s %12s %8s %10s %12s %12s %6s\n",
+            "table", "size (MB)", "pages", "page size", "rss (MB)", "huge (MB)", "numa");
+    for (int k = 0; k < count; k++) {
+        char numa[16];
+        if (stats[k].numa_nodes > 0) snprintf(numa, sizeof(numa), "%d", stats[k].numa_nodes);
+        else snprintf(numa, sizeof(numa), "local");
+        fprintf(out, "%-16s %12.1f %8s %9zuk %12.1f %12.1f %6s\n",
+                stats[k].name, stats[k].size / 1048576.0,
+                stats[k].file_backed ? "file" : page_names[stats[k].pages],
+                stats[k].page_size / 1024, stats[k].resident / 1048576.0,
+                stats[k].huge / 1048576.0, numa);
+    }
+}
+
+#ifdef __linux__
+static cpu_set_t pin_cpus;
+
+VOID_TASK_0(sylvan_pin_worker)
+{
+    const int ncpus = CPU_COUNT(&pin_cpus);
+    if (ncpus == 0) return;
+    // the i-th allowed CPU, for worker i (mod the number of allowed CPUs)
+    int target = lace_get_worker()->worker % ncpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &pin_cpus)) continue;
+        if (target-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            return;
+        }
+    }
+}
+#endif
+
+TASK_IMPL_0(int, sylvan_pin_workers)
+{
+#ifdef __linux__
+    // the CPUs of the main thread (the workers may have been pinned before)
+    CPU_ZERO(&pin_cpus);
+    if (sched_getaffinity(getpid(), sizeof(pin_cpus), &pin_cpus) != 0) return 0;
+    TOGETHER(sylvan_pin_worker);
+    return lace_workers();
+#else
+    return 0;
+#endif
+}
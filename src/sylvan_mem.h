@@ -0,0 +1,149 @@
+/*
+ * Copyright 2024 System Verification Lab, LIACS, Leiden University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Do not include this file directly. Instead, include sylvan.h */
+
+#ifndef SYLVAN_MEM_H
+#define SYLVAN_MEM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * Page size used for the big tables (node table, operation cache and edge
+ * weight table).
+ * - SYLVAN_PAGES_DEFAULT: whatever the kernel does by default (for THP this
+ *   depends on /sys/kernel/mm/transparent_hugepage/enabled)
+ * - SYLVAN_PAGES_SMALL: never use (transparent) huge pages
+ * - SYLVAN_PAGES_THP: madvise(MADV_HUGEPAGE), i.e. ask for transparent huge
+ *   pages, even if THP is only enabled in "madvise" mode
+ * - SYLVAN_PAGES_HUGETLB: mmap(MAP_HUGETLB), i.e. explicit huge pages from the
+ *   pool reserved in /proc/sys/vm/nr_hugepages. Falls back to THP for tables
+ *   which do not fit in the pool.
+ */
+typedef enum {
+    SYLVAN_PAGES_DEFAULT,
+    SYLVAN_PAGES_SMALL,
+    SYLVAN_PAGES_THP,
+    SYLVAN_PAGES_HUGETLB,
+} sylvan_pages_t;
+
+/**
+ * NUMA placement of the big tables.
+ * - SYLVAN_NUMA_FIRST_TOUCH: pages are placed on the node of the thread which
+ *   first writes them. Since every worker claims node table buckets starting
+ *   in its own part of the table (see llmsset_reset_region), combined with
+ *   sylvan_pin_workers() the nodes a worker creates are mostly local to it.
+ * - SYLVAN_NUMA_INTERLEAVE: pages are interleaved round-robin over all NUMA
+ *   nodes, which spreads the (random) accesses over all memory controllers.
+ */
+typedef enum {
+    SYLVAN_NUMA_FIRST_TOUCH,
+    SYLVAN_NUMA_INTERLEAVE,
+} sylvan_numa_t;
+
+/**
+ * Sets the page size and NUMA placement of the tables. Only affects tables
+ * which are allocated afterwards, so call this before sylvan_init_package().
+ * Without mmap support (SYLVAN_USE_MMAP) or on non-Linux systems the placement
+ * is ignored.
+ */
+void sylvan_set_placement(sylvan_pages_t pages, sylvan_numa_t numa);
+void sylvan_get_placement(sylvan_pages_t *pages, sylvan_numa_t *numa);
+
+/**
+ * Pins every Lace worker to its own CPU (worker i to the i-th CPU the process
+ * may run on, wrapping around). Returns the number of workers pinned.
+ */
+TASK_DECL_0(int, sylvan_pin_workers);
+#define sylvan_pin_workers() RUN(sylvan_pin_workers)
+
+/**
+ * Allocates (zeroed, cache line aligned) memory for the table <name> with the
+ * current placement, clears it again, and frees it. The name is used by
+ * sylvan_table_placement_report() and should be a string literal. Clearing
+ * only has to zero the first <size> bytes, so pass the part that is in use
+ * rather than the allocated size.
+ */
+void *sylvan_table_alloc(const char *name, size_t size);
+void sylvan_table_clear(void *ptr, size_t size);
+void sylvan_table_free(void *ptr, size_t size);
+
+/**
+ * Out-of-core mode. Tables allocated with sylvan_table_alloc_pageable() (the
+ * node data array and the edge weight table) are then backed by a sparse,
+ * already unlinked file in <dir> instead of anonymous memory, so the kernel can
+ * write cold pages back to the file instead of running out of memory. The node
+ * hash array and the cache stay in memory. Pageable tables are advised
+ * MADV_RANDOM, which avoids reading ahead on every page fault. Huge pages and
+ * NUMA interleaving do not apply to file-backed tables.
+ * Like sylvan_set_placement(), call this before sylvan_init_package(). Passing
+ * NULL switches back to anonymous memory.
+ */
+void sylvan_set_out_of_core(const char *dir);
+void *sylvan_table_alloc_pageable(const char *name, size_t size);
+
+/**
+ * Tells the given part of a table holds no live data. For a file-backed table
+ * its (whole) pages are dropped, without writing them back, and read as zeroes
+ * afterwards. Does nothing for tables in memory.
+ */
+void sylvan_table_discard(void *ptr, size_t offset, size_t size);
+
+/**
+ * Gives the number of major (requiring I/O) and minor page faults of the
+ * process so far.
+ */
+void sylvan_page_faults(uint64_t *major, uint64_t *minor);
+
+/**
+ * Page statistics of a table allocated with sylvan_table_alloc().
+ * - page_size: size of the pages backing the table (2MB or 1GB for hugetlb)
+ * - resident: bytes of the table in physical memory
+ * - huge: bytes of <resident> in (transparent or hugetlb) huge pages
+ * - numa_nodes: number of nodes the table is interleaved over (0 for first touch)
+ * - file_backed: whether the table is backed by a file (out-of-core mode)
+ */
+typedef struct sylvan_table_pages {
+    const char *name;
+    size_t size;
+    size_t page_size;
+    size_t resident;
+    size_t huge;
+    int numa_nodes;
+    sylvan_pages_t pages;
+    bool file_backed;
+} sylvan_table_pages_t;
+
+/**
+ * Fills <stats> with the page statistics of (at most <max>) allocated tables,
+ * and returns the number of tables. The resident/huge numbers are read from
+ * /proc/self/smaps, when mappings of several tables have been merged by the
+ * kernel they are divided proportionally to the table sizes.
+ */
+int sylvan_table_pages(sylvan_table_pages_t *stats, int max);
+
+/**
+ * Writes the page statistics of all tables in a human readable format.
+ */
+void sylvan_table_placement_report(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
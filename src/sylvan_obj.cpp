@@ -935,6 +935,144 @@ MtbddMap::isEmpty()
 }
 
 
+/***
+ * Implementation of class Qmdd
+ */
+
+Qmdd::Qmdd(const QMDD from, BDDVAR nqubits) : slot(new QMDD(from)), n(nqubits)
+{
+    evbdd_protect(slot);
+}
+
+Qmdd::Qmdd(const Qmdd &from) : slot(nullptr), n(from.n)
+{
+    if (from.slot != nullptr) {
+        slot = new QMDD(*from.slot);
+        evbdd_protect(slot);
+    }
+}
+
+Qmdd::~Qmdd()
+{
+    if (slot != nullptr) {
+        evbdd_unprotect(slot);
+        delete slot;
+    }
+}
+
+Qmdd&
+Qmdd::operator=(const Qmdd& right)
+{
+    if (right.slot == nullptr) {
+        // become empty
+        Qmdd empty;
+        std::swap(slot, empty.slot);
+    } else if (slot == nullptr) {
+        slot = new QMDD(*right.slot);
+        evbdd_protect(slot);
+    } else {
+        *slot = *right.slot;
+    }
+    n = right.n;
+    return *this;
+}
+
+Qmdd&
+Qmdd::operator=(Qmdd&& right) noexcept
+{
+    // the old slot of this object is released by <right>
+    std::swap(slot, right.slot);
+    std::swap(n, right.n);
+    return *this;
+}
+
+Qmdd
+Qmdd::allZero(BDDVAR nqubits)
+{
+    return Qmdd(qmdd_create_all_zero_state(nqubits), nqubits);
+}
+
+Qmdd
+Qmdd::basisState(const std::vector<bool> &x)
+{
+    bool *bits = new bool[x.size()];
+    for (size_t k = 0; k < x.size(); k++) bits[k] = x[k];
+    Qmdd res(qmdd_create_basis_state((BDDVAR)x.size(), bits), (BDDVAR)x.size());
+    delete[] bits;
+    return res;
+}
+
+bool
+Qmdd::operator==(const Qmdd& other) const
+{
+    return GetQMDD() == other.GetQMDD();
+}
+
+bool
+Qmdd::operator!=(const Qmdd& other) const
+{
+    return GetQMDD() != other.GetQMDD();
+}
+
+Qmdd&
+Qmdd::Apply(const QGate& g)
+{
+    assert(slot != nullptr);
+    // the input stays protected in the slot until the result is written
+    if (g.c1 == EVBDD_INVALID_VAR) {
+        *slot = qmdd_gate(*slot, (gate_id_t)g.gate, g.target);
+    } else {
+        *slot = _qmdd_cgate(*slot, (gate_id_t)g.gate, g.c1, g.c2, g.c3, g.target, n);
+    }
+    return *this;
+}
+
+QMDD
+Qmdd::GetQMDD() const
+{
+    assert(slot != nullptr);
+    return *slot;
+}
+
+double
+Qmdd::Norm() const
+{
+    return qmdd_get_norm(GetQMDD(), n);
+}
+
+double
+Qmdd::Fidelity(const Qmdd& other) const
+{
+    return qmdd_fidelity(GetQMDD(), other.GetQMDD(), n);
+}
+
+double
+Qmdd::ExpectationPauli(const std::string &pauli) const
+{
+    return qmdd_expectation_pauli(GetQMDD(), pauli.c_str(), n);
+}
+
+size_t
+Qmdd::NodeCount() const
+{
+    return evbdd_countnodes(GetQMDD());
+}
+
+Qmdd
+sylvan::operator*(const QGate& gate, const Qmdd& state)
+{
+    Qmdd res(state);
+    res.Apply(gate);
+    return res;
+}
+
+Qmdd
+sylvan::operator*(const QGate& gate, Qmdd&& state)
+{
+    state.Apply(gate);
+    return std::move(state);
+}
+
 /***
  * Implementation of class Sylvan
  */
@@ -22,6 +22,7 @@
 
 #include <lace.h>
 #include <sylvan.h>
+#include <qsylvan_simulator.h>
 
 namespace sylvan {
 
@@ -841,6 +842,115 @@ public:
     bool isEmpty();
 };
 
+/**
+ * A (controlled) single qubit gate, to be applied to a Qmdd.
+ * The gate is a predefined gate_id_t or a dynamic gate such as GATEID_Rz(theta).
+ */
+class QGate {
+public:
+    QGate(uint32_t gate, BDDVAR target)
+        : gate(gate), c1(EVBDD_INVALID_VAR), c2(EVBDD_INVALID_VAR), c3(EVBDD_INVALID_VAR), target(target) {}
+    QGate(uint32_t gate, BDDVAR control, BDDVAR target)
+        : gate(gate), c1(control), c2(EVBDD_INVALID_VAR), c3(EVBDD_INVALID_VAR), target(target) {}
+    QGate(uint32_t gate, BDDVAR control1, BDDVAR control2, BDDVAR target)
+        : gate(gate), c1(control1), c2(control2), c3(EVBDD_INVALID_VAR), target(target) {}
+    QGate(uint32_t gate, BDDVAR control1, BDDVAR control2, BDDVAR control3, BDDVAR target)
+        : gate(gate), c1(control1), c2(control2), c3(control3), target(target) {}
+
+    uint32_t gate;
+    BDDVAR c1, c2, c3;
+    BDDVAR target;
+};
+
+/**
+ * A QMDD state of nqubits() qubits, protected from garbage collection as long
+ * as the object lives.
+ *
+ * Unlike Bdd and Mtbdd, which protect the address of their member, a Qmdd
+ * protects a heap allocated slot. Moving a Qmdd (returning it from a function,
+ * assigning a temporary, std::move) hands over the slot, and Apply() and copy
+ * assignment overwrite the value in the slot, so none of these touch the table
+ * of protected EVBDDs. Only constructing a Qmdd from a QMDD or copy constructing
+ * one protects a new slot. A default constructed or moved-from Qmdd is empty.
+ */
+class Qmdd {
+public:
+    Qmdd() : slot(nullptr), n(0) {}
+    Qmdd(const QMDD from, BDDVAR nqubits);
+    Qmdd(const Qmdd &from);
+    Qmdd(Qmdd &&from) noexcept : slot(from.slot), n(from.n) { from.slot = nullptr; }
+    ~Qmdd();
+
+    Qmdd& operator=(const Qmdd& right);
+    Qmdd& operator=(Qmdd&& right) noexcept;
+
+    /**
+     * @brief Returns the state |00...0> on <nqubits> qubits
+     */
+    static Qmdd allZero(BDDVAR nqubits);
+
+    /**
+     * @brief Returns the basis state |x> on x.size() qubits
+     */
+    static Qmdd basisState(const std::vector<bool> &x);
+
+    bool operator==(const Qmdd& other) const;
+    bool operator!=(const Qmdd& other) const;
+
+    /**
+     * @brief Applies the gate to this state (in place)
+     */
+    Qmdd& Apply(const QGate& gate);
+    Qmdd& operator*=(const QGate& gate) { return Apply(gate); }
+
+    /**
+     * @brief Returns true if this Qmdd holds no state (default constructed or moved from)
+     */
+    bool isEmpty() const { return slot == nullptr; }
+
+    /**
+     * @brief Gets the number of qubits of this state
+     */
+    BDDVAR nqubits() const { return n; }
+
+    /**
+     * @brief Gets the QMDD of this Qmdd (for C functions)
+     */
+    QMDD GetQMDD() const;
+
+    /**
+     * @brief Computes the norm of the state (1 for a normalized state)
+     */
+    double Norm() const;
+
+    /**
+     * @brief Computes |<this|other>|^2
+     */
+    double Fidelity(const Qmdd& other) const;
+
+    /**
+     * @brief Computes <this|P|this> for the Pauli string P (e.g. "XZI"), with the
+     * character for qubit k at position k
+     */
+    double ExpectationPauli(const std::string &pauli) const;
+
+    /**
+     * @brief Gets the number of nodes in this Qmdd. Not thread-safe!
+     */
+    size_t NodeCount() const;
+
+private:
+    QMDD *slot;
+    BDDVAR n;
+};
+
+/**
+ * @brief Returns gate * state. When state is an rvalue (e.g. q = g * std::move(q)),
+ * its slot is reused.
+ */
+Qmdd operator*(const QGate& gate, const Qmdd& state);
+Qmdd operator*(const QGate& gate, Qmdd&& state);
+
 class Sylvan {
 public:
     /**
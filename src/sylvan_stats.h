@@ -97,6 +97,9 @@ typedef enum {
     OPCOUNTER(QMDD_GATE),
     OPCOUNTER(QMDD_CGATE),
     OPCOUNTER(QMDD_PROB),
+    OPCOUNTER(QMDD_EXP_PAULI),
+    OPCOUNTER(QMDD_DIAGONAL),
+    OPCOUNTER(QMDD_DM_GATE),
 
     /* AMP arithmetic operations */
     OPCOUNTER(WGT_ADD),
@@ -299,8 +299,8 @@ llmsset_create(size_t initial_size, size_t max_size)
     /* This implementation of "resizable hash table" allocates the max_size table in virtual memory,
        but only uses the "actual size" part in real memory */
 
-    dbs->table = (_Atomic(uint64_t)*) alloc_aligned(dbs->max_size * 8);
-    dbs->data = (uint8_t*) alloc_aligned(dbs->max_size * 16);
+    dbs->table = (_Atomic(uint64_t)*) sylvan_table_alloc("nodes (hash)", dbs->max_size * 8);
+    dbs->data = (uint8_t*) sylvan_table_alloc_pageable("nodes (data)", dbs->max_size * 16);
 
     /* Also allocate bitmaps. Each region is 64*8 = 512 buckets.
        Overhead of bitmap1: 1 bit per 4096 bucket.
@@ -344,8 +344,8 @@ llmsset_create(size_t initial_size, size_t max_size)
 void
 llmsset_free(llmsset_t dbs)
 {
-    free_aligned(dbs->table, dbs->max_size * 8);
-    free_aligned(dbs->data, dbs->max_size * 16);
+    sylvan_table_free(dbs->table, dbs->max_size * 8);
+    sylvan_table_free(dbs->data, dbs->max_size * 16);
     free_aligned(dbs->bitmap1, dbs->max_size / (512*8));
     free_aligned(dbs->bitmap2, dbs->max_size / 8);
     free_aligned(dbs->bitmapc, dbs->max_size / 8);
@@ -371,7 +371,9 @@ VOID_TASK_IMPL_1(llmsset_clear_data, llmsset_t, dbs)
 
 VOID_TASK_IMPL_1(llmsset_clear_hashes, llmsset_t, dbs)
 {
-    clear_aligned(dbs->table, dbs->max_size * 8);
+    // only the first table_size buckets are in use (gc resizes the table
+    // before the hashes are cleared)
+    sylvan_table_clear(dbs->table, dbs->table_size * 8);
 }
 
 int
@@ -492,6 +494,28 @@ VOID_TASK_IMPL_1(llmsset_destroy_unmarked, llmsset_t, dbs)
     CALL(llmsset_destroy_par, dbs, 0, dbs->table_size);
 }
 
+VOID_TASK_IMPL_1(llmsset_discard_unmarked, llmsset_t, dbs)
+{
+    // find runs of regions (512 buckets, 8 words of bitmap2) without marked buckets
+    const size_t regions = dbs->table_size / 512;
+    size_t run_start = 0, run_length = 0;
+    for (size_t r = 0; r <= regions; r++) {
+        bool empty = false;
+        if (r < regions) {
+            empty = true;
+            for (int k = 0; k < 8 && empty; k++) {
+                if (atomic_load_explicit(dbs->bitmap2 + 8*r + k, memory_order_relaxed) != 0) empty = false;
+            }
+        }
+        if (empty) {
+            if (run_length++ == 0) run_start = r;
+        } else if (run_length != 0) {
+            sylvan_table_discard(dbs->data, run_start * 512 * 16, run_length * 512 * 16);
+            run_length = 0;
+        }
+    }
+}
+
 /**
  * Set custom functions
  */
@@ -195,6 +195,15 @@ TASK_DECL_1(size_t, llmsset_count_marked, llmsset_t);
 VOID_TASK_DECL_1(llmsset_destroy_unmarked, llmsset_t);
 #define llmsset_destroy_unmarked(dbs) RUN(llmsset_destroy_unmarked, dbs)
 
+/**
+ * During garbage collection (after marking), this method tells the data regions
+ * without marked buckets are no longer needed. Only has an effect when the data
+ * array is backed by a file (see sylvan_set_out_of_core), in which case their
+ * pages are dropped instead of being written back.
+ */
+VOID_TASK_DECL_1(llmsset_discard_unmarked, llmsset_t);
+#define llmsset_discard_unmarked(dbs) RUN(llmsset_discard_unmarked, dbs)
+
 /**
  * Set custom functions
  */
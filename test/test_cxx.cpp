@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <sylvan.h>
 #include <sylvan_obj.hpp>
+#include <qsylvan.h>
 
 #include "test_assert.h"
 
@@ -36,6 +37,55 @@ TASK_0(int, runtest)
     return 0;
 }
 
+static Qmdd
+bell_state()
+{
+    Qmdd q = Qmdd::allZero(2);
+    q.Apply(QGate(GATEID_H, 0)).Apply(QGate(GATEID_X, 0, 1));
+    return q;
+}
+
+TASK_0(int, runtest_qmdd)
+{
+    size_t protected_before = evbdd_count_protected();
+
+    // same state as with the C API
+    QMDD ref = qmdd_create_all_zero_state(2);
+    ref = qmdd_gate(ref, GATEID_H, 0);
+    ref = qmdd_cgate(ref, GATEID_X, 0, 1);
+    Qmdd bell = bell_state();
+    test_assert(bell.GetQMDD() == ref);
+    test_assert(evbdd_count_protected() == protected_before + 1);
+
+    // moving hands over the protected slot, applying gates reuses it
+    Qmdd moved(std::move(bell));
+    test_assert(bell.isEmpty() && !moved.isEmpty());
+    test_assert(evbdd_count_protected() == protected_before + 1);
+    moved = QGate(GATEID_X, 0, 1) * std::move(moved);
+    moved *= QGate(GATEID_H, 0);
+    test_assert(moved == Qmdd::allZero(2));
+    test_assert(evbdd_count_protected() == protected_before + 1);
+
+    // copies are protected separately, and survive gc
+    Qmdd copy = moved;
+    test_assert(evbdd_count_protected() == protected_before + 2);
+    Qmdd other = QGate(GATEID_Ry(0.3), 1) * copy;
+    test_assert(other != copy);
+    sylvan_gc();
+    test_assert(copy == moved);
+    test_assert(fabs(other.Norm() - 1.0) < 1e-9);
+    test_assert(fabs(other.Fidelity(copy) - cos(0.15)*cos(0.15)) < 1e-9);
+    test_assert(fabs(other.ExpectationPauli("ZI") - 1.0) < 1e-9);
+    test_assert(fabs(other.ExpectationPauli("IZ") - cos(0.3)) < 1e-9);
+
+    // controls below the target
+    Qmdd q3 = Qmdd::basisState({false, false, true});
+    q3 *= QGate(GATEID_X, 2, 0);
+    test_assert(q3 == Qmdd::basisState({true, false, true}));
+
+    return 0;
+}
+
 void test6()
 {
     BddMap m1;
@@ -56,6 +106,15 @@ int main()
 
     int res = RUN(runtest);
 
+    if (res == 0) {
+        sylvan_init_mtbdd();
+        qsylvan_init_simulator(1LL<<14, 1LL<<14, -1, COMP_HASHMAP, NORM_LOW);
+        size_t protected_before = evbdd_count_protected();
+        res = RUN(runtest_qmdd);
+        // all Qmdd objects are gone again
+        if (res == 0) test_assert(evbdd_count_protected() == protected_before);
+    }
+
     sylvan_quit();
     lace_stop();
 
@@ -1,6 +1,8 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "qsylvan.h"
 #include <sylvan_edge_weights_complex.h>
@@ -746,20 +748,838 @@ int test_20qubit_circuit()
     return 0;
 }
 
+int test_serialization()
+{
+    QMDD q, qref, dds[2], res[2];
+    bool x5[] = {0,1,0,0,1};
+    int n = 5;
+
+    // 5 qubit state with non-trivial edge weights
+    q    = qmdd_create_basis_state(n, x5);
+    qref = qmdd_create_basis_state(n, x5);
+    q = qmdd_gate(q, GATEID_H, 0);        q = qmdd_gate(q, GATEID_H, 3);
+    q = qmdd_cgate(q, GATEID_X, 0, 2);    q = qmdd_gate(q, GATEID_T, 2);
+    q = qmdd_gate(q, GATEID_Rx(0.3), 4);  q = qmdd_cgate(q, GATEID_Z, 3, 4);
+    q = qmdd_gate(q, GATEID_sqrtY, 1);    q = qmdd_gate(q, GATEID_S, 0);
+    dds[0] = q;
+    dds[1] = qmdd_create_all_identity_matrix(n);
+
+    // write / read through a stream
+    FILE *f = tmpfile();
+    test_assert(f != NULL);
+    test_assert(evbdd_writer_tobinary(f, dds, 2) == 0);
+    rewind(f);
+    test_assert(evbdd_reader_frombinary(f, res, 2) == 0);
+    test_assert(res[0] == dds[0]);
+    test_assert(res[1] == dds[1]);
+    rewind(f);
+    test_assert(evbdd_reader_frombinary(f, res, 1) == -1); // wrong count
+    fclose(f);
+
+    // write to file, read through mmap
+    char filename[] = "/tmp/test_qmdd_serialization_XXXXXX";
+    int fd = mkstemp(filename);
+    test_assert(fd != -1);
+    f = fdopen(fd, "wb");
+    test_assert(evbdd_writer_tobinary(f, &qref, 1) == 0);
+    test_assert(evbdd_writer_tobinary(f, dds, 2) == 0); // ignored by mmap reader
+    fclose(f);
+    test_assert(evbdd_reader_frommmap(filename, res, 1) == 0);
+    test_assert(res[0] == qref);
+    unlink(filename);
+    test_assert(evbdd_reader_frommmap(filename, res, 1) == -1); // no file
+
+    if(VERBOSE) printf("qmdd serialization:        ok\n");
+    return 0;
+}
+
+typedef struct amp_list_s {
+    uint64_t count;
+    uint64_t index[32];
+    complex_t amp[32];
+} amp_list_t;
+
+static void
+amp_list_add(uint64_t index, complex_t amp, void *context)
+{
+    amp_list_t *list = (amp_list_t *) context;
+    list->index[list->count] = index;
+    list->amp[list->count] = amp;
+    list->count++;
+}
+
+int test_amplitude_iterator()
+{
+    QMDD q;
+    bool x5[] = {0,0,0,0,0};
+    int n = 5;
+
+    // 5 qubit state with 12 non-zero amplitudes
+    q = qmdd_create_basis_state(n, x5);
+    q = qmdd_gate(q, GATEID_H, 0);        q = qmdd_gate(q, GATEID_H, 2);
+    q = qmdd_gate(q, GATEID_Ry(0.4), 4);  q = qmdd_cgate(q, GATEID_X, 0, 3);
+    q = qmdd_gate(q, GATEID_T, 3);        q = qmdd_cgate(q, GATEID_H, 2, 1, n);
+    
+    for (int ordered = 0; ordered <= 1; ordered++) {
+        amp_list_t list;
+        list.count = 0;
+        uint64_t count = qmdd_foreach_amplitude(q, n, 0.0, ordered, amp_list_add, &list);
+        test_assert(count == list.count);
+        test_assert(count == 12);
+
+        // compare against qmdd_get_amplitude (x is q_{n-1}, ..., q_0)
+        uint64_t nonzero = 0;
+        for (uint64_t k = 0; k < (1ULL << n); k++) {
+            bool *x = int_to_bitarray(k, n, true);
+            complex_t c = qmdd_get_amplitude(q, x, n);
+            free(x);
+            if (c.r == 0 && c.i == 0) continue;
+            nonzero++;
+            bool found = false;
+            for (uint64_t j = 0; j < list.count; j++) {
+                if (list.index[j] == k) {
+                    test_assert(flt_abs(list.amp[j].r - c.r) < 1e-14);
+                    test_assert(flt_abs(list.amp[j].i - c.i) < 1e-14);
+                    found = true;
+                }
+            }
+            test_assert(found);
+        }
+        test_assert(nonzero == count);
+    }
+
+    // threshold: only the amplitudes with |amp|^2 > 0.1
+    amp_list_t list;
+    list.count = 0;
+    qmdd_foreach_amplitude(q, n, 0.1, true, amp_list_add, &list);
+    test_assert(list.count > 0 && list.count < 12);
+    for (uint64_t j = 0; j < list.count; j++) {
+        test_assert(list.amp[j].r*list.amp[j].r + list.amp[j].i*list.amp[j].i > 0.1);
+    }
+
+    // streamed to file, ordered gives sorted indices for both bit orders
+    for (int MSB_first = 0; MSB_first <= 1; MSB_first++) {
+        FILE *f = tmpfile();
+        test_assert(f != NULL);
+        test_assert(qmdd_amplitudes_tofile(f, q, n, 0.0, true, MSB_first) == 12);
+        rewind(f);
+        qmdd_amp_record_t rec;
+        uint64_t records = 0, prev = 0;
+        while (fread(&rec, sizeof(rec), 1, f) == 1) {
+            if (records > 0) test_assert(rec.index > prev);
+            // (x in qmdd_get_amplitude is q_{n-1}, ..., q_0)
+            uint64_t k = MSB_first ? 0 : rec.index;
+            for (int j = 0; j < n && MSB_first; j++) k |= ((rec.index >> j) & 1) << (n-1-j);
+            bool *x = int_to_bitarray(k, n, true);
+            complex_t c = qmdd_get_amplitude(q, x, n);
+            free(x);
+            test_assert(flt_abs(rec.re - c.r) < 1e-14 && flt_abs(rec.im - c.i) < 1e-14);
+            prev = rec.index;
+            records++;
+        }
+        test_assert(records == 12);
+        fclose(f);
+    }
+
+    // more amplitudes than fit in one sorted run (2^20), merged in order (this
+    // doesn't depend on the edge weight backend, so it is only tested once)
+    static bool merge_tested = false;
+    if (!merge_tested) {
+        merge_tested = true;
+        BDDVAR m = 21;
+        QMDD big = qmdd_create_all_zero_state(m);
+        for (BDDVAR k = 0; k < m; k++) big = qmdd_gate(big, GATEID_H, k);
+        big = qmdd_gate(big, GATEID_T, 0);
+        FILE *f = tmpfile();
+        test_assert(f != NULL);
+        test_assert(qmdd_amplitudes_tofile(f, big, m, 0.0, true, false) == (1ULL << m));
+        rewind(f);
+        qmdd_amp_record_t *recs = malloc(sizeof(qmdd_amp_record_t) * 4096);
+        uint64_t records = 0;
+        size_t got;
+        while ((got = fread(recs, sizeof(qmdd_amp_record_t), 4096, f)) > 0) {
+            for (size_t j = 0; j < got; j++) {
+                test_assert(recs[j].index == records);
+                test_assert((recs[j].im != 0) == (records & 1)); // (T on q_0)
+                records++;
+            }
+        }
+        test_assert(records == (1ULL << m));
+        free(recs);
+        fclose(f);
+    }
+
+    if(VERBOSE) printf("qmdd amplitude iterator:   ok\n");
+    return 0;
+}
+
+int test_batched_amplitudes()
+{
+    QMDD q;
+    bool x5[] = {0,0,0,0,0};
+    int n = 5;
+
+    q = qmdd_create_basis_state(n, x5);
+    q = qmdd_gate(q, GATEID_H, 0);        q = qmdd_gate(q, GATEID_H, 2);
+    q = qmdd_gate(q, GATEID_Ry(0.4), 4);  q = qmdd_cgate(q, GATEID_X, 0, 3);
+    q = qmdd_gate(q, GATEID_T, 3);        q = qmdd_cgate(q, GATEID_H, 2, 1, n);
+
+    // all basis states in scrambled order, every one queried twice
+    uint64_t count = 2 * (1ULL << n);
+    bool **queries = malloc(sizeof(bool*) * count);
+    complex_t *amps = malloc(sizeof(complex_t) * count);
+    for (uint64_t i = 0; i < count; i++) {
+        queries[i] = int_to_bitarray((i * 7) % (1ULL << n), n, true);
+    }
+    qmdd_get_amplitudes(q, queries, count, n, amps);
+    for (uint64_t i = 0; i < count; i++) {
+        complex_t c = qmdd_get_amplitude(q, queries[i], n);
+        test_assert(flt_abs(amps[i].r - c.r) < 1e-14);
+        test_assert(flt_abs(amps[i].i - c.i) < 1e-14);
+    }
+
+    // single query, and a subset which shares no prefix beyond q_0
+    qmdd_get_amplitudes(q, queries + 3, 1, n, amps);
+    complex_t c = qmdd_get_amplitude(q, queries[3], n);
+    test_assert(flt_abs(amps[0].r - c.r) < 1e-14);
+    test_assert(flt_abs(amps[0].i - c.i) < 1e-14);
+    qmdd_get_amplitudes(q, queries, 2, n, amps);
+    for (uint64_t i = 0; i < 2; i++) {
+        c = qmdd_get_amplitude(q, queries[i], n);
+        test_assert(flt_abs(amps[i].r - c.r) < 1e-14);
+        test_assert(flt_abs(amps[i].i - c.i) < 1e-14);
+    }
+
+    for (uint64_t i = 0; i < count; i++) free(queries[i]);
+    free(queries);
+    free(amps);
+
+    if(VERBOSE) printf("qmdd batched amplitudes:   ok\n");
+    return 0;
+}
+
+// <psi|P|psi> by applying P as gates and taking the inner product
+double pauli_expectation_ref(QMDD q, const char *pauli, BDDVAR n)
+{
+    QMDD p = q;
+    for (BDDVAR k = 0; k < n; k++) {
+        if (pauli[k] == 'X') p = qmdd_gate(p, GATEID_X, k);
+        if (pauli[k] == 'Y') p = qmdd_gate(p, GATEID_Y, k);
+        if (pauli[k] == 'Z') p = qmdd_gate(p, GATEID_Z, k);
+    }
+    complex_t c;
+    weight_value(evbdd_inner_product(p, q, n), &c); // <psi|(P|psi>)
+    return c.r;
+}
+
+int test_pauli_expectation()
+{
+    QMDD q;
+    bool x5[] = {0,0,0,0,0};
+    int n = 5;
+
+    // basis state and |+> 
+    q = qmdd_create_basis_state(n, x5);
+    test_assert(flt_abs(qmdd_expectation_pauli(q, "ZIIIZ", n) - 1.0) < 1e-14);
+    test_assert(flt_abs(qmdd_expectation_pauli(q, "IIXII", n)) < 1e-14);
+    q = qmdd_gate(q, GATEID_H, 2);
+    test_assert(flt_abs(qmdd_expectation_pauli(q, "IIXII", n) - 1.0) < 1e-14);
+    test_assert(flt_abs(qmdd_expectation_pauli(q, "IIZII", n)) < 1e-14);
+    q = qmdd_gate(q, GATEID_S, 2);
+    test_assert(flt_abs(qmdd_expectation_pauli(q, "IIYII", n) - 1.0) < 1e-14);
+
+    // entangled state w/ complex amplitudes, compare against P as gates
+    q = qmdd_create_basis_state(n, x5);
+    q = qmdd_gate(q, GATEID_H, 0);        q = qmdd_gate(q, GATEID_H, 2);
+    q = qmdd_gate(q, GATEID_Ry(0.4), 4);  q = qmdd_cgate(q, GATEID_X, 0, 3);
+    q = qmdd_gate(q, GATEID_T, 3);        q = qmdd_cgate(q, GATEID_H, 2, 1, n);
+    q = qmdd_gate(q, GATEID_Rx(0.7), 1);  q = qmdd_cgate(q, GATEID_Y, 4, 0, n);
+    char *paulis[] = {"IIIII", "ZZIII", "XIIXI", "YXZIY", "IYYII", "XXXXX", 
+                      "IIIYZ", "ZIYIX", "YYYYY", "IZIZI"};
+    double coeffs[] = {0.5, -1.0, 0.25, 2.0, 1.0, -0.5, 0.75, 1.5, -2.0, 0.1};
+    uint32_t nterms = 10;
+    double expected = 0.0;
+    for (uint32_t i = 0; i < nterms; i++) {
+        double ref = pauli_expectation_ref(q, paulis[i], n);
+        test_assert(flt_abs(qmdd_expectation_pauli(q, paulis[i], n) - ref) < 1e-12);
+        expected += coeffs[i] * ref;
+    }
+    double term_values[10];
+    double e = qmdd_expectation_hamiltonian(q, paulis, coeffs, nterms, n, term_values);
+    test_assert(flt_abs(e - expected) < 1e-12);
+    for (uint32_t i = 0; i < nterms; i++) {
+        test_assert(flt_abs(term_values[i] - pauli_expectation_ref(q, paulis[i], n)) < 1e-12);
+    }
+
+    // GHZ state on 40 qubits (Pauli suffixes too long to pack in cache key)
+    BDDVAR m = 40;
+    q = qmdd_create_all_zero_state(m);
+    q = qmdd_gate(q, GATEID_H, 0);
+    for (BDDVAR k = 1; k < m; k++) q = qmdd_cgate(q, GATEID_X, 0, k);
+    char pauli[41];
+    for (BDDVAR k = 0; k < m; k++) pauli[k] = 'X';
+    pauli[m] = '\0';
+    test_assert(flt_abs(qmdd_expectation_pauli(q, pauli, m) - 1.0) < 1e-12);
+    pauli[0] = 'Y'; pauli[m-1] = 'Y';
+    test_assert(flt_abs(qmdd_expectation_pauli(q, pauli, m) + 1.0) < 1e-12);
+    for (BDDVAR k = 0; k < m; k++) pauli[k] = 'I';
+    pauli[0] = 'Z'; pauli[m-1] = 'Z';
+    test_assert(flt_abs(qmdd_expectation_pauli(q, pauli, m) - 1.0) < 1e-12);
+    pauli[m-1] = 'I';
+    test_assert(flt_abs(qmdd_expectation_pauli(q, pauli, m)) < 1e-12);
+
+    if(VERBOSE) printf("qmdd pauli expectation:    ok\n");
+    return 0;
+}
+
+// Bell pairs (k, k+m) for k < m, which needs ~2^m nodes in the default order
+QMDD bell_pairs_state(BDDVAR m)
+{
+    QMDD q = qmdd_create_all_zero_state(2*m);
+    for (BDDVAR k = 0; k < m; k++) {
+        q = qmdd_gate(q, GATEID_Ry(0.3 + 0.2*k), k);
+        q = qmdd_cgate(q, GATEID_X, k, k+m);
+    }
+    return q;
+}
+
+QMDD bell_pairs_suffix(QMDD q, BDDVAR m)
+{
+    q = qmdd_gate(q, GATEID_T, 1);
+    q = qmdd_cgate(q, GATEID_H, m+1, 0, 2*m);
+    q = qmdd_cgate2(q, GATEID_Z, 2*m-1, 1, 2, 2*m);
+    q = qmdd_gate(q, GATEID_Rx(0.5), m);
+    return q;
+}
+
+int test_dynamic_reordering()
+{
+    BDDVAR m = 4, n = 2*m;
+    uint64_t dim = 1ULL << n;
+
+    // adjacent level swap
+    QMDD q = bell_pairs_state(m);
+    bool x[8], y[8];
+    for (BDDVAR k = 0; k+1 < n; k++) {
+        QMDD s = evbdd_swap_adjacent(q, k);
+        test_assert(qmdd_is_unitvector(s, n));
+        for (uint64_t i = 0; i < dim; i++) {
+            for (BDDVAR j = 0; j < n; j++) x[j] = y[j] = (i >> j) & 1;
+            y[k] = x[k+1]; y[k+1] = x[k];
+            test_assert(wgt_eps_close(evbdd_getvalue(q, x), evbdd_getvalue(s, y), 1e-12));
+        }
+        test_assert(evbdd_swap_adjacent(s, k) == q);
+    }
+
+    // reference amplitudes (in qubit order) without reordering
+    QMDD ref = bell_pairs_suffix(bell_pairs_state(m), m);
+    complex_t *amps = malloc(sizeof(complex_t) * dim);
+    for (uint64_t i = 0; i < dim; i++) {
+        bool *bits = int_to_bitarray(i, n, true);
+        amps[i] = qmdd_get_amplitude(ref, bits, n);
+        free(bits);
+    }
+
+    // sifting pairs the qubits up, gates and amplitudes use the qubit order
+    qmdd_set_auto_reorder(n, 0);
+    q = bell_pairs_state(m);
+    uint64_t before = evbdd_countnodes(q);
+    q = qmdd_sift(q);
+    test_assert(evbdd_countnodes(q) < before);
+    test_assert(evbdd_countnodes(q) == 3*m + 1);
+    for (BDDVAR k = 0; k < m; k++) {
+        BDDVAR l1 = qmdd_get_qubit_level(k), l2 = qmdd_get_qubit_level(k+m);
+        test_assert(l1 == l2 + 1 || l2 == l1 + 1);
+    }
+    q = bell_pairs_suffix(q, m);
+    for (uint64_t i = 0; i < dim; i++) {
+        bool *bits = int_to_bitarray(i, n, true);
+        complex_t c = qmdd_get_amplitude(q, bits, n);
+        test_assert(flt_abs(c.r - amps[i].r) < 1e-12 && flt_abs(c.i - amps[i].i) < 1e-12);
+        free(bits);
+    }
+    q = qmdd_restore_qubit_order(q);
+    test_assert(qmdd_get_qubit_level(1) == 1);
+    test_assert(flt_abs(qmdd_fidelity(q, ref, n) - 1.0) < 1e-12);
+
+    // measurements are reported in qubit order
+    q = qmdd_create_all_zero_state(n);
+    q = qmdd_gate(q, GATEID_X, 1);
+    q = qmdd_gate(q, GATEID_X, 6);
+    q = qmdd_swap_levels(q, 1);
+    q = qmdd_swap_levels(q, 5);
+    bool ms[8];
+    double p;
+    qmdd_measure_all(q, n, ms, &p);
+    for (BDDVAR k = 0; k < n; k++) test_assert(ms[k] == (k == 1 || k == 6));
+    int m1;
+    qmdd_measure_qubit(q, 6, n, &m1, &p);
+    test_assert(m1 == 1 && flt_abs(p) < 1e-12);
+    qmdd_measure_qubit(q, 5, n, &m1, &p);
+    test_assert(m1 == 0 && flt_abs(p - 1.0) < 1e-12);
+
+    // automatic sifting before gates when the state grows
+    m = 6; n = 2*m;
+    qmdd_set_auto_reorder(n, 1.5);
+    q = bell_pairs_state(m);
+    q = qmdd_gate(q, GATEID_H, 0);
+    uint64_t sifts, swaps;
+    double time;
+    qmdd_get_reorder_stats(&sifts, &swaps, &time);
+    test_assert(sifts > 0 && swaps > 0);
+    test_assert(evbdd_countnodes(q) < QMDD_REORDER_MIN_NODES);
+    test_assert(flt_abs(qmdd_get_norm(q, n) - 1.0) < 1e-12);
+
+    qmdd_set_auto_reorder(0, 0);
+    free(amps);
+
+    if(VERBOSE) printf("qmdd dynamic reordering:   ok\n");
+    return 0;
+}
+
+QMDD approx_test_circuit(QMDD q, BDDVAR n, int layers)
+{
+    for (int l = 0; l < layers; l++) {
+        for (BDDVAR k = 0; k < n; k++) {
+            q = qmdd_gate(q, GATEID_Ry(0.1 + 0.15*k + 0.4*l), k);
+        }
+        for (BDDVAR k = l % 2; k+1 < n; k += 2) {
+            q = qmdd_cgate(q, GATEID_Z, k, k+1);
+        }
+    }
+    return q;
+}
+
+int test_approximation()
+{
+    BDDVAR n = 6;
+    QMDD q = approx_test_circuit(qmdd_create_all_zero_state(n), n, 3);
+    uint64_t before = evbdd_countnodes(q);
+
+    // one round of pruning
+    double f;
+    QMDD a = qmdd_approximate(q, n, 0.05, &f);
+    test_assert(f >= 0.95 && f < 1.0);
+    test_assert(evbdd_countnodes(a) < before);
+    test_assert(flt_abs(qmdd_get_norm(a, n) - 1.0) < 1e-12);
+    test_assert(flt_abs(qmdd_fidelity(a, q, n) - f) < 1e-12);
+    test_assert(qmdd_approximate(q, n, 0, &f) == q && f == 1.0);
+
+    // automatic rounds before gates, down to the fidelity floor
+    qmdd_set_approximation(n, before / 4, 0, 0.97, 0.9);
+    a = approx_test_circuit(qmdd_create_all_zero_state(n), n, 4);
+    uint64_t rounds;
+    qmdd_get_approximation_stats(&f, &rounds);
+    test_assert(rounds > 0);
+    test_assert(f >= 0.9 - 1e-12 && f < 1.0);
+    test_assert(flt_abs(qmdd_get_norm(a, n) - 1.0) < 1e-12);
+    qmdd_set_approximation(0, 0, 0, 1.0, 1.0);
+
+    if(VERBOSE) printf("qmdd approximation:        ok\n");
+    return 0;
+}
+
+QMDD dense_test_circuit(QMDD q, BDDVAR n, int layers)
+{
+    for (int l = 0; l < layers; l++) {
+        for (BDDVAR k = 0; k < n; k++) {
+            q = qmdd_gate(q, GATEID_Ry(0.3 + 0.2*k + 0.5*l), k);
+        }
+        for (BDDVAR k = l % 2; k+1 < n; k += 2) {
+            q = qmdd_cgate(q, GATEID_X, k, k+1);
+        }
+        q = qmdd_cgate2(q, GATEID_Z, 0, 1, n-1);
+    }
+    for (BDDVAR k = 0; k < n; k++) {
+        q = qmdd_gate(q, GATEID_T, k);
+    }
+    return q;
+}
+
+int test_dense_blocks()
+{
+    BDDVAR n = 6, level;
+    uint64_t dim = 1ULL << n, blocks;
+    QMDD ref = dense_test_circuit(qmdd_create_all_zero_state(n), n, 2);
+    evbdd_protect(&ref);
+
+    // product states have no dense levels
+    qmdd_set_dense_blocks(n, 4, 0.75);
+    QMDD q = qmdd_gate(qmdd_create_all_zero_state(n), GATEID_H, 0);
+    qmdd_get_dense_block_stats(&level, &blocks);
+    test_assert(level == n && blocks == 0);
+
+    // the same circuit with dense blocks for the entangled bottom levels
+    q = dense_test_circuit(qmdd_create_all_zero_state(n), n, 2);
+    qmdd_get_dense_block_stats(&level, &blocks);
+    test_assert(blocks > 0);
+    test_assert(flt_abs(qmdd_get_norm(q, n) - 1.0) < 1e-12);
+    test_assert(flt_abs(qmdd_fidelity(q, ref, n) - 1.0) < 1e-12);
+    for (uint64_t i = 0; i < dim; i++) {
+        bool *bits = int_to_bitarray(i, n, true);
+        complex_t a = qmdd_get_amplitude(q, bits, n);
+        complex_t b = qmdd_get_amplitude(ref, bits, n);
+        test_assert(flt_abs(a.r - b.r) < 1e-12 && flt_abs(a.i - b.i) < 1e-12);
+        free(bits);
+    }
+
+    // gates on states with fewer / more qubits, at the block level of another
+    BDDVAR nd = 4;
+    for (BDDVAR m = nd - 1; m <= nd + 1; m += 2) {
+        evbdd_gc_wgt_table();
+        qmdd_set_dense_blocks(0, 0, 1.0);
+        QMDD s = dense_test_circuit(qmdd_create_all_zero_state(m), m, 2);
+        evbdd_protect(&s);
+        QMDD sref = qmdd_gate_rec(s, GATEID_H, 1);
+        sref = qmdd_gate_rec(sref, GATEID_Ry(0.7), m-1);
+        evbdd_protect(&sref);
+        qmdd_set_dense_blocks(nd, 4, 0.5);
+        dense_test_circuit(qmdd_create_all_zero_state(nd), nd, 2);
+        qmdd_get_dense_block_stats(&level, &blocks);
+        test_assert(level < nd);
+        evbdd_gc_wgt_table(); // (qmdd_gate_rec doesn't clean the table)
+        uint64_t before = blocks;
+        s = qmdd_gate_rec(s, GATEID_H, 1);
+        s = qmdd_gate_rec(s, GATEID_Ry(0.7), m-1);
+        test_assert(flt_abs(qmdd_fidelity(s, sref, m) - 1.0) < 1e-12);
+        // only the smaller state fits in dense blocks
+        qmdd_get_dense_block_stats(&level, &blocks);
+        test_assert((blocks > before) == (m < nd));
+        // a recheck on the larger state turns dense blocks off
+        if (m > nd) {
+            for (int g = 0; g < QMDD_DENSE_RECHECK; g++) s = qmdd_gate(s, GATEID_X, 0);
+            qmdd_get_dense_block_stats(&level, &blocks);
+            test_assert(level == nd);
+        }
+        evbdd_unprotect(&s);
+        evbdd_unprotect(&sref);
+    }
+    qmdd_set_dense_blocks(0, 0, 1.0);
+    evbdd_unprotect(&ref);
+
+    if(VERBOSE) printf("qmdd dense leaf blocks:    ok\n");
+    return 0;
+}
+
+int test_stabilizer_prefix()
+{
+    const gate_id_t clifford[] = {GATEID_X, GATEID_Y, GATEID_Z, GATEID_H, 
+                                  GATEID_S, GATEID_Sdag, GATEID_sqrtX, 
+                                  GATEID_sqrtXdag, GATEID_sqrtY, GATEID_sqrtYdag};
+    const gate_id_t controlled[] = {GATEID_X, GATEID_Y, GATEID_Z};
+    BDDVAR n = 6;
+    srand(42);
+    for (int r = 0; r < 20; r++) {
+        stabilizer_t *stab = stabilizer_create(n);
+        QMDD q = qmdd_create_all_zero_state(n);
+        evbdd_protect(&q);
+        for (int g = 0; g < 40; g++) {
+            BDDVAR t = rand() % n;
+            if (rand() % 3 == 0) {
+                BDDVAR c = (t + 1 + rand() % (n-1)) % n;
+                gate_id_t gate = controlled[rand() % 3];
+                test_assert(stabilizer_cgate(stab, gate, c, t));
+                q = qmdd_cgate(q, gate, c, t, n);
+            }
+            else {
+                gate_id_t gate = clifford[rand() % 10];
+                test_assert(stabilizer_gate(stab, gate, t));
+                q = qmdd_gate(q, gate, t);
+            }
+            if (g == 20) {
+                // materializing in between keeps the tableau usable
+                QMDD s = qmdd_from_stabilizer(stab);
+                test_assert(evbdd_equivalent(s, q, n, false, true));
+            }
+        }
+        // exact state, including the global phase
+        QMDD s = qmdd_from_stabilizer(stab);
+        test_assert(evbdd_equivalent(s, q, n, false, true));
+        test_assert(evbdd_countnodes(s) == evbdd_countnodes(q));
+        test_assert(!stabilizer_gate(stab, GATEID_T, 0));
+        evbdd_unprotect(&q);
+        stabilizer_free(stab);
+    }
+
+    if(VERBOSE) printf("qmdd stabilizer prefix:    ok\n");
+    return 0;
+}
+
+int test_apply_diagonal()
+{
+    BDDVAR n = 4;
+    QMDD q = qmdd_create_all_zero_state(n);
+    for (BDDVAR k = 0; k < n; k++) q = qmdd_gate(q, GATEID_H, k);
+    q = qmdd_gate(q, GATEID_T, 1);
+    q = qmdd_cgate(q, GATEID_X, 1, 3, n);
+    q = qmdd_gate(q, GATEID_sqrtY, 2);
+    evbdd_protect(&q);
+    QMDD qTest = EVBDD_ZERO, qRef = EVBDD_ZERO;
+    evbdd_protect(&qTest);
+    evbdd_protect(&qRef);
+    AMP minus_one = wgt_neg(EVBDD_ONE);
+
+    // phase -1 where x0 and x2 holds is a CZ
+    BDD f = sylvan_and(sylvan_ithvar(0), sylvan_ithvar(2));
+    qTest = qmdd_apply_diagonal(q, f, minus_one);
+    qRef  = qmdd_cgate(q, GATEID_Z, 0, 2, n);
+    test_assert(evbdd_equivalent(qTest, qRef, n, false, true));
+    test_assert(qTest == qRef);
+
+    // a single basis state (cube) is an all-control phase
+    bool x[] = {1, 0, 1, 1};
+    f = sylvan_true;
+    for (int k = n-1; k >= 0; k--) {
+        f = sylvan_and(f, x[k] ? sylvan_ithvar(k) : sylvan_nithvar(k));
+    }
+    qTest = qmdd_apply_diagonal(q, f, minus_one);
+    qRef  = qmdd_all_control_phase(q, n, x);
+    test_assert(evbdd_equivalent(qTest, qRef, n, false, true));
+
+    // MTBDD of phases e^(i theta(x))
+    double theta = 0.3;
+    MTBDD g = mtbdd_ite(mtbdd_ithvar(1), mtbdd_double(theta), mtbdd_double(0.0));
+    qTest = qmdd_apply_diagonal(q, g, EVBDD_ONE);
+    qRef  = qmdd_gate(q, GATEID_Phase(theta), 1);
+    test_assert(evbdd_equivalent(qTest, qRef, n, false, true));
+
+    // trivial cases
+    test_assert(qmdd_apply_diagonal(q, sylvan_false, minus_one) == q);
+    qTest = qmdd_apply_diagonal(q, sylvan_true, minus_one);
+    test_assert(qTest == evbdd_bundle(EVBDD_TARGET(q), wgt_neg(EVBDD_WEIGHT(q))));
+
+    // a zero weight projects out the part where f holds
+    qTest = qmdd_apply_diagonal(q, sylvan_ithvar(0), EVBDD_ZERO);
+    test_assert(flt_abs(qmdd_get_norm(qTest, n) - 0.5) < 1e-12);
+    qTest = qmdd_apply_diagonal(q, sylvan_true, EVBDD_ZERO);
+    test_assert(qTest == evbdd_bundle(EVBDD_TERMINAL, EVBDD_ZERO));
+
+    // with reordering the qubits of f are renamed to their current levels
+    // (here 0 <-> 1 and 2 -> 3, so f can not be renamed one qubit at a time)
+    f = sylvan_and(sylvan_and(sylvan_ithvar(0), sylvan_nithvar(1)), sylvan_ithvar(2));
+    qRef = qmdd_apply_diagonal(q, f, minus_one);
+    qmdd_set_auto_reorder(n, 0);
+    qTest = qmdd_swap_levels(q, 0);
+    qTest = qmdd_swap_levels(qTest, 2);
+    f = sylvan_and(sylvan_and(sylvan_ithvar(0), sylvan_nithvar(1)), sylvan_ithvar(2));
+    qTest = qmdd_apply_diagonal(qTest, f, minus_one);
+    test_assert(!evbdd_equivalent(qTest, qRef, n, false, false));
+    qTest = qmdd_restore_qubit_order(qTest);
+    qmdd_set_auto_reorder(0, 0);
+    test_assert(evbdd_equivalent(qTest, qRef, n, false, true));
+
+    evbdd_unprotect(&q);
+    evbdd_unprotect(&qTest);
+    evbdd_unprotect(&qRef);
+    if(VERBOSE) printf("qmdd apply diagonal:       ok\n");
+    return 0;
+}
+
+// Applies the same gates to |psi> and to rho = |psi><psi|
+QMDD dm_test_circuit(QMDD q, BDDVAR n, bool dm)
+{
+    if (dm) {
+        q = qmdd_dm_gate(q, GATEID_H, 0);
+        q = qmdd_dm_gate(q, GATEID_Ry(0.4), 2);
+        q = qmdd_dm_cgate(q, GATEID_X, 0, 1);
+        q = qmdd_dm_gate(q, GATEID_T, 1);
+        q = qmdd_dm_cgate(q, GATEID_Rx(0.7), 2, 0); // control after target
+        q = qmdd_dm_cgate2(q, GATEID_Y, 0, 1, 2);
+        q = qmdd_dm_cgate2(q, GATEID_H, 0, 2, 1); // controls on both sides
+        q = qmdd_dm_cgate2(q, GATEID_Ry(0.9), 2, 1, 0);
+        q = qmdd_dm_gate(q, GATEID_sqrtX, 0);
+    }
+    else {
+        q = qmdd_gate(q, GATEID_H, 0);
+        q = qmdd_gate(q, GATEID_Ry(0.4), 2);
+        q = qmdd_cgate(q, GATEID_X, 0, 1);
+        q = qmdd_gate(q, GATEID_T, 1);
+        q = qmdd_cgate(q, GATEID_Rx(0.7), 2, 0, n);
+        q = qmdd_cgate2(q, GATEID_Y, 0, 1, 2);
+        q = qmdd_cgate2(q, GATEID_H, 0, 2, 1, n);
+        q = qmdd_cgate2(q, GATEID_Ry(0.9), 2, 1, 0, n);
+        q = qmdd_gate(q, GATEID_sqrtX, 0);
+    }
+    return q;
+}
+
+int test_density_matrix()
+{
+    BDDVAR n = 3;
+    QMDD q = dm_test_circuit(qmdd_create_all_zero_state(n), n, false);
+    evbdd_protect(&q);
+    QMDD rho = qmdd_dm_from_state(qmdd_create_all_zero_state(n));
+    evbdd_protect(&rho);
+
+    // U rho U^dagger gate by gate equals |psi><psi| of the final state
+    rho = dm_test_circuit(rho, n, true);
+    QMDD ref = qmdd_dm_from_state(q);
+    evbdd_protect(&ref);
+    test_assert(evbdd_equivalent(rho, ref, 2*n, false, false));
+    test_assert(flt_abs(qmdd_dm_trace(rho, n) - 1.0) < 1e-12);
+    test_assert(flt_abs(qmdd_dm_purity(rho, n) - 1.0) < 1e-12);
+    char *paulis[] = {"IIZ", "XZI", "YYX", "ZIY", "IXX", "YII"};
+    for (int i = 0; i < 6; i++) {
+        double exp = qmdd_expectation_pauli(q, paulis[i], n);
+        test_assert(flt_abs(qmdd_dm_expectation_pauli(rho, paulis[i], n) - exp) < 1e-12);
+    }
+
+    // a Kraus "channel" with a single unitary Kraus operator is a gate
+    complex_t x[4] = {czero(), cone(), cone(), czero()};
+    ref = qmdd_dm_gate(rho, GATEID_X, 1);
+    test_assert(evbdd_equivalent(qmdd_dm_kraus(rho, x, 1, 1), ref, 2*n, false, false));
+
+    // tracing out one half of a Bell pair leaves I/2 (on q_0 of the result)
+    q = qmdd_create_all_zero_state(2);
+    q = qmdd_gate(q, GATEID_H, 0);
+    q = qmdd_cgate(q, GATEID_X, 0, 1);
+    rho = qmdd_dm_from_state(q);
+    for (BDDVAR t = 0; t < 2; t++) {
+        ref = qmdd_dm_partial_trace(rho, t);
+        QMDD id = qmdd_create_all_identity_matrix(1);
+        AMP w = wgt_mul(EVBDD_WEIGHT(id), qmdd_amp_from_prob(0.25));
+        QMDD half = evbdd_bundle(EVBDD_TARGET(id), w);
+        test_assert(evbdd_equivalent(ref, half, 2, false, false));
+    }
+    test_assert(flt_abs(qmdd_dm_purity(qmdd_dm_partial_trace(rho, 1), 1) - 0.5) < 1e-12);
+
+    // measuring both qubits of the Bell pair gives equal outcomes
+    bool ms[2];
+    double p;
+    ref = qmdd_dm_measure_all(rho, 2, ms, &p);
+    test_assert(ms[0] == ms[1]);
+    test_assert(flt_abs(p - 0.5) < 1e-12);
+    test_assert(flt_abs(qmdd_dm_trace(ref, 2) - 1.0) < 1e-12);
+    q = qmdd_create_basis_state(2, ms);
+    test_assert(evbdd_equivalent(ref, qmdd_dm_from_state(q), 4, false, false));
+
+    // depolarizing and amplitude damping channels
+    double prob = 0.3;
+    rho = qmdd_dm_from_state(qmdd_create_all_zero_state(n));
+    rho = qmdd_dm_depolarize(rho, prob, 1);
+    test_assert(flt_abs(qmdd_dm_trace(rho, n) - 1.0) < 1e-12);
+    test_assert(flt_abs(qmdd_dm_expectation_pauli(rho, "IZI", n) - (1.0 - 4.0*prob/3.0)) < 1e-12);
+    test_assert(flt_abs(qmdd_dm_expectation_pauli(rho, "IXI", n)) < 1e-12);
+    rho = qmdd_dm_gate(qmdd_dm_from_state(qmdd_create_all_zero_state(n)), GATEID_X, 2);
+    rho = qmdd_dm_amplitude_damp(rho, prob, 2);
+    test_assert(flt_abs(qmdd_dm_trace(rho, n) - 1.0) < 1e-12);
+    test_assert(flt_abs(qmdd_dm_expectation_pauli(rho, "IIZ", n) - (2.0*prob - 1.0)) < 1e-12);
+    double purity = (1.0-prob)*(1.0-prob) + prob*prob;
+    test_assert(flt_abs(qmdd_dm_purity(rho, n) - purity) < 1e-12);
+    // the Kraus operators of the same channel are interned only once
+    uint32_t interned = qmdd_gates_num_interned();
+    QMDD rho2 = qmdd_dm_amplitude_damp(rho, prob, 0);
+    test_assert(qmdd_dm_amplitude_damp(rho, prob, 0) == rho2);
+    test_assert(qmdd_gates_num_interned() == interned);
+
+    evbdd_unprotect(&q);
+    evbdd_unprotect(&rho);
+    evbdd_unprotect(&ref);
+    if(VERBOSE) printf("qmdd density matrices:     ok\n");
+    return 0;
+}
+
+int test_param_shift_gradient()
+{
+    // interned gates keep their ID (also when the dynamic gate changes)
+    uint32_t ry = GATEID_Ry_interned(0.3);
+    test_assert(ry == GATEID_Ry_interned(0.3));
+    test_assert(ry != GATEID_Ry_interned(0.4));
+    QMDD q = qmdd_gate(qmdd_create_all_zero_state(2), ry, 1);
+    evbdd_protect(&q);
+    QMDD ref = qmdd_gate(qmdd_create_all_zero_state(2), GATEID_Ry(0.3), 1);
+    evbdd_protect(&ref);
+    test_assert(evbdd_equivalent(q, ref, 2, false, false));
+
+    // circuit with a shared parameter and a control after the target
+    BDDVAR n = 3;
+    BDDVAR no = EVBDD_INVALID_VAR;
+    qmdd_pgate_t gates[] = {
+        {QMDD_PGATE_RY,    0,        0, no, no, no, 0},
+        {QMDD_PGATE_RX,    0,        1, no, no, no, 1},
+        {QMDD_PGATE_FIXED, GATEID_H, 0, no, no, no, 2},
+        {QMDD_PGATE_FIXED, GATEID_X, 0, 0,  no, no, 1},
+        {QMDD_PGATE_RZ,    0,        2, no, no, no, 1},
+        {QMDD_PGATE_FIXED, GATEID_Z, 0, 2,  no, no, 0},
+        {QMDD_PGATE_PHASE, 0,        3, no, no, no, 2},
+        {QMDD_PGATE_RY,    0,        0, no, no, no, 2},
+        {QMDD_PGATE_FIXED, GATEID_X, 0, 1,  no, no, 2},
+        {QMDD_PGATE_RX,    0,        1, no, no, no, 0},
+    };
+    qmdd_pcircuit_t pc = {n, 4, 10, gates};
+    char *paulis[] = {"ZZI", "XIX", "IYZ"};
+    double coeffs[] = {0.5, -1.0, 0.7};
+    double theta[] = {0.3, -1.2, 0.8, 2.1};
+    double grad[4], grad2[4];
+
+    // only the (at most 6) unshifted rotations stay interned
+    uint32_t interned = qmdd_gates_num_interned();
+    double e = qmdd_param_shift_gradient(&pc, theta, paulis, coeffs, 3, grad);
+    test_assert(qmdd_gates_num_interned() <= interned + 6);
+    q = qmdd_pcircuit_run(&pc, theta);
+    test_assert(flt_abs(e - qmdd_expectation_hamiltonian(q, paulis, coeffs, 3, n, NULL)) < 1e-12);
+
+    // compare with central differences
+    double h = 1e-5;
+    for (int p = 0; p < 4; p++) {
+        double t = theta[p];
+        theta[p] = t + h;
+        q = qmdd_pcircuit_run(&pc, theta);
+        double e_plus = qmdd_expectation_hamiltonian(q, paulis, coeffs, 3, n, NULL);
+        theta[p] = t - h;
+        q = qmdd_pcircuit_run(&pc, theta);
+        double e_min = qmdd_expectation_hamiltonian(q, paulis, coeffs, 3, n, NULL);
+        theta[p] = t;
+        test_assert(flt_abs(grad[p] - (e_plus - e_min) / (2*h)) < 1e-6);
+    }
+
+    // the same angles re-use the interned gates
+    interned = qmdd_gates_num_interned();
+    test_assert(flt_abs(qmdd_param_shift_gradient(&pc, theta, paulis, coeffs, 3, grad2) - e) < 1e-12);
+    test_assert(qmdd_gates_num_interned() == interned);
+    for (int p = 0; p < 4; p++) test_assert(flt_abs(grad2[p] - grad[p]) < 1e-12);
+
+    evbdd_unprotect(&q);
+    evbdd_unprotect(&ref);
+    if(VERBOSE) printf("qmdd param shift gradient: ok\n");
+    return 0;
+}
+
+/**
+ * Runs a test on an empty edge weight table (the states of earlier tests are
+ * dead).
+ */
+static int run_test(int (*test)())
+{
+    evbdd_gc_wgt_table();
+    return test();
+}
+
 int run_qmdd_tests()
 {
     // we are not testing garbage collection
     sylvan_gc_disable();
 
     // circuits
-    if (test_swap_circuit()) return 1;
-    if (test_cswap_circuit()) return 1;
-    if (test_tensor_product()) return 1;
-    if (test_measurements()) return 1;
-    if (test_5qubit_circuit()) return 1;
-    if (test_10qubit_circuit()) return 1;
-    //if (test_20qubit_circuit()) return 1;
-    if (test_QFT()) return 1;
+    if (run_test(test_swap_circuit)) return 1;
+    if (run_test(test_cswap_circuit)) return 1;
+    if (run_test(test_tensor_product)) return 1;
+    if (run_test(test_measurements)) return 1;
+    if (run_test(test_5qubit_circuit)) return 1;
+    if (run_test(test_10qubit_circuit)) return 1;
+    //if (run_test(test_20qubit_circuit)) return 1;
+    if (run_test(test_QFT)) return 1;
+    if (run_test(test_serialization)) return 1;
+    if (run_test(test_amplitude_iterator)) return 1;
+    if (run_test(test_batched_amplitudes)) return 1;
+    if (run_test(test_pauli_expectation)) return 1;
+    if (run_test(test_dynamic_reordering)) return 1;
+    if (run_test(test_approximation)) return 1;
+    if (run_test(test_dense_blocks)) return 1;
+    if (run_test(test_stabilizer_prefix)) return 1;
+    if (run_test(test_apply_diagonal)) return 1;
+    if (run_test(test_density_matrix)) return 1;
+    if (run_test(test_param_shift_gradient)) return 1;
 
     return 0;
 }
@@ -774,6 +1594,7 @@ int test_with(int wgt_backend, int norm_strat, int wgt_indx_bits)
     // Simple Sylvan initialization
     sylvan_set_sizes(1LL<<25, 1LL<<25, 1LL<<16, 1LL<<16);
     sylvan_init_package();
+    sylvan_init_mtbdd(); // for the (MT)BDDs of qmdd_apply_diagonal
     qsylvan_init_simulator(1LL<<wgt_indx_bits, 1LL<<wgt_indx_bits, -1, 
                            wgt_backend, norm_strat);
     qmdd_set_testing_mode(true); // turn on internal sanity tests
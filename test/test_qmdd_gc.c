@@ -1,9 +1,13 @@
+#include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 
 #include "qsylvan.h"
 #include "test_assert.h"
 #include "../examples/grover.h"
 
+bool VERBOSE = true;
+
 uint64_t min_wgt_tablesize = 1LL<<14;
 uint64_t max_wgt_tablesize = 1LL<<17;
 
@@ -144,6 +148,173 @@ int test_custom_gate_gc_protection()
 }
 
 
+int test_param_shift_gradient_gc()
+{
+    // Standard Lace initialization (the shifted circuits run in batches of
+    // 2 * workers, with gc of the edge weight table only between batches)
+    int workers = 2;
+    lace_start(workers, 0);
+
+    sylvan_set_sizes(1LL<<25, 1LL<<25, 1LL<<16, 1LL<<16);
+    sylvan_init_package();
+    qsylvan_init_simulator(min_wgt_tablesize, max_wgt_tablesize, 0, COMP_HASHMAP, NORM_MAX);
+    qmdd_set_testing_mode(true); // turn on internal sanity tests
+
+    // interned gates keep their ID and matrix after gc of the edge weight table
+    uint32_t ry = GATEID_Ry_interned(0.3);
+    evbdd_gc_wgt_table();
+    test_assert(GATEID_Ry_interned(0.3) == ry);
+    QMDD qRef = qmdd_gate(qmdd_create_all_zero_state(2), GATEID_Ry(0.3), 1);
+    evbdd_protect(&qRef);
+    evbdd_gc_wgt_table();
+    QMDD qTest = qmdd_gate(qmdd_create_all_zero_state(2), ry, 1);
+    test_assert(qTest == qRef);
+    evbdd_unprotect(&qRef);
+
+    // Ry layers with CZ gates in between, with 15 rotations
+    BDDVAR n = 5, no = EVBDD_INVALID_VAR;
+    qmdd_pgate_t gates[27];
+    uint32_t g = 0;
+    for (uint32_t d = 0; d < 3; d++) {
+        for (BDDVAR k = 0; k < n; k++) {
+            qmdd_pgate_t ry_k = {QMDD_PGATE_RY, 0, d*n + k, no, no, no, k};
+            gates[g++] = ry_k;
+        }
+        for (BDDVAR k = 0; k+1 < n && d < 2; k++) {
+            qmdd_pgate_t cz = {QMDD_PGATE_FIXED, GATEID_Z, 0, k, no, no, k+1};
+            gates[g++] = cz;
+        }
+    }
+    qmdd_pcircuit_t pc = {n, 3*n, g, gates};
+    char *paulis[] = {"ZZIII", "IXIXI", "IIZIY"};
+    double coeffs[] = {0.5, -1.0, 0.7};
+    double theta[15], grad[15], grad_gc[15];
+    for (uint32_t p = 0; p < 15; p++) theta[p] = 0.1 + 0.4*p;
+
+    double e = qmdd_param_shift_gradient(&pc, theta, paulis, coeffs, 3, grad);
+    uint32_t interned = qmdd_gates_num_interned();
+
+    // the same gradient with gc of the edge weight table after every batch
+    // (any negative threshold cleans the table whenever it is tested)
+    double thres = evbdd_get_gc_wgt_table_thres();
+    evbdd_set_gc_wgt_table_thres(-1.0);
+    uint64_t size = sylvan_get_edge_weight_table_size();
+    double e_gc = qmdd_param_shift_gradient(&pc, theta, paulis, coeffs, 3, grad_gc);
+    test_assert(sylvan_get_edge_weight_table_size() > size); // (grows at every gc)
+    evbdd_set_gc_wgt_table_thres(thres);
+
+    test_assert(evbdd_get_auto_gc_wgt_table());
+    test_assert(qmdd_gates_num_interned() == interned);
+    test_assert(fabs(e_gc - e) < 1e-10);
+    for (uint32_t p = 0; p < 15; p++) test_assert(fabs(grad_gc[p] - grad[p]) < 1e-10);
+
+    // and the central difference of one parameter
+    double h = 1e-5, t = theta[7];
+    theta[7] = t + h;
+    QMDD q = qmdd_pcircuit_run(&pc, theta);
+    double e_plus = qmdd_expectation_hamiltonian(q, paulis, coeffs, 3, n, NULL);
+    theta[7] = t - h;
+    q = qmdd_pcircuit_run(&pc, theta);
+    double e_min = qmdd_expectation_hamiltonian(q, paulis, coeffs, 3, n, NULL);
+    test_assert(fabs(grad_gc[7] - (e_plus - e_min) / (2*h)) < 1e-6);
+    printf("param shift gradient with gc: ok\n");
+
+    sylvan_quit();
+    lace_stop();
+    return 0;
+}
+
+
+int test_memory_budget()
+{
+    // Standard Lace initialization
+    int workers = 1;
+    lace_start(workers, 0);
+
+    // Small budget (1 MB) for all tables together, recover from full tables
+    size_t cap = 1LL<<20;
+    evbdd_set_limits(cap, 1, 5, 0.25);
+    sylvan_init_package();
+    qsylvan_init_simulator(min_wgt_tablesize, max_wgt_tablesize, -1, COMP_HASHMAP, NORM_MAX);
+    evbdd_set_recoverable_oom(true);
+
+    // random-ish circuit, for which the state quickly grows too large
+    BDDVAR nqubits = 14;
+    int ooms = 0;
+    QMDD state = qmdd_create_all_zero_state(nqubits);
+    evbdd_protect(&state);
+    for (int layer = 0; layer < 12 && ooms < 3; layer++) {
+        for (BDDVAR q = 0; q < nqubits && ooms < 3; q++) {
+            QMDD res = qmdd_gate(state, GATEID_Ry(0.1 + 0.37*layer + 0.21*q), q);
+            if (q < nqubits-1) res = qmdd_cgate(res, GATEID_X, q, q+1, nqubits);
+            if (evbdd_out_of_memory()) {
+                // the result is meaningless, but the previous state is intact
+                ooms++;
+                evbdd_clear_out_of_memory();
+                evbdd_gc_wgt_table();
+                sylvan_gc();
+                test_assert(fabs(qmdd_get_norm(state, nqubits) - 1.0) < 1e-6);
+                continue;
+            }
+            state = res;
+        }
+    }
+    evbdd_unprotect(&state);
+    test_assert(ooms > 0);
+
+    // the shares of the tables (possibly after rebalancing) fit the budget
+    size_t nodes_max, cache_max, wgts_max;
+    uint64_t rebalances;
+    evbdd_get_limits(&nodes_max, &cache_max, &wgts_max, &rebalances);
+    test_assert(nodes_max*24 + cache_max*36 + wgts_max*sizeof(complex_t) <= cap);
+    test_assert(sylvan_get_edge_weight_table_size() <= wgts_max);
+    printf("memory budget: %d times out of memory, %" PRIu64 " rebalance(s)\n", ooms, rebalances);
+
+    evbdd_set_recoverable_oom(false);
+    sylvan_quit();
+    lace_stop();
+    return 0;
+}
+
+
+int test_out_of_core()
+{
+    // Standard Lace initialization
+    int workers = 1;
+    lace_start(workers, 0);
+
+    // back the node data and edge weight table by files
+    const char *dir = getenv("TMPDIR");
+    sylvan_set_out_of_core(dir != NULL ? dir : "/tmp");
+    sylvan_set_sizes(1LL<<20, 1LL<<20, 1LL<<16, 1LL<<16);
+    sylvan_init_package();
+    qsylvan_init_simulator(min_wgt_tablesize, max_wgt_tablesize, -1, COMP_HASHMAP, NORM_MAX);
+    qmdd_set_testing_mode(true); // turn on internal sanity tests
+
+    sylvan_table_pages_t pages[16];
+    int n = sylvan_table_pages(pages, 16), file_backed = 0;
+    for (int k = 0; k < n; k++) {
+        if (pages[k].file_backed) file_backed++;
+    }
+    test_assert(file_backed == 2); // node data + edge weights
+
+    // same results with gc of both tables (which also discards free regions)
+    uint64_t major_before, minor_before, major, minor;
+    sylvan_page_faults(&major_before, &minor_before);
+    int res = run_qmdd_tests();
+    sylvan_page_faults(&major, &minor);
+    // the file backed pages are faulted in as the tables fill up
+    test_assert(major + minor > major_before + minor_before);
+    if (VERBOSE) printf("out-of-core: %" PRIu64 " major, %" PRIu64 " minor page faults\n", 
+                        major - major_before, minor - minor_before);
+
+    sylvan_quit();
+    sylvan_set_out_of_core(NULL);
+    lace_stop();
+    return res;
+}
+
+
 int test_with(int wgt_backend, int norm_strat) 
 {
     // Standard Lace initialization
@@ -175,6 +346,9 @@ int runtests()
     }
     if (test_table_size_increase()) return 1;
     if (test_custom_gate_gc_protection()) return 1;
+    if (test_param_shift_gradient_gc()) return 1;
+    if (test_memory_budget()) return 1;
+    if (test_out_of_core()) return 1;
     return 0;
 }
 
@@ -675,6 +675,53 @@ int test_tensor_product()
     return 0;
 }
 
+int test_identity_levels()
+{
+    BDDVAR nqubits = 6;
+    QMDD I, mX, mH, mCX, mCCZ, mTest, mRef, qInit, qTest, qRef;
+
+    // identity detection
+    I   = qmdd_create_all_identity_matrix(nqubits);
+    mX  = qmdd_create_single_qubit_gate(nqubits, 4, GATEID_X);
+    test_assert(evbdd_is_identity_matrix(I, 0, nqubits));
+    test_assert(evbdd_is_identity_matrix(qmdd_create_single_qubit_gates_same(nqubits, GATEID_I), 0, nqubits));
+    test_assert(!evbdd_is_identity_matrix(I, 0, nqubits+1));
+    test_assert(!evbdd_is_identity_matrix(mX, 0, nqubits));
+    test_assert(!evbdd_is_identity_matrix(qmdd_create_single_qubit_gates_same(nqubits, GATEID_Z), 0, nqubits));
+
+    // an identity operand is skipped in both operand orders
+    mH   = qmdd_create_single_qubit_gate(nqubits, 2, GATEID_H);
+    mCX  = qmdd_create_cgate(nqubits, 0, 3, GATEID_X);
+    mCCZ = qmdd_create_cgate2(nqubits, 1, 3, 5, GATEID_Z);
+    mRef = evbdd_matmat_mult(mCX, mH, nqubits);
+    mRef = evbdd_matmat_mult(mCCZ, mRef, nqubits);
+    test_assert(evbdd_matmat_mult(I, mRef, nqubits) == mRef);
+    test_assert(evbdd_matmat_mult(mRef, I, nqubits) == mRef);
+
+    // products of gate matrices agree with applying the gates one by one
+    qInit = qmdd_create_all_zero_state(nqubits);
+    qInit = qmdd_gate(qInit, GATEID_H, 0);
+    qInit = qmdd_gate(qInit, GATEID_H, 1);
+    qInit = qmdd_gate(qInit, GATEID_T, 1);
+    qInit = qmdd_gate(qInit, GATEID_H, 3);
+    qRef  = qmdd_gate(qInit, GATEID_H, 2);
+    qRef  = qmdd_cgate(qRef, GATEID_X, 0, 3);
+    qRef  = qmdd_cgate2(qRef, GATEID_Z, 1, 3, 5);
+    qRef  = qmdd_gate(qRef, GATEID_X, 4);
+    mTest = evbdd_matmat_mult(mX, mRef, nqubits);
+    qTest = evbdd_matvec_mult(mTest, qInit, nqubits);
+    test_assert(evbdd_equivalent(qRef, qTest, nqubits, false, false));
+    qTest = evbdd_matvec_mult(mH, qInit, nqubits);
+    qTest = evbdd_matvec_mult(mCX, qTest, nqubits);
+    qTest = evbdd_matvec_mult(mCCZ, qTest, nqubits);
+    qTest = evbdd_matvec_mult(mX, qTest, nqubits);
+    test_assert(evbdd_equivalent(qRef, qTest, nqubits, false, false));
+    test_assert(evbdd_matvec_mult(I, qRef, nqubits) == qRef);
+
+    if(VERBOSE) printf("matrix qmdd identity levels: ok\n");
+    return 0;
+}
+
 int runtests()
 {
     // we are not testing garbage collection
@@ -688,6 +735,7 @@ int runtests()
     if (test_ccz_gate()) return 1;
     if (test_multi_cgate()) return 1;
     if (test_tensor_product()) return 1;
+    if (test_identity_levels()) return 1;
 
     return 0;
 }